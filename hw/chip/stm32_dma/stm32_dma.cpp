@@ -2,48 +2,6 @@
 
 #include "debug_stuff.h"
 
-#define DMA_SxCR_CHSEL_SHIFT    25u
-#define DMA_SxCR_MBURST_SHIFT   23u
-#define DMA_SxCR_PBURST_SHIFT   21u
-#define DMA_SxCR_PL_SHIFT       16u
-#define DMA_SxCR_MSIZE_SHIFT    13u
-#define DMA_SxCR_PSIZE_SHIFT    11u
-#define DMA_SxCR_DIR_SHIFT      6u
-
-#define DMA_SxCR_CHSEL      (7u << DMA_SxCR_CHSEL_SHIFT)
-#define DMA_SxCR_MBURST     (3u << DMA_SxCR_MBURST_SHIFT)
-#define DMA_SxCR_PBURST     (3u << DMA_SxCR_PBURST_SHIFT)
-#define DMA_SxCR_CT         (1u << 19)
-#define DMA_SxCR_DBM        (1u << 18)
-#define DMA_SxCR_PL         (3u << DMA_SxCR_PL_SHIFT)
-#define DMA_SxCR_PINCOS     (1u << 15)
-#define DMA_SxCR_MSIZE      (3u << DMA_SxCR_MSIZE_SHIFT)
-#define DMA_SxCR_PSIZE      (3u << DMA_SxCR_PSIZE_SHIFT)
-#define DMA_SxCR_MINC       (1u << 10)
-#define DMA_SxCR_PINC       (1u << 9)
-#define DMA_SxCR_CIRC       (1u << 8)
-#define DMA_SxCR_DIR        (3u << DMA_SxCR_DIR_SHIFT)
-#define DMA_SxCR_PFCTRL     (1u << 5)
-#define DMA_SxCR_TCIE       (1u << 4)
-#define DMA_SxCR_HTIE       (1u << 3)
-#define DMA_SxCR_TEIE       (1u << 2)
-#define DMA_SxCR_DMEIE      (1u << 1)
-#define DMA_SxCR_EN         (1u << 0)
-#define DMA_SxCR_ALL        0xfefffff
-
-#define DMA_SxFCR_FS_SHIFT  3u
-#define DMA_SxFCR_FTH_SHIFT 0
-
-#define DMA_SxFCR_FEIE      (1u << 7)
-#define DMA_SxFCR_FS        (7u << DMA_SxFCR_FS_SHIFT)
-#define DMA_SxFCR_DMDIS     (1u << 2)
-#define DMA_SxFCR_FTH       (3u << DMA_SxFCR_FTH_SHIFT)
-#define DMA_SxFCR_ALL       0xbf
-
-#define DMA_DIR_P2M 0
-#define DMA_DIR_M2P 1u
-#define DMA_DIR_M2M 2u
-
 /*
  * Things to consider:
  *  - Periph to Mem
@@ -95,6 +53,7 @@ DmaRequest::DmaRequest()
     len = 0;
 
     stream = 7;
+    channel = 0;
     priority = PRIO_HIGH;
     periph_xfer_size = XFER_SIZE_BYTE;
     mem_xfer_size = XFER_SIZE_BYTE;
@@ -105,29 +64,66 @@ DmaRequest::DmaRequest()
     mem_inc = true;
     mode = MODE_DIRECT;
     fifo_threshold = FIFO_THRESH_1QUARTER;
+
+    xfer_complete = nullptr;
+    half_xfer_complete = nullptr;
+    xfer_error = nullptr;
+    cb_ctx = nullptr;
+
+    preset_cr = 0;
+    preset_fcr = 0;
+}
+
+static bool
+in_region(const uintptr_t start, const uintptr_t end, const uintptr_t base, const size_t size)
+{
+    return (start >= base) && (start <= end) && (end < (base + size));
+}
+
+bool
+dma_mem_reachable(const void *const addr, const size_t len)
+{
+    const uintptr_t start = reinterpret_cast<uintptr_t>(addr);
+    const uintptr_t end = start + ((len == 0) ? 0 : (len - 1u));
+    return in_region(start, end, SRAM_BASE, SRAM_SIZE) || in_region(start, end, FLASH_BASE, FLASH_SIZE);
+}
+
+/* Bytes in one item of the given size */
+static uint8_t
+xfer_size_bytes(const enum DmaRequest::transfer_size size)
+{
+    switch (size) {
+    case DmaRequest::XFER_SIZE_BYTE:  return 1;
+    case DmaRequest::XFER_SIZE_HWORD: return 2;
+    case DmaRequest::XFER_SIZE_WORD:  return 4;
+    default: return 0;
+    }
+}
+
+static uint8_t
+burst_amount(const enum DmaRequest::burst_type burst)
+{
+    switch (burst) {
+    case DmaRequest::BURST_NONE:   return 1;
+    case DmaRequest::BURST_INCR4:  return 4;
+    case DmaRequest::BURST_INCR8:  return 8;
+    case DmaRequest::BURST_INCR16: return 16;
+    default: return 0;
+    }
 }
 
+/*
+ * The parts of a request that change from one transfer to the next: where
+ * it goes, how long it is and which stream it's on. Preset requests still
+ * need these checked, only their configuration is known to be good.
+ */
 void
-DmaRequest::check_dma_req() const
+DmaRequest::check_dma_buffers() const
 {
     /* Make sure memory used is valid */
-    const uintptr_t mem1_int = reinterpret_cast<const uintptr_t>(mem1);
-    assert(
-            ((mem1_int >= SRAM_BASE) && (mem1_int < (SRAM_BASE + SRAM_SIZE)))
-#ifdef __STM32F4xx__
-            || ((mem1_int >= CCMRAM_BASE) && mem1_int < (CCMRAM_BASE + CCMRAM_SIZE))
-#endif
-            || ((mem1_int >= FLASH_BASE) && (mem1_int < (FLASH_BASE + FLASH_SIZE)))
-          );
+    assert(dma_mem_reachable(mem1, 1));
     if (mem2 != nullptr) {
-        const uintptr_t mem2_int = reinterpret_cast<const uintptr_t>(mem2);
-        assert(
-                ((mem2_int >= SRAM_BASE) && (mem2_int < (SRAM_BASE + SRAM_SIZE)))
-#ifdef __STM32F4xx__
-                || ((mem2_int >= CCMRAM_BASE) && mem2_int < (CCMRAM_BASE + CCMRAM_SIZE))
-#endif
-                || ((mem2_int >= FLASH_BASE) && (mem2_int < (FLASH_BASE + FLASH_SIZE)))
-              );
+        assert(dma_mem_reachable(mem2, 1));
     }
     if (periph != nullptr) {
         const uintptr_t periph_int = reinterpret_cast<const uintptr_t>(periph);
@@ -135,8 +131,52 @@ DmaRequest::check_dma_req() const
         assert(periph_int < (PERIPH_BASE + PERIPH_SIZE));
     }
 
-    /* Check that values are within range */
     assert(stream < DMA_NUM_STREAMS);
+    assert(channel < 8);
+
+    /* Make sure memory is aligned */
+    const uint8_t mem_read_size = xfer_size_bytes(mem_xfer_size);
+    assert(mem_read_size != 0);
+    assert((reinterpret_cast<const uintptr_t>(mem1) & (mem_read_size - 1u)) == 0);
+    if (mem2 != nullptr) {
+        assert((reinterpret_cast<const uintptr_t>(mem2) & (mem_read_size - 1u)) == 0);
+    }
+
+    /* Check len parameter */
+    /* NDTR stores number of *peripheral* transactions */
+    const uint8_t periph_read_size = xfer_size_bytes(periph_xfer_size);
+    assert(periph_read_size != 0);
+    if ((periph_read_size != 1) || (mem_read_size != 1)) {
+        /*
+         * Instead of checking buffer boundaries and other things,
+         * only allow odd-length transfers with a byte-to-byte transfer size
+         */
+        assert((len & 0x1) == 0);
+    }
+    uint16_t num_transactions = len / periph_read_size;
+    if (periph_read_size > mem_read_size) {
+        /*
+         * If (PSIZE, MSIZE) equals:
+         *  - (8-bit, 16-bit) or (16-bit, 32-bit)
+         *    then NDTR needs to be a multiple of 2
+         *  - (8-bit, 32-bit) then NDTR needs to be
+         *    a multiple of 4
+         */
+        assert((num_transactions % (periph_read_size / mem_read_size)) == 0);
+    }
+
+    /* Check NDTR for circular mode */
+    if (mode & MODE_CURR_TARGET) {
+        assert((num_transactions % (burst_amount(mem_burst) * (mem_read_size / periph_read_size))) == 0);
+    }
+}
+
+void
+DmaRequest::check_dma_req() const
+{
+    check_dma_buffers();
+
+    /* Check that values are within range */
     assert(priority < 4);
     assert(periph_xfer_size < 3);
     assert(mem_xfer_size < 3);
@@ -144,37 +184,6 @@ DmaRequest::check_dma_req() const
     assert(mem_burst < 4);
     assert(fifo_threshold < 4);
 
-    /* Make sure memory is aligned */
-    switch (mem_xfer_size) {
-    case XFER_SIZE_WORD:
-        assert((mem1_int & 0x3) == 0);
-        break;
-    case XFER_SIZE_HWORD:
-        assert((mem1_int & 0x1) == 0);
-        break;
-    case XFER_SIZE_BYTE:
-        break;
-    default:
-        /* I don't know how we got here */
-        assert(0);
-    }
-    if (mem2 != nullptr) {
-        const uintptr_t mem2_int = reinterpret_cast<const uintptr_t>(mem2);
-        switch (mem_xfer_size) {
-        case XFER_SIZE_WORD:
-            assert((mem2_int & 0x3) == 0);
-            break;
-        case XFER_SIZE_HWORD:
-            assert((mem2_int & 0x1) == 0);
-            break;
-        case XFER_SIZE_BYTE:
-            break;
-        default:
-            /* I don't know how we got here */
-            assert(0);
-        }
-    }
-
     if (mode & MODE_PERIPH_FLOW_CTRL) {
         /*
          * Circular mode and double buffer mode aren't
@@ -199,61 +208,10 @@ DmaRequest::check_dma_req() const
     default: break;
     }
 
-    uint8_t mem_read_size = 0;
-    switch (mem_xfer_size) {
-    case XFER_SIZE_BYTE:  mem_read_size = 1; break;
-    case XFER_SIZE_HWORD: mem_read_size = 2; break;
-    case XFER_SIZE_WORD:  mem_read_size = 4; break;
-    default: break;
-    }
-
-    uint8_t mem_burst_amt = 0;
-    switch (mem_burst) {
-    case BURST_NONE:   mem_burst_amt = 1; break;
-    case BURST_INCR4:  mem_burst_amt = 4; break;
-    case BURST_INCR8:  mem_burst_amt = 8; break;
-    case BURST_INCR16: mem_burst_amt = 16; break;
-    default: break;
-    }
-
-    assert((mem_burst_amt * mem_read_size) <= fifo_size);
+    assert((burst_amount(mem_burst) * xfer_size_bytes(mem_xfer_size)) <= fifo_size);
 
     /* Make sure the burst doesn't cross a 1 KB boundary */
     /* Maybe? idk if this is required */
-
-    /* Check len parameter */
-    /* NDTR stores number of *peripheral* transactions */
-    uint8_t periph_read_size = 0;
-    switch (periph_xfer_size) {
-    case XFER_SIZE_BYTE:  periph_read_size = 1; break;
-    case XFER_SIZE_HWORD: periph_read_size = 2; break;
-    case XFER_SIZE_WORD:  periph_read_size = 4; break;
-    default: break;
-    }
-
-    if ((periph_read_size != 1) || (mem_read_size != 1)) {
-        /*
-         * Instead of checking buffer boundaries and other things,
-         * only allow odd-length transfers with a byte-to-byte transfer size
-         */
-        assert((len & 0x1) == 0);
-    }
-    uint16_t num_transactions = len / periph_read_size;
-    if (periph_read_size > mem_read_size) {
-        /*
-         * If (PSIZE, MSIZE) equals:
-         *  - (8-bit, 16-bit) or (16-bit, 32-bit)
-         *    then NDTR needs to be a multiple of 2
-         *  - (8-bit, 32-bit) then NDTR needs to be
-         *    a multiple of 4
-         */
-        assert((num_transactions % (periph_read_size / mem_read_size)) == 0);
-    }
-
-    /* Check NDTR for circular mode */
-    if (mode & MODE_CURR_TARGET) {
-        assert((num_transactions % (mem_burst_amt * (mem_read_size / periph_read_size))) == 0);
-    }
 }
 
 /*
@@ -263,6 +221,7 @@ void
 DmaPeriph::read_dma_request(struct dma_stream_regs &dest, const DmaRequest &req) volatile
 {
     dest.CR = (streams[req.stream].CR & (~DMA_SxCR_ALL));
+    dest.CR |= static_cast<uint32_t>(req.channel) << DMA_SxCR_CHSEL_SHIFT;
     dest.CR |= req.priority << DMA_SxCR_PL_SHIFT;
     dest.CR |= req.periph_xfer_size << DMA_SxCR_PSIZE_SHIFT;
     dest.CR |= req.mem_xfer_size << DMA_SxCR_MSIZE_SHIFT;
@@ -289,6 +248,11 @@ DmaPeriph::read_dma_request(struct dma_stream_regs &dest, const DmaRequest &req)
     if (req.mode & DmaRequest::MODE_PERIPH_FLOW_CTRL) {
         dest.CR |= DMA_SxCR_PFCTRL;
     }
+    /* Completion and errors always interrupt, they only reach the CPU if the stream's IRQ is enabled in the NVIC */
+    dest.CR |= DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE;
+    if (req.half_xfer_complete != nullptr) {
+        dest.CR |= DMA_SxCR_HTIE;
+    }
 
     dest.FCR = (streams[req.stream].FCR & (~DMA_SxFCR_ALL));
     if (req.mode & DmaRequest::MODE_FIFO) {
@@ -314,98 +278,135 @@ DmaPeriph::set_config(const uint8_t stream, const struct dma_stream_regs &stream
     streams[stream].FCR = stream_cfg.FCR;
 }
 
+/*
+ * Programs and enables the stream. Requests built from a DmaPreset were
+ * checked and turned into register words at compile time, so only the
+ * parts that depend on the stream and callbacks are added here, and only
+ * the buffers and length are checked.
+ */
 int
-DmaPeriph::periph_to_mem(const DmaRequest &req) volatile
+DmaPeriph::start_stream(const DmaRequest &req, const uint32_t dir) volatile
 {
-    const void *const mem = req.mem1;
-    const volatile void *const periph = req.periph;
-    const size_t len = req.len;
-
-    /* Do debug error checking */
-    req.check_dma_req();
-
     struct dma_stream_regs stream_cfg;
 
-    read_dma_request(stream_cfg, req);
+    if (req.preset_cr != 0) {
+        /* The configuration was checked at compile time, what it's pointed at wasn't */
+        req.check_dma_buffers();
+        stream_cfg.CR = (streams[req.stream].CR & (~DMA_SxCR_ALL));
+        stream_cfg.CR |= req.preset_cr & ~(DMA_SxCR_CHSEL | DMA_SxCR_DIR);
+        stream_cfg.CR |= static_cast<uint32_t>(req.channel) << DMA_SxCR_CHSEL_SHIFT;
+        if (req.half_xfer_complete != nullptr) {
+            stream_cfg.CR |= DMA_SxCR_HTIE;
+        }
+        stream_cfg.FCR = (streams[req.stream].FCR & (~DMA_SxFCR_ALL)) | req.preset_fcr;
+    } else {
+        /* Do debug error checking */
+        req.check_dma_req();
+        read_dma_request(stream_cfg, req);
+    }
 
-    uint8_t psize = 0;
-    switch (req.periph_xfer_size) {
-    case DmaRequest::XFER_SIZE_BYTE: psize = 1; break;
-    case DmaRequest::XFER_SIZE_HWORD: psize = 2; break;
-    case DmaRequest::XFER_SIZE_WORD: psize = 4; break;
-    default: break;
+    /* NDTR counts peripheral sized items, and the size enum is log2 of the size in bytes */
+    stream_cfg.NDTR = req.len >> req.periph_xfer_size;
+    stream_cfg.CR |= dir << DMA_SxCR_DIR_SHIFT;
+    if (dir == DMA_DIR_M2M) {
+        /* The peripheral port is the source */
+        stream_cfg.PAR = (uintptr_t)req.mem1;
+        stream_cfg.M0AR = (uintptr_t)req.mem2;
+        stream_cfg.M1AR = 0;
+    } else {
+        stream_cfg.PAR = (uintptr_t)req.periph;
+        stream_cfg.M0AR = (uintptr_t)req.mem1;
+        /* Second buffer for double buffer mode */
+        stream_cfg.M1AR = (uintptr_t)req.mem2;
     }
-    stream_cfg.NDTR = len / psize;
-    stream_cfg.PAR = (uintptr_t)periph;
-    stream_cfg.M0AR = (uintptr_t)mem;
-    stream_cfg.CR |= DMA_DIR_P2M << DMA_SxCR_DIR_SHIFT;
 
     set_config(req.stream, stream_cfg);
+    streams[req.stream].CR |= DMA_SxCR_EN;
 
     return 0;
 }
 
 int
-DmaPeriph::mem_to_periph(const DmaRequest &req) volatile
+DmaPeriph::periph_to_mem(const DmaRequest &req) volatile
 {
-    const void *const mem = req.mem1;
-    const volatile void *const periph = req.periph;
-    const size_t len = req.len;
-
-    /* Do debug error checking */
-    req.check_dma_req();
+    return start_stream(req, DMA_DIR_P2M);
+}
 
-    struct dma_stream_regs stream_cfg;
+int
+DmaPeriph::mem_to_periph(const DmaRequest &req) volatile
+{
+    return start_stream(req, DMA_DIR_M2P);
+}
 
-    read_dma_request(stream_cfg, req);
+int
+DmaPeriph::mem_to_mem(const DmaRequest &req) volatile
+{
+    return start_stream(req, DMA_DIR_M2M);
+}
 
-    uint8_t psize = 0;
-    switch (req.periph_xfer_size) {
-    case DmaRequest::XFER_SIZE_BYTE: psize = 1; break;
-    case DmaRequest::XFER_SIZE_HWORD: psize = 2; break;
-    case DmaRequest::XFER_SIZE_WORD: psize = 4; break;
-    default: break;
-    }
-    stream_cfg.NDTR = len / psize;
-    stream_cfg.PAR = (uintptr_t)periph;
-    stream_cfg.M0AR = (uintptr_t)mem;
-    stream_cfg.CR |= DMA_DIR_M2P << DMA_SxCR_DIR_SHIFT;
+/*
+ * Disables a stream and waits for it to finish its current beat - the
+ * registers can't be touched until EN reads back as 0.
+ */
+void
+DmaPeriph::disable_stream(const uint8_t stream) volatile
+{
+    streams[stream].CR &= ~DMA_SxCR_EN;
+    while (streams[stream].CR & DMA_SxCR_EN) {}
+}
 
-    set_config(req.stream, stream_cfg);
-    streams[req.stream].CR |= DMA_SxCR_EN;
+bool
+DmaPeriph::stream_enabled(const uint8_t stream) volatile
+{
+    return (streams[stream].CR & DMA_SxCR_EN) != 0;
+}
 
-    return 0;
+/* Number of peripheral-sized items left to transfer */
+uint32_t
+DmaPeriph::get_remaining(const uint8_t stream) volatile
+{
+    return streams[stream].NDTR;
 }
 
-int
-DmaPeriph::mem_to_mem(const DmaRequest &req) volatile
+/*
+ * Buffer the stream is currently filling in double buffer mode: 0 for
+ * mem1 (M0AR), 1 for mem2 (M1AR). Flips in hardware at each transfer complete.
+ */
+uint8_t
+DmaPeriph::get_current_target(const uint8_t stream) volatile
 {
-    const void *const mem1 = req.mem1;
-    const void *const mem2 = req.mem2;
-    const size_t len = req.len;
+    return (streams[stream].CR & DMA_SxCR_CT) ? 1 : 0;
+}
 
-    /* Do debug error checking */
-    req.check_dma_req();
+/* Unlike the rest of FCR, FEIE can be set while the stream is running */
+void
+DmaPeriph::enable_fifo_error_interrupt(const uint8_t stream) volatile
+{
+    streams[stream].FCR |= DMA_SxFCR_FEIE;
+}
 
-    struct dma_stream_regs stream_cfg;
+/*
+ * Streams 0-3 have their flags in LISR/LIFCR and 4-7 in HISR/HIFCR,
+ * at the same bit offsets in each
+ */
+static const uint8_t stream_flag_shift[DMA_NUM_STREAMS / 2] = { 0, 6, 16, 22 };
 
-    read_dma_request(stream_cfg, req);
+uint32_t
+DmaPeriph::get_stream_flags(const uint8_t stream) volatile
+{
+    const uint32_t isr = (stream < 4) ? LISR : HISR;
+    return (isr >> stream_flag_shift[stream % 4]) & DMA_FLAG_ALL;
+}
 
-    uint8_t psize = 0;
-    switch (req.periph_xfer_size) {
-    case DmaRequest::XFER_SIZE_BYTE: psize = 1; break;
-    case DmaRequest::XFER_SIZE_HWORD: psize = 2; break;
-    case DmaRequest::XFER_SIZE_WORD: psize = 4; break;
-    default: break;
+void
+DmaPeriph::clear_stream_flags(const uint8_t stream, const uint32_t flags) volatile
+{
+    const uint32_t clear = (flags & DMA_FLAG_ALL) << stream_flag_shift[stream % 4];
+    if (stream < 4) {
+        LIFCR = clear;
+    } else {
+        HIFCR = clear;
     }
-    stream_cfg.NDTR = len / psize;
-    stream_cfg.PAR = (uintptr_t)mem1;
-    stream_cfg.M0AR = (uintptr_t)mem2;
-    stream_cfg.CR |= DMA_DIR_M2M << DMA_SxCR_DIR_SHIFT;
-
-    set_config(req.stream, stream_cfg);
-
-    return 0;
 }
 
 void
@@ -5,16 +5,67 @@
 
 #define DMA_NUM_STREAMS 8
 
+/* Per-stream interrupt flags, as returned by get_stream_flags */
+#define DMA_FLAG_FE     (1u << 0)
+#define DMA_FLAG_DME    (1u << 2)
+#define DMA_FLAG_TE     (1u << 3)
+#define DMA_FLAG_HT     (1u << 4)
+#define DMA_FLAG_TC     (1u << 5)
+#define DMA_FLAG_ALL    (DMA_FLAG_FE | DMA_FLAG_DME | DMA_FLAG_TE | DMA_FLAG_HT | DMA_FLAG_TC)
+
+#define DMA_SxCR_CHSEL_SHIFT    25u
+#define DMA_SxCR_MBURST_SHIFT   23u
+#define DMA_SxCR_PBURST_SHIFT   21u
+#define DMA_SxCR_PL_SHIFT       16u
+#define DMA_SxCR_MSIZE_SHIFT    13u
+#define DMA_SxCR_PSIZE_SHIFT    11u
+#define DMA_SxCR_DIR_SHIFT      6u
+
+#define DMA_SxCR_CHSEL      (7u << DMA_SxCR_CHSEL_SHIFT)
+#define DMA_SxCR_MBURST     (3u << DMA_SxCR_MBURST_SHIFT)
+#define DMA_SxCR_PBURST     (3u << DMA_SxCR_PBURST_SHIFT)
+#define DMA_SxCR_CT         (1u << 19)
+#define DMA_SxCR_DBM        (1u << 18)
+#define DMA_SxCR_PL         (3u << DMA_SxCR_PL_SHIFT)
+#define DMA_SxCR_PINCOS     (1u << 15)
+#define DMA_SxCR_MSIZE      (3u << DMA_SxCR_MSIZE_SHIFT)
+#define DMA_SxCR_PSIZE      (3u << DMA_SxCR_PSIZE_SHIFT)
+#define DMA_SxCR_MINC       (1u << 10)
+#define DMA_SxCR_PINC       (1u << 9)
+#define DMA_SxCR_CIRC       (1u << 8)
+#define DMA_SxCR_DIR        (3u << DMA_SxCR_DIR_SHIFT)
+#define DMA_SxCR_PFCTRL     (1u << 5)
+#define DMA_SxCR_TCIE       (1u << 4)
+#define DMA_SxCR_HTIE       (1u << 3)
+#define DMA_SxCR_TEIE       (1u << 2)
+#define DMA_SxCR_DMEIE      (1u << 1)
+#define DMA_SxCR_EN         (1u << 0)
+#define DMA_SxCR_ALL        0xfefffff
+
+#define DMA_SxFCR_FS_SHIFT  3u
+#define DMA_SxFCR_FTH_SHIFT 0
+
+#define DMA_SxFCR_FEIE      (1u << 7)
+#define DMA_SxFCR_FS        (7u << DMA_SxFCR_FS_SHIFT)
+#define DMA_SxFCR_DMDIS     (1u << 2)
+#define DMA_SxFCR_FTH       (3u << DMA_SxFCR_FTH_SHIFT)
+#define DMA_SxFCR_ALL       0xbf
+
+#define DMA_DIR_P2M 0
+#define DMA_DIR_M2P 1u
+#define DMA_DIR_M2M 2u
+
 /* Size of FIFO: 4 words/16 bytes */
 /*
  * Data struct for parameters of the DMA request.
  *
  * mem1: Memory address 1 for DMA operation, memory address used for mem<->periph transfers.
- * mem2: Memory address 2, only used for mem<->mem transfers.
+ * mem2: Memory address 2, used for mem<->mem transfers and as the second buffer in double buffer mode.
  * periph: Address of peripheral for DMA operation, used for mem<->periph transfers.
  * len: Length of data to transfer, in bytes.
  *
  * stream: Which stream to use: 0 to 7
+ * channel: Which request channel the stream listens to: 0 to 7
  * priority: Priority of the request: low, med, high, or very high
  * periph_xfer_size: Size of peripheral reads/writes: byte, half-word, or word
  * mem_xfer_size: Size of memory reads/writes: byte, half-word, word
@@ -37,6 +88,12 @@
  *  - Direct, Circular, Double Buffer disallowed with mem-to-mem
  *  - Circular, Double Buffer disallowed with peripheral as flow controller
  * fifo_threshold: When in FIFO mode, at what point to transfer from the FIFO to the target: 1/4 full, 1/2 full, 3/4 full, or completely full
+ *
+ * xfer_complete, half_xfer_complete, xfer_error: Optional callbacks, called from the stream's interrupt handler with cb_ctx.
+ *  - Only used when the transfer goes through the DMA driver, which owns the interrupts
+ *  - The half transfer interrupt is only enabled when half_xfer_complete is set
+ *
+ * preset_cr, preset_fcr: Register words worked out at compile time by DmaPreset, 0 to build them from the fields above.
  */
 struct DmaRequest {
     enum priority_level { PRIO_LOW = 0, PRIO_MED, PRIO_HIGH, PRIO_VHIGH, NUM_PRIOS };
@@ -45,18 +102,16 @@ struct DmaRequest {
     enum periph_incr_mode { PERIPH_INCR_PSIZE = 0, PERIPH_INCR_FIXED, NUM_INCR_MODES };
     enum dma_mode { MODE_DIRECT = 0, MODE_PERIPH_FLOW_CTRL = 1, MODE_CIRC = 2, MODE_DOUBLE_BUFF = 4, MODE_CURR_TARGET = 8, MODE_FIFO = 16 };
     enum fifo_threshold_amt { FIFO_THRESH_1QUARTER = 0, FIFO_THRESH_HALF, FIFO_THRESH_3QUARTER, FIFO_THRESH_FULL, NUM_FIFO_THRESH };
-    /* These are interrupt handlers, might find a better way to support this
-    void (*xfer_complete)(void);
-    void (*half_xfer_complete)(void);
-    void (*xfer_error)(void);
-    void (*direct_mode_error)(void);
-    void (*fifo_mode_error)(void);
-    */
+    void (*xfer_complete)(void *ctx);
+    void (*half_xfer_complete)(void *ctx);
+    void (*xfer_error)(void *ctx, uint32_t flags);
+    void *cb_ctx;
     const void *mem1;
     const void *mem2;
     const volatile void *periph;
     uint32_t len;
     uint8_t stream;
+    uint8_t channel;
     enum priority_level priority;
     enum transfer_size periph_xfer_size;
     enum transfer_size mem_xfer_size;
@@ -67,10 +122,171 @@ struct DmaRequest {
     bool mem_inc;
     enum dma_mode mode; /* CT, DBM, CIRC, and PFCTRL, FIFO or direct mode */
     enum fifo_threshold_amt fifo_threshold;
+    uint32_t preset_cr;
+    uint32_t preset_fcr;
 
     public:
         DmaRequest();
         void check_dma_req() const;
+        void check_dma_buffers() const;
+};
+
+/*
+ * Whether the controllers can get at all of [addr, addr + len). Their
+ * memory ports only reach the SRAM and the flash, the F4's CCM RAM is
+ * wired to the core alone.
+ */
+bool dma_mem_reachable(const void *const addr, const size_t len);
+
+/*
+ * Compile time version of the configuration part of a DmaRequest, for
+ * transfers whose setup never changes. Build one as a constexpr with the
+ * setters, and DmaPreset checks it against the rules above with
+ * static_assert and works out its CR and FCR words at compile time:
+ *
+ *   static constexpr DmaConfig tx_config =
+ *       DmaConfig(DmaConfig::DIR_MEM_TO_PERIPH).set_priority(DmaRequest::PRIO_LOW);
+ *   typedef DmaPreset<tx_config> TxPreset;
+ *   ...
+ *   TxPreset::apply(req);
+ *
+ * A request set up from a preset skips the configuration checks and the
+ * register building, so starting it is little more than the register
+ * stores. The addresses, length, stream and channel are still filled in at
+ * run time, and check_dma_buffers still checks them.
+ */
+class DmaConfig {
+    public:
+        enum direction { DIR_PERIPH_TO_MEM = 0, DIR_MEM_TO_PERIPH, DIR_MEM_TO_MEM };
+
+        enum direction dir;
+        enum DmaRequest::priority_level priority;
+        enum DmaRequest::transfer_size periph_xfer_size;
+        enum DmaRequest::transfer_size mem_xfer_size;
+        enum DmaRequest::burst_type periph_burst;
+        enum DmaRequest::burst_type mem_burst;
+        bool periph_inc;
+        enum DmaRequest::periph_incr_mode periph_inc_offset;
+        bool mem_inc;
+        uint32_t mode;
+        enum DmaRequest::fifo_threshold_amt fifo_threshold;
+
+        /* Same defaults as DmaRequest */
+        constexpr explicit DmaConfig(const enum direction d)
+            : dir(d), priority(DmaRequest::PRIO_HIGH),
+              periph_xfer_size(DmaRequest::XFER_SIZE_BYTE), mem_xfer_size(DmaRequest::XFER_SIZE_BYTE),
+              periph_burst(DmaRequest::BURST_NONE), mem_burst(DmaRequest::BURST_NONE),
+              periph_inc(false), periph_inc_offset(DmaRequest::PERIPH_INCR_PSIZE), mem_inc(true),
+              mode(DmaRequest::MODE_DIRECT), fifo_threshold(DmaRequest::FIFO_THRESH_1QUARTER) {}
+
+        constexpr DmaConfig set_priority(const enum DmaRequest::priority_level p) const
+        { DmaConfig c = *this; c.priority = p; return c; }
+        constexpr DmaConfig set_sizes(const enum DmaRequest::transfer_size psize, const enum DmaRequest::transfer_size msize) const
+        { DmaConfig c = *this; c.periph_xfer_size = psize; c.mem_xfer_size = msize; return c; }
+        constexpr DmaConfig set_bursts(const enum DmaRequest::burst_type pburst, const enum DmaRequest::burst_type mburst) const
+        { DmaConfig c = *this; c.periph_burst = pburst; c.mem_burst = mburst; return c; }
+        constexpr DmaConfig set_periph_inc(const bool inc, const enum DmaRequest::periph_incr_mode offset = DmaRequest::PERIPH_INCR_PSIZE) const
+        { DmaConfig c = *this; c.periph_inc = inc; c.periph_inc_offset = offset; return c; }
+        constexpr DmaConfig set_mem_inc(const bool inc) const
+        { DmaConfig c = *this; c.mem_inc = inc; return c; }
+        /* mode is an OR of DmaRequest::dma_mode flags */
+        constexpr DmaConfig set_mode(const uint32_t m) const
+        { DmaConfig c = *this; c.mode = m; return c; }
+        constexpr DmaConfig set_fifo_threshold(const enum DmaRequest::fifo_threshold_amt t) const
+        { DmaConfig c = *this; c.fifo_threshold = t; return c; }
+
+        /* Rules from the DmaRequest comment, checked by DmaPreset */
+        constexpr bool bursts_in_fifo_mode() const
+        {
+            return ((periph_burst == DmaRequest::BURST_NONE) && (mem_burst == DmaRequest::BURST_NONE))
+                || ((mode & DmaRequest::MODE_FIFO) != 0);
+        }
+        constexpr bool mem_burst_fits_fifo() const
+        {
+            return ((mode & DmaRequest::MODE_FIFO) == 0)
+                || ((burst_beats(mem_burst) << mem_xfer_size) <= ((fifo_threshold + 1u) * 4u));
+        }
+        constexpr bool periph_burst_fits_fifo() const
+        {
+            /* The FIFO is 16 bytes */
+            return (burst_beats(periph_burst) << periph_xfer_size) <= 16u;
+        }
+        constexpr bool mem_to_mem_modes_ok() const
+        {
+            return (dir != DIR_MEM_TO_MEM)
+                || (((mode & (DmaRequest::MODE_CIRC | DmaRequest::MODE_DOUBLE_BUFF)) == 0)
+                    && ((mode & DmaRequest::MODE_FIFO) != 0));
+        }
+        constexpr bool flow_ctrl_modes_ok() const
+        {
+            return ((mode & DmaRequest::MODE_PERIPH_FLOW_CTRL) == 0)
+                || ((mode & (DmaRequest::MODE_CIRC | DmaRequest::MODE_DOUBLE_BUFF)) == 0);
+        }
+        constexpr bool direct_mode_sizes_ok() const
+        {
+            /* Without the FIFO there's nothing to pack through, both sides move PSIZE items */
+            return ((mode & DmaRequest::MODE_FIFO) != 0) || (periph_xfer_size == mem_xfer_size);
+        }
+
+        constexpr uint32_t cr() const
+        {
+            return (static_cast<uint32_t>(priority) << DMA_SxCR_PL_SHIFT)
+                | (static_cast<uint32_t>(periph_xfer_size) << DMA_SxCR_PSIZE_SHIFT)
+                | (static_cast<uint32_t>(mem_xfer_size) << DMA_SxCR_MSIZE_SHIFT)
+                | (static_cast<uint32_t>(periph_burst) << DMA_SxCR_PBURST_SHIFT)
+                | (static_cast<uint32_t>(mem_burst) << DMA_SxCR_MBURST_SHIFT)
+                | (periph_inc ? DMA_SxCR_PINC : 0)
+                | ((periph_inc && periph_inc_offset) ? DMA_SxCR_PINCOS : 0)
+                | (mem_inc ? DMA_SxCR_MINC : 0)
+                | ((mode & DmaRequest::MODE_CURR_TARGET) ? DMA_SxCR_CT : 0)
+                | ((mode & DmaRequest::MODE_DOUBLE_BUFF) ? DMA_SxCR_DBM : 0)
+                | ((mode & DmaRequest::MODE_CIRC) ? DMA_SxCR_CIRC : 0)
+                | ((mode & DmaRequest::MODE_PERIPH_FLOW_CTRL) ? DMA_SxCR_PFCTRL : 0)
+                | (static_cast<uint32_t>(dir) << DMA_SxCR_DIR_SHIFT)
+                | DMA_SxCR_TCIE | DMA_SxCR_TEIE | DMA_SxCR_DMEIE;
+        }
+        constexpr uint32_t fcr() const
+        {
+            return ((mode & DmaRequest::MODE_FIFO) ? DMA_SxFCR_DMDIS : 0)
+                | (static_cast<uint32_t>(fifo_threshold) << DMA_SxFCR_FTH_SHIFT);
+        }
+
+    private:
+        static constexpr uint32_t burst_beats(const enum DmaRequest::burst_type burst)
+        {
+            return (burst == DmaRequest::BURST_NONE) ? 1u : (2u << burst);
+        }
+};
+
+template <const DmaConfig &config>
+struct DmaPreset {
+    static_assert(config.bursts_in_fifo_mode(), "Burst transfers are only allowed in FIFO mode");
+    static_assert(config.mem_burst_fits_fifo(), "Memory burst is bigger than the FIFO threshold");
+    static_assert(config.periph_burst_fits_fifo(), "Peripheral burst is bigger than the FIFO");
+    static_assert(config.mem_to_mem_modes_ok(), "Memory to memory needs FIFO mode, and can't be circular or double buffered");
+    static_assert(config.flow_ctrl_modes_ok(), "Circular and double buffer modes aren't allowed with peripheral flow control");
+    static_assert(config.direct_mode_sizes_ok(), "Direct mode needs the same peripheral and memory transfer size");
+
+    static constexpr uint32_t CR = config.cr();
+    static constexpr uint32_t FCR = config.fcr();
+
+    /* Fills in everything but the addresses, length, stream, channel and callbacks */
+    static void
+    apply(DmaRequest &req)
+    {
+        req.priority = config.priority;
+        req.periph_xfer_size = config.periph_xfer_size;
+        req.mem_xfer_size = config.mem_xfer_size;
+        req.periph_burst = config.periph_burst;
+        req.mem_burst = config.mem_burst;
+        req.periph_inc = config.periph_inc;
+        req.periph_inc_offset = config.periph_inc_offset;
+        req.mem_inc = config.mem_inc;
+        req.mode = static_cast<enum DmaRequest::dma_mode>(config.mode);
+        req.fifo_threshold = config.fifo_threshold;
+        req.preset_cr = CR;
+        req.preset_fcr = FCR;
+    }
 };
 
 class DmaPeriph {
@@ -90,11 +306,21 @@ class DmaPeriph {
     private:
         void read_dma_request(struct dma_stream_regs &dest, const DmaRequest &req) volatile;
         void set_config(const uint8_t stream, const struct dma_stream_regs &stream_cfg) volatile;
+        int start_stream(const DmaRequest &req, const uint32_t dir) volatile;
 
     public:
         int periph_to_mem(const DmaRequest &req) volatile;
         int mem_to_periph(const DmaRequest &req) volatile;
         int mem_to_mem(const DmaRequest &req) volatile;
+
+        void disable_stream(const uint8_t stream) volatile;
+        bool stream_enabled(const uint8_t stream) volatile;
+        uint32_t get_remaining(const uint8_t stream) volatile;
+        uint8_t get_current_target(const uint8_t stream) volatile;
+        void enable_fifo_error_interrupt(const uint8_t stream) volatile;
+
+        uint32_t get_stream_flags(const uint8_t stream) volatile;
+        void clear_stream_flags(const uint8_t stream, const uint32_t flags) volatile;
 };
 
 extern volatile DmaPeriph *const DMA1;
@@ -104,7 +104,8 @@ int
 ExtiPeriph::clear_pending(const uint32_t interrupt_num) volatile
 {
     CHECK_VALID_INTERRUPT(interrupt_num);
-    PR |= (1u << interrupt_num);
+    /* Write 1 to clear - a read-modify-write would clear every other pending line too */
+    PR = (1u << interrupt_num);
     return 0;
 }
 
@@ -0,0 +1,138 @@
+#include "stm32_flash.h"
+
+#define FLASH_IF_BASE       (PERIPH_BASE + 0x23c00)
+
+#define FLASH_ACR_LATENCY   0x7
+#define FLASH_ACR_PRFTEN    (1u << 8)
+#define FLASH_ACR_ICEN      (1u << 9)
+#define FLASH_ACR_DCEN      (1u << 10)
+#define FLASH_ACR_ICRST     (1u << 11)
+#define FLASH_ACR_DCRST     (1u << 12)
+
+#define FLASH_ACR_ACCEL     (FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN)
+
+#define FLASH_KEY1          0x45670123
+#define FLASH_KEY2          0xcdef89ab
+
+#define FLASH_SR_EOP        (1u << 0)
+#define FLASH_SR_OPERR      (1u << 1)
+#define FLASH_SR_WRPERR     (1u << 4)
+#define FLASH_SR_PGAERR     (1u << 5)
+#define FLASH_SR_PGPERR     (1u << 6)
+#define FLASH_SR_PGSERR     (1u << 7)
+#define FLASH_SR_BSY        (1u << 16)
+#define FLASH_SR_ERRORS     (FLASH_SR_OPERR | FLASH_SR_WRPERR | FLASH_SR_PGAERR | FLASH_SR_PGPERR | FLASH_SR_PGSERR)
+
+#define FLASH_CR_PG         (1u << 0)
+#define FLASH_CR_SER        (1u << 1)
+#define FLASH_CR_SNB        0x78
+#define FLASH_CR_PSIZE      0x300
+#define FLASH_CR_STRT       (1u << 16)
+#define FLASH_CR_LOCK       (1u << 31)
+
+#define FLASH_CR_SNB_SHIFT      3u
+#define FLASH_CR_PSIZE_SHIFT    8u
+
+/* PSIZE value for 32 bit parallelism */
+#define FLASH_PSIZE_WORD    0x2
+
+volatile FlashIfPeriph *const FLASH_IF = reinterpret_cast<volatile FlashIfPeriph *>(FLASH_IF_BASE);
+
+void
+FlashIfPeriph::set_latency(const uint32_t wait_states) volatile
+{
+    ACR = (ACR & ~FLASH_ACR_LATENCY) | (wait_states & FLASH_ACR_LATENCY);
+
+    /* The new latency has to be in effect before the clock changes */
+    while ((ACR & FLASH_ACR_LATENCY) != (wait_states & FLASH_ACR_LATENCY)) { }
+}
+
+uint32_t
+FlashIfPeriph::get_latency(void) volatile
+{
+    return ACR & FLASH_ACR_LATENCY;
+}
+
+void
+FlashIfPeriph::enable_accelerator(void) volatile
+{
+    /* The caches can only be reset while they're off */
+    ACR &= ~(FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+    ACR |= FLASH_ACR_ICRST | FLASH_ACR_DCRST;
+    ACR &= ~(FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+
+    ACR |= FLASH_ACR_ACCEL;
+}
+
+void
+FlashIfPeriph::disable_accelerator(void) volatile
+{
+    ACR &= ~FLASH_ACR_ACCEL;
+}
+
+bool
+FlashIfPeriph::accelerator_enabled(void) volatile
+{
+    return (ACR & FLASH_ACR_ACCEL) == FLASH_ACR_ACCEL;
+}
+
+void
+FlashIfPeriph::unlock(void) volatile
+{
+    if (CR & FLASH_CR_LOCK) {
+        KEYR = FLASH_KEY1;
+        KEYR = FLASH_KEY2;
+    }
+}
+
+void
+FlashIfPeriph::lock(void) volatile
+{
+    CR |= FLASH_CR_LOCK;
+}
+
+/* Waits out the operation in progress, then clears its flags */
+int
+FlashIfPeriph::wait_done(void) volatile
+{
+    while (SR & FLASH_SR_BSY) { }
+
+    const uint32_t status = SR;
+    SR = status & (FLASH_SR_EOP | FLASH_SR_ERRORS);
+    return (status & FLASH_SR_ERRORS) ? -1 : 0;
+}
+
+int
+FlashIfPeriph::erase_sector(const uint32_t sector) volatile
+{
+    if ((sector >= FLASH_NUM_SECTORS) || (wait_done() < 0)) {
+        return -1;
+    }
+
+    CR = (CR & ~(FLASH_CR_PG | FLASH_CR_SNB | FLASH_CR_PSIZE))
+         | FLASH_CR_SER
+         | ((sector << FLASH_CR_SNB_SHIFT) & FLASH_CR_SNB)
+         | ((FLASH_PSIZE_WORD << FLASH_CR_PSIZE_SHIFT) & FLASH_CR_PSIZE);
+    CR |= FLASH_CR_STRT;
+
+    const int ret = wait_done();
+    CR &= ~(FLASH_CR_SER | FLASH_CR_SNB);
+    return ret;
+}
+
+int
+FlashIfPeriph::program_word(const uint32_t addr, const uint32_t word) volatile
+{
+    if (((addr & 0x3) != 0) || (wait_done() < 0)) {
+        return -1;
+    }
+
+    CR = (CR & ~(FLASH_CR_SER | FLASH_CR_PSIZE))
+         | FLASH_CR_PG
+         | ((FLASH_PSIZE_WORD << FLASH_CR_PSIZE_SHIFT) & FLASH_CR_PSIZE);
+    *reinterpret_cast<volatile uint32_t *>(addr) = word;
+
+    const int ret = wait_done();
+    CR &= ~FLASH_CR_PG;
+    return ret;
+}
@@ -0,0 +1,56 @@
+#ifndef _FLASH_H
+#define _FLASH_H
+
+#include "chip_common.h"
+
+/* Most wait states the flash can be set to */
+#define FLASH_MAX_LATENCY 7u
+
+/* Sectors 0-3 are 16 KB, 4 is 64 KB and 5-11 are 128 KB */
+#define FLASH_NUM_SECTORS 12u
+
+/* The flash interface registers, not the flash memory itself */
+class FlashIfPeriph {
+    uint32_t ACR;
+    uint32_t KEYR;
+    uint32_t OPTKEYR;
+    uint32_t SR;
+    uint32_t CR;
+    uint32_t OPTCR;
+
+    int wait_done(void) volatile;
+
+    public:
+        /*
+         * Wait states for reading the flash. They have to be raised before
+         * HCLK goes up and can only be lowered after it has come down.
+         */
+        void set_latency(const uint32_t wait_states) volatile;
+        uint32_t get_latency(void) volatile;
+
+        /*
+         * The ART accelerator: prefetch, plus the instruction and data
+         * caches that hide the wait states. The caches are flushed on the
+         * way back on, so nothing stale survives them having been off
+         * (e.g. while the flash was being written).
+         */
+        void enable_accelerator(void) volatile;
+        void disable_accelerator(void) volatile;
+        bool accelerator_enabled(void) volatile;
+
+        /*
+         * Erasing and programming, 32 bits at a time (which needs a 2.7 V
+         * to 3.6 V supply). The control register has to be unlocked
+         * first. There's only the one bank, so anything that reads the
+         * flash while it's busy (including fetching code) stalls until
+         * it's done. Both return -1 if the flash reports an error.
+         */
+        void unlock(void) volatile;
+        void lock(void) volatile;
+        int erase_sector(const uint32_t sector) volatile;
+        int program_word(const uint32_t addr, const uint32_t word) volatile;
+};
+
+extern volatile FlashIfPeriph *const FLASH_IF;
+
+#endif /* _FLASH_H */
@@ -2,7 +2,11 @@
 
 #define PWR_BASE            (PERIPH_BASE + 0x7000)
 
-#define PWR_CR_DBP (1u << 8)
+#define PWR_CR_LPDS (1u << 0)
+#define PWR_CR_PDDS (1u << 1)
+#define PWR_CR_CWUF (1u << 2)
+#define PWR_CR_DBP  (1u << 8)
+#define PWR_CR_FPDS (1u << 9)
 
 volatile PwrPeriph *const PWR = reinterpret_cast<volatile PwrPeriph *>(PWR_BASE);
 
@@ -18,6 +22,20 @@ PwrPeriph::enable_bd_write_protection() volatile
     PWR->CR &= ~PWR_CR_DBP;
 }
 
+void
+PwrPeriph::configure_stop(const bool low_power_regulator, const bool flash_power_down) volatile
+{
+    uint32_t cr = CR & ~(PWR_CR_PDDS | PWR_CR_LPDS | PWR_CR_FPDS);
+    if (low_power_regulator) {
+        cr |= PWR_CR_LPDS;
+    }
+    if (flash_power_down) {
+        cr |= PWR_CR_FPDS;
+    }
+    /* Clear any old wakeup flag too */
+    CR = cr | PWR_CR_CWUF;
+}
+
 void
 pwr_init(void)
 {
@@ -10,6 +10,13 @@ class PwrPeriph {
     public:
         void disable_bd_write_protection() volatile;
         void enable_bd_write_protection() volatile;
+
+        /*
+         * Makes the next deep sleep Stop mode rather than Standby. The low
+         * power regulator and powering down the flash save more in Stop, but
+         * both make waking up take longer.
+         */
+        void configure_stop(const bool low_power_regulator, const bool flash_power_down) volatile;
 };
 
 extern volatile PwrPeriph *const PWR;
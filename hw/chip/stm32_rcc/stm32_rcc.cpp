@@ -23,7 +23,7 @@
 #define RCC_CFGR_SW             0x3
 #define RCC_CFGR_SWS            0xc
 #define RCC_CFGR_HPRE           0xf0
-#define RCC_CFGR_PPRE1          0xfc00
+#define RCC_CFGR_PPRE1          0x1c00
 #define RCC_CFGR_PPRE2          0xe000
 
 #define RCC_CFGR_SW_SHIFT       0
@@ -32,11 +32,16 @@
 #define RCC_CFGR_PPRE1_SHIFT    10u
 #define RCC_CFGR_PPRE2_SHIFT    13u
 
+#define RCC_BDCR_LSEON          (1u << 0)
+#define RCC_BDCR_LSERDY         (1u << 1)
 #define RCC_BDCR_RTCEN          (1u << 15)
 #define RCC_BDCR_RTCSEL         0x300
 
 #define RCC_BDCR_RTCSEL_SHIFT   8u
 
+/* The LSE crystal can take a couple of seconds to start */
+#define RCC_LSE_TIMEOUT         0x1000000
+
 volatile RccPeriph *const RCC = reinterpret_cast<volatile RccPeriph *>(RCC_BASE);
 
 void
@@ -139,63 +144,135 @@ RccPeriph::APB2_reset_cmd(const enum APB2_periphs periph, const bool state) vola
     periph_cmd(&APB2RSTR, periph, state);
 }
 
+void
+RccPeriph::enable_pll(const uint32_t pllm, const uint32_t plln, const uint32_t pllp, const uint32_t pllq) volatile
+{
+    disable_pll();
+
+    /* PLL source is the HSI (PLLSRC clear), P is encoded as pllp / 2 - 1 */
+    PLLCFGR = ((pllq << RCC_PLLCFGR_PLLQ_SHIFT) & RCC_PLLCFGR_PLLQ)
+                 | ((((pllp / 2u) - 1u) << RCC_PLLCFGR_PLLP_SHIFT) & RCC_PLLCFGR_PLLP)
+                 | ((plln << RCC_PLLCFGR_PLLN_SHIFT) & RCC_PLLCFGR_PLLN)
+                 | ((pllm << RCC_PLLCFGR_PLLM_SHIFT) & RCC_PLLCFGR_PLLM);
+
+    CR |= RCC_CR_PLLON;
+
+    /* Wait for PLL to be ready */
+    while ((CR & RCC_CR_PLLRDY) == 0) { }
+}
+
+void
+RccPeriph::disable_pll() volatile
+{
+    CR &= ~RCC_CR_PLLON;
+    while ((CR & RCC_CR_PLLRDY) != 0) { }
+}
+
+void
+RccPeriph::select_sysclk(const enum sysclk_source source) volatile
+{
+    CFGR = (CFGR & ~RCC_CFGR_SW) | (source << RCC_CFGR_SW_SHIFT);
+
+    /* Wait for the switch to happen */
+    while (get_sysclk() != source) { }
+}
+
+int
+RccPeriph::start_rtc_clock() volatile
+{
+    BDCR |= RCC_BDCR_LSEON;
+
+    uint32_t counter = 0;
+    while ((BDCR & RCC_BDCR_LSERDY) == 0) {
+        counter++;
+        if (counter >= RCC_LSE_TIMEOUT) {
+            return -1;
+        }
+    }
+
+    BDCR = (BDCR & ~RCC_BDCR_RTCSEL) | ((0x1 << RCC_BDCR_RTCSEL_SHIFT) & RCC_BDCR_RTCSEL) | RCC_BDCR_RTCEN;
+    return 0;
+}
+
+enum RccPeriph::sysclk_source
+RccPeriph::get_sysclk() volatile
+{
+    return static_cast<enum sysclk_source>((CFGR & RCC_CFGR_SWS) >> RCC_CFGR_SWS_SHIFT);
+}
+
+/*
+ * AHB divisors are encoded as 0 for 1, then 8 upwards for 2 to 512
+ * (skipping 32). APB ones are 0 for 1, then 4 upwards for 2 to 16.
+ */
+static uint32_t
+ahb_prescaler(const uint32_t div)
+{
+    if (div <= 1u) {
+        return 0;
+    }
+    const uint32_t shift = __builtin_ctz(div);
+    return (shift <= 4u) ? (7u + shift) : (6u + shift);
+}
+
+static uint32_t
+apb_prescaler(const uint32_t div)
+{
+    if (div <= 1u) {
+        return 0;
+    }
+    return 3u + __builtin_ctz(div);
+}
+
+void
+RccPeriph::set_bus_prescalers(const uint32_t ahb_div, const uint32_t apb1_div, const uint32_t apb2_div) volatile
+{
+    CFGR = (CFGR & ~(RCC_CFGR_HPRE | RCC_CFGR_PPRE1 | RCC_CFGR_PPRE2))
+           | ((ahb_prescaler(ahb_div) << RCC_CFGR_HPRE_SHIFT) & RCC_CFGR_HPRE)
+           | ((apb_prescaler(apb1_div) << RCC_CFGR_PPRE1_SHIFT) & RCC_CFGR_PPRE1)
+           | ((apb_prescaler(apb2_div) << RCC_CFGR_PPRE2_SHIFT) & RCC_CFGR_PPRE2);
+}
+
+/* Offset of each bus's register from the AHB1 one, in the ENR and LPENR blocks alike */
+static const uint8_t bus_reg_offsets[RccPeriph::NUM_BUSES] = { 0, 1, 2, 4, 5 };
+
+uint32_t
+RccPeriph::get_enabled(const enum bus bus) volatile
+{
+    return (&AHB1ENR)[bus_reg_offsets[bus]];
+}
+
+uint32_t
+RccPeriph::get_LP_enabled(const enum bus bus) volatile
+{
+    return (&AHB1LPENR)[bus_reg_offsets[bus]];
+}
+
+void
+RccPeriph::set_LP_enabled(const enum bus bus, const uint32_t periphs) volatile
+{
+    (&AHB1LPENR)[bus_reg_offsets[bus]] = periphs;
+}
+
 void
 RccPeriph::init() volatile
 {
     /* Disable all interrupts */
     CIR = 0x00000000;
 
-    /* Set PLL CFG register:
-     *  - PLL source to HSI
-     *  - Main PLL divider for VCO set to 8 (VCO = HSI * 192 / 8)
-     *  - Main PLL multiplier for VCO set to 192
-     *  - Main PLL divider for main system clock to 6 (SYSCLCK = VCO / 6)
-     *  - Main PLL divider for USB OTG FS, SDIO, and RNG to 8 (OTG FS, SDIO, RNG = VCO / 8)
-     */
-    PLLCFGR &= ~RCC_PLLCFGR_PLLSRC;
-    PLLCFGR = (0x8  << RCC_PLLCFGR_PLLQ_SHIFT)
-                 | (0x2  << RCC_PLLCFGR_PLLP_SHIFT)
-                 | (0xc0 << RCC_PLLCFGR_PLLN_SHIFT)
-                 | (0x8  << RCC_PLLCFGR_PLLM_SHIFT);
-
     /* Set Control register:
      *  - Enable HSI clock
-     *  - Enable PLL clock
      *  - Disable HSE clock
      *  - Do not bypass HSE with external clock
      *  - Disable clock security system
+     *
+     * The system clock is left on the HSI, the clock driver sets up the
+     * PLL for whichever operating point it starts in.
      */
-    CR |= RCC_CR_HSION | RCC_CR_PLLON;
+    CR |= RCC_CR_HSION;
     CR &= ~(RCC_CR_HSEON | RCC_CR_HSEBYP | RCC_CR_CSSON);
 
-    /* Wait for PLL to be ready */
-    while ((CR & RCC_CR_PLLRDY) == 0) { }
-
-    /* Set CFG register:
-     *  - PLL selected as system clock
-     *  - PLLI2S used for I2S clock
-     *  - AHB prescaler set to 1
-     *  - APB1 (low speed) prescaler set to 4
-     *  - APB2 (high speed) prescaler set to 2
-     */
-    CFGR = (0x5 << RCC_CFGR_PPRE1_SHIFT) | (0x4 << RCC_CFGR_PPRE2_SHIFT) | (0x2 << RCC_CFGR_SW_SHIFT);
-
-    /* Wait for PLL to be used as system clock */
-    while (((CFGR & RCC_CFGR_SWS) >> RCC_CFGR_SWS_SHIFT) != 0x2) { }
-
     /* Enable RTC, set clock to LSE */
     BDCR |= RCC_BDCR_RTCEN | (0x1 << RCC_BDCR_RTCSEL_SHIFT);
 
-    /* Enable USARTs */
-    APB1_periph_cmd(UART5, true);
-    APB1_periph_cmd(UART4, true);
-    APB1_periph_cmd(USART3, true);
-    APB1_periph_cmd(USART2, true);
-    APB2_periph_cmd(USART6, true);
-    APB2_periph_cmd(USART1, true);
-
-    /* Enable DMAs */
-    AHB1_periph_cmd(DMA1, true);
-    AHB1_periph_cmd(DMA2, true);
+    /* Peripheral clocks are turned on and off by the power driver as they're needed */
 }
-
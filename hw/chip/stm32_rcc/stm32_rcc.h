@@ -39,6 +39,7 @@ class RccPeriph {
     uint32_t SSCGR;
     uint32_t PLLI2SCFGR;
 
+    public:
     enum AHB1_periphs { GPIOA = (1u <<  0), GPIOB   = (1u <<  1), GPIOC = (1u <<  2),
                         GPIOD = (1u <<  3), GPIOE   = (1u <<  4), GPIOF = (1u <<  5),
                         GPIOG = (1u <<  6), GPIOH   = (1u <<  7), GPIOI = (1u <<  8),
@@ -67,9 +68,31 @@ class RccPeriph {
                         SPI1   = (1u << 12), SYSCFG = (1u << 14), TIM9   = (1u << 16),
                         TIM10  = (1u << 17), TIM11  = (1u << 18) };
 
+    enum sysclk_source { SYSCLK_HSI = 0, SYSCLK_HSE = 1, SYSCLK_PLL = 2 };
+
+    enum bus { BUS_AHB1 = 0, BUS_AHB2, BUS_AHB3, BUS_APB1, BUS_APB2, NUM_BUSES };
+
     private:
         void periph_cmd(volatile uint32_t *const reg, const uint32_t periph, const bool state) volatile;
     public:
+        /*
+         * Clock tree commands. The PLL runs from the HSI:
+         *   VCO = HSI * plln / pllm, SYSCLK = VCO / pllp, USB/SDIO/RNG = VCO / pllq
+         * It can only be reconfigured while it isn't the system clock.
+         * Prescalers are given as divisors (e.g. 4 rather than the register encoding).
+         */
+        void enable_pll(const uint32_t pllm, const uint32_t plln, const uint32_t pllp, const uint32_t pllq) volatile;
+        void disable_pll() volatile;
+        void select_sysclk(const enum sysclk_source source) volatile;
+        enum sysclk_source get_sysclk() volatile;
+        void set_bus_prescalers(const uint32_t ahb_div, const uint32_t apb1_div, const uint32_t apb2_div) volatile;
+
+        /*
+         * Starts the LSE and runs the RTC from it. The backup domain has to
+         * be writable. Returns -1 if the LSE doesn't start (e.g. no crystal).
+         */
+        int start_rtc_clock() volatile;
+
         /*
          * Periph commands enable/disable each peripheral
          * Low-Power periph commands enable/disable each peripheral in low power mode
@@ -95,6 +118,15 @@ class RccPeriph {
         void APB2_LP_periph_cmd(const enum APB2_periphs periph, const bool state) volatile;
         void APB2_reset_cmd(const enum APB2_periphs periph, const bool state) volatile;
 
+        /*
+         * Whole bus enable masks, made of the bus's periphs enum values. Some
+         * low power bits (e.g. FLITF, SRAM1 and SRAM2 on AHB1) have no
+         * matching enable bit, those clocks are always on when awake.
+         */
+        uint32_t get_enabled(const enum bus bus) volatile;
+        uint32_t get_LP_enabled(const enum bus bus) volatile;
+        void set_LP_enabled(const enum bus bus, const uint32_t periphs) volatile;
+
         void init() volatile;
 };
 
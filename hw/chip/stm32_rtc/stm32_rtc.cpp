@@ -42,6 +42,7 @@
 #define RTC_CR_WUCKSEL              0x7
 #define RTC_CR_WUCKSEL_SHIFT        0
 
+#define RTC_ISR_WUTF                (1u << 10)
 #define RTC_ISR_INIT                (1u << 7)
 #define RTC_ISR_INITF               (1u << 6)
 #define RTC_ISR_RSF                 (1u << 5)
@@ -51,6 +52,11 @@
 #define RTC_PRER_ASYNC_SHIFT        16u
 #define RTC_PRER_SYNC               0x1fff
 
+#define RTC_WUTR_WUT                0xffff
+
+/* WUCKSEL value for RTCCLK / 2 */
+#define RTC_WUCKSEL_DIV2            0x3
+
 #define RTC_INIT_TIMEOUT            0x10000
 #define RTC_SYNCHRO_TIMEOUT         0x80000
 
@@ -265,6 +271,46 @@ RtcPeriph::disable_WUT_Interrupt(void) volatile
     CR &= ~RTC_CR_WUTIE;
 }
 
+int
+RtcPeriph::start_wakeup_timer(const uint32_t count) volatile
+{
+    if ((count == 0) || (count > (RTC_WUTR_WUT + 1u))) {
+        return -1;
+    }
+
+    disable_write_protection();
+    disable_wut();
+    CR = (CR & ~RTC_CR_WUCKSEL) | ((RTC_WUCKSEL_DIV2 << RTC_CR_WUCKSEL_SHIFT) & RTC_CR_WUCKSEL);
+    WUTR = (count - 1u) & RTC_WUTR_WUT;
+    ISR &= ~RTC_ISR_WUTF;
+    CR |= RTC_CR_WUTIE;
+    enable_wut();
+    enable_write_protection();
+
+    return 0;
+}
+
+void
+RtcPeriph::stop_wakeup_timer(void) volatile
+{
+    disable_write_protection();
+    CR &= ~(RTC_CR_WUTE | RTC_CR_WUTIE);
+    ISR &= ~RTC_ISR_WUTF;
+    enable_write_protection();
+}
+
+bool
+RtcPeriph::wakeup_timer_fired(void) volatile
+{
+    return (ISR & RTC_ISR_WUTF) != 0;
+}
+
+void
+RtcPeriph::clear_wakeup_timer_flag(void) volatile
+{
+    ISR &= ~RTC_ISR_WUTF;
+}
+
 void
 RtcPeriph::init(void) volatile
 {
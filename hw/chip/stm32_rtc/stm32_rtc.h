@@ -47,6 +47,18 @@ class RtcPeriph {
         int enter_dst(void) volatile;
         void enable_WUT_Interrupt(void) volatile;
         void disable_WUT_Interrupt(void) volatile;
+
+        /*
+         * One-shot use of the wakeup timer, e.g. to come out of Stop mode.
+         * count is in RTCCLK / 2 periods, which is 16.384 kHz from the LSE,
+         * and can be up to 65536 (4 s). The interrupt is enabled, and the
+         * timer keeps reloading until it's stopped. start returns -1 if count
+         * is out of range.
+         */
+        int start_wakeup_timer(const uint32_t count) volatile;
+        void stop_wakeup_timer(void) volatile;
+        bool wakeup_timer_fired(void) volatile;
+        void clear_wakeup_timer_flag(void) volatile;
         void init(void) volatile;
 };
 
@@ -45,17 +45,60 @@ UsartPeriph::finish_send() volatile
     while ((SR & USART_SR_TC) == 0);
 }
 
+bool
+UsartPeriph::rx_ready() volatile
+{
+    return (SR & USART_SR_RXNE) != 0;
+}
+
+/*
+ * Reading DR clears RXNE, so only call this once rx_ready() says there's a byte.
+ */
+uint8_t
+UsartPeriph::receive() volatile
+{
+    return static_cast<uint8_t>(DR);
+}
+
+void
+UsartPeriph::enable_rx_interrupt() volatile
+{
+    CR1 |= USART_CR1_RXNEIE;
+}
+
+void
+UsartPeriph::disable_rx_interrupt() volatile
+{
+    CR1 &= ~USART_CR1_RXNEIE;
+}
+
+bool
+UsartPeriph::rx_interrupt_enabled() volatile
+{
+    return (CR1 & USART_CR1_RXNEIE) != 0;
+}
+
 /*
- * Ready a usart for use.
+ * With 16x oversampling, BRR holds USARTDIV = pclk / (16 * baud) as 12.4
+ * fixed point, which is just pclk / baud rounded to the nearest integer.
+ * Changing it in the middle of a frame garbles that frame.
  */
 void
-UsartPeriph::init() volatile
+UsartPeriph::set_baud_rate(const uint32_t pclk_hz, const uint32_t baud) volatile
+{
+    const uint32_t div = (pclk_hz + (baud / 2u)) / baud;
+    BRR = div & (USART_BRR_MANT | USART_BRR_FRAC);
+}
+
+/*
+ * Ready a usart for use. pclk_hz is the clock of the APB bus it's on.
+ */
+void
+UsartPeriph::init(const uint32_t pclk_hz, const uint32_t baud) volatile
 {
     enable();
 
-    /* Set BRR to 416.6875 */
-    BRR |= (416u << USART_BRR_MANT_SHIFT) & USART_BRR_MANT;
-    BRR |= 11u & USART_BRR_FRAC;
+    set_baud_rate(pclk_hz, baud);
 
     /* Set CR1:
      *  - Enable transmitter
@@ -77,3 +120,96 @@ UsartPeriph::get_address_for_dma() volatile
     return &DR;
 }
 
+void
+UsartPeriph::enable_dma_tx() volatile
+{
+    CR3 |= USART_CR3_DMAT;
+}
+
+void
+UsartPeriph::enable_dma_rx() volatile
+{
+    CR3 |= USART_CR3_DMAR;
+}
+
+void
+UsartPeriph::disable_dma_rx() volatile
+{
+    CR3 &= ~USART_CR3_DMAR;
+}
+
+bool
+UsartPeriph::dma_rx_enabled() volatile
+{
+    return (CR3 & USART_CR3_DMAR) != 0;
+}
+
+void
+UsartPeriph::enable_idle_interrupt() volatile
+{
+    CR1 |= USART_CR1_IDLEIE;
+}
+
+void
+UsartPeriph::disable_idle_interrupt() volatile
+{
+    CR1 &= ~USART_CR1_IDLEIE;
+}
+
+/* Set once the line has been quiet for a frame after receiving something */
+bool
+UsartPeriph::idle_detected() volatile
+{
+    return (SR & USART_SR_IDLE) != 0;
+}
+
+/*
+ * IDLE is cleared by reading SR then DR. DR belongs to the DMA while it is
+ * receiving, so DMAR is off around the read. If a byte has just arrived DR
+ * is left for the DMA, whose own read of it clears IDLE instead.
+ */
+void
+UsartPeriph::clear_idle() volatile
+{
+    const uint32_t dmar = CR3 & USART_CR3_DMAR;
+    CR3 &= ~USART_CR3_DMAR;
+    if ((SR & USART_SR_RXNE) == 0) {
+        (void)DR;
+    }
+    CR3 |= dmar;
+}
+
+void
+UsartPeriph::enable_tc_interrupt() volatile
+{
+    CR1 |= USART_CR1_TCIE;
+}
+
+void
+UsartPeriph::disable_tc_interrupt() volatile
+{
+    CR1 &= ~USART_CR1_TCIE;
+}
+
+bool
+UsartPeriph::tc_interrupt_enabled() volatile
+{
+    return (CR1 & USART_CR1_TCIE) != 0;
+}
+
+/* Set once the last byte written has left the shift register */
+bool
+UsartPeriph::tx_done() volatile
+{
+    return (SR & USART_SR_TC) != 0;
+}
+
+/*
+ * The DMA writes DR without reading SR first, so a TC left over from
+ * earlier isn't cleared by the next transfer. Clear it before starting one.
+ */
+void
+UsartPeriph::clear_tx_done() volatile
+{
+    SR &= ~USART_SR_TC;
+}
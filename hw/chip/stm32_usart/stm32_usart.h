@@ -5,6 +5,8 @@
 
 #define USART_SR_TXE    (1u << 7)
 #define USART_SR_TC     (1u << 6)
+#define USART_SR_RXNE   (1u << 5)
+#define USART_SR_IDLE   (1u << 4)
 
 #define USART_BRR_FRAC 0xf
 #define USART_BRR_MANT 0xfff0
@@ -12,12 +14,18 @@
 
 #define USART_CR1_UE    (1u << 13)
 #define USART_CR1_M     (1u << 12)
+#define USART_CR1_TCIE  (1u << 6)
+#define USART_CR1_RXNEIE (1u << 5)
+#define USART_CR1_IDLEIE (1u << 4)
 #define USART_CR1_TE    (1u << 3)
 #define USART_CR1_RE    (1u << 2)
 #define USART_CR1_SBK   (1u << 0)
 
 #define USART_CR2_STOP  (3u << 12)
 
+#define USART_CR3_DMAT  (1u << 7)
+#define USART_CR3_DMAR  (1u << 6)
+
 #define USART_GTPR_PSC  0xff
 #define USART_GTPR_GT   0xff00
 #define USART_GTPR_GT_SHIFT 8u
@@ -36,8 +44,27 @@ class UsartPeriph {
         void disable() volatile;
         void send(const uint8_t byte) volatile;
         void finish_send() volatile;
-        void init() volatile;
+        bool rx_ready() volatile;
+        uint8_t receive() volatile;
+        void enable_rx_interrupt() volatile;
+        void disable_rx_interrupt() volatile;
+        bool rx_interrupt_enabled() volatile;
+        void set_baud_rate(const uint32_t pclk_hz, const uint32_t baud) volatile;
+        void init(const uint32_t pclk_hz, const uint32_t baud) volatile;
         volatile uint32_t *get_address_for_dma() volatile;
+        void enable_dma_tx() volatile;
+        void enable_dma_rx() volatile;
+        void disable_dma_rx() volatile;
+        bool dma_rx_enabled() volatile;
+        void enable_idle_interrupt() volatile;
+        void disable_idle_interrupt() volatile;
+        bool idle_detected() volatile;
+        void clear_idle() volatile;
+        void enable_tc_interrupt() volatile;
+        void disable_tc_interrupt() volatile;
+        bool tc_interrupt_enabled() volatile;
+        bool tx_done() volatile;
+        void clear_tx_done() volatile;
 };
 
 typedef volatile UsartPeriph *const usart_t;
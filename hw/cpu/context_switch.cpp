@@ -0,0 +1,116 @@
+#include "cpu.h"
+#include "irq.h"
+#include "pwr_driver.h"
+#include "ramfunc.h"
+#include "scheduler.h"
+#include "sys_ctl_block.h"
+#include "thread.h"
+#include "trace.h"
+
+/* Architecture specific half of the CPU code - host builds leave this file out */
+
+/* SVC Interrupt used for service calls - goes directly to a function that handles requests to make OS calls
+ * PendSV used for context switching - from OS back to user process I guess?
+ * SysTick used for time slicing - loads the OS thread then chooses which thread to run next
+ * 
+ * PendSV needs to be set to lowest priority in the system - prevents a context switch from occurring during ISR handlers
+ * Option: SysTick sets the thread scheduler to run next, then sets a pending PendSV request to do the context switch when all other ISRs have finished
+ *   -> probably this option
+ * 
+ * Need to handle tail chaining and preemption:
+ * - SysTick occuring during a PendSV - should be fine, SysTick tail chains back into the thread scheduler
+ * - PendSV during SysTick - shouldn't happen (PendSV should only be caused by OS)
+ * - SysTick during SVC - thread scheduler is going to have to check if the running thread was the OS thread
+ *    -> return early if it was and let the SVC call complete
+ *       (bonus: complete the call but schedule a new thread to run instead of returning to the caller?)
+ * - SVC during PendSV, PendSV during SVC, and SVC during SysTick shouldn't happen
+ * 
+ */
+
+Thread *runningThread;
+
+/* Somewhere for the first PendSV to dump the registers of the boot code, which is never resumed */
+static CpuRegsOnStack bootFrame;
+
+/* Called from PendSV with the outgoing thread's stack, returns the incoming thread's */
+extern "C" RAMFUNC CpuRegsOnStack *
+switchContext(CpuRegsOnStack *const outgoingStack)
+{
+    SYS_CTL->clear_pending_pendsv();
+    Thread *const outgoing = runningThread;
+    CpuRegsOnStack *const incomingStack = scheduler_switch(outgoingStack);
+    runningThread = scheduler_current();
+    if (runningThread != outgoing) {
+        TRACE(CONTEXT_SWITCH, 0, (outgoing != nullptr) ? outgoing->getId() : UINT32_MAX,
+                runningThread->getId());
+    }
+    return incomingStack;
+}
+
+/*
+ * The CPU has already stacked R0-R3, R12, LR, PC and PSR on the process stack,
+ * so this only needs to deal with R4-R11 to complete a CpuRegsOnStack.
+ * Threads always run in thread mode on the process stack.
+ * Both halves run from RAM, so a switch never waits on the flash.
+ */
+RAMFUNC __attribute__((naked))
+void
+PendSV_Handler(void)
+{
+    asm volatile (
+        "\n\t" "MRS     R0, PSP"
+        "\n\t" "STMDB   R0!, { R4-R11 }"
+        "\n\t" "BL      switchContext"
+        "\n\t" "LDMIA   R0!, { R4-R11 }"
+        "\n\t" "MSR     PSP, R0"
+        "\n\t" "MVN     LR, #2" // EXC_RETURN 0xfffffffd: thread mode, process stack
+        "\n\t" "BX      LR"
+        : : : "memory");
+}
+
+/*
+ * Points the process stack at a scratch frame and hands over to PendSV,
+ * which switches to the first thread picked by the scheduler.
+ */
+__attribute__((noreturn))
+void
+cpu_start_threads(void)
+{
+    CpuRegsOnStack *const scratchStack = &bootFrame + 1;
+    asm volatile ("MSR PSP, %0" : : "r" (scratchStack) : "memory");
+
+    SYS_CTL->set_pending_pendsv();
+    irq_enable();
+    for ( ;; ) {
+        wait_for_interrupt();
+    }
+}
+
+/* Single core part, so always CPU 0 */
+uint32_t
+cpu_current_id(void)
+{
+    return 0;
+}
+
+void
+cpu_idle(const uint32_t ticksLeft)
+{
+    pwr_idle(ticksLeft);
+}
+
+/* Single core part, so it's always this one */
+void
+cpu_idle_wake(const uint32_t)
+{
+    pwr_idle_wake();
+}
+
+void
+cpu_request_switch(const uint32_t cpuId)
+{
+    // Would be an inter-processor interrupt with more than one core
+    if (cpuId == cpu_current_id()) {
+        SYS_CTL->set_pending_pendsv();
+    }
+}
@@ -4,16 +4,73 @@
 #include <stdio.h>
 
 #include "cpuRegsOnStack.h"
+#include "run_queue.h"
 
+/* Host builds (e.g. the scheduler simulator) can pretend to have more cores */
+#ifndef NUM_CPUS
 #define NUM_CPUS 1u
+#endif
 
+#define ALL_CPUS_MASK ((1u << NUM_CPUS) - 1u)
+
+struct CpuStats {
+    uint32_t switches;  // Times a different thread was switched in
+    uint32_t steals;    // Threads taken from another CPU's run queue
+    uint32_t idleTicks; // Ticks spent running the idle thread
+};
+
+/*
+ * Per core state. Each core has its own run queue so picking the next
+ * thread only ever takes that core's lock; an idle core steals from the
+ * others rather than sharing one global queue.
+ */
 class Cpu {
     public:
-        void collectCpuInfo();
-        void dispatchThread(CpuRegsOnStack& regs);
+        Cpu();
+        void collectCpuInfo(const uint32_t id);
+
+        uint32_t getId()            const { return _id; };
+        RunQueue &getRunQueue()           { return _runQueue; };
+        Thread *getCurrentThread()  const { return _currentThread; };
+        Thread *getIdleThread()     const { return _idleThread; };
+        bool isIdle()               const { return _currentThread == _idleThread; };
+        uint32_t getLoad() const;
+        CpuStats &getStats()              { return _stats; };
+
+        void setCurrentThread(Thread *const thread) { _currentThread = thread; };
+        void setIdleThread(Thread *const thread)    { _idleThread = thread; };
+        void resetSlice(const uint32_t ticks)       { _sliceTicksLeft = ticks; };
+        bool tickSlice();
 
     private:
+        uint32_t _id;
+        RunQueue _runQueue;
+        Thread *_currentThread;
+        Thread *_idleThread;
+        uint32_t _sliceTicksLeft;
+        CpuStats _stats;
 };
 
-#endif /* _CPU_H */
+extern Cpu hw_cpus[NUM_CPUS];
+
+uint32_t cpu_current_id(void);
+/* Asks a CPU to run the scheduler once it's done with interrupts */
+void cpu_request_switch(const uint32_t cpuId);
+__attribute__((noreturn)) void cpu_start_threads(void);
+
+#define CPU_NO_DEADLINE 0xffffffffu
 
+/*
+ * The idle thread's wait for an interrupt. ticksLeft is how long until
+ * something is due (CPU_NO_DEADLINE if nothing is), which decides how deeply
+ * the CPU can sleep. Called with interrupts masked, and returns with them
+ * still masked once something is pending.
+ */
+void cpu_idle(const uint32_t ticksLeft);
+/*
+ * Tells an idle CPU that a thread has been made ready for it, before the
+ * switch, so it can get back up to speed. Can be called from interrupts.
+ */
+void cpu_idle_wake(const uint32_t cpuId);
+
+#endif /* _CPU_H */
@@ -0,0 +1,22 @@
+#include "dwt.h"
+
+#define DWT_BASE 0xe0001000
+/* Debug Exception and Monitor Control Register, part of the debug control block */
+#define DEMCR_ADDR 0xe000edfc
+
+volatile Dwt *const DWT = reinterpret_cast<volatile Dwt *>(DWT_BASE);
+
+/*
+ * Start the cycle counter. The DWT is part of the debug
+ * infrastructure, so tracing has to be enabled in DEMCR
+ * before any of its registers can be written.
+ */
+void
+Dwt::init(void) volatile
+{
+    volatile uint32_t *const demcr = reinterpret_cast<volatile uint32_t *>(DEMCR_ADDR);
+    *demcr |= DEMCR_TRCENA;
+
+    CYCCNT = 0;
+    CTRL |= DWT_CTRL_CYCCNTENA;
+}
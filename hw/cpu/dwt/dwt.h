@@ -0,0 +1,36 @@
+#ifndef _DWT_H
+#define _DWT_H
+
+#include <stdio.h>
+
+#define DWT_CTRL_CYCCNTENA  (1u << 0)
+
+#define DEMCR_TRCENA        (1u << 24)
+
+/*
+ * Data Watchpoint and Trace unit.
+ * Only the cycle counter is used for now, it gives
+ * a free running count of core clock cycles which is
+ * used to time kernel operations.
+ */
+class Dwt {
+    uint32_t CTRL;      // Control
+    uint32_t CYCCNT;    // Cycle Count
+    uint32_t CPICNT;    // CPI Count
+    uint32_t EXCCNT;    // Exception Overhead Count
+    uint32_t SLEEPCNT;  // Sleep Count
+    uint32_t LSUCNT;    // LSU Count
+    uint32_t FOLDCNT;   // Folded-instruction Count
+    uint32_t PCSR;      // Program Counter Sample
+
+    public:
+        uint32_t get_cycle_count(void) const volatile { return CYCCNT; };
+        uint32_t get_pc_sample(void) const volatile { return PCSR; };
+        void reset_cycle_count(void) volatile { CYCCNT = 0; };
+
+        void init(void) volatile;
+};
+
+extern volatile Dwt *const DWT;
+
+#endif /* _DWT_H */
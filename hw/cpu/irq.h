@@ -0,0 +1,78 @@
+#ifndef _IRQ_H
+#define _IRQ_H
+
+#include <cstdint>
+
+#if defined(__arm__)
+
+/*
+ * Critical sections. irq_save masks interrupts and returns the previous
+ * PRIMASK so they can nest - always pair it with irq_restore.
+ */
+static inline uint32_t
+irq_save(void)
+{
+    uint32_t primask;
+    asm volatile (
+        "\n\t" "MRS     %0, PRIMASK"
+        "\n\t" "CPSID   i"
+        : "=r" (primask) : : "memory");
+    return primask;
+}
+
+static inline void
+irq_restore(const uint32_t primask)
+{
+    asm volatile ("MSR PRIMASK, %0" : : "r" (primask) : "memory");
+}
+
+static inline void
+irq_enable(void)
+{
+    asm volatile ("CPSIE i" : : : "memory");
+}
+
+static inline void
+irq_disable(void)
+{
+    asm volatile ("CPSID i" : : : "memory");
+}
+
+static inline void
+wait_for_interrupt(void)
+{
+    asm volatile ("WFI");
+}
+
+/* True while running an exception handler rather than a thread */
+static inline bool
+irq_in_handler(void)
+{
+    uint32_t ipsr;
+    asm volatile ("MRS %0, IPSR" : "=r" (ipsr));
+    return ipsr != 0;
+}
+
+/* Exception number being handled (16 + IRQ number for peripherals), 0 in a thread */
+static inline uint32_t
+irq_current_exception(void)
+{
+    uint32_t ipsr;
+    asm volatile ("MRS %0, IPSR" : "=r" (ipsr));
+    return ipsr & 0x1ff;
+}
+
+#else
+
+/* Host builds (e.g. the scheduler simulator) provide their own */
+uint32_t irq_save(void);
+void irq_restore(const uint32_t primask);
+void irq_enable(void);
+void irq_disable(void);
+void wait_for_interrupt(void);
+bool irq_in_handler(void);
+uint32_t irq_current_exception(void);
+
+#endif
+
+#endif /* _IRQ_H */
@@ -0,0 +1,59 @@
+#include "nvic.h"
+
+#define NVIC_BASE 0xe000e100
+
+volatile Nvic *const NVIC = reinterpret_cast<volatile Nvic *>(NVIC_BASE);
+
+static inline uint32_t
+regIndex(const Nvic::InterruptNumber interruptNum)
+{
+    return static_cast<uint32_t>(interruptNum) / 32u;
+}
+
+static inline uint32_t
+regBit(const Nvic::InterruptNumber interruptNum)
+{
+    return 1u << (static_cast<uint32_t>(interruptNum) % 32u);
+}
+
+/* The set/clear registers ignore zero bits, so these are plain writes */
+void
+Nvic::enableInterrupt(InterruptNumber interruptNum) volatile
+{
+    ISER[regIndex(interruptNum)] = regBit(interruptNum);
+}
+
+void
+Nvic::disableInterrupt(InterruptNumber interruptNum) volatile
+{
+    ICER[regIndex(interruptNum)] = regBit(interruptNum);
+}
+
+void
+Nvic::setPending(InterruptNumber interruptNum) volatile
+{
+    ISPR[regIndex(interruptNum)] = regBit(interruptNum);
+}
+
+void
+Nvic::clearPending(InterruptNumber interruptNum) volatile
+{
+    ICPR[regIndex(interruptNum)] = regBit(interruptNum);
+}
+
+bool
+Nvic::isActive(InterruptNumber interruptNum) volatile
+{
+    return (IABR[regIndex(interruptNum)] & regBit(interruptNum)) != 0;
+}
+
+/* Priority is 0 (highest) to 15 (lowest) */
+void
+Nvic::setPriority(InterruptNumber interruptNum, uint8_t priority) volatile
+{
+    const uint32_t num = static_cast<uint32_t>(interruptNum);
+    const uint32_t shift = ((num % 4u) * 8u) + (8u - NVIC_PRIORITY_BITS);
+    const uint32_t mask = ((1u << NVIC_PRIORITY_BITS) - 1u) << shift;
+
+    IPR[num / 4u] = (IPR[num / 4u] & ~mask) | ((static_cast<uint32_t>(priority) << shift) & mask);
+}
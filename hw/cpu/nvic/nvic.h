@@ -9,43 +9,128 @@
 #define NUM_INTERRUPT_REGS ROUND_UP(NUM_INTERRUPTS, sizeof(uint32_t) * 8)
 #define NUM_PRIORITY_REGS ROUND_UP(NUM_INTERRUPTS, sizeof(uint32_t))
 
+// STM32F2/F4 implement the top 4 bits of each priority field
+#define NVIC_PRIORITY_BITS 4u
+
 // This controls the IRQs, not the system handlers.
 // For those, use the system control block.
 class Nvic {
     // Interrup Set Enable
     uint32_t ISER[NUM_INTERRUPT_REGS];
+    uint32_t rsvd0[24];
     // Interrup Clear Enable
     uint32_t ICER[NUM_INTERRUPT_REGS];
+    uint32_t rsvd1[24];
     // Interrup Set Pending
     uint32_t ISPR[NUM_INTERRUPT_REGS];
+    uint32_t rsvd2[24];
     // Interrup Clear Pending
     uint32_t ICPR[NUM_INTERRUPT_REGS];
+    uint32_t rsvd3[24];
     // Interrupt Active Bit
     uint32_t IABR[NUM_INTERRUPT_REGS];
+    uint32_t rsvd4[56];
     // Interrupt Priority
     uint32_t IPR[NUM_PRIORITY_REGS];
+    uint32_t rsvd5[644];
     // Software Trigger Interrupt
     uint32_t STIR;
 
     public:
+        // Positive IRQ numbers only - the system handlers are in the system control block
         enum class InterruptNumber : uint8_t {
-            // TODO: this should be the positive IRQ numbers only, not the handlers
-            // NMI = -14,
-            // HardFault = -13,
-            // MemManageFault = -12,
-            // BusFault = -11,
-            // UsageFault = -10,
-            // SVCall = -5,
-            // DebugMonitor = -4,
-            // PendSV = -2,
-            // SysTick = -1,
+            WWDG = 0,
+            PVD,
+            TAMP_STAMP,
+            RTC_WKUP,
+            FLASH,
+            RCC,
+            EXTI0,
+            EXTI1,
+            EXTI2,
+            EXTI3,
+            EXTI4,
+            DMA1_Stream0,
+            DMA1_Stream1,
+            DMA1_Stream2,
+            DMA1_Stream3,
+            DMA1_Stream4,
+            DMA1_Stream5,
+            DMA1_Stream6,
+            ADC,
+            CAN1_TX,
+            CAN1_RX0,
+            CAN1_RX1,
+            CAN1_SCE,
+            EXTI9_5,
+            TIM1_BRK_TIM9,
+            TIM1_UP_TIM10,
+            TIM1_TRG_COM_TIM11,
+            TIM1_CC,
+            TIM2,
+            TIM3,
+            TIM4,
+            I2C1_EV,
+            I2C1_ER,
+            I2C2_EV,
+            I2C2_ER,
+            SPI1,
+            SPI2,
+            USART1,
+            USART2,
+            USART3,
+            EXTI15_10,
+            RTC_Alarm,
+            OTG_FS_WKUP,
+            TIM8_BRK_TIM12,
+            TIM8_UP_TIM13,
+            TIM8_TRG_COM_TIM14,
+            TIM8_CC,
+            DMA1_Stream7,
+            FSMC,
+            SDIO,
+            TIM5,
+            SPI3,
+            UART4,
+            UART5,
+            TIM6_DAC,
+            TIM7,
+            DMA2_Stream0,
+            DMA2_Stream1,
+            DMA2_Stream2,
+            DMA2_Stream3,
+            DMA2_Stream4,
+            ETH,
+            ETH_WKUP,
+            CAN2_TX,
+            CAN2_RX0,
+            CAN2_RX1,
+            CAN2_SCE,
+            OTG_FS,
+            DMA2_Stream5,
+            DMA2_Stream6,
+            DMA2_Stream7,
+            USART6,
+            I2C3_EV,
+            I2C3_ER,
+            OTG_HS_EP1_OUT,
+            OTG_HS_EP1_IN,
+            OTG_HS_WKUP,
+            OTG_HS,
+            DCMI,
+            CRYP,
+            HASH_RNG,
+            FPU,
         };
 
-        void enableInterrupt(InterruptNumber interruptNum);
-        void disableInterrupt(InterruptNumber interruptNum);
-        void setPending(InterruptNumber interruptNum);
-        void clearPending(InterruptNumber interruptNum);
-        void setPriority(InterruptNumber interruptNum, uint8_t priority);
+        void enableInterrupt(InterruptNumber interruptNum) volatile;
+        void disableInterrupt(InterruptNumber interruptNum) volatile;
+        void setPending(InterruptNumber interruptNum) volatile;
+        void clearPending(InterruptNumber interruptNum) volatile;
+        bool isActive(InterruptNumber interruptNum) volatile;
+        void setPriority(InterruptNumber interruptNum, uint8_t priority) volatile;
 };
 
+extern volatile Nvic *const NVIC;
+
 #endif
@@ -0,0 +1,28 @@
+#ifndef _RAMFUNC_H
+#define _RAMFUNC_H
+
+/*
+ * Puts a function in .ramfunc, which the linker script keeps in .data so
+ * it's copied to SRAM with the rest of it at boot. Code there runs with no
+ * flash wait states and no cache misses, so it takes the same time every
+ * time, but it's fetched over the system bus it shares with data.
+ *
+ * Calls between SRAM and the flash are too far for a BL, so the linker
+ * goes through a veneer for them. Anything small a RAM function calls a
+ * lot should be inline or in RAM too.
+ *
+ * Build with RAMFUNC_IN_FLASH=1 to leave it all in the flash, e.g. to
+ * compare the two. Host builds (tools/) have nowhere else to put it, so it
+ * does nothing there.
+ */
+#ifndef RAMFUNC_IN_FLASH
+#define RAMFUNC_IN_FLASH 0
+#endif
+
+#if defined(__arm__) && !RAMFUNC_IN_FLASH
+#define RAMFUNC __attribute__((section(".ramfunc"), noinline))
+#else
+#define RAMFUNC
+#endif
+
+#endif /* _RAMFUNC_H */
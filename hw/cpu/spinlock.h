@@ -0,0 +1,33 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+#include <cstdint>
+
+#include "irq.h"
+
+/*
+ * Masks interrupts on this core, then spins until no other core holds the
+ * lock. On a single core the exchange always succeeds first time.
+ */
+class SpinLock {
+    public:
+        SpinLock() : _locked(0) {};
+
+        uint32_t lock()
+        {
+            const uint32_t primask = irq_save();
+            while (__atomic_exchange_n(&_locked, 1u, __ATOMIC_ACQUIRE) != 0) {}
+            return primask;
+        };
+
+        void unlock(const uint32_t primask)
+        {
+            __atomic_store_n(&_locked, 0u, __ATOMIC_RELEASE);
+            irq_restore(primask);
+        };
+
+    private:
+        volatile uint32_t _locked;
+};
+
+#endif /* _SPINLOCK_H */
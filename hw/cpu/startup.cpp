@@ -2,6 +2,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "boot_report.h"
+#include "clock_driver.h"
+#include "dwt.h"
+#include "flash_driver.h"
 #include "startup.h"
 #include "stm32_rcc.h"
 #include "sys_ctl_block.h"
@@ -13,37 +17,94 @@ extern unsigned _INITIAL_STACK_POINTER; /* Defined in linker script. Used by int
 
 #define I2C1_LOC ((void *)0x40005400)
 
+/*
+ * Copies whole words from src into [dest, dest_end), eight at a time with
+ * LDM/STM and then one at a time for the rest. Both have to be word aligned,
+ * which the linker script's sections are.
+ */
+__attribute__((naked, noinline))
+static void
+copy_words(unsigned *const /* dest, r0 */, const unsigned *const /* src, r1 */, const unsigned *const /* dest_end, r2 */)
+{
+    asm volatile (
+        "\n\t" "PUSH    {r4-r10, lr}"
+        "\n\t" "1:"
+        "\n\t" "SUB     r3, r2, r0"
+        "\n\t" "CMP     r3, #32"
+        "\n\t" "BLT     2f"
+        "\n\t" "LDMIA   r1!, {r3-r10}"
+        "\n\t" "STMIA   r0!, {r3-r10}"
+        "\n\t" "B       1b"
+        "\n\t" "2:"
+        "\n\t" "CMP     r0, r2"
+        "\n\t" "BHS     3f"
+        "\n\t" "LDR     r3, [r1], #4"
+        "\n\t" "STR     r3, [r0], #4"
+        "\n\t" "B       2b"
+        "\n\t" "3:"
+        "\n\t" "POP     {r4-r10, pc}"
+        : : : "memory");
+}
+
+/* Zeroes [dest, dest_end) the same way */
+__attribute__((naked, noinline))
+static void
+zero_words(unsigned *const /* dest, r0 */, const unsigned *const /* dest_end, r1 */)
+{
+    asm volatile (
+        "\n\t" "PUSH    {r4-r10, lr}"
+        "\n\t" "MOV     r2, #0"
+        "\n\t" "MOV     r3, #0"
+        "\n\t" "MOV     r4, #0"
+        "\n\t" "MOV     r5, #0"
+        "\n\t" "MOV     r6, #0"
+        "\n\t" "MOV     r7, #0"
+        "\n\t" "MOV     r8, #0"
+        "\n\t" "MOV     r9, #0"
+        "\n\t" "1:"
+        "\n\t" "SUB     r10, r1, r0"
+        "\n\t" "CMP     r10, #32"
+        "\n\t" "BLT     2f"
+        "\n\t" "STMIA   r0!, {r2-r9}"
+        "\n\t" "B       1b"
+        "\n\t" "2:"
+        "\n\t" "CMP     r0, r1"
+        "\n\t" "BHS     3f"
+        "\n\t" "STR     r2, [r0], #4"
+        "\n\t" "B       2b"
+        "\n\t" "3:"
+        "\n\t" "POP     {r4-r10, pc}"
+        : : : "memory");
+}
+
 __attribute__((interrupt("IRQ")))
 static void
 Reset_Handler(void)
 {
+    /* Start the cycle counter first so the whole boot can be timed */
+    DWT->init();
+
     /* Copy .data section from Flash to SRAM */
-    unsigned *read_ptr = &_DATA_ROM_START;
-    unsigned *write_ptr = &_DATA_RAM_START;
-    for ( ; write_ptr < &_DATA_RAM_END; ) {
-        *write_ptr++ = *read_ptr++;
-    }
+    copy_words(&_DATA_RAM_START, &_DATA_ROM_START, &_DATA_RAM_END);
+    const uint32_t data_done = boot_cycles();
 
     /* Init .bss section with zeros */
-    for (write_ptr = &_BSS_START; write_ptr < &_BSS_END; write_ptr++) {
-        *write_ptr = 0;
-    }
+    zero_words(&_BSS_START, &_BSS_END);
+    const uint32_t bss_done = boot_cycles();
 
-#ifdef __STM32F4xx__
-    /* Initialize CCMRAM to zeros */
-    for (write_ptr = CCM_RAM_START_LOC; write_ptr < CCM_RAM_END_LOC; write_ptr++) {
-        *write_ptr = 0;
-    }
-    /* Copy .ccmram from Flash to CCMRAM */
-    read_ptr = &_CCM_ROM_START;
-    write_ptr = &_CCM_RAM_START;
-    for ( ; write_ptr < &_CCM_RAM_END; ) {
-        *write_ptr++ = *read_ptr++;
-    }
+    /* boot_report is in .bss, so it can only be written now */
+    boot_phase_record(BootPhase::DATA_COPY, 0, data_done);
+    boot_phase_record(BootPhase::BSS_ZERO, data_done, bss_done);
 
+#ifdef __STM32F4xx__
+    /* Copy .ccmram from Flash to CCMRAM, and zero the rest of it */
+    copy_words(&_CCM_RAM_START, &_CCM_ROM_START, &_CCM_RAM_END);
+    zero_words(&_CCM_RAM_END, reinterpret_cast<unsigned *>(CCMRAM_BASE + CCMRAM_SIZE));
+    boot_phase_record(BootPhase::CCM_INIT, bss_done, boot_cycles());
 #endif
 
     /* Run C++ static constructors */
+    const uint32_t ctors_start = boot_cycles();
     uintptr_t *initializer = reinterpret_cast<uintptr_t *>(&__init_array_start);
     uintptr_t *initializersEnd = reinterpret_cast<uintptr_t *>(&__init_array_end);
     while (initializer < initializersEnd) {
@@ -53,6 +114,7 @@ Reset_Handler(void)
         fp();
         initializer++;
     }
+    boot_phase_record(BootPhase::STATIC_CTORS, ctors_start, boot_cycles());
 
     /* Start runnin boi */
     (void)main();
@@ -215,8 +277,12 @@ System_Init(void)
      * Only initialize things required for
      * normal operation here e.g. clocks
      */
+    const uint32_t start = boot_cycles();
     RCC->init();
+    flash_driver_init();
+    clock_driver_init();
     sys_timer_init();
+    boot_phase_record(BootPhase::SYSTEM_INIT, start, boot_cycles());
 }
 
 extern void cpu_init(void);
@@ -226,7 +292,7 @@ main(void)
 {
     System_Init();
 
-    cpu_init();
+    BOOT_PHASE(CPU_INIT, cpu_init());
     ker_main();
 
     abort();
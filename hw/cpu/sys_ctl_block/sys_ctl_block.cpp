@@ -16,7 +16,8 @@ SysControlBlock::initialize(void) volatile
      *
      * System timer clock is 64 MHz / 8 = 8 MHz,
      * so set reload value to 63999 so that it ticks
-     * every 64000 cycles.
+     * every 64000 cycles. sys_timer keeps it in step
+     * with the clock after that.
      */
     RVR &= ~RVR_RELOAD;
     RVR |= 63999u;
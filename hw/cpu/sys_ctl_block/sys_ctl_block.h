@@ -18,6 +18,8 @@
 #define ICSR_PENDSVSET  (1u << 28)
 #define ICSR_PENDSVCLR  (1u << 27)
 
+#define SCR_SLEEPDEEP   (1u << 2)
+
 class SysControlBlock {
     uint32_t ACTLR; // Auxiliary Control
     uint32_t rsvd1;
@@ -53,6 +55,10 @@ class SysControlBlock {
         void enable_sys_tick(void) volatile { CSR |= CSR_TICKINT; };
         void set_pending_pendsv(void) volatile { ICSR |= ICSR_PENDSVSET; };
         void clear_pending_pendsv(void) volatile { ICSR |= ICSR_PENDSVCLR; };
+        /* Takes effect when the current tick runs out */
+        void set_sys_tick_reload(const uint32_t reload) volatile { RVR = reload & RVR_RELOAD; };
+        /* Whether WFI goes into the chip's deep sleep (e.g. Stop mode) rather than plain sleep */
+        void set_sleep_deep(const bool deep) volatile { SCR = deep ? (SCR | SCR_SLEEPDEEP) : (SCR & ~SCR_SLEEPDEEP); };
 
         void initialize(void) volatile;
 };
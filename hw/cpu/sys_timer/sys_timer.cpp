@@ -1,5 +1,9 @@
+#include "profiler.h"
+#include "ramfunc.h"
+#include "scheduler.h"
 #include "sys_ctl_block.h"
 #include "sys_timer.h"
+#include "trace.h"
 
 struct cpu_regs_on_stack {
     uint32_t R4_11[8];
@@ -164,16 +168,66 @@ old_SysTick_Handler(void)
     : "memory" );
 }
 
+/* SysTick counts HCLK / 8 */
+#define SYS_TICK_CLOCK_DIV 8u
+
 uint32_t numSystemTicks;
 
-__attribute__((interrupt))
+/* Called from SysTick_Handler with the exception frame of whatever the tick interrupted */
+extern "C" RAMFUNC void
+sysTickHandler(const uint32_t *const frame)
+{
+    TRACE_IRQ_ENTER();
+    numSystemTicks++;
+    prof_tick(frame);
+    scheduler_tick();
+    TRACE_IRQ_EXIT();
+}
+
+void
+sys_timer_catch_up(const uint32_t ticks)
+{
+    for (uint32_t i = 0; i < ticks; i++) {
+        numSystemTicks++;
+        scheduler_tick();
+    }
+}
+
+/*
+ * Bit 2 of EXC_RETURN says which stack the frame was pushed to. LR still
+ * holds EXC_RETURN when sysTickHandler returns, so that ends the exception.
+ * Both run from RAM, as they do every tick.
+ */
+RAMFUNC __attribute__((naked))
 void
 SysTick_Handler(void)
 {
-    numSystemTicks++;
-    SYS_CTL->set_pending_pendsv();
+    asm volatile (
+        "\n\t" "TST     LR, #4"
+        "\n\t" "ITE     EQ"
+        "\n\t" "MRSEQ   R0, MSP"
+        "\n\t" "MRSNE   R0, PSP"
+        "\n\t" "B       sysTickHandler"
+        : : : "memory");
+}
+
+static uint32_t
+sys_tick_reload(const uint32_t hclk_hz)
+{
+    return (hclk_hz / (SYS_TICK_CLOCK_DIV * SYS_TICK_HZ)) - 1u;
 }
 
+/* Keeps the tick length the same whatever the clock is running at */
+static void
+sys_tick_clock_changed(void *, const ClockEvent event, const ClockRates &, const ClockRates &new_rates)
+{
+    if (event == ClockEvent::POST_CHANGE) {
+        SYS_CTL->set_sys_tick_reload(sys_tick_reload(new_rates.hclk_hz));
+    }
+}
+
+static ClockNotifier sys_tick_notifier = { sys_tick_clock_changed, nullptr, nullptr };
+
 void
 sys_timer_init(void)
 {
@@ -204,5 +258,7 @@ sys_timer_init(void)
     /* Everything else 0. */
 
     SYS_CTL->initialize();
+    SYS_CTL->set_sys_tick_reload(sys_tick_reload(clock_rates().hclk_hz));
+    clock_register_notifier(sys_tick_notifier);
 }
 
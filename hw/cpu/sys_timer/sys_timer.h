@@ -5,10 +5,21 @@
 
 #include "drivers.h"
 
+/* Ticks every 8 ms */
+#define SYS_TICK_HZ 125u
+#define SYS_TICK_US (1000000u / SYS_TICK_HZ)
+
 extern uint32_t main_stack[64];
 
 void thread_1(void);
 void sys_timer_init(void);
 
+/*
+ * Runs the ticks SysTick missed while its clock was stopped (e.g. in Stop
+ * mode), so timeouts and idle time come out as if it had kept going.
+ * Interrupts must be masked.
+ */
+void sys_timer_catch_up(const uint32_t ticks);
+
 #endif /* _SYS_TIMER_H */
 
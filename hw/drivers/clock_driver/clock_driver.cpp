@@ -0,0 +1,212 @@
+#include "clock_driver.h"
+#include "irq.h"
+#include "stm32_rcc.h"
+
+#define HSI_HZ 16000000u
+
+#define NUM_CLOCK_OPS static_cast<uint32_t>(ClockOp::NUM_OPS)
+
+/*
+ * How to get to each operating point. The PLL's input (HSI / pllm) has to be
+ * 1-2 MHz and its VCO 192-432 MHz. APB1 can go up to 30 MHz and APB2 up to
+ * 60 MHz, and pllq is picked to give USB its 48 MHz.
+ */
+struct ClockOpConfig {
+    ClockRates rates;
+    bool use_pll;
+    uint8_t pllm;
+    uint16_t plln;
+    uint8_t pllp;
+    uint8_t pllq;
+    uint16_t ahb_div;
+    uint8_t apb1_div;
+    uint8_t apb2_div;
+};
+
+static const ClockOpConfig op_configs[NUM_CLOCK_OPS] = {
+    /* LOW: HSI with everything undivided */
+    { { HSI_HZ, HSI_HZ, HSI_HZ, HSI_HZ }, false, 0, 0, 0, 0, 1, 1, 1 },
+    /* NORMAL: VCO = 16 MHz * 192 / 8 = 384 MHz, SYSCLK = VCO / 6 */
+    { { 64000000u, 64000000u, 16000000u, 32000000u }, true, 8, 192, 6, 8, 1, 4, 2 },
+    /* BOOST: VCO = 16 MHz * 240 / 16 = 240 MHz, SYSCLK = VCO / 2 */
+    { { 120000000u, 120000000u, 30000000u, 60000000u }, true, 16, 240, 2, 5, 1, 4, 2 },
+};
+
+/* Straight out of reset the chip runs from the HSI, which is what LOW is */
+static enum ClockOp current_op = ClockOp::LOW;
+static uint32_t requests[NUM_CLOCK_OPS];
+static bool changing;
+static ClockNotifier *notifiers;
+
+static void
+notify(const ClockEvent event, const ClockRates &old_rates, const ClockRates &new_rates)
+{
+    for (ClockNotifier *n = notifiers; n != nullptr; n = n->next) {
+        n->changed(n->ctx, event, old_rates, new_rates);
+    }
+}
+
+/*
+ * The PLL can't be touched while it's driving SYSCLK, so the HSI fills in
+ * while it's reconfigured. Prescalers are changed while on the HSI too,
+ * where no divisor can take a bus over its limit.
+ */
+static void
+apply_op(const ClockOpConfig &config)
+{
+    if (RCC->get_sysclk() != RccPeriph::SYSCLK_HSI) {
+        RCC->select_sysclk(RccPeriph::SYSCLK_HSI);
+    }
+
+    RCC->set_bus_prescalers(config.ahb_div, config.apb1_div, config.apb2_div);
+
+    if (config.use_pll) {
+        RCC->enable_pll(config.pllm, config.plln, config.pllp, config.pllq);
+        RCC->select_sysclk(RccPeriph::SYSCLK_PLL);
+    } else {
+        RCC->disable_pll();
+    }
+}
+
+static void
+switch_op(const enum ClockOp op)
+{
+    const ClockRates &old_rates = op_configs[static_cast<uint32_t>(current_op)].rates;
+    const ClockOpConfig &config = op_configs[static_cast<uint32_t>(op)];
+
+    notify(ClockEvent::PRE_CHANGE, old_rates, config.rates);
+
+    const uint32_t primask = irq_save();
+    apply_op(config);
+    current_op = op;
+    irq_restore(primask);
+
+    notify(ClockEvent::POST_CHANGE, old_rates, config.rates);
+}
+
+/* Fastest operating point with a request, LOW if there are none */
+static enum ClockOp
+wanted_op(void)
+{
+    for (uint32_t i = NUM_CLOCK_OPS; i > 0; i--) {
+        if (requests[i - 1u] != 0) {
+            return static_cast<enum ClockOp>(i - 1u);
+        }
+    }
+    return ClockOp::LOW;
+}
+
+/*
+ * Only one thread changes the clock at a time. Requests that come in while
+ * it's doing so are picked up by it before it gives up, so anybody else
+ * can just return.
+ */
+static void
+update_op(void)
+{
+    uint32_t primask = irq_save();
+    if (changing) {
+        irq_restore(primask);
+        return;
+    }
+    changing = true;
+
+    for (enum ClockOp op = wanted_op(); op != current_op; op = wanted_op()) {
+        irq_restore(primask);
+        switch_op(op);
+        primask = irq_save();
+    }
+
+    changing = false;
+    irq_restore(primask);
+}
+
+static int
+change_request(const enum ClockOp op, const bool take)
+{
+    const uint32_t index = static_cast<uint32_t>(op);
+    if ((index >= NUM_CLOCK_OPS) || irq_in_handler()) {
+        return -1;
+    }
+
+    const uint32_t primask = irq_save();
+    if (take) {
+        requests[index]++;
+    } else if (requests[index] != 0) {
+        requests[index]--;
+    } else {
+        irq_restore(primask);
+        return -1;
+    }
+    irq_restore(primask);
+
+    update_op();
+    return 0;
+}
+
+int
+clock_request(const enum ClockOp op)
+{
+    return change_request(op, true);
+}
+
+int
+clock_release(const enum ClockOp op)
+{
+    return change_request(op, false);
+}
+
+const ClockRates &
+clock_rates(void)
+{
+    return op_configs[static_cast<uint32_t>(current_op)].rates;
+}
+
+enum ClockOp
+clock_op(void)
+{
+    return current_op;
+}
+
+const ClockRates &
+clock_op_rates(const enum ClockOp op)
+{
+    return op_configs[static_cast<uint32_t>(op)].rates;
+}
+
+void
+clock_register_notifier(ClockNotifier &notifier)
+{
+    const uint32_t primask = irq_save();
+    notifier.next = notifiers;
+    notifiers = &notifier;
+    irq_restore(primask);
+}
+
+void
+clock_unregister_notifier(ClockNotifier &notifier)
+{
+    const uint32_t primask = irq_save();
+    for (ClockNotifier **link = &notifiers; *link != nullptr; link = &(*link)->next) {
+        if (*link == &notifier) {
+            *link = notifier.next;
+            break;
+        }
+    }
+    irq_restore(primask);
+}
+
+void
+clock_resume(void)
+{
+    const ClockOpConfig &config = op_configs[static_cast<uint32_t>(current_op)];
+    if (config.use_pll) {
+        apply_op(config);
+    }
+}
+
+void
+clock_driver_init(void)
+{
+    clock_request(ClockOp::NORMAL);
+}
@@ -0,0 +1,78 @@
+#ifndef _CLOCK_DRIVER_H
+#define _CLOCK_DRIVER_H
+
+#include <cstdint>
+
+/*
+ * Operating points the system clock can run at, slowest first. Everything
+ * runs from the HSI, so no crystal is needed for any of them.
+ *   LOW:    16 MHz straight from the HSI, PLL off
+ *   NORMAL: 64 MHz from the PLL, what the kernel boots into
+ *   BOOST:  120 MHz from the PLL, the most the F2 can do
+ */
+enum class ClockOp : uint8_t {
+    LOW,
+    NORMAL,
+    BOOST,
+    NUM_OPS,
+};
+
+struct ClockRates {
+    uint32_t sysclk_hz;
+    uint32_t hclk_hz;       // Core, AHB and DMA
+    uint32_t pclk1_hz;      // APB1: USART2-5
+    uint32_t pclk2_hz;      // APB2: USART1 and 6
+};
+
+/*
+ * Notifiers are told before and after every change of operating point.
+ * PRE_CHANGE is the time to finish anything that can't survive the clock
+ * changing under it (e.g. a USART frame), POST_CHANGE the time to reprogram
+ * whatever was derived from the old rates. Both are called from the thread
+ * changing the clock with interrupts enabled, so they may wait for
+ * interrupts, but shouldn't sleep.
+ */
+enum class ClockEvent : uint8_t {
+    PRE_CHANGE,
+    POST_CHANGE,
+};
+
+struct ClockNotifier {
+    void (*changed)(void *ctx, const ClockEvent event, const ClockRates &old_rates, const ClockRates &new_rates);
+    void *ctx;
+    ClockNotifier *next;
+};
+
+/* Switches from the HSI the chip resets into to the NORMAL operating point */
+void clock_driver_init(void);
+
+const ClockRates &clock_rates(void);
+enum ClockOp clock_op(void);
+const ClockRates &clock_op_rates(const enum ClockOp op);
+
+/* The notifier has to stay alive until it's unregistered */
+void clock_register_notifier(ClockNotifier &notifier);
+void clock_unregister_notifier(ClockNotifier &notifier);
+
+/*
+ * Stop mode wakes up on the HSI with the PLL off. This puts the current
+ * operating point back, without telling the notifiers as the rates end up
+ * where they were. Call it with interrupts masked, straight after waking.
+ */
+void clock_resume(void);
+
+/*
+ * Requests are counted per operating point and the clock runs at the
+ * fastest one anybody wants, or LOW if nobody wants anything. The kernel
+ * holds a NORMAL request from clock_driver_init, so releasing it when idle
+ * drops to LOW, and taking a BOOST request (e.g. for a UI animation) goes
+ * up until it's released.
+ *
+ * Changing the operating point takes a while (the PLL has to relock) and
+ * waits for the USARTs to drain, so these can't be called from interrupts.
+ * They return -1 if they are, or if the op is invalid.
+ */
+int clock_request(const enum ClockOp op);
+int clock_release(const enum ClockOp op);
+
+#endif /* _CLOCK_DRIVER_H */
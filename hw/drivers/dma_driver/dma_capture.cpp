@@ -0,0 +1,78 @@
+#include "dma_driver.h"
+#include "irq.h"
+
+static void
+capture_complete(void *const ctx)
+{
+    DmaCapture &cap = *static_cast<DmaCapture *>(ctx);
+
+    /* CT has already flipped, the buffer that just filled is the other one */
+    const uint8_t target = dma_controller(cap.xfer)->get_current_target(cap.xfer.req.stream);
+    const uint8_t done = target ^ 1;
+
+    if (cap.held & (1u << target)) {
+        /* The consumer is still reading the buffer the DMA is now writing */
+        cap.overruns++;
+    }
+    cap.held |= (1u << done);
+    cap.buffers++;
+
+    if (cap.filled != nullptr) {
+        cap.filled(cap.ctx, cap.bufs[done], cap.len);
+    }
+}
+
+int
+dma_capture_start(DmaCapture &cap, const DmaLine line, const volatile void *const periph,
+        void *const buf0, void *const buf1, const uint32_t len, const enum DmaRequest::transfer_size size,
+        DmaBufferFilled filled, void *const ctx)
+{
+    /* Capture only makes sense from a peripheral, a TX line would send the buffers instead */
+    if (!dma_line_is_p2m(line) || (buf0 == nullptr) || (buf1 == nullptr) || (len == 0)) {
+        return -1;
+    }
+
+    cap.bufs[0] = buf0;
+    cap.bufs[1] = buf1;
+    cap.len = len;
+    cap.filled = filled;
+    cap.ctx = ctx;
+    cap.held = 0;
+    cap.buffers = 0;
+    cap.overruns = 0;
+
+    DmaTransfer &xfer = cap.xfer;
+    xfer.req = DmaRequest();
+    xfer.req.mem1 = buf0;
+    xfer.req.mem2 = buf1;
+    xfer.req.periph = periph;
+    xfer.req.len = len;
+    xfer.req.periph_xfer_size = size;
+    xfer.req.mem_xfer_size = size;
+    xfer.req.mode = DmaRequest::MODE_DOUBLE_BUFF;
+    /* A late stream loses samples, unlike most transfers which just finish later */
+    xfer.req.priority = DmaRequest::PRIO_VHIGH;
+    xfer.req.xfer_complete = capture_complete;
+    xfer.req.cb_ctx = &cap;
+    xfer.line = line;
+
+    return dma_submit(xfer);
+}
+
+void
+dma_capture_release(DmaCapture &cap, const void *const buf)
+{
+    const uint32_t primask = irq_save();
+    if (buf == cap.bufs[0]) {
+        cap.held &= ~1u;
+    } else if (buf == cap.bufs[1]) {
+        cap.held &= ~2u;
+    }
+    irq_restore(primask);
+}
+
+int
+dma_capture_stop(DmaCapture &cap)
+{
+    return dma_cancel(cap.xfer);
+}
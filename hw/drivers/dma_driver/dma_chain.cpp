@@ -0,0 +1,48 @@
+#include "dma_driver.h"
+
+/* Points the request at the next non-empty piece, returns false at the end of the chain */
+static bool
+chain_next(DmaChain &chain)
+{
+    while (chain.iov_index < chain.iov_count) {
+        const DmaIovec &iov = chain.iov[chain.iov_index];
+        chain.iov_index++;
+        if (iov.len != 0) {
+            chain.xfer.req.mem1 = iov.base;
+            chain.xfer.req.len = iov.len;
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool
+chain_reload(void *const ctx)
+{
+    return chain_next(*static_cast<DmaChain *>(ctx));
+}
+
+int
+dma_chain_submit(DmaChain &chain, const DmaIovec *const iov, const uint32_t iov_count)
+{
+    if ((chain.xfer.line == DmaLine::MEM_TO_MEM) || (iov == nullptr)) {
+        return -1;
+    }
+    if (chain.xfer.req.mode & (DmaRequest::MODE_CIRC | DmaRequest::MODE_DOUBLE_BUFF)) {
+        /* A circular stream never completes, so there'd be no point to reload at */
+        return -1;
+    }
+
+    chain.iov = iov;
+    chain.iov_count = iov_count;
+    chain.iov_index = 0;
+    if (!chain_next(chain)) {
+        /* Nothing to send */
+        return -1;
+    }
+
+    chain.xfer.reload = chain_reload;
+    chain.xfer.reload_ctx = &chain;
+
+    return dma_submit(chain.xfer);
+}
@@ -0,0 +1,292 @@
+#include "cpu.h"
+#include "dma_driver.h"
+#include "irq.h"
+#include "scheduler.h"
+
+/* NDTR is 16 bits */
+#define DMA_MAX_ITEMS 0xffffu
+
+/*
+ * Direct mode isn't allowed for memory to memory. Peripherals can't wait and
+ * copies can, so copies go at the lowest priority. The peripheral side of a
+ * memory to memory stream is the source, which stays put for a fill.
+ */
+static constexpr DmaConfig copy_bytes_config =
+    DmaConfig(DmaConfig::DIR_MEM_TO_MEM).set_priority(DmaRequest::PRIO_LOW)
+        .set_mode(DmaRequest::MODE_FIFO).set_fifo_threshold(DmaRequest::FIFO_THRESH_FULL)
+        .set_periph_inc(true);
+static constexpr DmaConfig copy_words_config =
+    copy_bytes_config.set_sizes(DmaRequest::XFER_SIZE_WORD, DmaRequest::XFER_SIZE_WORD);
+static constexpr DmaConfig fill_bytes_config = copy_bytes_config.set_periph_inc(false);
+static constexpr DmaConfig fill_words_config = copy_words_config.set_periph_inc(false);
+
+static bool
+is_word_aligned(const void *const p)
+{
+    return (reinterpret_cast<uintptr_t>(p) & 0x3) == 0;
+}
+
+static void
+cpu_copy(uint8_t *dest, const uint8_t *src, size_t len)
+{
+    if (is_word_aligned(dest) && is_word_aligned(src)) {
+        uint32_t *d = reinterpret_cast<uint32_t *>(dest);
+        const uint32_t *s = reinterpret_cast<const uint32_t *>(src);
+        while (len >= 16) {
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            d[3] = s[3];
+            d += 4;
+            s += 4;
+            len -= 16;
+        }
+        while (len >= 4) {
+            *d++ = *s++;
+            len -= 4;
+        }
+        dest = reinterpret_cast<uint8_t *>(d);
+        src = reinterpret_cast<const uint8_t *>(s);
+    }
+    while (len > 0) {
+        *dest++ = *src++;
+        len--;
+    }
+}
+
+static void
+cpu_fill(uint8_t *dest, const uint8_t value, size_t len)
+{
+    while ((len > 0) && !is_word_aligned(dest)) {
+        *dest++ = value;
+        len--;
+    }
+    uint32_t *d = reinterpret_cast<uint32_t *>(dest);
+    const uint32_t word = value * 0x01010101u;
+    while (len >= 16) {
+        d[0] = word;
+        d[1] = word;
+        d[2] = word;
+        d[3] = word;
+        d += 4;
+        len -= 16;
+    }
+    while (len >= 4) {
+        *d++ = word;
+        len -= 4;
+    }
+    dest = reinterpret_cast<uint8_t *>(d);
+    while (len > 0) {
+        *dest++ = value;
+        len--;
+    }
+}
+
+static bool
+is_fill(const DmaCopy &op)
+{
+    return op.src == reinterpret_cast<const uint8_t *>(&op.pattern);
+}
+
+/* Worth handing to the DMA: big enough, and nothing in memory it can't reach (e.g. a stack in CCM RAM) */
+static bool
+use_dma(const DmaCopy &op)
+{
+    const size_t src_len = is_fill(op) ? sizeof(op.pattern) : op.remaining;
+    return (op.remaining >= DMA_COPY_THRESHOLD) && dma_mem_reachable(op.dest, op.remaining)
+           && dma_mem_reachable(op.src, src_len);
+}
+
+static void chunk_complete(void *ctx);
+static void chunk_error(void *ctx, uint32_t flags);
+
+/*
+ * Starts the next piece of the copy. Words are moved when everything lines
+ * up, bytes otherwise.
+ */
+static int
+start_chunk(DmaCopy &op)
+{
+    const bool words = is_word_aligned(op.dest) && is_word_aligned(op.src) && ((op.remaining & 0x3) == 0);
+    const uint32_t item_size = words ? 4 : 1;
+
+    op.chunk = op.remaining;
+    if (op.chunk > (DMA_MAX_ITEMS * item_size)) {
+        op.chunk = DMA_MAX_ITEMS * item_size;
+    }
+
+    DmaTransfer &xfer = op.xfer;
+    xfer.req = DmaRequest();
+    if (is_fill(op)) {
+        if (words) {
+            DmaPreset<fill_words_config>::apply(xfer.req);
+        } else {
+            DmaPreset<fill_bytes_config>::apply(xfer.req);
+        }
+    } else {
+        if (words) {
+            DmaPreset<copy_words_config>::apply(xfer.req);
+        } else {
+            DmaPreset<copy_bytes_config>::apply(xfer.req);
+        }
+    }
+    xfer.req.mem1 = op.src;
+    xfer.req.mem2 = op.dest;
+    xfer.req.len = op.chunk;
+    xfer.req.xfer_complete = chunk_complete;
+    xfer.req.xfer_error = chunk_error;
+    xfer.req.cb_ctx = &op;
+    xfer.line = DmaLine::MEM_TO_MEM;
+
+    return dma_submit(xfer);
+}
+
+static void
+finish(DmaCopy &op)
+{
+    op.finished = true;
+    if (op.waiter != nullptr) {
+        scheduler_wake(*op.waiter);
+    }
+    if (op.done != nullptr) {
+        op.done(op.ctx);
+    }
+}
+
+static void
+chunk_complete(void *const ctx)
+{
+    DmaCopy &op = *static_cast<DmaCopy *>(ctx);
+
+    op.dest += op.chunk;
+    if (!is_fill(op)) {
+        op.src += op.chunk;
+    }
+    op.remaining -= op.chunk;
+
+    if (op.remaining != 0) {
+        if (start_chunk(op) == 0) {
+            return;
+        }
+        op.failed = true;
+    }
+    finish(op);
+}
+
+static void
+chunk_error(void *const ctx, const uint32_t)
+{
+    DmaCopy &op = *static_cast<DmaCopy *>(ctx);
+    op.failed = true;
+    finish(op);
+}
+
+static void
+init_op(DmaCopy &op, void *const dest, const void *const src, const size_t len,
+        void (*const done)(void *ctx), void *const ctx)
+{
+    op.dest = static_cast<uint8_t *>(dest);
+    op.src = static_cast<const uint8_t *>(src);
+    op.remaining = len;
+    op.chunk = 0;
+    op.done = done;
+    op.ctx = ctx;
+    op.waiter = nullptr;
+    op.finished = false;
+    op.failed = false;
+}
+
+/*
+ * Runs the copy on DMA2 and blocks until it's done, or returns false if the
+ * caller can't block and should copy on the CPU.
+ */
+static bool
+run_and_wait(DmaCopy &op)
+{
+    const uint32_t primask = irq_save();
+
+    Thread *const thread = scheduler_current();
+    if ((primask != 0) || irq_in_handler() || (thread == nullptr)
+            || (thread == hw_cpus[cpu_current_id()].getIdleThread())) {
+        irq_restore(primask);
+        return false;
+    }
+
+    if (start_chunk(op) < 0) {
+        irq_restore(primask);
+        return false;
+    }
+    op.waiter = thread;
+    while (!op.finished) {
+        (void)scheduler_block(WAIT_FOREVER);
+    }
+
+    irq_restore(primask);
+    return true;
+}
+
+void
+dma_memcpy(void *const dest, const void *const src, const size_t len)
+{
+    if (len >= DMA_COPY_THRESHOLD) {
+        DmaCopy op;
+        init_op(op, dest, src, len, nullptr, nullptr);
+        if (use_dma(op) && run_and_wait(op)) {
+            if (op.failed) {
+                cpu_copy(op.dest, op.src, op.remaining);
+            }
+            return;
+        }
+    }
+    cpu_copy(static_cast<uint8_t *>(dest), static_cast<const uint8_t *>(src), len);
+}
+
+void
+dma_memset(void *const dest, const uint8_t value, const size_t len)
+{
+    if (len >= DMA_COPY_THRESHOLD) {
+        DmaCopy op;
+        init_op(op, dest, nullptr, len, nullptr, nullptr);
+        op.pattern = value * 0x01010101u;
+        op.src = reinterpret_cast<const uint8_t *>(&op.pattern);
+        if (use_dma(op) && run_and_wait(op)) {
+            if (op.failed) {
+                cpu_fill(op.dest, value, op.remaining);
+            }
+            return;
+        }
+    }
+    cpu_fill(static_cast<uint8_t *>(dest), value, len);
+}
+
+int
+dma_memcpy_async(DmaCopy &op, void *const dest, const void *const src, const size_t len,
+        void (*const done)(void *ctx), void *const ctx)
+{
+    init_op(op, dest, src, len, done, ctx);
+    if (use_dma(op)) {
+        return start_chunk(op);
+    }
+
+    cpu_copy(op.dest, op.src, len);
+    op.remaining = 0;
+    finish(op);
+    return 0;
+}
+
+int
+dma_memset_async(DmaCopy &op, void *const dest, const uint8_t value, const size_t len,
+        void (*const done)(void *ctx), void *const ctx)
+{
+    init_op(op, dest, nullptr, len, done, ctx);
+    op.pattern = value * 0x01010101u;
+    op.src = reinterpret_cast<const uint8_t *>(&op.pattern);
+    if (use_dma(op)) {
+        return start_chunk(op);
+    }
+
+    cpu_fill(op.dest, value, len);
+    op.remaining = 0;
+    finish(op);
+    return 0;
+}
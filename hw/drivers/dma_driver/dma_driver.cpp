@@ -0,0 +1,447 @@
+#include "dma_driver.h"
+#include "dwt.h"
+#include "irq.h"
+#include "nvic.h"
+#include "pwr_driver.h"
+#include "trace.h"
+#include "wait_set.h"
+
+/* Strong versions of the weak handlers in startup.h */
+#define IRQ_HANDLER void __attribute__((interrupt("IRQ")))
+
+#define MAX_ROUTES 2u
+
+enum dma_direction { DIR_P2M = 0, DIR_M2P, DIR_M2M };
+
+struct DmaRoute {
+    uint8_t controller;
+    uint8_t stream;
+    uint8_t channel;
+};
+
+struct DmaLineInfo {
+    enum dma_direction direction;
+    uint8_t num_routes;
+    DmaRoute routes[MAX_ROUTES];
+};
+
+/* Request mapping from the reference manual, first route is preferred */
+static const DmaLineInfo line_info[static_cast<uint32_t>(DmaLine::NUM_LINES)] = {
+    /* USART1_RX */  { DIR_P2M, 2, { { 1, 2, 4 }, { 1, 5, 4 } } },
+    /* USART1_TX */  { DIR_M2P, 1, { { 1, 7, 4 } } },
+    /* USART2_RX */  { DIR_P2M, 1, { { 0, 5, 4 } } },
+    /* USART2_TX */  { DIR_M2P, 1, { { 0, 6, 4 } } },
+    /* USART3_RX */  { DIR_P2M, 1, { { 0, 1, 4 } } },
+    /* USART3_TX */  { DIR_M2P, 2, { { 0, 3, 4 }, { 0, 4, 7 } } },
+    /* UART4_RX */   { DIR_P2M, 1, { { 0, 2, 4 } } },
+    /* UART4_TX */   { DIR_M2P, 1, { { 0, 4, 4 } } },
+    /* UART5_RX */   { DIR_P2M, 1, { { 0, 0, 4 } } },
+    /* UART5_TX */   { DIR_M2P, 1, { { 0, 7, 4 } } },
+    /* USART6_RX */  { DIR_P2M, 2, { { 1, 1, 5 }, { 1, 2, 5 } } },
+    /* USART6_TX */  { DIR_M2P, 2, { { 1, 6, 5 }, { 1, 7, 5 } } },
+    /* SPI1_RX */    { DIR_P2M, 2, { { 1, 0, 3 }, { 1, 2, 3 } } },
+    /* SPI1_TX */    { DIR_M2P, 2, { { 1, 3, 3 }, { 1, 5, 3 } } },
+    /* SPI2_RX */    { DIR_P2M, 1, { { 0, 3, 0 } } },
+    /* SPI2_TX */    { DIR_M2P, 1, { { 0, 4, 0 } } },
+    /* SPI3_RX */    { DIR_P2M, 2, { { 0, 0, 0 }, { 0, 2, 0 } } },
+    /* SPI3_TX */    { DIR_M2P, 2, { { 0, 5, 0 }, { 0, 7, 0 } } },
+    /* I2C1_RX */    { DIR_P2M, 2, { { 0, 0, 1 }, { 0, 5, 1 } } },
+    /* I2C1_TX */    { DIR_M2P, 2, { { 0, 6, 1 }, { 0, 7, 1 } } },
+    /* ADC1 */       { DIR_P2M, 2, { { 1, 0, 0 }, { 1, 4, 0 } } },
+    /* MEM_TO_MEM */ { DIR_M2M, 0, { } },
+};
+
+static volatile DmaPeriph *const controllers[DMA_NUM_CONTROLLERS] = { DMA1, DMA2 };
+static const WaitSource wait_sources[DMA_NUM_CONTROLLERS] = { WaitSource::Dma1, WaitSource::Dma2 };
+
+static const Nvic::InterruptNumber stream_irqs[DMA_NUM_CONTROLLERS][DMA_NUM_STREAMS] = {
+    {
+        Nvic::InterruptNumber::DMA1_Stream0, Nvic::InterruptNumber::DMA1_Stream1,
+        Nvic::InterruptNumber::DMA1_Stream2, Nvic::InterruptNumber::DMA1_Stream3,
+        Nvic::InterruptNumber::DMA1_Stream4, Nvic::InterruptNumber::DMA1_Stream5,
+        Nvic::InterruptNumber::DMA1_Stream6, Nvic::InterruptNumber::DMA1_Stream7,
+    },
+    {
+        Nvic::InterruptNumber::DMA2_Stream0, Nvic::InterruptNumber::DMA2_Stream1,
+        Nvic::InterruptNumber::DMA2_Stream2, Nvic::InterruptNumber::DMA2_Stream3,
+        Nvic::InterruptNumber::DMA2_Stream4, Nvic::InterruptNumber::DMA2_Stream5,
+        Nvic::InterruptNumber::DMA2_Stream6, Nvic::InterruptNumber::DMA2_Stream7,
+    },
+};
+
+/* Each controller's clock is held while any of its streams are claimed */
+static const enum RccPeriph::AHB1_periphs controller_clocks[DMA_NUM_CONTROLLERS] = { RccPeriph::DMA1, RccPeriph::DMA2 };
+
+/* Transfer currently owning each stream */
+static DmaTransfer *active[DMA_NUM_CONTROLLERS][DMA_NUM_STREAMS];
+/* Transfers waiting for a stream, highest priority first */
+static DmaTransfer *pending_head;
+
+#if DMA_PROFILING
+static DmaStreamStats stream_stats[DMA_NUM_CONTROLLERS][DMA_NUM_STREAMS];
+/* Cycle count when the stream's current transfer (or lap, if circular) started */
+static uint32_t stream_started[DMA_NUM_CONTROLLERS][DMA_NUM_STREAMS];
+
+static void
+profile_start(const DmaTransfer &xfer)
+{
+    const uint32_t now = DWT->get_cycle_count();
+    DmaStreamStats &stats = stream_stats[xfer.controller][xfer.req.stream];
+    if (xfer.state == DmaTransfer::STATE_QUEUED) {
+        const uint32_t wait = now - xfer.queued_at;
+        if (wait > stats.max_queue_wait_cycles) {
+            stats.max_queue_wait_cycles = wait;
+        }
+    }
+    stream_started[xfer.controller][xfer.req.stream] = now;
+}
+
+/* Counts the time since the transfer started, and its bytes if it got to the end */
+static void
+profile_stop(const uint8_t controller, const uint8_t stream, const uint32_t bytes)
+{
+    const uint32_t now = DWT->get_cycle_count();
+    DmaStreamStats &stats = stream_stats[controller][stream];
+    stats.active_cycles += now - stream_started[controller][stream];
+    stream_started[controller][stream] = now;
+    if (bytes != 0) {
+        stats.transfers++;
+        stats.bytes += bytes;
+    }
+}
+
+static void
+profile_errors(const uint8_t controller, const uint8_t stream, const uint32_t flags)
+{
+    DmaStreamStats &stats = stream_stats[controller][stream];
+    if (flags & DMA_FLAG_TE) {
+        stats.transfer_errors++;
+    }
+    if (flags & DMA_FLAG_DME) {
+        stats.direct_mode_errors++;
+    }
+    if (flags & DMA_FLAG_FE) {
+        stats.fifo_errors++;
+    }
+}
+#endif
+
+DmaTransfer::DmaTransfer()
+{
+    line = DmaLine::MEM_TO_MEM;
+    state = STATE_IDLE;
+    controller = 0;
+    next = nullptr;
+    reload = nullptr;
+    reload_ctx = nullptr;
+}
+
+static bool
+is_circular(const DmaRequest &req)
+{
+    return (req.mode & (DmaRequest::MODE_CIRC | DmaRequest::MODE_DOUBLE_BUFF)) != 0;
+}
+
+/*
+ * Finds a free stream for the transfer's line and claims it.
+ * Interrupts must be masked.
+ */
+static bool
+claim_stream(DmaTransfer &xfer)
+{
+    const DmaLineInfo &info = line_info[static_cast<uint32_t>(xfer.line)];
+
+    if (info.direction == DIR_M2M) {
+        /* Only DMA2 can do memory to memory. Go from the top, the low streams are more useful to peripherals */
+        for (int stream = DMA_NUM_STREAMS - 1; stream >= 0; stream--) {
+            if (active[1][stream] == nullptr) {
+                xfer.controller = 1;
+                xfer.req.stream = static_cast<uint8_t>(stream);
+                xfer.req.channel = 0;
+                active[1][stream] = &xfer;
+                (void)pwr_clock_acquire(controller_clocks[1]);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    for (uint32_t i = 0; i < info.num_routes; i++) {
+        const DmaRoute &route = info.routes[i];
+        if (active[route.controller][route.stream] == nullptr) {
+            xfer.controller = route.controller;
+            xfer.req.stream = route.stream;
+            xfer.req.channel = route.channel;
+            active[route.controller][route.stream] = &xfer;
+            (void)pwr_clock_acquire(controller_clocks[route.controller]);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Interrupts must be masked, and the stream claimed */
+static int
+start_transfer(DmaTransfer &xfer)
+{
+    volatile DmaPeriph *const dma = controllers[xfer.controller];
+    const DmaLineInfo &info = line_info[static_cast<uint32_t>(xfer.line)];
+
+    dma->clear_stream_flags(xfer.req.stream, DMA_FLAG_ALL);
+#if DMA_PROFILING
+    profile_start(xfer);
+#endif
+    TRACE(DMA_START, (xfer.controller << 3) | xfer.req.stream, &xfer, xfer.req.len);
+    xfer.state = DmaTransfer::STATE_ACTIVE;
+
+    int ret;
+    switch (info.direction) {
+    case DIR_P2M: ret = dma->periph_to_mem(xfer.req); break;
+    case DIR_M2P: ret = dma->mem_to_periph(xfer.req); break;
+    case DIR_M2M: ret = dma->mem_to_mem(xfer.req); break;
+    default: ret = -1; break;
+    }
+
+#if DMA_PROFILING
+    /* FIFO errors don't stop the stream, so they only interrupt when they're being counted */
+    dma->enable_fifo_error_interrupt(xfer.req.stream);
+#endif
+    return ret;
+}
+
+/* Interrupts must be masked */
+static void
+release_stream(const uint8_t controller, const uint8_t stream)
+{
+    active[controller][stream] = nullptr;
+
+    /* Hand the stream to the best queued transfer that can use it */
+    DmaTransfer **link = &pending_head;
+    while (*link != nullptr) {
+        DmaTransfer &xfer = **link;
+        if (claim_stream(xfer)) {
+            *link = xfer.next;
+            xfer.next = nullptr;
+            (void)start_transfer(xfer);
+            break;
+        }
+        link = &xfer.next;
+    }
+
+    /* After the hand-off, so the clock doesn't go off and on again when the stream is reused */
+    (void)pwr_clock_release(controller_clocks[controller]);
+}
+
+/* Interrupts must be masked */
+static void
+queue_transfer(DmaTransfer &xfer)
+{
+    DmaTransfer **link = &pending_head;
+    /* PRIO_VHIGH is the highest value, keep FIFO order within a priority */
+    while ((*link != nullptr) && ((*link)->req.priority >= xfer.req.priority)) {
+        link = &(*link)->next;
+    }
+    xfer.next = *link;
+    *link = &xfer;
+    xfer.state = DmaTransfer::STATE_QUEUED;
+#if DMA_PROFILING
+    xfer.queued_at = DWT->get_cycle_count();
+#endif
+}
+
+void
+dma_driver_init(void)
+{
+    for (uint32_t controller = 0; controller < DMA_NUM_CONTROLLERS; controller++) {
+        for (uint32_t stream = 0; stream < DMA_NUM_STREAMS; stream++) {
+            active[controller][stream] = nullptr;
+            NVIC->enableInterrupt(stream_irqs[controller][stream]);
+        }
+    }
+    pending_head = nullptr;
+}
+
+int
+dma_submit(DmaTransfer &xfer)
+{
+    if ((xfer.line >= DmaLine::NUM_LINES) || dma_busy(xfer)) {
+        return -1;
+    }
+    if ((xfer.line == DmaLine::MEM_TO_MEM) && is_circular(xfer.req)) {
+        /* Not supported by the hardware */
+        return -1;
+    }
+
+    int ret = 0;
+    const uint32_t primask = irq_save();
+    xfer.next = nullptr;
+    if (claim_stream(xfer)) {
+        ret = start_transfer(xfer);
+    } else {
+        queue_transfer(xfer);
+    }
+    irq_restore(primask);
+
+    return ret;
+}
+
+int
+dma_cancel(DmaTransfer &xfer)
+{
+    int ret = 0;
+    const uint32_t primask = irq_save();
+
+    if (xfer.state == DmaTransfer::STATE_QUEUED) {
+        DmaTransfer **link = &pending_head;
+        while ((*link != nullptr) && (*link != &xfer)) {
+            link = &(*link)->next;
+        }
+        if (*link != nullptr) {
+            *link = xfer.next;
+        }
+        xfer.next = nullptr;
+        xfer.state = DmaTransfer::STATE_IDLE;
+    } else if (xfer.state == DmaTransfer::STATE_ACTIVE) {
+        volatile DmaPeriph *const dma = controllers[xfer.controller];
+        dma->disable_stream(xfer.req.stream);
+        dma->clear_stream_flags(xfer.req.stream, DMA_FLAG_ALL);
+#if DMA_PROFILING
+        profile_stop(xfer.controller, xfer.req.stream, 0);
+#endif
+        TRACE(DMA_DONE, (xfer.controller << 3) | xfer.req.stream, &xfer, 0);
+        xfer.state = DmaTransfer::STATE_IDLE;
+        release_stream(xfer.controller, xfer.req.stream);
+    } else {
+        ret = -1;
+    }
+
+    irq_restore(primask);
+    return ret;
+}
+
+bool
+dma_line_is_p2m(const DmaLine line)
+{
+    if (line >= DmaLine::NUM_LINES) {
+        return false;
+    }
+    return line_info[static_cast<uint32_t>(line)].direction == DIR_P2M;
+}
+
+bool
+dma_busy(const DmaTransfer &xfer)
+{
+    return (xfer.state == DmaTransfer::STATE_QUEUED) || (xfer.state == DmaTransfer::STATE_ACTIVE);
+}
+
+volatile DmaPeriph *
+dma_controller(const DmaTransfer &xfer)
+{
+    return controllers[xfer.controller];
+}
+
+#if DMA_PROFILING
+int
+dma_get_stream_stats(const uint8_t controller, const uint8_t stream, DmaStreamStats &stats)
+{
+    if ((controller >= DMA_NUM_CONTROLLERS) || (stream >= DMA_NUM_STREAMS)) {
+        return -1;
+    }
+
+    const uint32_t primask = irq_save();
+    stats = stream_stats[controller][stream];
+    irq_restore(primask);
+
+    return 0;
+}
+
+void
+dma_reset_stats(void)
+{
+    const uint32_t primask = irq_save();
+    for (uint32_t controller = 0; controller < DMA_NUM_CONTROLLERS; controller++) {
+        for (uint32_t stream = 0; stream < DMA_NUM_STREAMS; stream++) {
+            stream_stats[controller][stream] = DmaStreamStats();
+            stream_started[controller][stream] = DWT->get_cycle_count();
+        }
+    }
+    irq_restore(primask);
+}
+#endif
+
+static void
+dma_stream_irq(const uint8_t controller, const uint8_t stream)
+{
+    TRACE_IRQ_ENTER();
+    volatile DmaPeriph *const dma = controllers[controller];
+    const uint32_t flags = dma->get_stream_flags(stream);
+    dma->clear_stream_flags(stream, flags);
+
+#if DMA_PROFILING
+    profile_errors(controller, stream, flags);
+#endif
+
+    DmaTransfer *const xfer = active[controller][stream];
+    if (xfer != nullptr) {
+        DmaRequest &req = xfer->req;
+
+        if (flags & (DMA_FLAG_TE | DMA_FLAG_DME)) {
+#if DMA_PROFILING
+            profile_stop(controller, stream, 0);
+#endif
+            TRACE(DMA_ERROR, (controller << 3) | stream, xfer, flags);
+            /* The stream disables itself on an error */
+            xfer->state = DmaTransfer::STATE_ERROR;
+            release_stream(controller, stream);
+            if (req.xfer_error != nullptr) {
+                req.xfer_error(req.cb_ctx, flags);
+            }
+        } else {
+            if ((flags & DMA_FLAG_HT) && (req.half_xfer_complete != nullptr)) {
+                req.half_xfer_complete(req.cb_ctx);
+            }
+            if (flags & DMA_FLAG_TC) {
+#if DMA_PROFILING
+                profile_stop(controller, stream, req.len);
+#endif
+                TRACE(DMA_DONE, (controller << 3) | stream, xfer, req.len);
+                if (is_circular(req)) {
+                    if (req.xfer_complete != nullptr) {
+                        req.xfer_complete(req.cb_ctx);
+                    }
+                } else if ((xfer->reload != nullptr) && xfer->reload(xfer->reload_ctx)) {
+                    /* Keep the stream and go straight on with the next piece */
+                    (void)start_transfer(*xfer);
+                } else {
+                    xfer->state = DmaTransfer::STATE_DONE;
+                    release_stream(controller, stream);
+                    if (req.xfer_complete != nullptr) {
+                        req.xfer_complete(req.cb_ctx);
+                    }
+                }
+            }
+        }
+    }
+
+    if (flags & (DMA_FLAG_TC | DMA_FLAG_TE | DMA_FLAG_DME)) {
+        wait_set_notify(wait_sources[controller], stream);
+    }
+    TRACE_IRQ_EXIT();
+}
+
+IRQ_HANDLER DMA1_Stream0_IRQHandler(void) { dma_stream_irq(0, 0); }
+IRQ_HANDLER DMA1_Stream1_IRQHandler(void) { dma_stream_irq(0, 1); }
+IRQ_HANDLER DMA1_Stream2_IRQHandler(void) { dma_stream_irq(0, 2); }
+IRQ_HANDLER DMA1_Stream3_IRQHandler(void) { dma_stream_irq(0, 3); }
+IRQ_HANDLER DMA1_Stream4_IRQHandler(void) { dma_stream_irq(0, 4); }
+IRQ_HANDLER DMA1_Stream5_IRQHandler(void) { dma_stream_irq(0, 5); }
+IRQ_HANDLER DMA1_Stream6_IRQHandler(void) { dma_stream_irq(0, 6); }
+IRQ_HANDLER DMA1_Stream7_IRQHandler(void) { dma_stream_irq(0, 7); }
+IRQ_HANDLER DMA2_Stream0_IRQHandler(void) { dma_stream_irq(1, 0); }
+IRQ_HANDLER DMA2_Stream1_IRQHandler(void) { dma_stream_irq(1, 1); }
+IRQ_HANDLER DMA2_Stream2_IRQHandler(void) { dma_stream_irq(1, 2); }
+IRQ_HANDLER DMA2_Stream3_IRQHandler(void) { dma_stream_irq(1, 3); }
+IRQ_HANDLER DMA2_Stream4_IRQHandler(void) { dma_stream_irq(1, 4); }
+IRQ_HANDLER DMA2_Stream5_IRQHandler(void) { dma_stream_irq(1, 5); }
+IRQ_HANDLER DMA2_Stream6_IRQHandler(void) { dma_stream_irq(1, 6); }
+IRQ_HANDLER DMA2_Stream7_IRQHandler(void) { dma_stream_irq(1, 7); }
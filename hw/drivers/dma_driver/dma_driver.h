@@ -0,0 +1,229 @@
+#ifndef _DMA_DRIVER_H
+#define _DMA_DRIVER_H
+
+#include "stm32_dma.h"
+
+#define DMA_NUM_CONTROLLERS 2u
+
+/* Per-stream transfer counters, timed with the DWT cycle counter. Build with DMA_PROFILING=0 to leave them out. */
+#ifndef DMA_PROFILING
+#define DMA_PROFILING 1
+#endif
+
+class Thread;
+class UsartPeriph;
+/* Same as stm32_usart.h's, without pulling a USART into every DMA user */
+typedef volatile UsartPeriph *const usart_t;
+
+/*
+ * Peripheral request lines. Each one is wired to a fixed channel on one or
+ * two streams, which the driver picks between based on what's free.
+ */
+enum class DmaLine : uint8_t {
+    USART1_RX,
+    USART1_TX,
+    USART2_RX,
+    USART2_TX,
+    USART3_RX,
+    USART3_TX,
+    UART4_RX,
+    UART4_TX,
+    UART5_RX,
+    UART5_TX,
+    USART6_RX,
+    USART6_TX,
+    SPI1_RX,
+    SPI1_TX,
+    SPI2_RX,
+    SPI2_TX,
+    SPI3_RX,
+    SPI3_TX,
+    I2C1_RX,
+    I2C1_TX,
+    ADC1,
+    MEM_TO_MEM,     // Any DMA2 stream
+    NUM_LINES,
+};
+
+/*
+ * A transfer handed to the driver. It has to stay alive until it completes
+ * or is cancelled. req.stream and req.channel are filled in by the driver.
+ *
+ * Non-circular transfers give their stream back as soon as they complete
+ * (before xfer_complete is called, so the callback can submit the next one).
+ * Circular and double buffered transfers hold the stream until cancelled.
+ */
+struct DmaTransfer {
+    enum transfer_state { STATE_IDLE = 0, STATE_QUEUED, STATE_ACTIVE, STATE_DONE, STATE_ERROR };
+
+    DmaRequest req;
+    DmaLine line;
+
+    /*
+     * Optional, called from the transfer complete interrupt before a
+     * non-circular transfer gives up its stream. Returning true means req has
+     * been pointed at more data, and the stream is restarted with it straight
+     * away instead of completing.
+     */
+    bool (*reload)(void *ctx);
+    void *reload_ctx;
+
+    volatile enum transfer_state state;
+    uint8_t controller;
+    DmaTransfer *next;
+#if DMA_PROFILING
+    uint32_t queued_at;
+#endif
+
+    DmaTransfer();
+};
+
+void dma_driver_init(void);
+
+/*
+ * Starts the transfer on a free stream for its line, or queues it until one
+ * is released. Queued transfers are started highest priority first.
+ */
+int dma_submit(DmaTransfer &xfer);
+/* Stops an active or queued transfer and releases its stream */
+int dma_cancel(DmaTransfer &xfer);
+bool dma_busy(const DmaTransfer &xfer);
+/* True for lines that move data from a peripheral into memory */
+bool dma_line_is_p2m(const DmaLine line);
+
+/* Controller a transfer is running on, for reading its stream's registers */
+volatile DmaPeriph *dma_controller(const DmaTransfer &xfer);
+
+#if DMA_PROFILING
+/*
+ * A transfer is counted each time a stream reaches transfer complete, so
+ * every lap of a circular transfer and every piece of a chain counts. Active
+ * time runs from starting the stream until it completes, fails or is
+ * cancelled. Queue wait is how long a transfer waited for a free stream.
+ */
+struct DmaStreamStats {
+    uint32_t transfers;
+    uint32_t bytes;
+    uint64_t active_cycles;
+    uint32_t max_queue_wait_cycles;
+    uint32_t transfer_errors;
+    uint32_t direct_mode_errors;
+    uint32_t fifo_errors;
+};
+
+/* Copies out one stream's counters, returns -1 if there's no such stream */
+int dma_get_stream_stats(const uint8_t controller, const uint8_t stream, DmaStreamStats &stats);
+void dma_reset_stats(void);
+/* Writes a line per stream that has been used to the USART */
+void dma_dump_stats(usart_t usart);
+#endif
+
+/* Called from the DMA interrupt with a buffer that has just been filled */
+typedef void (*DmaBufferFilled)(void *ctx, void *buf, uint32_t len);
+
+/*
+ * Continuous capture from a peripheral into two buffers. The stream runs in
+ * double buffer mode and swaps between them in hardware, so there is no CPU
+ * work per sample and the data is read where the DMA wrote it.
+ *
+ * filled() is handed each buffer as it completes, while the DMA carries on
+ * with the other one. The buffer has to be given back with
+ * dma_capture_release before the DMA comes round to it again, one buffer's
+ * worth of samples later. If it hasn't been, the samples still get written
+ * and the capture counts an overrun.
+ */
+struct DmaCapture {
+    DmaTransfer xfer;
+    void *bufs[2];
+    uint32_t len;
+    DmaBufferFilled filled;
+    void *ctx;
+
+    volatile uint8_t held;          // Bit per buffer owned by the consumer
+    volatile uint32_t buffers;
+    volatile uint32_t overruns;
+};
+
+/*
+ * line has to be a peripheral to memory one, or this returns -1. len is the
+ * size of each buffer in bytes, size the width of each sample.
+ */
+int dma_capture_start(DmaCapture &cap, const DmaLine line, const volatile void *periph,
+        void *buf0, void *buf1, const uint32_t len, const enum DmaRequest::transfer_size size,
+        DmaBufferFilled filled, void *ctx);
+void dma_capture_release(DmaCapture &cap, const void *buf);
+int dma_capture_stop(DmaCapture &cap);
+
+/* One piece of a scatter-gather transfer */
+struct DmaIovec {
+    const void *base;
+    uint32_t len;
+};
+
+/*
+ * Sends (or receives) a list of separate buffers as one transfer, without
+ * copying them together. The stream is kept for the whole chain and
+ * reprogrammed from its transfer complete interrupt for each piece, so the
+ * gap between pieces is one interrupt's worth of latency. Raising the
+ * stream's interrupt priority in the NVIC tightens it further.
+ *
+ * Before submitting, set xfer.line and the peripheral side of xfer.req
+ * (periph, transfer sizes, priority). xfer.req.xfer_complete is called once,
+ * after the last piece. The iovec array has to stay alive until then.
+ */
+struct DmaChain {
+    DmaTransfer xfer;
+    const DmaIovec *iov;
+    uint32_t iov_count;
+    uint32_t iov_index;
+};
+
+int dma_chain_submit(DmaChain &chain, const DmaIovec *iov, const uint32_t iov_count);
+
+/*
+ * Bulk copies and fills at or above this many bytes go to DMA2, which is the
+ * only controller that can do memory to memory. Anything smaller is done on
+ * the CPU, where it's over before a stream could be set up, as is anything
+ * touching memory the DMA can't reach (the F4's CCM RAM).
+ */
+#ifndef DMA_COPY_THRESHOLD
+#define DMA_COPY_THRESHOLD 512u
+#endif
+
+/* State for one copy or fill, which may span several DMA transfers */
+struct DmaCopy {
+    DmaTransfer xfer;
+    uint8_t *dest;
+    const uint8_t *src;
+    uint32_t remaining;
+    uint32_t chunk;
+    uint32_t pattern;       // Source of a fill
+    void (*done)(void *ctx);
+    void *ctx;
+
+    Thread *volatile waiter;
+    volatile bool finished;
+    volatile bool failed;
+};
+
+/*
+ * The synchronous forms block the calling thread while the DMA runs. From an
+ * interrupt handler, with interrupts masked, or before the scheduler has
+ * started there is nothing else to run, so they copy on the CPU instead.
+ */
+void dma_memcpy(void *dest, const void *src, const size_t len);
+void dma_memset(void *dest, const uint8_t value, const size_t len);
+
+/*
+ * The asynchronous forms return as soon as the copy has started, and call
+ * done(ctx) from the DMA interrupt once it's finished. op has to stay alive
+ * until then. Copies under the threshold are done on the spot, and done is
+ * called before returning. If the DMA fails op.failed is set and the rest of
+ * the copy is left undone.
+ */
+int dma_memcpy_async(DmaCopy &op, void *dest, const void *src, const size_t len,
+        void (*done)(void *ctx), void *ctx);
+int dma_memset_async(DmaCopy &op, void *dest, const uint8_t value, const size_t len,
+        void (*done)(void *ctx), void *ctx);
+
+#endif /* _DMA_DRIVER_H */
@@ -0,0 +1,37 @@
+#include "dma_driver.h"
+#include "format.h"
+#include "usart_driver.h"
+
+#if DMA_PROFILING
+
+#define DUMP_LINE_SIZE 160u
+
+void
+dma_dump_stats(usart_t usart)
+{
+    char line[DUMP_LINE_SIZE];
+
+    for (uint8_t controller = 0; controller < DMA_NUM_CONTROLLERS; controller++) {
+        for (uint8_t stream = 0; stream < DMA_NUM_STREAMS; stream++) {
+            DmaStreamStats stats;
+            (void)dma_get_stream_stats(controller, stream, stats);
+            if ((stats.transfers == 0) && (stats.active_cycles == 0) && (stats.transfer_errors == 0)
+                    && (stats.direct_mode_errors == 0) && (stats.fifo_errors == 0)) {
+                continue;
+            }
+
+            /* 64 bit division isn't available without libgcc, so active time goes out in hex */
+            const size_t len = FORMAT_BUF(line, sizeof(line),
+                    "DMA%u S%u: xfers %u bytes %u active 0x%08x%08x max_wait %u te %u dme %u fe %u\n",
+                    controller + 1, stream, stats.transfers, stats.bytes,
+                    static_cast<uint32_t>(stats.active_cycles >> 32), static_cast<uint32_t>(stats.active_cycles),
+                    stats.max_queue_wait_cycles, stats.transfer_errors, stats.direct_mode_errors,
+                    stats.fifo_errors);
+
+            /* Far more than the TX queue holds, so wait for room rather than lose lines */
+            (void)usart_send_blocking(usart, line, len, USART_SEND_TIMEOUT_TICKS);
+        }
+    }
+}
+
+#endif
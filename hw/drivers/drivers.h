@@ -1,6 +1,10 @@
 #ifndef _DRIVERS_H
 #define _DRIVERS_H
 
+#include "clock_driver.h"
+#include "dma_driver.h"
+#include "flash_driver.h"
+#include "pwr_driver.h"
 #include "usart_driver.h"
 
 /* TODO: these chip drivers.
@@ -0,0 +1,144 @@
+#include "chip_common.h"
+#include "clock_driver.h"
+#include "dwt.h"
+#include "flash_driver.h"
+#include "irq.h"
+#include "stm32_flash.h"
+#include "sys_timer.h"
+
+/* Flash wait states needed per 30 MHz of HCLK, for a 2.7 V to 3.6 V supply */
+#define FLASH_HZ_PER_WAIT_STATE 30000000u
+
+#define FLASH_SMALL_SECTOR_SIZE (16 * 1024u)
+#define FLASH_MEDIUM_SECTOR_SIZE (64 * 1024u)
+#define FLASH_LARGE_SECTOR_SIZE (128 * 1024u)
+/* The first 128 KB sector */
+#define FLASH_FIRST_LARGE_SECTOR 5u
+
+static uint32_t
+wait_states(const uint32_t hclk_hz)
+{
+    return (hclk_hz - 1u) / FLASH_HZ_PER_WAIT_STATE;
+}
+
+/* Wait states go up before the clock does and down after it has */
+static void
+clock_changed(void *, const ClockEvent event, const ClockRates &old_rates, const ClockRates &new_rates)
+{
+    const uint32_t old_ws = wait_states(old_rates.hclk_hz);
+    const uint32_t new_ws = wait_states(new_rates.hclk_hz);
+    if ((event == ClockEvent::PRE_CHANGE) && (new_ws > old_ws)) {
+        FLASH_IF->set_latency(new_ws);
+    } else if ((event == ClockEvent::POST_CHANGE) && (new_ws < old_ws)) {
+        FLASH_IF->set_latency(new_ws);
+    }
+}
+
+static ClockNotifier clock_notifier = { clock_changed, nullptr, nullptr };
+
+void
+flash_accelerator_cmd(const bool state)
+{
+    const uint32_t primask = irq_save();
+    if (state) {
+        FLASH_IF->enable_accelerator();
+    } else {
+        FLASH_IF->disable_accelerator();
+    }
+    irq_restore(primask);
+}
+
+bool
+flash_accelerator_enabled(void)
+{
+    return FLASH_IF->accelerator_enabled();
+}
+
+uint32_t
+flash_sector_address(const uint32_t sector)
+{
+    if (sector < 4u) {
+        return FLASH_BASE + (sector * FLASH_SMALL_SECTOR_SIZE);
+    }
+    if (sector == 4u) {
+        return FLASH_BASE + (4u * FLASH_SMALL_SECTOR_SIZE);
+    }
+    return FLASH_BASE + ((sector - (FLASH_FIRST_LARGE_SECTOR - 1u)) * FLASH_LARGE_SECTOR_SIZE);
+}
+
+uint32_t
+flash_sector_size(const uint32_t sector)
+{
+    if (sector < 4u) {
+        return FLASH_SMALL_SECTOR_SIZE;
+    }
+    return (sector == 4u) ? FLASH_MEDIUM_SECTOR_SIZE : FLASH_LARGE_SECTOR_SIZE;
+}
+
+int
+flash_erase_sector(const uint32_t sector)
+{
+    if (sector >= FLASH_NUM_SECTORS) {
+        return -1;
+    }
+
+    /* Off while erasing, and back on with the caches reset */
+    const bool accelerated = flash_accelerator_enabled();
+    flash_accelerator_cmd(false);
+
+    /*
+     * The vector table is in flash, so no interrupt can be taken until the
+     * erase is done anyway. SysTick keeps counting but only one tick is
+     * left pending for afterwards, so the rest are given back here, going
+     * by the cycle counter.
+     */
+    const uint32_t primask = irq_save();
+    const uint32_t start = DWT->get_cycle_count();
+    FLASH_IF->unlock();
+    const int ret = FLASH_IF->erase_sector(sector);
+    FLASH_IF->lock();
+    const uint32_t ticks = (DWT->get_cycle_count() - start) / (clock_rates().hclk_hz / SYS_TICK_HZ);
+    if (ticks > 1u) {
+        sys_timer_catch_up(ticks - 1u);
+    }
+    irq_restore(primask);
+
+    flash_accelerator_cmd(accelerated);
+    return ret;
+}
+
+int
+flash_program(const uint32_t addr, const void *const data, const uint32_t len)
+{
+    if (((addr & 0x3) != 0) || ((len & 0x3) != 0)) {
+        return -1;
+    }
+
+    const uint8_t *const bytes = static_cast<const uint8_t *>(data);
+    int ret = 0;
+    FLASH_IF->unlock();
+    for (uint32_t i = 0; (i < len) && (ret == 0); i += sizeof(uint32_t)) {
+        /* Byte reads, data isn't guaranteed to be aligned */
+        const uint32_t word = static_cast<uint32_t>(bytes[i])
+            | (static_cast<uint32_t>(bytes[i + 1]) << 8)
+            | (static_cast<uint32_t>(bytes[i + 2]) << 16)
+            | (static_cast<uint32_t>(bytes[i + 3]) << 24);
+        ret = FLASH_IF->program_word(addr + i, word);
+    }
+    FLASH_IF->lock();
+
+    /* Programming can leave stale lines behind in the data cache too */
+    if (flash_accelerator_enabled()) {
+        flash_accelerator_cmd(true);
+    }
+    return ret;
+}
+
+void
+flash_driver_init(void)
+{
+    /* Whatever the clock is now, the latency has to be right for it before the notifier takes over */
+    FLASH_IF->set_latency(wait_states(clock_rates().hclk_hz));
+    clock_register_notifier(clock_notifier);
+    flash_accelerator_cmd(true);
+}
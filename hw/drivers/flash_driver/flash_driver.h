@@ -0,0 +1,39 @@
+#ifndef _FLASH_DRIVER_H
+#define _FLASH_DRIVER_H
+
+#include <cstdint>
+
+/*
+ * Keeps the flash interface set up for whatever the clock is doing. Wait
+ * states follow HCLK through a clock notifier, raised before the clock
+ * goes up and lowered after it has come down, and prefetch and the caches
+ * stay on throughout.
+ *
+ * Has to be called before clock_driver_init, so the notifier sees the
+ * first move off the HSI.
+ */
+void flash_driver_init(void);
+
+/*
+ * Turns prefetch and the caches on or off, e.g. to compare the two or
+ * while writing the flash. The wait states are left alone either way.
+ */
+void flash_accelerator_cmd(const bool state);
+bool flash_accelerator_enabled(void);
+
+/* Where each sector of the internal flash is, and how big it is */
+uint32_t flash_sector_address(const uint32_t sector);
+uint32_t flash_sector_size(const uint32_t sector);
+
+/*
+ * Erases a sector or programs whole words into erased flash. addr and len
+ * have to be word aligned, data doesn't. The caches are flushed after an
+ * erase so nothing stale is read back. These stall the core until the
+ * flash is done, up to a couple of seconds for a 128 KB erase, and the
+ * system ticks missed during an erase are made up afterwards. Both return
+ * 0, or -1 if the flash reported an error.
+ */
+int flash_erase_sector(const uint32_t sector);
+int flash_program(const uint32_t addr, const void *const data, const uint32_t len);
+
+#endif /* _FLASH_DRIVER_H */
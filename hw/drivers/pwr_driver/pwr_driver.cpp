@@ -0,0 +1,539 @@
+#include "clock_driver.h"
+#include "cpu.h"
+#include "dwt.h"
+#include "format.h"
+#include "irq.h"
+#include "nvic.h"
+#include "pwr_driver.h"
+#include "stm32_exti.h"
+#include "stm32_pwr.h"
+#include "stm32_rtc.h"
+#include "sys_ctl_block.h"
+#include "sys_timer.h"
+#include "usart_driver.h"
+#include "work_queue.h"
+
+/* Strong version of the weak handler in startup.h */
+#define IRQ_HANDLER void __attribute__((interrupt("IRQ")))
+
+#define BUS_BITS 32u
+#define DUMP_LINE_SIZE 160u
+
+#define RTC_WAKEUP_EXTI_LINE 22u
+
+/* The wakeup timer counts the 32.768 kHz LSE / 2 */
+#define WAKEUP_TIMER_HZ 16384u
+#define WAKEUP_TIMER_MAX_COUNT 65536u
+
+/* Stop mode isn't worth going into for less than this, plain sleep wakes up for free */
+#ifndef PWR_STOP_MIN_TICKS
+#define PWR_STOP_MIN_TICKS 2u
+#endif
+
+/* As long as the wakeup timer can count */
+#define PWR_STOP_MAX_TICKS ((WAKEUP_TIMER_MAX_COUNT * SYS_TICK_HZ) / WAKEUP_TIMER_HZ)
+
+/*
+ * Time the chip takes to come out of Stop with the low power regulator
+ * before any code runs, which the cycle counter can't see. The datasheet's
+ * worst case with some margin.
+ */
+#define PWR_STOP_HW_WAKEUP_US 200u
+
+/* Assumed until a wakeup has been measured */
+#define PWR_STOP_INITIAL_WAKEUP_US 2000u
+
+/* Dropping to the LOW clock costs two PLL relocks, so it's only done for idles at least this long */
+#ifndef PWR_LOW_CLOCK_MIN_TICKS
+#define PWR_LOW_CLOCK_MIN_TICKS 4u
+#endif
+
+/*
+ * Flash and SRAM only have low power enables. They're left on in sleep so a
+ * DMA transfer can keep running while the core waits for its interrupt.
+ */
+#define AHB1_LP_ALWAYS_ON (RccPeriph::FLITF | RccPeriph::SRAM1 | RccPeriph::SRAM2)
+
+/* How many holders each clock has, and how many of those need it in sleep */
+struct BusClockCounts {
+    uint8_t held[BUS_BITS];
+    uint8_t in_sleep[BUS_BITS];
+};
+
+static BusClockCounts counts[RccPeriph::NUM_BUSES];
+/* Total of all the in_sleep counts. Stop mode turns every clock off, so it's only used when this is 0 */
+static uint32_t sleep_holds;
+
+/* Set once the RTC is running from the LSE, and so can wake the chip up */
+static bool stop_available;
+static PwrStopStats stop_stats;
+/* Time slept that didn't add up to a whole tick, carried over to the next stop */
+static uint32_t leftover_us;
+
+/*
+ * Changing the clock waits for the USARTs to drain, which can't be done
+ * from the idle thread with interrupts masked, so pwr_idle hands the NORMAL
+ * request over to work items. Set while the request is released for idle.
+ */
+static bool idle_clock_low;
+static PwrIdleClockStats idle_clock_stats;
+
+static void clock_drop(void *arg);
+static void clock_restore(void *arg);
+static WorkItem clock_drop_work(clock_drop, nullptr, WorkPriority::Low);
+/* High so the clock is back up before any ordinary thread runs */
+static WorkItem clock_restore_work(clock_restore, nullptr, WorkPriority::High);
+
+struct ClockName {
+    uint32_t periph;
+    const char *name;
+};
+
+static const ClockName ahb1_names[] = {
+    { RccPeriph::GPIOA, "GPIOA" }, { RccPeriph::GPIOB, "GPIOB" }, { RccPeriph::GPIOC, "GPIOC" },
+    { RccPeriph::GPIOD, "GPIOD" }, { RccPeriph::GPIOE, "GPIOE" }, { RccPeriph::GPIOF, "GPIOF" },
+    { RccPeriph::GPIOG, "GPIOG" }, { RccPeriph::GPIOH, "GPIOH" }, { RccPeriph::GPIOI, "GPIOI" },
+    { RccPeriph::CRC, "CRC" }, { RccPeriph::FLITF, "FLITF" }, { RccPeriph::SRAM1, "SRAM1" },
+    { RccPeriph::SRAM2, "SRAM2" }, { RccPeriph::BKPSRAM, "BKPSRAM" }, { RccPeriph::DMA1, "DMA1" },
+    { RccPeriph::DMA2, "DMA2" }, { RccPeriph::ETHMAC, "ETHMAC" }, { RccPeriph::ETHRX, "ETHRX" },
+    { RccPeriph::ETHPTP, "ETHPTP" }, { RccPeriph::OTGHS, "OTGHS" }, { RccPeriph::OTGHSULPI, "OTGHSULPI" },
+};
+
+static const ClockName ahb2_names[] = {
+    { RccPeriph::DCMI, "DCMI" }, { RccPeriph::CRYP, "CRYP" }, { RccPeriph::HASH, "HASH" },
+    { RccPeriph::RNG, "RNG" }, { RccPeriph::OTGFS, "OTGFS" },
+};
+
+static const ClockName ahb3_names[] = {
+    { RccPeriph::FSMC, "FSMC" },
+};
+
+static const ClockName apb1_names[] = {
+    { RccPeriph::TIM2, "TIM2" }, { RccPeriph::TIM3, "TIM3" }, { RccPeriph::TIM4, "TIM4" },
+    { RccPeriph::TIM5, "TIM5" }, { RccPeriph::TIM6, "TIM6" }, { RccPeriph::TIM7, "TIM7" },
+    { RccPeriph::TIM12, "TIM12" }, { RccPeriph::TIM13, "TIM13" }, { RccPeriph::TIM14, "TIM14" },
+    { RccPeriph::WWDG, "WWDG" }, { RccPeriph::SPI2, "SPI2" }, { RccPeriph::SPI3, "SPI3" },
+    { RccPeriph::USART2, "USART2" }, { RccPeriph::USART3, "USART3" }, { RccPeriph::UART4, "UART4" },
+    { RccPeriph::UART5, "UART5" }, { RccPeriph::I2C1, "I2C1" }, { RccPeriph::I2C2, "I2C2" },
+    { RccPeriph::I2C3, "I2C3" }, { RccPeriph::CAN1, "CAN1" }, { RccPeriph::CAN2, "CAN2" },
+    { RccPeriph::PWR, "PWR" }, { RccPeriph::DAC, "DAC" },
+};
+
+static const ClockName apb2_names[] = {
+    { RccPeriph::TIM1, "TIM1" }, { RccPeriph::TIM8, "TIM8" }, { RccPeriph::USART1, "USART1" },
+    { RccPeriph::USART6, "USART6" }, { RccPeriph::ADC, "ADC" }, { RccPeriph::SDIO, "SDIO" },
+    { RccPeriph::SPI1, "SPI1" }, { RccPeriph::SYSCFG, "SYSCFG" }, { RccPeriph::TIM9, "TIM9" },
+    { RccPeriph::TIM10, "TIM10" }, { RccPeriph::TIM11, "TIM11" },
+};
+
+struct BusNames {
+    const char *bus;
+    const ClockName *names;
+    uint32_t count;
+};
+
+#define BUS_NAMES(_bus, _names) { _bus, _names, sizeof(_names) / sizeof(_names[0]) }
+
+static const BusNames bus_names[RccPeriph::NUM_BUSES] = {
+    BUS_NAMES("AHB1", ahb1_names),
+    BUS_NAMES("AHB2", ahb2_names),
+    BUS_NAMES("AHB3", ahb3_names),
+    BUS_NAMES("APB1", apb1_names),
+    BUS_NAMES("APB2", apb2_names),
+};
+
+static void
+periph_cmd(const enum RccPeriph::bus bus, const uint32_t periph, const bool state)
+{
+    switch (bus) {
+    case RccPeriph::BUS_AHB1: RCC->AHB1_periph_cmd(static_cast<enum RccPeriph::AHB1_periphs>(periph), state); break;
+    case RccPeriph::BUS_AHB2: RCC->AHB2_periph_cmd(static_cast<enum RccPeriph::AHB2_periphs>(periph), state); break;
+    case RccPeriph::BUS_AHB3: RCC->AHB3_periph_cmd(static_cast<enum RccPeriph::AHB3_periphs>(periph), state); break;
+    case RccPeriph::BUS_APB1: RCC->APB1_periph_cmd(static_cast<enum RccPeriph::APB1_periphs>(periph), state); break;
+    case RccPeriph::BUS_APB2: RCC->APB2_periph_cmd(static_cast<enum RccPeriph::APB2_periphs>(periph), state); break;
+    default: break;
+    }
+
+    /* A peripheral can't be accessed for a couple of cycles after its clock is turned on, reading back covers that */
+    (void)RCC->get_enabled(bus);
+}
+
+static void
+LP_periph_cmd(const enum RccPeriph::bus bus, const uint32_t periph, const bool state)
+{
+    switch (bus) {
+    case RccPeriph::BUS_AHB1: RCC->AHB1_LP_periph_cmd(static_cast<enum RccPeriph::AHB1_periphs>(periph), state); break;
+    case RccPeriph::BUS_AHB2: RCC->AHB2_LP_periph_cmd(static_cast<enum RccPeriph::AHB2_periphs>(periph), state); break;
+    case RccPeriph::BUS_AHB3: RCC->AHB3_LP_periph_cmd(static_cast<enum RccPeriph::AHB3_periphs>(periph), state); break;
+    case RccPeriph::BUS_APB1: RCC->APB1_LP_periph_cmd(static_cast<enum RccPeriph::APB1_periphs>(periph), state); break;
+    case RccPeriph::BUS_APB2: RCC->APB2_LP_periph_cmd(static_cast<enum RccPeriph::APB2_periphs>(periph), state); break;
+    default: break;
+    }
+}
+
+static int
+acquire(const enum RccPeriph::bus bus, const uint32_t periph, const bool in_sleep)
+{
+    const uint32_t bit = __builtin_ctz(periph);
+    BusClockCounts &c = counts[bus];
+
+    const uint32_t primask = irq_save();
+    if (c.held[bit]++ == 0) {
+        periph_cmd(bus, periph, true);
+    }
+    if (in_sleep) {
+        sleep_holds++;
+        if (c.in_sleep[bit]++ == 0) {
+            LP_periph_cmd(bus, periph, true);
+        }
+    }
+    irq_restore(primask);
+
+    return 0;
+}
+
+static int
+release(const enum RccPeriph::bus bus, const uint32_t periph, const bool in_sleep)
+{
+    const uint32_t bit = __builtin_ctz(periph);
+    BusClockCounts &c = counts[bus];
+
+    const uint32_t primask = irq_save();
+    if ((c.held[bit] == 0) || (in_sleep && (c.in_sleep[bit] == 0))) {
+        irq_restore(primask);
+        return -1;
+    }
+
+    if (in_sleep) {
+        sleep_holds--;
+        if (--c.in_sleep[bit] == 0) {
+            LP_periph_cmd(bus, periph, false);
+        }
+    }
+    if (--c.held[bit] == 0) {
+        periph_cmd(bus, periph, false);
+    }
+    irq_restore(primask);
+
+    return 0;
+}
+
+int
+pwr_clock_acquire(const enum RccPeriph::AHB1_periphs periph, const bool in_sleep)
+{
+    return acquire(RccPeriph::BUS_AHB1, periph, in_sleep);
+}
+
+int
+pwr_clock_acquire(const enum RccPeriph::AHB2_periphs periph, const bool in_sleep)
+{
+    return acquire(RccPeriph::BUS_AHB2, periph, in_sleep);
+}
+
+int
+pwr_clock_acquire(const enum RccPeriph::AHB3_periphs periph, const bool in_sleep)
+{
+    return acquire(RccPeriph::BUS_AHB3, periph, in_sleep);
+}
+
+int
+pwr_clock_acquire(const enum RccPeriph::APB1_periphs periph, const bool in_sleep)
+{
+    return acquire(RccPeriph::BUS_APB1, periph, in_sleep);
+}
+
+int
+pwr_clock_acquire(const enum RccPeriph::APB2_periphs periph, const bool in_sleep)
+{
+    return acquire(RccPeriph::BUS_APB2, periph, in_sleep);
+}
+
+int
+pwr_clock_release(const enum RccPeriph::AHB1_periphs periph, const bool in_sleep)
+{
+    return release(RccPeriph::BUS_AHB1, periph, in_sleep);
+}
+
+int
+pwr_clock_release(const enum RccPeriph::AHB2_periphs periph, const bool in_sleep)
+{
+    return release(RccPeriph::BUS_AHB2, periph, in_sleep);
+}
+
+int
+pwr_clock_release(const enum RccPeriph::AHB3_periphs periph, const bool in_sleep)
+{
+    return release(RccPeriph::BUS_AHB3, periph, in_sleep);
+}
+
+int
+pwr_clock_release(const enum RccPeriph::APB1_periphs periph, const bool in_sleep)
+{
+    return release(RccPeriph::BUS_APB1, periph, in_sleep);
+}
+
+int
+pwr_clock_release(const enum RccPeriph::APB2_periphs periph, const bool in_sleep)
+{
+    return release(RccPeriph::BUS_APB2, periph, in_sleep);
+}
+
+uint32_t
+pwr_clocks_on(const enum RccPeriph::bus bus)
+{
+    return RCC->get_enabled(bus);
+}
+
+uint32_t
+pwr_clocks_on_in_sleep(const enum RccPeriph::bus bus)
+{
+    return RCC->get_LP_enabled(bus);
+}
+
+static const char *
+clock_name(const BusNames &names, const uint32_t periph)
+{
+    for (uint32_t i = 0; i < names.count; i++) {
+        if (names.names[i].periph == periph) {
+            return names.names[i].name;
+        }
+    }
+    return nullptr;
+}
+
+void
+pwr_dump_clocks(usart_t usart)
+{
+    char line[DUMP_LINE_SIZE];
+
+    for (uint32_t bus = 0; bus < RccPeriph::NUM_BUSES; bus++) {
+        const uint32_t on = pwr_clocks_on(static_cast<enum RccPeriph::bus>(bus));
+        const uint32_t on_in_sleep = pwr_clocks_on_in_sleep(static_cast<enum RccPeriph::bus>(bus));
+        size_t len = FORMAT_BUF(line, sizeof(line), "%s:", bus_names[bus].bus);
+
+        for (uint32_t bit = 0; bit < BUS_BITS; bit++) {
+            const uint32_t periph = 1u << bit;
+            if ((on & periph) == 0) {
+                continue;
+            }
+            const char *const name = clock_name(bus_names[bus], periph);
+            const char *const sleep_mark = ((on_in_sleep & periph) != 0) ? "*" : "";
+            if (name != nullptr) {
+                len += FORMAT_BUF(line + len, sizeof(line) - len, " %s%s", name, sleep_mark);
+            } else {
+                len += FORMAT_BUF(line + len, sizeof(line) - len, " bit%u%s", bit, sleep_mark);
+            }
+        }
+        len += FORMAT_BUF(line + len, sizeof(line) - len, "\n");
+
+        (void)usart_send_string(usart, line, len);
+    }
+}
+
+/* Worst wakeup seen so far, or a guess until there has been one */
+static uint32_t
+stop_wakeup_us(void)
+{
+    return (stop_stats.stops != 0) ? stop_stats.worst_wakeup_us : PWR_STOP_INITIAL_WAKEUP_US;
+}
+
+/*
+ * How many ticks to set the wakeup timer for, 0 if Stop isn't worth it.
+ * The tick that's due is somewhere in the next ticks_left ticks, the
+ * current one being partly gone already, so the wakeup is set for enough
+ * whole ticks before it to be running again by then.
+ */
+static uint32_t
+stop_ticks(const uint32_t ticks_left)
+{
+    if (!stop_available || (sleep_holds != 0)) {
+        return 0;
+    }
+
+    uint32_t ticks = PWR_STOP_MAX_TICKS;
+    if (ticks_left != CPU_NO_DEADLINE) {
+        const uint32_t wakeup_ticks = 1u + ((stop_wakeup_us() + SYS_TICK_US - 1u) / SYS_TICK_US);
+        if (ticks_left <= wakeup_ticks) {
+            return 0;
+        }
+        if ((ticks_left - wakeup_ticks) < ticks) {
+            ticks = ticks_left - wakeup_ticks;
+        }
+    }
+    return (ticks >= PWR_STOP_MIN_TICKS) ? ticks : 0;
+}
+
+/*
+ * SysTick stops along with everything else, so the time spent in Stop is
+ * given back to it afterwards. That's the wakeup timer's time plus however
+ * long waking took. Anything else that wakes the chip (an EXTI line) leaves
+ * the time slept unknown, so nothing is given back and timeouts run late by
+ * up to the time slept.
+ */
+static void
+stop(const uint32_t ticks)
+{
+    const uint32_t count = (ticks * WAKEUP_TIMER_HZ) / SYS_TICK_HZ;
+    if (RTC->start_wakeup_timer(count) < 0) {
+        wait_for_interrupt();
+        return;
+    }
+
+    PWR->configure_stop(true, false);
+    SYS_CTL->set_sleep_deep(true);
+    wait_for_interrupt();
+    SYS_CTL->set_sleep_deep(false);
+
+    /* Back on the HSI with the PLL off */
+    const uint32_t woke = DWT->get_cycle_count();
+    clock_resume();
+    const bool timer_woke = RTC->wakeup_timer_fired();
+    RTC->stop_wakeup_timer();
+    (void)EXTI->clear_pending(RTC_WAKEUP_EXTI_LINE);
+    NVIC->clearPending(Nvic::InterruptNumber::RTC_WKUP);
+
+    /* Counted as if it was all at the HSI's rate, which can only overestimate */
+    const uint32_t hsi_mhz = clock_op_rates(ClockOp::LOW).hclk_hz / 1000000u;
+    const uint32_t wakeup_us = PWR_STOP_HW_WAKEUP_US + ((DWT->get_cycle_count() - woke) / hsi_mhz);
+
+    stop_stats.stops++;
+    stop_stats.last_wakeup_us = wakeup_us;
+    if (wakeup_us > stop_stats.worst_wakeup_us) {
+        stop_stats.worst_wakeup_us = wakeup_us;
+    }
+
+    if (!timer_woke) {
+        stop_stats.early_wakes++;
+        return;
+    }
+
+    /* 1000000 / 16384 = 15625 / 256 */
+    const uint32_t slept_us = ((count * 15625u) / 256u) + wakeup_us + leftover_us;
+    leftover_us = slept_us % SYS_TICK_US;
+    stop_stats.ticks_stopped += slept_us / SYS_TICK_US;
+    sys_timer_catch_up(slept_us / SYS_TICK_US);
+}
+
+static void
+clock_drop(void *)
+{
+    if (!idle_clock_low && (clock_release(ClockOp::NORMAL) == 0)) {
+        idle_clock_low = true;
+        idle_clock_stats.drops++;
+    }
+}
+
+static void
+clock_restore(void *)
+{
+    if (idle_clock_low && (clock_request(ClockOp::NORMAL) == 0)) {
+        idle_clock_low = false;
+        idle_clock_stats.restores++;
+    }
+}
+
+/* Interrupts must be masked */
+static void
+restore_clock(void)
+{
+    if (idle_clock_low && !clock_restore_work.pending) {
+        (void)work_submit(clock_restore_work);
+    }
+}
+
+void
+pwr_idle(const uint32_t ticks_left)
+{
+    /*
+     * Back here once the worker is done either way. Plain wakeups (e.g. a
+     * tick with nothing due) leave the clock where it is, so it only moves
+     * when there's work or a deadline coming up.
+     */
+    if (idle_clock_low) {
+        if (ticks_left < PWR_LOW_CLOCK_MIN_TICKS) {
+            restore_clock();
+            return;
+        }
+    } else if ((clock_op() == ClockOp::NORMAL) && (ticks_left >= PWR_LOW_CLOCK_MIN_TICKS)) {
+        if (!clock_drop_work.pending) {
+            (void)work_submit(clock_drop_work);
+        }
+        return;
+    }
+
+    const uint32_t ticks = stop_ticks(ticks_left);
+    if (ticks == 0) {
+        wait_for_interrupt();
+    } else {
+        stop(ticks);
+    }
+}
+
+void
+pwr_idle_wake(void)
+{
+    const uint32_t primask = irq_save();
+    restore_clock();
+    irq_restore(primask);
+}
+
+void
+pwr_get_stop_stats(PwrStopStats &stats)
+{
+    const uint32_t primask = irq_save();
+    stats = stop_stats;
+    irq_restore(primask);
+}
+
+void
+pwr_get_idle_clock_stats(PwrIdleClockStats &stats)
+{
+    const uint32_t primask = irq_save();
+    stats = idle_clock_stats;
+    irq_restore(primask);
+}
+
+/* Only there to wake the chip up, pwr_idle deals with the rest */
+IRQ_HANDLER RTC_WKUP_IRQHandler(void)
+{
+    RTC->clear_wakeup_timer_flag();
+    (void)EXTI->clear_pending(RTC_WAKEUP_EXTI_LINE);
+}
+
+/*
+ * Stop mode needs the RTC to wake it up, which needs the LSE. The PWR
+ * clock is only needed to write PWR's registers, so it isn't kept in sleep.
+ */
+static void
+stop_init(void)
+{
+    (void)pwr_clock_acquire(RccPeriph::PWR, false);
+
+    PWR->disable_bd_write_protection();
+    const int ret = RCC->start_rtc_clock();
+    PWR->enable_bd_write_protection();
+    if (ret < 0) {
+        return;
+    }
+
+    (void)EXTI->set_rising_trigger(RTC_WAKEUP_EXTI_LINE);
+    (void)EXTI->unmask_interrupt(RTC_WAKEUP_EXTI_LINE);
+    NVIC->enableInterrupt(Nvic::InterruptNumber::RTC_WKUP);
+    stop_available = true;
+}
+
+void
+pwr_driver_init(void)
+{
+    for (uint32_t bus = 0; bus < RccPeriph::NUM_BUSES; bus++) {
+        uint32_t keep = (bus == RccPeriph::BUS_AHB1) ? AHB1_LP_ALWAYS_ON : 0;
+        for (uint32_t bit = 0; bit < BUS_BITS; bit++) {
+            if (counts[bus].in_sleep[bit] != 0) {
+                keep |= 1u << bit;
+            }
+        }
+        RCC->set_LP_enabled(static_cast<enum RccPeriph::bus>(bus), keep);
+    }
+
+    stop_init();
+}
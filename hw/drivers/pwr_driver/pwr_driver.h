@@ -0,0 +1,84 @@
+#ifndef _PWR_DRIVER_H
+#define _PWR_DRIVER_H
+
+#include "stm32_rcc.h"
+#include "stm32_usart.h"
+
+/*
+ * Peripheral clocks are reference counted: the first acquire turns a clock
+ * on and the last release turns it off again, so drivers only hold the
+ * clocks of peripherals they're actually using.
+ *
+ * The low power enables, which decide whether a clock keeps running while
+ * the core sleeps, follow the same counts. in_sleep says whether the
+ * caller needs the peripheral to keep working during sleep (e.g. a DMA
+ * stream that runs while the idle thread waits for its interrupt). A clock
+ * is kept on in sleep while anybody holding it asked for that. Releases
+ * have to pass the same in_sleep as their acquire.
+ *
+ * All of these can be called from interrupts. They return -1 when
+ * releasing a clock that isn't held.
+ */
+int pwr_clock_acquire(const enum RccPeriph::AHB1_periphs periph, const bool in_sleep = true);
+int pwr_clock_acquire(const enum RccPeriph::AHB2_periphs periph, const bool in_sleep = true);
+int pwr_clock_acquire(const enum RccPeriph::AHB3_periphs periph, const bool in_sleep = true);
+int pwr_clock_acquire(const enum RccPeriph::APB1_periphs periph, const bool in_sleep = true);
+int pwr_clock_acquire(const enum RccPeriph::APB2_periphs periph, const bool in_sleep = true);
+
+int pwr_clock_release(const enum RccPeriph::AHB1_periphs periph, const bool in_sleep = true);
+int pwr_clock_release(const enum RccPeriph::AHB2_periphs periph, const bool in_sleep = true);
+int pwr_clock_release(const enum RccPeriph::AHB3_periphs periph, const bool in_sleep = true);
+int pwr_clock_release(const enum RccPeriph::APB1_periphs periph, const bool in_sleep = true);
+int pwr_clock_release(const enum RccPeriph::APB2_periphs periph, const bool in_sleep = true);
+
+/* Clocks that are on (or on in sleep) on a bus right now, as read back from the RCC */
+uint32_t pwr_clocks_on(const enum RccPeriph::bus bus);
+uint32_t pwr_clocks_on_in_sleep(const enum RccPeriph::bus bus);
+
+/* Writes a line per bus listing the clocks that are on, marking the ones that stay on in sleep with a * */
+void pwr_dump_clocks(usart_t usart);
+
+struct PwrStopStats {
+    uint32_t stops;             // Times Stop mode was entered
+    uint32_t early_wakes;       // Stops ended by something other than the wakeup timer
+    uint32_t ticks_stopped;     // System ticks given back after stops
+    uint32_t last_wakeup_us;    // Time from the wakeup to running at full speed again
+    uint32_t worst_wakeup_us;
+};
+
+struct PwrIdleClockStats {
+    uint32_t drops;             // Times the NORMAL request was released for idle
+    uint32_t restores;          // Times it was taken back
+};
+
+/*
+ * The idle policy. Called from the idle thread with interrupts masked,
+ * ticks_left being how long until something is due (CPU_NO_DEADLINE if
+ * nothing is). Waits for an interrupt in plain sleep, or in Stop mode when
+ * nothing holds a clock in sleep and there's enough time before the
+ * deadline to wake up again, going by the slowest wakeup measured so far.
+ * Stop wakes up on the RTC's wakeup timer, with the clocks put back as
+ * they were and the ticks missed given back to the system timer.
+ *
+ * Before a long enough idle at the NORMAL operating point, the kernel's
+ * NORMAL clock request is released on the Low work queue, so the core
+ * sleeps at LOW. It's taken again from the High work queue, ahead of
+ * ordinary threads, once a thread is made ready while idle (pwr_idle_wake)
+ * or the deadline gets closer than PWR_LOW_CLOCK_MIN_TICKS. Wakeups with
+ * nothing to do leave the clock at LOW. A thread that becomes ready while
+ * the clock is dropping runs at LOW until one of those happens.
+ */
+void pwr_idle(const uint32_t ticks_left);
+/* Called when a thread is made ready while the CPU idles, from interrupts too */
+void pwr_idle_wake(void);
+void pwr_get_stop_stats(PwrStopStats &stats);
+void pwr_get_idle_clock_stats(PwrIdleClockStats &stats);
+
+/*
+ * Turns off the low power enables of everything that isn't held, and
+ * starts the RTC from the LSE so Stop mode can be used. Without the LSE
+ * (e.g. no crystal) idle only ever uses plain sleep.
+ */
+void pwr_driver_init(void);
+
+#endif /* _PWR_DRIVER_H */
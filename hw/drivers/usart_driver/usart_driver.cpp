@@ -1,53 +1,721 @@
+#include "clock_driver.h"
+#include "cpu.h"
+#include "dwt.h"
+#include "irq.h"
+#include "nvic.h"
+#include "pwr_driver.h"
+#include "scheduler.h"
+#include "sys_timer.h"
+#include "trace.h"
 #include "usart_driver.h"
+#include "wait_set.h"
+#include "work_queue.h"
+
+#define NUM_USARTS 6u
+#define USART_TX_QUEUE_MASK (USART_TX_QUEUE_SIZE - 1u)
+#define USART_RX_BUFFER_MASK (USART_RX_BUFFER_SIZE - 1u)
+#define USART_RX_HALF (USART_RX_BUFFER_SIZE / 2u)
+
+/* Times in a row a transfer can fail to start before the queued bytes are dropped */
+#define USART_TX_KICK_RETRIES 3u
+
+/* Strong versions of the weak handlers in startup.h */
+#define IRQ_HANDLER void __attribute__((interrupt("IRQ")))
+
+static_assert((USART_TX_QUEUE_SIZE & USART_TX_QUEUE_MASK) == 0, "USART_TX_QUEUE_SIZE must be a power of 2");
+static_assert((USART_RX_BUFFER_SIZE & USART_RX_BUFFER_MASK) == 0, "USART_RX_BUFFER_SIZE must be a power of 2");
+
+static constexpr DmaConfig tx_config =
+    DmaConfig(DmaConfig::DIR_MEM_TO_PERIPH).set_priority(DmaRequest::PRIO_LOW);
+/* Bytes that aren't picked up in time are overwritten by the next ones */
+static constexpr DmaConfig rx_config =
+    DmaConfig(DmaConfig::DIR_PERIPH_TO_MEM).set_priority(DmaRequest::PRIO_HIGH).set_mode(DmaRequest::MODE_CIRC);
+typedef DmaPreset<tx_config> TxPreset;
+typedef DmaPreset<rx_config> RxPreset;
+
+/*
+ * head and tail run freely and are masked on access, so head - tail is
+ * always the number of bytes queued. in_flight of those, starting at tail,
+ * belong to the DMA transfer currently running.
+ */
+struct UsartTxQueue {
+    char buf[USART_TX_QUEUE_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    volatile uint32_t in_flight;
+    volatile uint32_t dropped;
+    uint8_t kick_failures;
+    /* Submitted when room frees up, see usart_notify_tx_space */
+    WorkItem *space_work;
+    /* From the first byte queued until the last one has left the shift register */
+    bool busy;
+    DmaTransfer xfer;
+};
+
+static usart_t usarts[NUM_USARTS] = { USART1, USART2, USART3, UART4, UART5, USART6 };
+static const uint32_t usart_clocks[NUM_USARTS] = {
+    RccPeriph::USART1, RccPeriph::USART2, RccPeriph::USART3,
+    RccPeriph::UART4, RccPeriph::UART5, RccPeriph::USART6,
+};
+static const DmaLine tx_lines[NUM_USARTS] = {
+    DmaLine::USART1_TX, DmaLine::USART2_TX, DmaLine::USART3_TX,
+    DmaLine::UART4_TX, DmaLine::UART5_TX, DmaLine::USART6_TX,
+};
+
+/*
+ * The DMA writes buf in a circle without telling anyone where it's got to,
+ * so head only moves when data is published: dma_written is how many bytes
+ * the DMA had written the last time, and anything written since is added to
+ * head. Its position only says where it is within a lap, so dma_halves
+ * counts the half and full ring interrupts to say which lap that is. head,
+ * tail and dma_written run freely like the TX queue's.
+ */
+struct UsartRxRing {
+    char buf[USART_RX_BUFFER_SIZE];
+    volatile uint32_t head;
+    volatile uint32_t tail;
+    uint32_t dma_written;
+    volatile uint32_t dma_halves;
+    volatile uint32_t overruns;
+    Thread *volatile waiter;
+    DmaTransfer xfer;
+};
+
+static UsartTxQueue tx_queues[NUM_USARTS];
+static UsartRxRing rx_rings[NUM_USARTS];
+/* 0 for ports that haven't been set up */
+static uint32_t baud_rates[NUM_USARTS];
+
+static const DmaLine rx_lines[NUM_USARTS] = {
+    DmaLine::USART1_RX, DmaLine::USART2_RX, DmaLine::USART3_RX,
+    DmaLine::UART4_RX, DmaLine::UART5_RX, DmaLine::USART6_RX,
+};
+static const Nvic::InterruptNumber usart_irqs[NUM_USARTS] = {
+    Nvic::InterruptNumber::USART1, Nvic::InterruptNumber::USART2,
+    Nvic::InterruptNumber::USART3, Nvic::InterruptNumber::UART4,
+    Nvic::InterruptNumber::UART5, Nvic::InterruptNumber::USART6,
+};
+
+static int
+usart_index(usart_t usart)
+{
+    for (uint32_t i = 0; i < NUM_USARTS; i++) {
+        if (usarts[i] == usart) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* USART1 and USART6 are on APB2, the rest on APB1 */
+static bool
+usart_on_apb2(const uint32_t index)
+{
+    return (index == 0) || (index == 5);
+}
+
+/*
+ * A port's clock is held from when it's first set up. While it's sending or
+ * receiving it's held in sleep as well, so the DMA can carry on while the
+ * core waits for an interrupt.
+ */
+static void
+usart_clock_cmd(const uint32_t index, const bool acquire, const bool in_sleep)
+{
+    if (usart_on_apb2(index)) {
+        const enum RccPeriph::APB2_periphs clock = static_cast<enum RccPeriph::APB2_periphs>(usart_clocks[index]);
+        (void)(acquire ? pwr_clock_acquire(clock, in_sleep) : pwr_clock_release(clock, in_sleep));
+    } else {
+        const enum RccPeriph::APB1_periphs clock = static_cast<enum RccPeriph::APB1_periphs>(usart_clocks[index]);
+        (void)(acquire ? pwr_clock_acquire(clock, in_sleep) : pwr_clock_release(clock, in_sleep));
+    }
+}
+
+static void tx_complete(void *ctx);
+static void tx_error(void *ctx, uint32_t flags);
+static void tx_retry(void *arg);
+
+/* Interrupts must be masked */
+static void
+tx_space_freed(UsartTxQueue &queue)
+{
+    WorkItem *const item = queue.space_work;
+    if (item != nullptr) {
+        queue.space_work = nullptr;
+        (void)work_submit(*item);
+    }
+}
+
+/*
+ * The bytes stay queued and the kick is retried from a work item, as well
+ * as by the next send. If it keeps failing they are dropped, so the queue
+ * can't stall for good and usart_flush can finish. Interrupts must be masked.
+ */
+static void
+tx_kick_failed(const uint32_t index)
+{
+    UsartTxQueue &queue = tx_queues[index];
+    queue.kick_failures++;
+    if (queue.kick_failures <= USART_TX_KICK_RETRIES) {
+        (void)work_submit_fn(WorkPriority::Low, tx_retry, &queue, WORK_COALESCE);
+        return;
+    }
+
+    queue.kick_failures = 0;
+    queue.dropped += queue.head - queue.tail;
+    queue.tail = queue.head;
+    tx_space_freed(queue);
+}
+
+/*
+ * Starts a transfer for the oldest queued bytes if the port isn't already
+ * sending. A transfer never wraps, the part after the wrap gets its own
+ * transfer once this one completes. Interrupts must be masked.
+ */
+static void
+tx_kick(const uint32_t index)
+{
+    UsartTxQueue &queue = tx_queues[index];
+    const uint32_t queued = queue.head - queue.tail;
+    if ((queue.in_flight != 0) || (queued == 0)) {
+        return;
+    }
+
+    const uint32_t start = queue.tail & USART_TX_QUEUE_MASK;
+    uint32_t len = USART_TX_QUEUE_SIZE - start;
+    if (len > queued) {
+        len = queued;
+    }
+
+    usart_t usart = usarts[index];
+    /* Stays enabled from here on, turning it off at the end would cut off the last byte */
+    usart->enable();
+    usart->enable_dma_tx();
+
+    DmaTransfer &xfer = queue.xfer;
+    xfer.req = DmaRequest();
+    TxPreset::apply(xfer.req);
+    xfer.req.mem1 = &queue.buf[start];
+    xfer.req.periph = usart->get_address_for_dma();
+    xfer.req.len = len;
+    xfer.req.xfer_complete = tx_complete;
+    xfer.req.xfer_error = tx_error;
+    xfer.req.cb_ctx = &queue;
+    xfer.line = tx_lines[index];
+
+    queue.in_flight = len;
+    usart->clear_tx_done();
+    usart->disable_tc_interrupt();
+    if (dma_submit(xfer) < 0) {
+        queue.in_flight = 0;
+        tx_kick_failed(index);
+        return;
+    }
+    queue.kick_failures = 0;
+
+    if (!queue.busy) {
+        queue.busy = true;
+        usart_clock_cmd(index, true, true);
+    }
+}
+
+/* Called from the DMA interrupt, chains the next transfer */
+static void
+tx_complete(void *const ctx)
+{
+    UsartTxQueue *const queue = static_cast<UsartTxQueue *>(ctx);
+    const uint32_t index = queue - tx_queues;
+    queue->tail += queue->in_flight;
+    queue->in_flight = 0;
+    tx_space_freed(*queue);
+    tx_kick(index);
+
+    /* The last byte is still going out, the port's interrupt says when it's done */
+    if (queue->in_flight == 0) {
+        usarts[index]->enable_tc_interrupt();
+    }
+}
+
+static void
+tx_retry(void *const arg)
+{
+    const uint32_t primask = irq_save();
+    tx_kick(static_cast<UsartTxQueue *>(arg) - tx_queues);
+    irq_restore(primask);
+}
+
+static void
+tx_error(void *const ctx, const uint32_t)
+{
+    /* Nothing useful to retry with, drop the chunk and carry on */
+    UsartTxQueue *const queue = static_cast<UsartTxQueue *>(ctx);
+    queue->dropped += queue->in_flight;
+    tx_complete(ctx);
+}
 
 int
 usart_send_byte(usart_t usart, const char byte)
 {
-    usart->enable();
+    return usart_send_string(usart, &byte, 1);
+}
 
-    usart->send(byte);
-    usart->finish_send();
+/* Queues as much of str as fits and starts sending it. Interrupts must be masked. */
+static uint32_t
+tx_enqueue(const uint32_t index, const char *const str, const uint32_t len)
+{
+    UsartTxQueue &queue = tx_queues[index];
 
-    usart->disable();
+    uint32_t count = USART_TX_QUEUE_SIZE - (queue.head - queue.tail);
+    if (count > len) {
+        count = len;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        queue.buf[(queue.head + i) & USART_TX_QUEUE_MASK] = str[i];
+    }
+    queue.head += count;
 
-    return 0;
+    tx_kick(index);
+    return count;
 }
 
 int
 usart_send_string(usart_t usart, const char *const str, const uint8_t len)
 {
-    int count = 0;
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return 0;
+    }
+
+    const uint32_t primask = irq_save();
+    const uint32_t count = tx_enqueue(index, str, len);
+    tx_queues[index].dropped += len - count;
+    irq_restore(primask);
+
+    return count;
+}
+
+int
+usart_try_send(usart_t usart, const char *const str, const uint8_t len)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
 
-    usart->enable();
+    UsartTxQueue &queue = tx_queues[index];
+    int ret = -1;
+
+    const uint32_t primask = irq_save();
+    if ((USART_TX_QUEUE_SIZE - (queue.head - queue.tail)) >= len) {
+        ret = usart_send_string(usart, str, len);
+    }
+    irq_restore(primask);
+
+    return ret;
+}
+
+/* A thread that can sleep while the queue drains, rather than spin */
+static bool
+can_sleep(const uint32_t primask)
+{
+    const Thread *const thread = scheduler_current();
+    return (primask == 0) && !irq_in_handler() && (thread != nullptr)
+           && (thread != hw_cpus[cpu_current_id()].getIdleThread());
+}
+
+int
+usart_send_blocking(usart_t usart, const char *const buf, const uint32_t len, const uint32_t timeoutTicks)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    uint32_t primask = irq_save();
+    irq_restore(primask);
+    const bool sleep = can_sleep(primask);
+    const uint32_t cycles_per_tick = clock_rates().hclk_hz / SYS_TICK_HZ;
+
+    uint32_t sent = 0;
+    uint32_t waited = 0;
+    uint32_t spin_start = DWT->get_cycle_count();
+    while (sent < len) {
+        primask = irq_save();
+        const uint32_t count = tx_enqueue(index, buf + sent, len - sent);
+        irq_restore(primask);
+
+        if (count != 0) {
+            sent += count;
+            waited = 0;
+            spin_start = DWT->get_cycle_count();
+            continue;
+        }
+
+        if (primask != 0) {
+            /* Nothing can drain the queue with interrupts masked */
+            break;
+        }
+        if (sleep) {
+            if ((timeoutTicks != WAIT_FOREVER) && (waited >= timeoutTicks)) {
+                break;
+            }
+            scheduler_sleep(1);
+            waited++;
+        } else if ((timeoutTicks != WAIT_FOREVER)
+                   && ((DWT->get_cycle_count() - spin_start) / cycles_per_tick) >= timeoutTicks) {
+            break;
+        }
+    }
+
+    return sent;
+}
+
+int
+usart_notify_tx_space(usart_t usart, WorkItem &item)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    UsartTxQueue &queue = tx_queues[index];
+    const uint32_t primask = irq_save();
+    queue.space_work = &item;
+    if (queue.head == queue.tail) {
+        tx_space_freed(queue);
+    }
+    irq_restore(primask);
+    return 0;
+}
+
+uint32_t
+usart_tx_pending(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return 0;
+    }
+    return tx_queues[index].head - tx_queues[index].tail;
+}
 
-    DmaRequest dma_req;
-    dma_req.mem1 = static_cast<const void *>(str);
-    dma_req.periph = usart->get_address_for_dma();
-    dma_req.len = len;
+uint32_t
+usart_tx_dropped(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return 0;
+    }
+    return tx_queues[index].dropped;
+}
 
-    dma_req.stream = 0;
-    dma_req.priority = DmaRequest::PRIO_LOW;
+void
+usart_flush(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return;
+    }
 
-    DMA1->mem_to_periph(dma_req);
-#if 0
-    for (int i = 0; i < len; i++) {
-        if ((unsigned char)str[i] > 0xff) {
-            return count;
+    UsartTxQueue &queue = tx_queues[index];
+    while (usart_tx_pending(usart) != 0) {
+        if (queue.in_flight == 0) {
+            /* A kick failed and nothing else will drain the queue, so retry it here */
+            const uint32_t primask = irq_save();
+            tx_kick(index);
+            irq_restore(primask);
         }
-        usart_send(usart, str[i]);
-        count++;
     }
+    usart->finish_send();
+}
+
+/* Picks up whatever the DMA has written since last time. Interrupts must be masked. */
+static void
+rx_publish(const uint32_t index)
+{
+    UsartRxRing &rx = rx_rings[index];
+    if (rx.xfer.state != DmaTransfer::STATE_ACTIVE) {
+        return;
+    }
+
+    const uint32_t remaining = dma_controller(rx.xfer)->get_remaining(rx.xfer.req.stream);
+    const uint32_t pos = (USART_RX_BUFFER_SIZE - remaining) & USART_RX_BUFFER_MASK;
+    /*
+     * The DMA is somewhere less than a lap past the last interrupt taken,
+     * even if the next one is pending, so pos only has to be placed within
+     * that lap. Falling further behind than that can't be seen at all.
+     */
+    const uint32_t interrupted = rx.dma_halves * USART_RX_HALF;
+    const uint32_t written = interrupted + ((pos - interrupted) & USART_RX_BUFFER_MASK);
+    const uint32_t added = written - rx.dma_written;
+    if (added == 0) {
+        return;
+    }
+    rx.dma_written = written;
+    rx.head += added;
+
+    const uint32_t queued = rx.head - rx.tail;
+    if (queued > USART_RX_BUFFER_SIZE) {
+        /* The DMA has gone round past the reader, the oldest bytes are gone */
+        rx.overruns += queued - USART_RX_BUFFER_SIZE;
+        rx.tail = rx.head - USART_RX_BUFFER_SIZE;
+    }
+
+    wait_set_notify(WaitSource::UsartRx, index);
+    if (rx.waiter != nullptr) {
+        scheduler_wake(*rx.waiter);
+        rx.waiter = nullptr;
+    }
+}
+
+/* Half and full ring interrupts, so a long burst is published before it laps */
+static void
+rx_dma_event(void *const ctx)
+{
+    UsartRxRing *const rx = static_cast<UsartRxRing *>(ctx);
+    rx->dma_halves++;
+    rx_publish(rx - rx_rings);
+}
+
+/* Interrupts must be masked */
+static uint32_t
+rx_copy_out(UsartRxRing &rx, char *const buf, const uint32_t len)
+{
+    uint32_t count = rx.head - rx.tail;
+    if (count > len) {
+        count = len;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        buf[i] = rx.buf[(rx.tail + i) & USART_RX_BUFFER_MASK];
+    }
+    rx.tail += count;
+    return count;
+}
+
+int
+usart_rx_start(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    UsartRxRing &rx = rx_rings[index];
+    if (dma_busy(rx.xfer)) {
+        return -1;
+    }
+    rx.head = 0;
+    rx.tail = 0;
+    rx.dma_written = 0;
+    rx.dma_halves = 0;
+    rx.overruns = 0;
+    rx.waiter = nullptr;
+
+    DmaTransfer &xfer = rx.xfer;
+    xfer.req = DmaRequest();
+    RxPreset::apply(xfer.req);
+    xfer.req.mem1 = rx.buf;
+    xfer.req.periph = usart->get_address_for_dma();
+    xfer.req.len = USART_RX_BUFFER_SIZE;
+    xfer.req.xfer_complete = rx_dma_event;
+    xfer.req.half_xfer_complete = rx_dma_event;
+    xfer.req.cb_ctx = &rx;
+    xfer.line = rx_lines[index];
+
+    usart->disable_rx_interrupt();
+    usart->enable_dma_rx();
+    usart->enable();
+    if (dma_submit(xfer) < 0) {
+        usart->disable_dma_rx();
+        return -1;
+    }
+
+    usart_clock_cmd(index, true, true);
+    usart->clear_idle();
+    usart->enable_idle_interrupt();
+    NVIC->enableInterrupt(usart_irqs[index]);
+
+    return 0;
+}
+
+int
+usart_rx_stop(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    usart->disable_idle_interrupt();
+    const int ret = dma_cancel(rx_rings[index].xfer);
+    usart->disable_dma_rx();
+    if (ret == 0) {
+        usart_clock_cmd(index, false, true);
+    }
+
+    return ret;
+}
+
+int
+usart_read(usart_t usart, char *const buf, const uint32_t len)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    const uint32_t primask = irq_save();
+    /* Don't wait for the idle line to see what has already arrived */
+    rx_publish(index);
+    const uint32_t count = rx_copy_out(rx_rings[index], buf, len);
+    irq_restore(primask);
+
+    return count;
+}
+
+int
+usart_read_timeout(usart_t usart, char *const buf, const uint32_t len, const uint32_t timeoutTicks)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return -1;
+    }
+
+    UsartRxRing &rx = rx_rings[index];
+    const uint32_t deadline = scheduler_ticks() + timeoutTicks;
 
-    usart_finish_send(usart);
-    usart_disable(usart);
-#endif
+    const uint32_t primask = irq_save();
+    rx_publish(index);
+    while (rx.head == rx.tail) {
+        uint32_t wait = WAIT_FOREVER;
+        if (timeoutTicks != WAIT_FOREVER) {
+            wait = deadline - scheduler_ticks();
+            if (static_cast<int32_t>(wait) <= 0) {
+                break;
+            }
+        }
+        rx.waiter = scheduler_current();
+        (void)scheduler_block(wait);
+        rx.waiter = nullptr;
+        rx_publish(index);
+    }
+    const uint32_t count = rx_copy_out(rx, buf, len);
+    irq_restore(primask);
 
     return count;
 }
 
+uint32_t
+usart_rx_overruns(usart_t usart)
+{
+    const int index = usart_index(usart);
+    if (index < 0) {
+        return 0;
+    }
+    return rx_rings[index].overruns;
+}
+
+/*
+ * A port receiving by DMA only interrupts for idle line. Otherwise RXNE is
+ * for wait sets: it stays set until DR is read, which is the waiting
+ * thread's job, so the interrupt turns itself off and WaitSet::wait turns it
+ * back on.
+ */
+static void
+usart_irq(const uint8_t index)
+{
+    TRACE_IRQ_ENTER();
+    usart_t usart = usarts[index];
+    if (usart->tc_interrupt_enabled() && usart->tx_done()) {
+        usart->disable_tc_interrupt();
+        UsartTxQueue &queue = tx_queues[index];
+        if (queue.busy && (queue.in_flight == 0)) {
+            queue.busy = false;
+            usart_clock_cmd(index, false, true);
+        }
+    }
+
+    if (usart->dma_rx_enabled()) {
+        if (usart->idle_detected()) {
+            usart->clear_idle();
+            rx_publish(index);
+        }
+    } else if (usart->rx_interrupt_enabled() && usart->rx_ready()) {
+        usart->disable_rx_interrupt();
+        wait_set_notify(WaitSource::UsartRx, index);
+    }
+    TRACE_IRQ_EXIT();
+}
+
+IRQ_HANDLER USART1_IRQHandler(void) { usart_irq(0); }
+IRQ_HANDLER USART2_IRQHandler(void) { usart_irq(1); }
+IRQ_HANDLER USART3_IRQHandler(void) { usart_irq(2); }
+IRQ_HANDLER UART4_IRQHandler(void)  { usart_irq(3); }
+IRQ_HANDLER UART5_IRQHandler(void)  { usart_irq(4); }
+IRQ_HANDLER USART6_IRQHandler(void) { usart_irq(5); }
+
+static uint32_t
+usart_pclk(const uint32_t index, const ClockRates &rates)
+{
+    return usart_on_apb2(index) ? rates.pclk2_hz : rates.pclk1_hz;
+}
+
+/* Interrupts must be masked */
+static void
+usart_setup(const uint32_t index, const uint32_t baud)
+{
+    usart_clock_cmd(index, true, false);
+    usarts[index]->init(usart_pclk(index, clock_rates()), baud);
+    baud_rates[index] = baud;
+    NVIC->enableInterrupt(usart_irqs[index]);
+}
+
+int
+usart_set_baud(usart_t usart, const uint32_t baud)
+{
+    const int index = usart_index(usart);
+    if ((index < 0) || (baud == 0)) {
+        return -1;
+    }
+
+    /* Whatever is queued goes out at the old rate, BRR can't change under the DMA */
+    if (baud_rates[index] != 0) {
+        usart_flush(usart);
+    }
+
+    const uint32_t primask = irq_save();
+    if (baud_rates[index] == 0) {
+        usart_setup(index, baud);
+    } else {
+        baud_rates[index] = baud;
+        usart->set_baud_rate(usart_pclk(index, clock_rates()), baud);
+    }
+    irq_restore(primask);
+    return 0;
+}
+
+static void
+usart_clock_changed(void *, const ClockEvent event, const ClockRates &, const ClockRates &new_rates)
+{
+    for (uint32_t i = 0; i < NUM_USARTS; i++) {
+        if (baud_rates[i] == 0) {
+            continue;
+        }
+        if (event == ClockEvent::PRE_CHANGE) {
+            usart_flush(usarts[i]);
+        } else {
+            usarts[i]->set_baud_rate(usart_pclk(i, new_rates), baud_rates[i]);
+        }
+    }
+}
+
+static ClockNotifier usart_notifier = { usart_clock_changed, nullptr, nullptr };
+
 void
 usart_driver_init(void)
 {
-    USART3->init();
+    dma_driver_init();
+    const uint32_t primask = irq_save();
+    usart_setup(2, USART_DEFAULT_BAUD);
+    irq_restore(primask);
+    clock_register_notifier(usart_notifier);
 }
-
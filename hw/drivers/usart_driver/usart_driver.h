@@ -1,7 +1,91 @@
-#include "stm32_dma.h"
+#include "dma_driver.h"
 #include "stm32_usart.h"
 
+struct WorkItem;
+
+/* Per-port transmit queue, must be a power of 2 */
+#ifndef USART_TX_QUEUE_SIZE
+#define USART_TX_QUEUE_SIZE 256u
+#endif
+
+/* Per-port receive ring, must be a power of 2 */
+#ifndef USART_RX_BUFFER_SIZE
+#define USART_RX_BUFFER_SIZE 256u
+#endif
+
+/* Baud rate ports are set up with */
+#ifndef USART_DEFAULT_BAUD
+#define USART_DEFAULT_BAUD 2400u
+#endif
+
+/*
+ * Sending is asynchronous: the bytes are copied into the port's queue and
+ * DMA drains it in the background. Returns the number of bytes queued, which
+ * is less than len if the queue filled up - the rest are dropped rather than
+ * stalling the caller.
+ */
 int usart_send_byte(usart_t usart, const char byte);
 int usart_send_string(usart_t usart, const char *str, const uint8_t len);
+/* All or nothing version of usart_send_string, returns -1 without queuing anything if it won't all fit */
+int usart_try_send(usart_t usart, const char *str, const uint8_t len);
+/*
+ * Queues all of buf, waiting for room as the queue drains. A thread sleeps
+ * a tick at a time while it waits, anything else (interrupt handlers, boot
+ * code) spins. Gives up once the queue hasn't moved for timeoutTicks, or
+ * straight away with interrupts masked as then nothing can drain it.
+ * WAIT_FOREVER waits as long as it takes. Returns the number of bytes
+ * queued, which is len unless it gave up.
+ */
+int usart_send_blocking(usart_t usart, const char *buf, const uint32_t len, const uint32_t timeoutTicks);
+/* Two seconds of system ticks, longer than a full queue takes to drain at 2400 baud */
+#ifndef USART_SEND_TIMEOUT_TICKS
+#define USART_SEND_TIMEOUT_TICKS 250u
+#endif
+/*
+ * Submits item once the transfer in flight completes and frees up room in
+ * the queue (or the queue is dropped), or straight away if the queue is
+ * already empty. It's for senders that would otherwise poll usart_try_send.
+ * Each port holds one item, so a second call replaces the first. Returns -1
+ * for a bad port.
+ */
+int usart_notify_tx_space(usart_t usart, WorkItem &item);
+/* Number of bytes queued or being sent */
+uint32_t usart_tx_pending(usart_t usart);
+/* Number of bytes dropped because the queue was full, or lost to a DMA error */
+uint32_t usart_tx_dropped(usart_t usart);
+/*
+ * Blocks until everything queued has been shifted out. If the DMA won't
+ * take the queue it is dropped and counted, so this always returns.
+ */
+void usart_flush(usart_t usart);
+
+/*
+ * Receiving runs a circular DMA into the port's ring, so the CPU isn't
+ * involved per byte. What has arrived is published when the line goes idle
+ * after a burst, and at every half ring, which also signals the port's
+ * UsartRx wait set source. Readers that fall more than a ring behind lose the
+ * oldest bytes, which are counted as overruns.
+ */
+int usart_rx_start(usart_t usart);
+int usart_rx_stop(usart_t usart);
+/* Returns the number of bytes read, which may be 0 */
+int usart_read(usart_t usart, char *buf, const uint32_t len);
+/*
+ * Waits up to timeoutTicks (or WAIT_FOREVER) for at least one byte, then
+ * reads what's there. Returns the number of bytes read, 0 on timeout.
+ */
+int usart_read_timeout(usart_t usart, char *buf, const uint32_t len, const uint32_t timeoutTicks);
+uint32_t usart_rx_overruns(usart_t usart);
+
+/*
+ * The baud rate is kept across clock changes: queued bytes are sent at the
+ * old rate first, then BRR is recomputed for the new APB clock. Bytes
+ * arriving while the clock changes may be garbled. Setting the baud rate of
+ * a port that isn't set up yet turns its clock on and sets it up. On a port
+ * that is, usart_set_baud flushes what's queued first, so it waits for the
+ * DMA and can't be called with interrupts masked.
+ */
+int usart_set_baud(usart_t usart, const uint32_t baud);
+
 void usart_driver_init(void);
 
@@ -0,0 +1,84 @@
+#include "boot_report.h"
+#include "clock_driver.h"
+#include "dwt.h"
+#include "format.h"
+#include "usart_driver.h"
+
+#define REPORT_LINE_SIZE 64u
+
+BootReport boot_report;
+
+/* Where the last phase ended, and the time from reset until then */
+static uint32_t mark_cycles;
+static uint32_t mark_us;
+
+static const char *const phase_names[NUM_BOOT_PHASES] = {
+    "data copy",
+    "bss zero",
+    "ccm init",
+    "static ctors",
+    "system init",
+    "cpu init",
+    "usart_driver_init",
+    "mem_mgr_init",
+    "alloc_init",
+    "flash_mgr_init",
+};
+
+static uint32_t
+cycles_to_us(const uint32_t cycles)
+{
+    return cycles / (clock_rates().hclk_hz / 1000000u);
+}
+
+/* Moves the mark up to now, counting whatever ran in between */
+static void
+advance_mark(const uint32_t now)
+{
+    mark_us += cycles_to_us(now - mark_cycles);
+    mark_cycles = now;
+}
+
+uint32_t
+boot_cycles(void)
+{
+    return DWT->get_cycle_count();
+}
+
+void
+boot_phase_record(const enum BootPhase phase, const uint32_t start, const uint32_t end)
+{
+    const uint32_t index = static_cast<uint32_t>(phase);
+    if (index >= NUM_BOOT_PHASES) {
+        return;
+    }
+
+    boot_report.cycles[index] = end - start;
+    boot_report.us[index] = cycles_to_us(end - start);
+    advance_mark(end);
+}
+
+void
+boot_report_done(void)
+{
+    advance_mark(boot_cycles());
+    boot_report.done_us = mark_us;
+}
+
+void
+boot_report_print(usart_t usart)
+{
+    char line[REPORT_LINE_SIZE];
+
+    for (uint32_t i = 0; i < NUM_BOOT_PHASES; i++) {
+        if (boot_report.cycles[i] == 0) {
+            continue;
+        }
+        const size_t len = FORMAT_BUF(line, sizeof(line), "boot: %-18s %9u cycles %7u us\n",
+                phase_names[i], boot_report.cycles[i], boot_report.us[i]);
+        (void)usart_send_string(usart, line, len);
+    }
+
+    const size_t len = FORMAT_BUF(line, sizeof(line), "boot: reset to ready %u us\n", boot_report.done_us);
+    (void)usart_send_string(usart, line, len);
+}
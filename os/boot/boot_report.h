@@ -0,0 +1,56 @@
+#ifndef _BOOT_REPORT_H
+#define _BOOT_REPORT_H
+
+#include <cstdint>
+
+#include "stm32_usart.h"
+
+/*
+ * Boot phases, in the order they run. Each one is timed with the DWT cycle
+ * counter, which Reset_Handler starts before doing anything else, so the
+ * report covers everything from reset to the scheduler starting. Time spent
+ * in the hardware before Reset_Handler isn't counted.
+ */
+enum class BootPhase : uint8_t {
+    DATA_COPY,
+    BSS_ZERO,
+    CCM_INIT,           // F4 only
+    STATIC_CTORS,
+    SYSTEM_INIT,        // Clocks and the system timer
+    CPU_INIT,
+    USART_DRIVER_INIT,
+    MEM_MGR_INIT,
+    ALLOC_INIT,
+    FLASH_MGR_INIT,     // Mounting the flash filesystem
+    NUM_PHASES,
+};
+
+#define NUM_BOOT_PHASES static_cast<uint32_t>(BootPhase::NUM_PHASES)
+
+/*
+ * Cycles are converted with the clock running when a phase ends, so a
+ * phase that changes the clock (SYSTEM_INIT) is only roughly right.
+ */
+struct BootReport {
+    uint32_t cycles[NUM_BOOT_PHASES];
+    uint32_t us[NUM_BOOT_PHASES];
+    uint32_t done_us;           // Reset until boot_report_done
+};
+
+extern BootReport boot_report;
+
+uint32_t boot_cycles(void);
+/* Phases that run before .bss is zeroed are recorded afterwards from saved cycle counts */
+void boot_phase_record(const enum BootPhase phase, const uint32_t start, const uint32_t end);
+void boot_report_done(void);
+void boot_report_print(usart_t usart);
+
+/* Times one call, e.g. BOOT_PHASE(ALLOC_INIT, alloc_init()) */
+#define BOOT_PHASE(_phase, _call) \
+    do { \
+        const uint32_t _boot_start = boot_cycles(); \
+        _call; \
+        boot_phase_record(BootPhase::_phase, _boot_start, boot_cycles()); \
+    } while (0)
+
+#endif /* _BOOT_REPORT_H */
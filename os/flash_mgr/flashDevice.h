@@ -0,0 +1,26 @@
+#ifndef _FLASH_DEVICE_H
+#define _FLASH_DEVICE_H
+
+#include <cstdint>
+
+/*
+ * A NOR flash the filesystem can sit on, split into equal sized sectors.
+ * Addresses are byte offsets from the start of the device.
+ *
+ * Erasing a sector sets all of it to 0xff. Programming can only clear bits,
+ * and addr and len have to be multiples of 4. Each function returns 0, or
+ * -1 on error.
+ *
+ * The filesystem only ever goes through one of these, so the same code runs
+ * on the internal flash and on a RAM backed one in a host harness.
+ */
+struct FlashDevice {
+    uint32_t sectorSize;
+    uint32_t numSectors;
+    int (*read)(void *ctx, const uint32_t addr, void *buf, const uint32_t len);
+    int (*program)(void *ctx, const uint32_t addr, const void *buf, const uint32_t len);
+    int (*erase)(void *ctx, const uint32_t sector);
+    void *ctx;
+};
+
+#endif /* _FLASH_DEVICE_H */
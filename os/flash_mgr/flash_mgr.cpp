@@ -0,0 +1,165 @@
+#include "flash_driver.h"
+#include "flash_mgr.h"
+#include "format.h"
+#include "irq.h"
+#include "scheduler.h"
+#include "usart_driver.h"
+#include "work_queue.h"
+
+#define FLASH_FS_FIRST_SECTOR 8u
+#define FLASH_FS_NUM_SECTORS 4u
+
+#define STATS_LINE_SIZE 96u
+
+static LogFs fs;
+static volatile bool busy;
+
+static int
+device_read(void *, const uint32_t addr, void *buf, const uint32_t len)
+{
+    /* Memory mapped, so reads go straight through the accelerator */
+    const uint8_t *const src = reinterpret_cast<const uint8_t *>(flash_sector_address(FLASH_FS_FIRST_SECTOR) + addr);
+    uint8_t *const dest = static_cast<uint8_t *>(buf);
+    for (uint32_t i = 0; i < len; i++) {
+        dest[i] = src[i];
+    }
+    return 0;
+}
+
+static int
+device_program(void *, const uint32_t addr, const void *buf, const uint32_t len)
+{
+    return flash_program(flash_sector_address(FLASH_FS_FIRST_SECTOR) + addr, buf, len);
+}
+
+static int
+device_erase(void *, const uint32_t sector)
+{
+    return flash_erase_sector(FLASH_FS_FIRST_SECTOR + sector);
+}
+
+static FlashDevice device;
+
+static void
+lock(void)
+{
+    for ( ;; ) {
+        const uint32_t primask = irq_save();
+        if (!busy) {
+            busy = true;
+            irq_restore(primask);
+            return;
+        }
+        irq_restore(primask);
+        scheduler_sleep(1);
+    }
+}
+
+static void
+unlock(void)
+{
+    busy = false;
+}
+
+/* One step each time round, so other low priority work gets a look in between */
+static void
+gc_work(void *)
+{
+    lock();
+    const bool more = fs.gcWanted() && (fs.gcStep() > 0) && fs.gcWanted();
+    unlock();
+
+    if (more) {
+        (void)work_submit_fn(WorkPriority::Low, gc_work, nullptr, WORK_COALESCE);
+    }
+}
+
+static void
+kick_gc(void)
+{
+    if (fs.gcWanted()) {
+        (void)work_submit_fn(WorkPriority::Low, gc_work, nullptr, WORK_COALESCE);
+    }
+}
+
+int
+flash_mgr_init(void)
+{
+    device.sectorSize = flash_sector_size(FLASH_FS_FIRST_SECTOR);
+    device.numSectors = FLASH_FS_NUM_SECTORS;
+    device.read = device_read;
+    device.program = device_program;
+    device.erase = device_erase;
+    device.ctx = nullptr;
+
+    lock();
+    const int ret = fs.mount(device);
+    unlock();
+    return ret;
+}
+
+int
+flash_fs_write(const char *const name, const void *const data, const uint32_t len)
+{
+    lock();
+    const int ret = fs.write(name, data, len);
+    unlock();
+
+    kick_gc();
+    return ret;
+}
+
+int
+flash_fs_read(const char *const name, void *const buf, const uint32_t len, const uint32_t offset)
+{
+    lock();
+    const int ret = fs.read(name, buf, len, offset);
+    unlock();
+    return ret;
+}
+
+int
+flash_fs_size(const char *const name)
+{
+    lock();
+    const int ret = fs.size(name);
+    unlock();
+    return ret;
+}
+
+int
+flash_fs_remove(const char *const name)
+{
+    lock();
+    const int ret = fs.remove(name);
+    unlock();
+
+    kick_gc();
+    return ret;
+}
+
+LogFsStats
+flash_fs_stats(void)
+{
+    lock();
+    const LogFsStats stats = fs.getStats();
+    unlock();
+    return stats;
+}
+
+void
+flash_fs_print_stats(usart_t usart)
+{
+    const LogFsStats stats = flash_fs_stats();
+    char line[STATS_LINE_SIZE];
+
+    size_t len = FORMAT_BUF(line, sizeof(line), "flash fs: %u files, %u sectors free, erases %u (min %u max %u)\n",
+            stats.files, stats.freeSectors, stats.erases, stats.minEraseCount, stats.maxEraseCount);
+    (void)usart_send_string(usart, line, len);
+    len = FORMAT_BUF(line, sizeof(line), "flash fs: %u bytes written, %u programmed, %u copied by gc\n",
+            stats.payloadBytes, stats.programmedBytes, stats.gcCopiedBytes);
+    (void)usart_send_string(usart, line, len);
+    len = FORMAT_BUF(line, sizeof(line), "flash fs: mount read %u records, %u bytes\n",
+            stats.mountRecords, stats.mountBytesRead);
+    (void)usart_send_string(usart, line, len);
+}
@@ -0,0 +1,39 @@
+#ifndef _FLASH_MGR_H
+#define _FLASH_MGR_H
+
+#include <cstdint>
+
+#include "logFs.h"
+#include "stm32_usart.h"
+
+/*
+ * Files in the internal flash, using sectors 8-11 (the top 512 KB), which
+ * the linker script keeps the program out of. See logFs.h for how they're
+ * stored.
+ *
+ * The core stalls on any flash access while the flash is programming or
+ * erasing, and an erase takes about a second, so garbage collection runs a
+ * record at a time from the low priority work queue rather than in the
+ * caller's write wherever it can.
+ *
+ * Calls are serialised, and can block, so only call these from threads
+ * (or before the scheduler starts). Each returns as its LogFs counterpart.
+ *
+ * The lock is a flag polled with scheduler_sleep(1), with no priority
+ * inheritance, and it's held across a whole erase. So a call can wait out
+ * an erase someone else started, about a second. A garbage collection step
+ * that finds the lock taken sleeps on the low priority worker, and other
+ * low priority work waits behind it until it gets the lock.
+ */
+
+int flash_mgr_init(void);
+
+int flash_fs_write(const char *const name, const void *const data, const uint32_t len);
+int flash_fs_read(const char *const name, void *const buf, const uint32_t len, const uint32_t offset = 0);
+int flash_fs_size(const char *const name);
+int flash_fs_remove(const char *const name);
+
+LogFsStats flash_fs_stats(void);
+void flash_fs_print_stats(usart_t usart);
+
+#endif /* _FLASH_MGR_H */
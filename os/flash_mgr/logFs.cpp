@@ -0,0 +1,938 @@
+#include <cstddef>
+
+#include "crc32.h"
+#include "logFs.h"
+
+#define SECTOR_MAGIC 0x4c465321u    // "!SFL"
+#define SECTOR_RETIRED 0u           // Magic is cleared just before a sector is erased
+#define RECORD_MAGIC 0x4c465352u    // "RSFL"
+#define ERASED_WORD 0xffffffffu
+
+#define RECORD_DELETE (1u << 0)
+
+#define LOC_NONE 0xffffffffu
+#define LOC_SECTOR_SHIFT 20u
+#define LOC_OFFSET_MASK ((1u << LOC_SECTOR_SHIFT) - 1u)
+#define NO_SECTOR 0xffffffffu
+
+/* The fewest sectors that leave room for a head and the one kept back for collection */
+#define LOGFS_MIN_SECTORS 3u
+
+/*
+ * At the start of every sector. seq stays erased until the sector becomes
+ * the head. A sector opened by collection gets the victim's number in
+ * gcSource, programmed along with seq, and gcDone is cleared once that
+ * collection has copied everything. Until then the sector only holds
+ * copies of records still in the victim.
+ */
+struct SectorHeader {
+    uint32_t magic;
+    uint32_t eraseCount;
+    uint32_t gcSource;
+    uint32_t seq;
+    uint32_t gcDone;
+    uint32_t reserved;
+};
+
+/*
+ * At the start of every record, followed by the name and data, each padded
+ * to a word. The commit word is programmed to 0 after everything else.
+ */
+struct RecordHeader {
+    uint32_t magic;
+    uint16_t nameLen;
+    uint16_t flags;
+    uint32_t nameHash;
+    uint32_t dataLen;
+    uint32_t dataCrc;       // Over the name then the data
+    uint32_t headerCrc;     // Over everything before it
+    uint32_t commit;
+};
+
+static_assert(sizeof(SectorHeader) == 24, "sector header layout");
+static_assert(sizeof(RecordHeader) == 28, "record header layout");
+static_assert((LOGFS_INDEX_SLOTS & (LOGFS_INDEX_SLOTS - 1)) == 0, "index slots must be a power of 2");
+static_assert(LOGFS_INDEX_SLOTS > LOGFS_MAX_FILES, "index needs empty slots");
+
+#define RECORD_COMMIT_OFFSET offsetof(RecordHeader, commit)
+#define RECORD_CRC_LEN offsetof(RecordHeader, headerCrc)
+
+static uint32_t
+pad4(const uint32_t len)
+{
+    return (len + 3u) & ~3u;
+}
+
+static uint32_t
+recordSize(const uint32_t nameLen, const uint32_t dataLen)
+{
+    return sizeof(RecordHeader) + pad4(nameLen) + pad4(dataLen);
+}
+
+/* FNV-1a */
+static uint32_t
+nameHash(const char *const name, const uint32_t nameLen)
+{
+    uint32_t hash = 2166136261u;
+    for (uint32_t i = 0; i < nameLen; i++) {
+        hash = (hash ^ static_cast<uint8_t>(name[i])) * 16777619u;
+    }
+    return hash;
+}
+
+static uint32_t
+nameLength(const char *const name)
+{
+    uint32_t len = 0;
+    while ((len <= LOGFS_NAME_MAX) && (name[len] != '\0')) {
+        len++;
+    }
+    return len;
+}
+
+static uint32_t
+headerCrc(const RecordHeader &hdr)
+{
+    return crc32(&hdr, RECORD_CRC_LEN);
+}
+
+static uint32_t
+makeLoc(const uint32_t sector, const uint32_t offset)
+{
+    return (sector << LOC_SECTOR_SHIFT) | offset;
+}
+
+static uint32_t
+locSector(const uint32_t loc)
+{
+    return loc >> LOC_SECTOR_SHIFT;
+}
+
+static uint32_t
+locOffset(const uint32_t loc)
+{
+    return loc & LOC_OFFSET_MASK;
+}
+
+LogFs::LogFs() : dev(nullptr), entries(0), freeCount(0), head(NO_SECTOR), nextSeq(0), gcActive(false),
+    gcDropTombstones(false), gcVictim(NO_SECTOR), gcDest(NO_SECTOR), gcOffset(0), stats()
+{
+}
+
+uint32_t
+LogFs::addr(const uint32_t sector, const uint32_t offset) const
+{
+    return (sector * dev->sectorSize) + offset;
+}
+
+int
+LogFs::readHeader(const uint32_t sector, const uint32_t offset, void *const hdr)
+{
+    return dev->read(dev->ctx, addr(sector, offset), hdr, sizeof(RecordHeader));
+}
+
+bool
+LogFs::nameMatches(const IndexEntry &entry, const char *const name, const uint32_t nameLen)
+{
+    if (entry.nameLen != nameLen) {
+        return false;
+    }
+
+    const uint32_t from = addr(locSector(entry.loc), locOffset(entry.loc) + sizeof(RecordHeader));
+    if (dev->read(dev->ctx, from, nameBuf, nameLen) < 0) {
+        return false;
+    }
+    for (uint32_t i = 0; i < nameLen; i++) {
+        if (nameBuf[i] != name[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int
+LogFs::findName(const uint32_t hash, const char *const name, const uint32_t nameLen)
+{
+    for (uint32_t n = 0, slot = hash; n < LOGFS_INDEX_SLOTS; n++, slot++) {
+        slot &= LOGFS_INDEX_SLOTS - 1u;
+        const IndexEntry &entry = index[slot];
+        if (entry.loc == LOC_NONE) {
+            return -1;
+        }
+        // Names only get read from flash when the hashes match
+        if ((entry.hash == hash) && nameMatches(entry, name, nameLen)) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+int
+LogFs::findLoc(const uint32_t hash, const uint32_t loc) const
+{
+    for (uint32_t n = 0, slot = hash; n < LOGFS_INDEX_SLOTS; n++, slot++) {
+        slot &= LOGFS_INDEX_SLOTS - 1u;
+        if (index[slot].loc == LOC_NONE) {
+            return -1;
+        }
+        if (index[slot].loc == loc) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+int
+LogFs::insertEntry(const uint32_t hash)
+{
+    if (entries >= (LOGFS_INDEX_SLOTS - 1u)) {
+        return -1;
+    }
+
+    uint32_t slot = hash & (LOGFS_INDEX_SLOTS - 1u);
+    while (index[slot].loc != LOC_NONE) {
+        slot = (slot + 1u) & (LOGFS_INDEX_SLOTS - 1u);
+    }
+    index[slot].hash = hash;
+    entries++;
+    return slot;
+}
+
+/* Backward shift deletion, so probe chains never need tombstones of their own */
+void
+LogFs::removeEntry(uint32_t slot)
+{
+    const IndexEntry &removed = index[slot];
+    sectors[locSector(removed.loc)].live -= recordSize(removed.nameLen, removed.dataLen);
+    if (!removed.deleted) {
+        stats.files--;
+    }
+    entries--;
+
+    uint32_t next = slot;
+    for ( ;; ) {
+        next = (next + 1u) & (LOGFS_INDEX_SLOTS - 1u);
+        if (index[next].loc == LOC_NONE) {
+            break;
+        }
+        // Only move entries whose home slot isn't cyclically between the hole and where they are
+        const uint32_t home = index[next].hash & (LOGFS_INDEX_SLOTS - 1u);
+        const uint32_t distHole = (slot - home) & (LOGFS_INDEX_SLOTS - 1u);
+        const uint32_t distNext = (next - home) & (LOGFS_INDEX_SLOTS - 1u);
+        if (distHole < distNext) {
+            index[slot] = index[next];
+            slot = next;
+        }
+    }
+    index[slot].loc = LOC_NONE;
+}
+
+/* Points a slot at a new record, moving the live bytes over from the one it replaces */
+void
+LogFs::setEntry(const uint32_t slot, const uint32_t loc, const uint32_t nameLen, const uint32_t dataLen,
+                const bool deleted)
+{
+    IndexEntry &entry = index[slot];
+    if (entry.loc != LOC_NONE) {
+        sectors[locSector(entry.loc)].live -= recordSize(entry.nameLen, entry.dataLen);
+        if (!entry.deleted) {
+            stats.files--;
+        }
+    }
+
+    entry.loc = loc;
+    entry.nameLen = static_cast<uint8_t>(nameLen);
+    entry.dataLen = dataLen;
+    entry.deleted = deleted;
+    sectors[locSector(loc)].live += recordSize(nameLen, dataLen);
+    if (!deleted) {
+        stats.files++;
+    }
+}
+
+/*
+ * Slot of the name a record on flash belongs to, or -1 if it's new. The
+ * record's name is only read if something with the same hash is indexed.
+ */
+int
+LogFs::findRecord(const void *const header, const uint32_t sector, const uint32_t offset)
+{
+    const RecordHeader &hdr = *static_cast<const RecordHeader *>(header);
+    char name[LOGFS_NAME_MAX];
+    bool haveName = false;
+
+    for (uint32_t n = 0, slot = hdr.nameHash; n < LOGFS_INDEX_SLOTS; n++, slot++) {
+        slot &= LOGFS_INDEX_SLOTS - 1u;
+        if (index[slot].loc == LOC_NONE) {
+            return -1;
+        }
+        if ((index[slot].hash != hdr.nameHash) || (index[slot].nameLen != hdr.nameLen)) {
+            continue;
+        }
+
+        if (!haveName) {
+            if (dev->read(dev->ctx, addr(sector, offset + sizeof(hdr)), name, hdr.nameLen) < 0) {
+                return -1;
+            }
+            stats.mountBytesRead += 2u * hdr.nameLen;
+            haveName = true;
+        }
+        if (nameMatches(index[slot], name, hdr.nameLen)) {
+            return slot;
+        }
+    }
+    return -1;
+}
+
+/*
+ * Indexes every committed record in a sector. Sectors are scanned oldest
+ * first, so a later record for a name simply replaces the earlier one.
+ */
+void
+LogFs::scanSector(const uint32_t sector)
+{
+    SectorInfo &info = sectors[sector];
+    uint32_t offset = sizeof(SectorHeader);
+
+    while ((offset + sizeof(RecordHeader)) <= dev->sectorSize) {
+        RecordHeader hdr;
+        if (readHeader(sector, offset, &hdr) < 0) {
+            break;
+        }
+        stats.mountBytesRead += sizeof(hdr);
+
+        if (hdr.magic == ERASED_WORD) {
+            break;
+        }
+        const uint32_t size = recordSize(hdr.nameLen, hdr.dataLen);
+        if ((hdr.magic != RECORD_MAGIC) || (hdr.headerCrc != headerCrc(hdr)) || (hdr.nameLen == 0)
+            || (hdr.nameLen > LOGFS_NAME_MAX) || (size > (dev->sectorSize - offset))) {
+            // Power went during a header, nothing after it can be trusted
+            offset = dev->sectorSize;
+            break;
+        }
+        stats.mountRecords++;
+
+        if (hdr.commit == 0) {
+            const uint32_t loc = makeLoc(sector, offset);
+            const int slot = findRecord(&hdr, sector, offset);
+            const bool deleted = (hdr.flags & RECORD_DELETE) != 0;
+            if (slot >= 0) {
+                setEntry(slot, loc, hdr.nameLen, hdr.dataLen, deleted);
+            } else if (!deleted) {
+                // A tombstone for a name with nothing older doesn't hide anything, so it isn't indexed
+                const int newSlot = insertEntry(hdr.nameHash);
+                if (newSlot >= 0) {
+                    setEntry(newSlot, loc, hdr.nameLen, hdr.dataLen, false);
+                }
+            }
+        }
+        offset += size;
+    }
+
+    info.used = offset;
+}
+
+/* Erases a sector and writes it a header, erase count first so the magic is only valid with it */
+int
+LogFs::formatSector(const uint32_t sector, const uint32_t eraseCount)
+{
+    if (dev->erase(dev->ctx, sector) < 0) {
+        return -1;
+    }
+    stats.erases++;
+
+    SectorInfo &info = sectors[sector];
+    info.eraseCount = eraseCount;
+    info.seq = ERASED_WORD;
+    info.used = sizeof(SectorHeader);
+    info.live = 0;
+    info.active = false;
+    freeCount++;
+
+    const uint32_t magic = SECTOR_MAGIC;
+    stats.programmedBytes += 2u * sizeof(uint32_t);
+    if (dev->program(dev->ctx, addr(sector, offsetof(SectorHeader, eraseCount)), &eraseCount, sizeof(eraseCount)) < 0) {
+        return -1;
+    }
+    return dev->program(dev->ctx, addr(sector, offsetof(SectorHeader, magic)), &magic, sizeof(magic));
+}
+
+int
+LogFs::mount(const FlashDevice &device)
+{
+    if ((device.numSectors < LOGFS_MIN_SECTORS) || (device.numSectors > LOGFS_MAX_SECTORS)
+        || ((device.sectorSize & 3u) != 0) || (device.sectorSize > (LOC_OFFSET_MASK + 1u))) {
+        return -1;
+    }
+
+    dev = &device;
+    stats = LogFsStats();
+    for (uint32_t i = 0; i < LOGFS_INDEX_SLOTS; i++) {
+        index[i].loc = LOC_NONE;
+    }
+    entries = 0;
+    freeCount = 0;
+    head = NO_SECTOR;
+    nextSeq = 0;
+    gcActive = false;
+    gcVictim = NO_SECTOR;
+    gcDest = NO_SECTOR;
+
+    uint8_t order[LOGFS_MAX_SECTORS];
+    uint32_t numActive = 0;
+    uint32_t maxErase = 0;
+    // Erase count for each sector that needs erasing before use, ERASED_WORD if it's unknown
+    uint32_t needsErase[LOGFS_MAX_SECTORS];
+    bool gcCopyOnly[LOGFS_MAX_SECTORS] = {};
+
+    for (uint32_t i = 0; i < dev->numSectors; i++) {
+        SectorHeader hdr;
+        if (dev->read(dev->ctx, addr(i, 0), &hdr, sizeof(hdr)) < 0) {
+            return -1;
+        }
+        stats.mountBytesRead += sizeof(hdr);
+
+        SectorInfo &info = sectors[i];
+        info.eraseCount = hdr.eraseCount;
+        info.seq = hdr.seq;
+        info.used = sizeof(SectorHeader);
+        info.live = 0;
+        info.active = false;
+        needsErase[i] = 0;
+
+        if ((hdr.magic == SECTOR_MAGIC) && (hdr.seq == ERASED_WORD) && (hdr.gcSource == ERASED_WORD)) {
+            freeCount++;
+        } else if ((hdr.magic == SECTOR_MAGIC) && (hdr.seq == ERASED_WORD)) {
+            // Power went while it was being opened
+            needsErase[i] = hdr.eraseCount + 1u;
+        } else if (hdr.magic == SECTOR_MAGIC) {
+            info.active = true;
+            // Insertion sort by seq, there are only a handful
+            uint32_t j = numActive++;
+            for ( ; (j > 0) && (sectors[order[j - 1]].seq > hdr.seq); j--) {
+                order[j] = order[j - 1];
+            }
+            order[j] = static_cast<uint8_t>(i);
+            if (hdr.seq >= nextSeq) {
+                nextSeq = hdr.seq + 1u;
+            }
+            gcCopyOnly[i] = (hdr.gcSource != ERASED_WORD) && (hdr.gcDone == ERASED_WORD);
+        } else if ((hdr.magic == SECTOR_RETIRED) && (hdr.eraseCount != ERASED_WORD)) {
+            // Collected, but the erase didn't finish
+            needsErase[i] = hdr.eraseCount + 1u;
+        } else {
+            // Never formatted, or the erase itself was cut short
+            needsErase[i] = ERASED_WORD;
+            info.eraseCount = 0;
+        }
+
+        if (info.eraseCount > maxErase) {
+            maxErase = info.eraseCount;
+        }
+    }
+
+    /*
+     * Power went part way through a collection. What it copied is all still
+     * in the victim, and with nowhere left to copy to the collection could
+     * never finish, so start again from an empty sector.
+     */
+    if ((numActive > 0) && gcCopyOnly[order[numActive - 1]]) {
+        const uint32_t copies = order[--numActive];
+        sectors[copies].active = false;
+        needsErase[copies] = sectors[copies].eraseCount + 1u;
+    }
+
+    for (uint32_t i = 0; i < numActive; i++) {
+        scanSector(order[i]);
+    }
+    if (numActive > 0) {
+        head = order[numActive - 1];
+    }
+
+    for (uint32_t i = 0; i < dev->numSectors; i++) {
+        if (needsErase[i] != 0) {
+            // With no count to go on, assume it's been worn as much as any other
+            const uint32_t count = (needsErase[i] != ERASED_WORD) ? needsErase[i] : maxErase;
+            if (formatSector(i, count) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    // Headers and names read while mounting aren't counted as traffic
+    stats.programmedBytes = 0;
+    stats.erases = 0;
+    return 0;
+}
+
+/* The free sector with the fewest erases becomes the new head */
+int
+LogFs::openHead(const bool forGc)
+{
+    uint32_t best = NO_SECTOR;
+    for (uint32_t i = 0; i < dev->numSectors; i++) {
+        if (!sectors[i].active && ((best == NO_SECTOR) || (sectors[i].eraseCount < sectors[best].eraseCount))) {
+            best = i;
+        }
+    }
+    if (best == NO_SECTOR) {
+        return -1;
+    }
+
+    // gcSource and seq go in one go, gcSource first
+    const uint32_t words[2] = { forGc ? gcVictim : ERASED_WORD, nextSeq++ };
+    const uint32_t first = forGc ? 0u : 1u;
+    stats.programmedBytes += sizeof(words) - (first * sizeof(uint32_t));
+    if (dev->program(dev->ctx, addr(best, offsetof(SectorHeader, gcSource)) + (first * sizeof(uint32_t)), &words[first],
+                     sizeof(words) - (first * sizeof(uint32_t))) < 0) {
+        return -1;
+    }
+
+    // Whatever is left at the end of the old head is never going to be written
+    if (head != NO_SECTOR) {
+        sectors[head].used = dev->sectorSize;
+    }
+
+    SectorInfo &info = sectors[best];
+    info.seq = words[1];
+    info.active = true;
+    freeCount--;
+    head = best;
+    if (forGc) {
+        gcDest = best;
+    }
+    return 0;
+}
+
+/*
+ * Makes sure the head has recSize bytes free. Writes never take the last
+ * free sector, that's left for collection to copy into, and when they'd
+ * need it they collect synchronously until there's space. Once collection
+ * has taken it, writes wait for the collection to finish, so that sector
+ * only ever holds copies until then.
+ */
+int
+LogFs::makeRoom(const uint32_t recSize, const bool forGc)
+{
+    // Once every sector has been collected without making room, the flash is as full as it gets
+    const uint32_t giveUp = stats.erases + dev->numSectors;
+
+    for ( ;; ) {
+        if (!forGc && gcActive && (freeCount == 0)) {
+            if (gcStep() < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if ((head != NO_SECTOR) && ((sectors[head].used + recSize) <= dev->sectorSize)) {
+            return 0;
+        }
+
+        if (freeCount > (forGc ? 0u : 1u)) {
+            if (openHead(forGc) < 0) {
+                return -1;
+            }
+            continue;
+        }
+
+        if (forGc || (stats.erases > giveUp) || (gcStep() <= 0)) {
+            return -1;
+        }
+    }
+}
+
+/* Programs len bytes, padding the last word with 0xff */
+int
+LogFs::programPadded(uint32_t to, const void *const src, const uint32_t len)
+{
+    const uint32_t whole = len & ~3u;
+    if ((whole > 0) && (dev->program(dev->ctx, to, src, whole) < 0)) {
+        return -1;
+    }
+
+    if (whole < len) {
+        const uint8_t *const bytes = static_cast<const uint8_t *>(src);
+        uint8_t tail[4] = { 0xff, 0xff, 0xff, 0xff };
+        for (uint32_t i = whole; i < len; i++) {
+            tail[i - whole] = bytes[i];
+        }
+        if (dev->program(dev->ctx, to + whole, tail, sizeof(tail)) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Writes a record at the end of the head, room has to have been made. Returns its loc or -1 */
+int
+LogFs::append(const char *const name, const uint32_t nameLen, const uint16_t flags,
+              const void *const data, const uint32_t dataLen, const uint32_t hash)
+{
+    const uint32_t offset = sectors[head].used;
+    const uint32_t to = addr(head, offset);
+
+    RecordHeader hdr;
+    hdr.magic = RECORD_MAGIC;
+    hdr.nameLen = static_cast<uint16_t>(nameLen);
+    hdr.flags = flags;
+    hdr.nameHash = hash;
+    hdr.dataLen = dataLen;
+    hdr.dataCrc = crc32(data, dataLen, crc32(name, nameLen));
+    hdr.headerCrc = headerCrc(hdr);
+    hdr.commit = 0;
+
+    // However far this gets, the space is used
+    const uint32_t size = recordSize(nameLen, dataLen);
+    sectors[head].used += size;
+    stats.programmedBytes += size;
+
+    if ((dev->program(dev->ctx, to, &hdr, RECORD_COMMIT_OFFSET) < 0)
+        || (programPadded(to + sizeof(hdr), name, nameLen) < 0)
+        || (programPadded(to + sizeof(hdr) + pad4(nameLen), data, dataLen) < 0)
+        || (dev->program(dev->ctx, to + RECORD_COMMIT_OFFSET, &hdr.commit, sizeof(hdr.commit)) < 0)) {
+        return -1;
+    }
+    return static_cast<int>(makeLoc(head, offset));
+}
+
+/* Copies a committed record to the end of the head as is, committing it last */
+int
+LogFs::copyRecord(const uint32_t from, const uint32_t recSize)
+{
+    const uint32_t to = addr(head, sectors[head].used);
+    sectors[head].used += recSize;
+    stats.programmedBytes += recSize;
+    stats.gcCopiedBytes += recSize;
+
+    for (uint32_t done = 0; done < recSize; ) {
+        uint32_t chunk = recSize - done;
+        if (chunk > sizeof(copyBuf)) {
+            chunk = sizeof(copyBuf);
+        }
+        if (dev->read(dev->ctx, from + done, copyBuf, chunk) < 0) {
+            return -1;
+        }
+        if (done == 0) {
+            copyBuf[RECORD_COMMIT_OFFSET / sizeof(uint32_t)] = ERASED_WORD;
+        }
+        if (dev->program(dev->ctx, to + done, copyBuf, chunk) < 0) {
+            return -1;
+        }
+        done += chunk;
+    }
+
+    const uint32_t commit = 0;
+    return dev->program(dev->ctx, to + RECORD_COMMIT_OFFSET, &commit, sizeof(commit));
+}
+
+int
+LogFs::write(const char *const name, const void *const data, const uint32_t len)
+{
+    const uint32_t nameLen = nameLength(name);
+    if ((dev == nullptr) || (nameLen == 0) || (nameLen > LOGFS_NAME_MAX)
+        || (recordSize(nameLen, len) > (dev->sectorSize - sizeof(SectorHeader)))) {
+        return -1;
+    }
+
+    const uint32_t hash = nameHash(name, nameLen);
+    if ((findName(hash, name, nameLen) < 0) && (entries >= LOGFS_MAX_FILES)) {
+        return -1;
+    }
+
+    if (makeRoom(recordSize(nameLen, len), false) < 0) {
+        return -1;
+    }
+
+    const int loc = append(name, nameLen, 0, data, len, hash);
+    if (loc < 0) {
+        return -1;
+    }
+
+    // Collection can move things around the index, so look again
+    int slot = findName(hash, name, nameLen);
+    if (slot < 0) {
+        slot = insertEntry(hash);
+    }
+    setEntry(slot, loc, nameLen, len, false);
+    stats.payloadBytes += len;
+    return 0;
+}
+
+int
+LogFs::read(const char *const name, void *const buf, const uint32_t len, const uint32_t offset)
+{
+    const uint32_t nameLen = nameLength(name);
+    if ((dev == nullptr) || (nameLen == 0) || (nameLen > LOGFS_NAME_MAX)) {
+        return -1;
+    }
+
+    const int slot = findName(nameHash(name, nameLen), name, nameLen);
+    if ((slot < 0) || index[slot].deleted) {
+        return -1;
+    }
+    const IndexEntry &entry = index[slot];
+    if (offset >= entry.dataLen) {
+        return 0;
+    }
+
+    uint32_t count = entry.dataLen - offset;
+    if (count > len) {
+        count = len;
+    }
+    const uint32_t from = addr(locSector(entry.loc), locOffset(entry.loc) + sizeof(RecordHeader) + pad4(nameLen));
+    if (dev->read(dev->ctx, from + offset, buf, count) < 0) {
+        return -1;
+    }
+
+    if (count == entry.dataLen) {
+        RecordHeader hdr;
+        if ((readHeader(locSector(entry.loc), locOffset(entry.loc), &hdr) < 0)
+            || (hdr.dataCrc != crc32(buf, count, crc32(name, nameLen)))) {
+            return -1;
+        }
+    }
+    return static_cast<int>(count);
+}
+
+int
+LogFs::size(const char *const name)
+{
+    const uint32_t nameLen = nameLength(name);
+    if ((dev == nullptr) || (nameLen == 0) || (nameLen > LOGFS_NAME_MAX)) {
+        return -1;
+    }
+
+    const int slot = findName(nameHash(name, nameLen), name, nameLen);
+    if ((slot < 0) || index[slot].deleted) {
+        return -1;
+    }
+    return static_cast<int>(index[slot].dataLen);
+}
+
+int
+LogFs::remove(const char *const name)
+{
+    const uint32_t nameLen = nameLength(name);
+    if ((dev == nullptr) || (nameLen == 0) || (nameLen > LOGFS_NAME_MAX)) {
+        return -1;
+    }
+
+    const uint32_t hash = nameHash(name, nameLen);
+    int slot = findName(hash, name, nameLen);
+    if ((slot < 0) || index[slot].deleted) {
+        return -1;
+    }
+
+    if (makeRoom(recordSize(nameLen, 0), false) < 0) {
+        return -1;
+    }
+
+    const int loc = append(name, nameLen, RECORD_DELETE, nullptr, 0, hash);
+    if (loc < 0) {
+        return -1;
+    }
+    slot = findName(hash, name, nameLen);
+    setEntry(slot, loc, nameLen, 0, true);
+    return 0;
+}
+
+/*
+ * Whether a sector's live records are sure to fit somewhere: either all in
+ * what's left of the head, or in a free sector, since they fit in one before.
+ */
+bool
+LogFs::canCollect(const uint32_t sector) const
+{
+    if (!sectors[sector].active || (sector == head)) {
+        return false;
+    }
+    if (freeCount > 0) {
+        return true;
+    }
+    return (head != NO_SECTOR) && (sectors[sector].live <= (dev->sectorSize - sectors[head].used));
+}
+
+/*
+ * The least worn active sector, if the erase counts have spread too far.
+ * Moving it doesn't free any space, so not while space is short.
+ */
+uint32_t
+LogFs::wearVictim(void) const
+{
+    if (freeCount < LOGFS_GC_FREE_TARGET) {
+        return NO_SECTOR;
+    }
+
+    uint32_t maxErase = 0;
+    uint32_t victim = NO_SECTOR;
+    for (uint32_t i = 0; i < dev->numSectors; i++) {
+        if (sectors[i].eraseCount > maxErase) {
+            maxErase = sectors[i].eraseCount;
+        }
+        if (canCollect(i) && ((victim == NO_SECTOR) || (sectors[i].eraseCount < sectors[victim].eraseCount))) {
+            victim = i;
+        }
+    }
+
+    if ((victim == NO_SECTOR) || ((maxErase - sectors[victim].eraseCount) <= LOGFS_WEAR_SPREAD)) {
+        return NO_SECTOR;
+    }
+    return victim;
+}
+
+/* The sector with the most garbage (at least minGarbage), the least worn one on a tie */
+uint32_t
+LogFs::greedyVictim(const uint32_t minGarbage) const
+{
+    uint32_t victim = NO_SECTOR;
+    uint32_t mostGarbage = (minGarbage > 0) ? (minGarbage - 1u) : 0;
+    for (uint32_t i = 0; i < dev->numSectors; i++) {
+        if (!canCollect(i)) {
+            continue;
+        }
+        const uint32_t garbage = sectors[i].used - sizeof(SectorHeader) - sectors[i].live;
+        if ((garbage > mostGarbage)
+            || ((garbage == mostGarbage) && (victim != NO_SECTOR) && (sectors[i].eraseCount < sectors[victim].eraseCount))) {
+            victim = i;
+            mostGarbage = garbage;
+        }
+    }
+    return victim;
+}
+
+/*
+ * Background collection only goes for sectors at least half garbage. The
+ * live half then can't waste more than it frees by not fitting at the end
+ * of the head, so it always makes progress and can't churn a full flash.
+ */
+bool
+LogFs::gcWanted(void) const
+{
+    if (dev == nullptr) {
+        return false;
+    }
+    const uint32_t minGarbage = (dev->sectorSize - sizeof(SectorHeader)) / 2u;
+    return gcActive || (wearVictim() != NO_SECTOR)
+           || ((freeCount < LOGFS_GC_FREE_TARGET) && (greedyVictim(minGarbage) != NO_SECTOR));
+}
+
+/*
+ * Clears the victim's magic so a power cut before the erase finishes still
+ * leaves it looking retired rather than valid, then erases it.
+ */
+int
+LogFs::retireVictim(void)
+{
+    const uint32_t retired = SECTOR_RETIRED;
+    if (gcDest != NO_SECTOR) {
+        stats.programmedBytes += sizeof(retired);
+        if (dev->program(dev->ctx, addr(gcDest, offsetof(SectorHeader, gcDone)), &retired, sizeof(retired)) < 0) {
+            return -1;
+        }
+        gcDest = NO_SECTOR;
+    }
+
+    stats.programmedBytes += sizeof(retired);
+    if (dev->program(dev->ctx, addr(gcVictim, offsetof(SectorHeader, magic)), &retired, sizeof(retired)) < 0) {
+        return -1;
+    }
+    if (formatSector(gcVictim, sectors[gcVictim].eraseCount + 1u) < 0) {
+        return -1;
+    }
+
+    gcActive = false;
+    gcVictim = NO_SECTOR;
+    return 0;
+}
+
+int
+LogFs::gcStep(void)
+{
+    if (dev == nullptr) {
+        return -1;
+    }
+
+    if (!gcActive) {
+        uint32_t victim = wearVictim();
+        if (victim == NO_SECTOR) {
+            victim = greedyVictim(1);
+        }
+        if (victim == NO_SECTOR) {
+            return 0;
+        }
+
+        // Tombstones can only go once there's nothing older left for them to hide
+        gcDropTombstones = true;
+        for (uint32_t i = 0; i < dev->numSectors; i++) {
+            if (sectors[i].active && (sectors[i].seq < sectors[victim].seq)) {
+                gcDropTombstones = false;
+            }
+        }
+        gcActive = true;
+        gcVictim = victim;
+        gcDest = NO_SECTOR;
+        gcOffset = sizeof(SectorHeader);
+    }
+
+    // Skip past garbage until there's one live record to move
+    SectorInfo &victim = sectors[gcVictim];
+    while ((gcOffset + sizeof(RecordHeader)) <= victim.used) {
+        RecordHeader hdr;
+        if (readHeader(gcVictim, gcOffset, &hdr) < 0) {
+            return -1;
+        }
+        if ((hdr.magic != RECORD_MAGIC) || (hdr.headerCrc != headerCrc(hdr))) {
+            break;
+        }
+
+        const uint32_t loc = makeLoc(gcVictim, gcOffset);
+        const uint32_t size = recordSize(hdr.nameLen, hdr.dataLen);
+        const int slot = (hdr.commit == 0) ? findLoc(hdr.nameHash, loc) : -1;
+        if (slot < 0) {
+            gcOffset += size;
+            continue;
+        }
+
+        if (index[slot].deleted && gcDropTombstones) {
+            removeEntry(slot);
+        } else {
+            if ((makeRoom(size, true) < 0)) {
+                return -1;
+            }
+            const uint32_t newLoc = makeLoc(head, sectors[head].used);
+            if (copyRecord(addr(gcVictim, gcOffset), size) < 0) {
+                return -1;
+            }
+            setEntry(slot, newLoc, hdr.nameLen, hdr.dataLen, index[slot].deleted);
+        }
+        gcOffset += size;
+        return 1;
+    }
+
+    if (retireVictim() < 0) {
+        return -1;
+    }
+    return 1;
+}
+
+const LogFsStats &
+LogFs::getStats(void)
+{
+    stats.freeSectors = freeCount;
+    stats.minEraseCount = 0;
+    stats.maxEraseCount = 0;
+    if (dev != nullptr) {
+        stats.minEraseCount = sectors[0].eraseCount;
+        for (uint32_t i = 0; i < dev->numSectors; i++) {
+            if (sectors[i].eraseCount < stats.minEraseCount) {
+                stats.minEraseCount = sectors[i].eraseCount;
+            }
+            if (sectors[i].eraseCount > stats.maxEraseCount) {
+                stats.maxEraseCount = sectors[i].eraseCount;
+            }
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,147 @@
+#ifndef _LOG_FS_H
+#define _LOG_FS_H
+
+#include <cstdint>
+
+#include "flashDevice.h"
+
+/*
+ * Log structured filesystem for NOR flash.
+ *
+ * Every write appends a whole new copy of the file to the head sector, and
+ * a remove appends a tombstone, so nothing is ever rewritten in place. A
+ * record is only valid once its commit word has been programmed, which is
+ * the last thing written, so losing power part way through leaves the old
+ * copy of the file in charge.
+ *
+ * A RAM index of name hash to record location is built at mount by reading
+ * only the record headers, and lookups after that are O(1). Superseded
+ * records are garbage, and garbage collection copies the live records out
+ * of the sector with the most garbage into the head before erasing it. It
+ * can run a record at a time in the background (gcStep), and only runs in
+ * the foreground when a write would otherwise take the last free sector,
+ * which is kept back so collection always has room to copy into.
+ *
+ * Wear levelling: new head sectors are the free ones with the fewest
+ * erases, and if the erase counts spread too far apart the least worn
+ * active sector is collected even with no garbage, so static data doesn't
+ * pin a sector forever.
+ *
+ * Not thread safe, the caller serialises access. Files can't be bigger than
+ * a sector less the headers.
+ */
+
+#ifndef LOGFS_MAX_SECTORS
+#define LOGFS_MAX_SECTORS 16u
+#endif
+/* Live files plus tombstones still waiting to be collected */
+#ifndef LOGFS_MAX_FILES
+#define LOGFS_MAX_FILES 64u
+#endif
+/* Open addressed, has to be a power of 2 and comfortably more than LOGFS_MAX_FILES */
+#define LOGFS_INDEX_SLOTS 128u
+#define LOGFS_NAME_MAX 31u
+/* Erase count difference that triggers collecting a sector for wear alone */
+#define LOGFS_WEAR_SPREAD 16u
+/* Background collection keeps going until there are this many free sectors */
+#define LOGFS_GC_FREE_TARGET 2u
+
+struct LogFsStats {
+    uint32_t payloadBytes;      // File data handed to write
+    uint32_t programmedBytes;   // Everything actually programmed, headers and collection included
+    uint32_t erases;
+    uint32_t gcCopiedBytes;
+    uint32_t files;
+    uint32_t freeSectors;
+    uint32_t minEraseCount;
+    uint32_t maxEraseCount;
+    uint32_t mountRecords;      // Record headers read by the last mount
+    uint32_t mountBytesRead;
+};
+
+class LogFs {
+    struct SectorInfo {
+        uint32_t eraseCount;
+        uint32_t seq;           // Order the sectors were started in, newest highest
+        uint32_t used;          // Where the next record would go
+        uint32_t live;          // Bytes of records the index still points at
+        bool active;
+    };
+
+    struct IndexEntry {
+        uint32_t hash;
+        uint32_t loc;           // Sector << 20 | offset, LOC_NONE if the slot is empty
+        uint32_t dataLen;
+        uint8_t nameLen;
+        bool deleted;           // Points at a tombstone
+    };
+
+    const FlashDevice *dev;
+    SectorInfo sectors[LOGFS_MAX_SECTORS];
+    IndexEntry index[LOGFS_INDEX_SLOTS];
+    uint32_t entries;
+    uint32_t freeCount;
+    uint32_t head;
+    uint32_t nextSeq;
+
+    bool gcActive;
+    bool gcDropTombstones;
+    uint32_t gcVictim;
+    uint32_t gcDest;            // Sector this collection opened, if it had to
+    uint32_t gcOffset;
+
+    LogFsStats stats;
+    char nameBuf[LOGFS_NAME_MAX + 1];
+    uint32_t copyBuf[16];
+
+    uint32_t addr(const uint32_t sector, const uint32_t offset) const;
+    int readHeader(const uint32_t sector, const uint32_t offset, void *const hdr);
+    bool nameMatches(const IndexEntry &entry, const char *const name, const uint32_t nameLen);
+
+    int findRecord(const void *const header, const uint32_t sector, const uint32_t offset);
+    int findName(const uint32_t hash, const char *const name, const uint32_t nameLen);
+    int findLoc(const uint32_t hash, const uint32_t loc) const;
+    int insertEntry(const uint32_t hash);
+    void removeEntry(uint32_t slot);
+    void setEntry(const uint32_t slot, const uint32_t loc, const uint32_t nameLen, const uint32_t dataLen,
+                  const bool deleted);
+
+    void scanSector(const uint32_t sector);
+    int formatSector(const uint32_t sector, const uint32_t eraseCount);
+    int openHead(const bool forGc);
+    int makeRoom(const uint32_t recSize, const bool forGc);
+    int append(const char *const name, const uint32_t nameLen, const uint16_t flags,
+               const void *const data, const uint32_t dataLen, const uint32_t hash);
+    int programPadded(uint32_t to, const void *const src, const uint32_t len);
+    int copyRecord(const uint32_t from, const uint32_t recSize);
+
+    uint32_t wearVictim(void) const;
+    uint32_t greedyVictim(const uint32_t minGarbage) const;
+    bool canCollect(const uint32_t sector) const;
+    int retireVictim(void);
+
+    public:
+        LogFs();
+        /* Rebuilds the index from flash, formatting any sector that isn't usable */
+        int mount(const FlashDevice &device);
+
+        /* Replaces the whole file. Returns 0, or -1 if it's too big or the flash is full */
+        int write(const char *const name, const void *const data, const uint32_t len);
+        /*
+         * Returns the number of bytes read from offset, or -1 if there's no
+         * such file. Reading a whole file checks its CRC, and fails if it's bad.
+         */
+        int read(const char *const name, void *const buf, const uint32_t len, const uint32_t offset = 0);
+        /* Size of the file, or -1 if there's no such file */
+        int size(const char *const name);
+        int remove(const char *const name);
+
+        /* Whether there's collection worth doing in the background */
+        bool gcWanted(void) const;
+        /* Copies one record or erases one sector. Returns 1 if it did something, 0 if not, -1 on error */
+        int gcStep(void);
+
+        const LogFsStats &getStats();
+};
+
+#endif /* _LOG_FS_H */
@@ -1,6 +1,13 @@
 #include "alloc.h"
+#include "binlog.h"
+#include "boot_report.h"
 #include "drivers.h"
+#include "flash_bench.h"
+#include "flash_mgr.h"
 #include "mem_mgr.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "work_queue.h"
 #include "stm32_rtc.h"
 
 /*
@@ -10,19 +17,34 @@
 void
 ker_main(void)
 {
+    trace_init();
+
     // Test stuff
-    usart_driver_init();
+    BOOT_PHASE(USART_DRIVER_INIT, usart_driver_init());
+    pwr_driver_init();
+    binlog_init(USART3);
     usart_send_string(USART3, "hello world\n", sizeof("hello world\n"));
 
     struct RTC_datetime dt;
     RTC->get_datetime(&dt);
 
-    mem_mgr_init();
-    alloc_init();
+    BOOT_PHASE(MEM_MGR_INIT, mem_mgr_init());
+    BOOT_PHASE(ALLOC_INIT, alloc_init());
     void *p = _malloc(64);
     void *p2 = _malloc(64);
     int *p3 = new int[6];
     _free(p);
     delete[] p3;
     _free(p2);
+
+#if FLASH_BENCHMARK
+    flash_benchmark(USART3);
+#endif
+
+    scheduler_init();
+    work_queue_init();
+    BOOT_PHASE(FLASH_MGR_INIT, (void)flash_mgr_init());
+    boot_report_done();
+    boot_report_print(USART3);
+    scheduler_start();
 }
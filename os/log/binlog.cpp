@@ -0,0 +1,147 @@
+#include "binlog.h"
+#include "clock_driver.h"
+#include "dwt.h"
+#include "usart_driver.h"
+#include "work_queue.h"
+
+#define BINLOG_RING_MASK (BINLOG_RING_WORDS - 1u)
+/* Ring positions run freely in 16 bits, so they fit next to the sequence number */
+#define BINLOG_POS_MASK 0xffffu
+#define BINLOG_SEQ_SHIFT 16u
+
+static_assert((BINLOG_RING_WORDS & BINLOG_RING_MASK) == 0, "BINLOG_RING_WORDS must be a power of 2");
+static_assert(BINLOG_RING_WORDS <= (BINLOG_POS_MASK / 2u), "BINLOG_RING_WORDS must fit the 16 bit positions");
+
+/*
+ * Writers reserve space by moving head along with a compare and swap, so
+ * interrupts don't have to be masked and a writer interrupted mid-record
+ * doesn't hold anyone else up. The header word is written last, and a slot
+ * reads as 0 until it has been: the drain stops at the first record that
+ * isn't finished yet, and zeroes each record once it has been sent.
+ *
+ * reserve holds the next sequence number above head, so the same compare
+ * and swap hands out both, and sequence numbers follow ring order.
+ */
+static uint32_t ring[BINLOG_RING_WORDS];
+static uint32_t reserve;
+static volatile uint32_t tail;
+static BinlogStats stats;
+
+static volatile UsartPeriph *output;
+
+static void drain(void *arg);
+static WorkItem drain_work(drain, nullptr, WorkPriority::Low);
+
+static void
+log_clock(const uint32_t hz)
+{
+    binlog_commit(BINLOG_CLOCK_ID, &hz, 1);
+}
+
+static void
+clock_changed(void *, const ClockEvent event, const ClockRates &, const ClockRates &new_rates)
+{
+    if (event == ClockEvent::POST_CHANGE) {
+        log_clock(new_rates.hclk_hz);
+    }
+}
+
+static ClockNotifier clock_notifier = { clock_changed, nullptr, nullptr };
+
+void
+binlog_init(usart_t usart)
+{
+    output = usart;
+    clock_register_notifier(clock_notifier);
+    log_clock(clock_rates().hclk_hz);
+}
+
+void
+binlog_commit(const uintptr_t fmt, const uint32_t *const args, const uint32_t nargs)
+{
+    const uint32_t words = BINLOG_HEADER_WORDS + nargs;
+
+    /* A record that doesn't fit still takes its sequence number, so the decoder sees the gap */
+    uint32_t old = __atomic_load_n(&reserve, __ATOMIC_RELAXED);
+    bool fits;
+    for ( ;; ) {
+        const uint32_t pos = old & BINLOG_POS_MASK;
+        fits = ((pos + words - tail) & BINLOG_POS_MASK) <= BINLOG_RING_WORDS;
+        const uint32_t next_seq = ((old >> BINLOG_SEQ_SHIFT) + 1u) << BINLOG_SEQ_SHIFT;
+        const uint32_t next = next_seq | (fits ? ((pos + words) & BINLOG_POS_MASK) : pos);
+        if (__atomic_compare_exchange_n(&reserve, &old, next, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (!fits) {
+        __atomic_fetch_add(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    const uint32_t start = old & BINLOG_POS_MASK;
+    const uint32_t seq = old >> BINLOG_SEQ_SHIFT;
+
+    ring[(start + 1) & BINLOG_RING_MASK] = static_cast<uint32_t>(fmt);
+    ring[(start + 2) & BINLOG_RING_MASK] = DWT->get_cycle_count();
+    for (uint32_t i = 0; i < nargs; i++) {
+        ring[(start + BINLOG_HEADER_WORDS + i) & BINLOG_RING_MASK] = args[i];
+    }
+
+    const uint32_t header = (BINLOG_MAGIC << 24) | (nargs << 16) | seq;
+    __atomic_store_n(&ring[start & BINLOG_RING_MASK], header, __ATOMIC_RELEASE);
+    __atomic_fetch_add(&stats.written, 1, __ATOMIC_RELAXED);
+
+    if (!drain_work.pending) {
+        (void)work_submit(drain_work);
+    }
+}
+
+BinlogStats
+binlog_stats(void)
+{
+    BinlogStats copy;
+    copy.written = __atomic_load_n(&stats.written, __ATOMIC_RELAXED);
+    copy.dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+    return copy;
+}
+
+/*
+ * Runs on the low priority worker. Records go out whole through the USART's
+ * DMA queue, so they can't be split up by other output to the same port.
+ * When the queue is full the record stays in the ring and the drain runs
+ * again once the USART has sent some of it, instead of sleeping or
+ * spinning on the worker.
+ */
+static void
+drain(void *)
+{
+    if (output == nullptr) {
+        return;
+    }
+
+    uint32_t record[BINLOG_HEADER_WORDS + BINLOG_MAX_ARGS];
+
+    for ( ;; ) {
+        const uint32_t start = tail;
+        const uint32_t header = __atomic_load_n(&ring[start & BINLOG_RING_MASK], __ATOMIC_ACQUIRE);
+        if ((header >> 24) != BINLOG_MAGIC) {
+            /* Empty, or the next record is still being written */
+            break;
+        }
+
+        const uint32_t words = BINLOG_HEADER_WORDS + ((header >> 16) & 0xff);
+        for (uint32_t i = 0; i < words; i++) {
+            record[i] = ring[(start + i) & BINLOG_RING_MASK];
+        }
+
+        const char *const bytes = reinterpret_cast<const char *>(record);
+        if (usart_try_send(output, bytes, words * sizeof(uint32_t)) < 0) {
+            (void)usart_notify_tx_space(output, drain_work);
+            return;
+        }
+
+        for (uint32_t i = 0; i < words; i++) {
+            ring[(start + i) & BINLOG_RING_MASK] = 0;
+        }
+        tail = (start + words) & BINLOG_POS_MASK;
+    }
+}
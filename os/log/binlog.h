@@ -0,0 +1,86 @@
+#ifndef _BINLOG_H
+#define _BINLOG_H
+
+#include <cstdint>
+#include <type_traits>
+
+#include "stm32_usart.h"
+
+/*
+ * Binary logging with the formatting left to the host.
+ *
+ *   BINLOG("dma stream %u done after %u cycles", stream, cycles);
+ *
+ * The format string goes into the .log_strings section, which isn't loaded
+ * onto the target, and its address there is the record's ID. A call site
+ * only copies the ID, a timestamp and the raw arguments into a ring buffer,
+ * and a low priority worker ships whole records to the USART in the
+ * background. tools/binlog/binlog_decode.py turns them back into text using
+ * the strings in the ELF.
+ *
+ * Arguments are sent as 32 bit words: integers, characters and pointers.
+ * %s only works for strings in flash, since the host reads them from the ELF.
+ * If the ring is full the record is dropped and counted, the caller never
+ * waits.
+ *
+ * The core clock goes into the stream too, when logging starts and each
+ * time it changes, so the decoder can turn cycle counts into time.
+ */
+
+#define BINLOG_MAX_ARGS 6u
+/* Ring size in 32 bit words, must be a power of 2 and at most 32768 */
+#ifndef BINLOG_RING_WORDS
+#define BINLOG_RING_WORDS 512u
+#endif
+
+/*
+ * Record layout, in little endian words:
+ *  0: BINLOG_MAGIC << 24 | number of arguments << 16 | sequence number
+ *  1: format string ID
+ *  2: DWT cycle count
+ *  3...: arguments
+ * Sequence numbers go up by one per record in the order they're sent, and
+ * records dropped for lack of room still use one up, so any gap is a loss.
+ */
+#define BINLOG_MAGIC 0xb1u
+#define BINLOG_HEADER_WORDS 3u
+/* Format ID of the records holding the core clock in Hz, as their one argument */
+#define BINLOG_CLOCK_ID 0xffffffffu
+
+struct BinlogStats {
+    uint32_t written;
+    uint32_t dropped;
+};
+
+void binlog_init(usart_t usart);
+void binlog_commit(const uintptr_t fmt, const uint32_t *args, const uint32_t nargs);
+BinlogStats binlog_stats(void);
+
+template <typename T>
+static inline uint32_t
+binlog_word(const T value)
+{
+    if constexpr (std::is_pointer<T>::value) {
+        return static_cast<uint32_t>(reinterpret_cast<uintptr_t>(value));
+    } else {
+        return static_cast<uint32_t>(value);
+    }
+}
+
+template <typename... Args>
+static inline void
+binlog_write(const uintptr_t fmt, const Args... args)
+{
+    static_assert(sizeof...(Args) <= BINLOG_MAX_ARGS, "Too many arguments for BINLOG");
+    /* The extra 0 keeps the array from being empty */
+    const uint32_t words[] = { binlog_word(args)..., 0 };
+    binlog_commit(fmt, words, sizeof...(Args));
+}
+
+#define BINLOG(_fmt, ...)                                                               \
+    do {                                                                                \
+        static const char _binlog_fmt[] __attribute__((section(".log_strings"), used)) = _fmt; \
+        binlog_write(reinterpret_cast<uintptr_t>(_binlog_fmt), ##__VA_ARGS__);          \
+    } while (0)
+
+#endif /* _BINLOG_H */
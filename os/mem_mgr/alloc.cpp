@@ -1,7 +1,16 @@
 #include <new>
 
 #include "alloc.h"
+#include "dma_driver.h"
 #include "mem_mgr.h"
+#include "ramfunc.h"
+#include "trace.h"
+
+#if ALLOC_RECORDING
+#include "dwt.h"
+#include "irq.h"
+#include "usart_driver.h"
+#endif
 /*
  * Planned interface:
  *  1) ker_malloc:
@@ -134,6 +143,13 @@ round_up_to_mult(const size_t value, const size_t mult_of)
     return round_down + mult_of;
 }
 
+/*
+ * A free entry on list n needs room for its size and n + 1 next pointers.
+ * The list sizes guarantee that with 4 byte pointers, but 16 bytes isn't
+ * enough for two 8 byte ones (e.g. in the host replay tool).
+ */
+#define LIST_ENTRY_SIZE(list) (sizeof(size_t) + (((list) + 1) * sizeof(void *)))
+
 static unsigned
 which_skiplist_by_size(const size_t size)
 {
@@ -141,7 +157,7 @@ which_skiplist_by_size(const size_t size)
         return 3;
     } else if (size >= 64) {
         return 2;
-    } else if (size >= 16) {
+    } else if ((size >= 16) && (size >= LIST_ENTRY_SIZE(1))) {
         return 1;
     } else {
         return 0;
@@ -216,7 +232,7 @@ class Skiplist {
 
         /* Helpers for realloc */
         void copy_and_resize(list_walker& lw, free_entry& dest, const free_entry& src, const size_t new_size);
-        void resize_allocated_block(list_walker& lw, const free_entry *const allocated_block, const size_t old_size, const size_t new_size);
+        bool resize_allocated_block(list_walker& lw, const free_entry *const allocated_block, const size_t old_size, const size_t new_size);
 
         /* Unused - delete? */
         void shrink_entry(list_walker& lw, free_entry& entry, const size_t shrink_amt);
@@ -231,7 +247,7 @@ void
 Skiplist::free_entry::copy_from(const free_entry& fe)
 {
     size = fe.size;
-    for (unsigned i = 0; i < fe.skiplist(); i++) {
+    for (unsigned i = 0; i <= fe.skiplist(); i++) {
         next[i] = fe.next[i];
     }
 }
@@ -246,8 +262,13 @@ Skiplist::list_links::list_links(const Skiplist &list)
 Skiplist::list_walker::list_walker(const unsigned skip_list, const Skiplist &list_start)
     : skiplist_num(skip_list),
       curr_block(list_start.heads[skip_list]),
-      links(list_start) { }
+      links(list_start)
+{
+    /* The lower lists can have entries before the first one on this list */
+    advance_links();
+}
 
+RAMFUNC
 void
 Skiplist::list_walker::move_next()
 {
@@ -255,16 +276,20 @@ Skiplist::list_walker::move_next()
     advance_links();
 }
 
+RAMFUNC
 void
 Skiplist::list_walker::advance_links()
 {
     for (unsigned i = 0; i < NUM_FREE_LISTS; i++) {
-        if (*(links.lists[i]) < curr_block) {
-            /* Advance the links forward, but only if they don't pass p.
-             * This is because the links will be used to update the next
-             * pointers in the list once an entry is allocated, so we need
-             * to stay behind p.
-             */
+        /* Advance the links forward, but only if they don't pass p.
+         * This is because the links will be used to update the next
+         * pointers in the list once an entry is allocated, so we need
+         * to stay behind p. The higher lists are sparser than the one
+         * being walked, so they may need several steps or none at all.
+         * A null curr_block is the end of the list, past every entry.
+         */
+        while ((*(links.lists[i]) != nullptr)
+               && ((curr_block == nullptr) || (*(links.lists[i]) < curr_block))) {
             struct free_entry *next_entry = *(links.lists[i]);
             links.lists[i] = &next_entry->next[i];
         }
@@ -441,14 +466,14 @@ Skiplist::copy_and_resize(list_walker& lw, free_entry& dest, const free_entry& s
     }
 }
 
-void
+bool
 Skiplist::resize_allocated_block(list_walker& lw, const free_entry *const allocated_block, const size_t old_size, const size_t new_size)
 {
     const uintptr_t ab_int = reinterpret_cast<uintptr_t>(allocated_block);
     const uintptr_t curr_block_int = reinterpret_cast<uintptr_t>(lw.curr_block);
     if ((ab_int + old_size) != curr_block_int) {
         /* allocated_block must be adjacent to the currently selected block */
-        return;
+        return false;
     }
 
     if (old_size > new_size) {
@@ -464,7 +489,10 @@ Skiplist::resize_allocated_block(list_walker& lw, const free_entry *const alloca
     } else {
         /* Extending p */
         const unsigned size_diff = new_size - old_size;
-        if ((lw.curr_block->size - size_diff) < MIN_ALLOC_SIZE) {
+        if (lw.curr_block->size < size_diff) {
+            /* Following block is too small to extend into */
+            return false;
+        } else if ((lw.curr_block->size - size_diff) < MIN_ALLOC_SIZE) {
             /* Allocate all of curr_block */
             allocate_entire_block(lw);
         } else {
@@ -477,12 +505,19 @@ Skiplist::resize_allocated_block(list_walker& lw, const free_entry *const alloca
             lw.curr_block = new_block;
         }
     }
+
+    return true;
 }
 
 /*
  * The ker_* functions expect proper input values, should only be called
  * from the _* functions at the bottom of the file
+ *
+ * The list walks in malloc and free run from RAM (see ramfunc.h), along
+ * with the entry points that lead to them. The splitting and coalescing
+ * done once a spot is found stays in the flash.
  */
+RAMFUNC
 void *
 Skiplist::malloc(const size_t size) {
     const unsigned skip_list = which_skiplist_by_size(size);
@@ -509,6 +544,7 @@ Skiplist::malloc(const size_t size) {
     return malloc(size);
 }
 
+RAMFUNC
 void
 Skiplist::free(const size_t size, void *const pointer_to_free)
 {
@@ -521,7 +557,8 @@ Skiplist::free(const size_t size, void *const pointer_to_free)
         lw.move_next();
     }
 
-    /* Get pointer to block previous to p */
+    /* Get pointer to block previous to p, if there is one */
+    const bool has_prev = lw.links.lists[0] != &heads[0];
     const uintptr_t prev_int = reinterpret_cast<uintptr_t>(lw.links.lists[0]) - offsetof(free_entry, next);
     free_entry *const prev = reinterpret_cast<free_entry *>(prev_int);
     /* uint versions of pointers for comparisons */
@@ -531,7 +568,7 @@ Skiplist::free(const size_t size, void *const pointer_to_free)
     if (lw.curr_block != nullptr) {
         /* Freed memory block belongs just before curr_block */
 
-        if ((prev_int + prev->size) == p_int) {
+        if (has_prev && ((prev_int + prev->size) == p_int)) {
             /* Can coalesce freed block with previous block */
 
             if ((p_int + size) == curr_block_int) {
@@ -553,7 +590,7 @@ Skiplist::free(const size_t size, void *const pointer_to_free)
         }
     } else {
         /* We got to the end of the list, so this block must belong on the end */
-        if ((prev_int + size) == p_int) {
+        if (has_prev && ((prev_int + prev->size) == p_int)) {
             /* Can coalesce with previous */
             expand_entry(lw, *prev, size);
         } else {
@@ -567,10 +604,10 @@ void *
 Skiplist::resize(const size_t old_size, const size_t new_size, void *const pointer_to_resize)
 {
     free_entry *const p = static_cast<free_entry *>(pointer_to_resize);
-    const unsigned old_skip_list = which_skiplist_by_size(old_size);
     const bool expanding = new_size > old_size;
 
-    list_walker lw = get_walker(old_skip_list);
+    /* The following block can be any size, so walk the lowest list */
+    list_walker lw = get_walker(0);
 
     /* Find free block following p */
     while (lw.curr_block && (lw.curr_block <= p)) {
@@ -582,8 +619,10 @@ Skiplist::resize(const size_t old_size, const size_t new_size, void *const point
     const uintptr_t curr_block_int = reinterpret_cast<uintptr_t>(lw.curr_block);
     if ((lw.curr_block != nullptr) && ((p_int + old_size) == curr_block_int)) {
         /* Following block is free and is adjacent to p, extend/shrink p */
-        resize_allocated_block(lw, p, old_size, new_size);
-        return p;
+        if (resize_allocated_block(lw, p, old_size, new_size)) {
+            return p;
+        }
+        return nullptr;
     } else {
         /* Not connected, will need to create a new free_entry */
         if (expanding) {
@@ -610,57 +649,213 @@ Skiplist::resize(const size_t old_size, const size_t new_size, void *const point
     return nullptr;
 }
 
-/* Entry point for each skip list */
-static Skiplist free_list_start(nullptr);
+/*
+ * Entry point for each skip list, one per zone. A block goes back to the
+ * list of the zone it's in, so the lists never mix.
+ */
+static Skiplist sram_list(nullptr);
+static Skiplist ccm_list(nullptr);
+
+static void *
+sram_pages(const size_t size)
+{
+    return allocateZonePages(MemZone::SRAM, size);
+}
+
+static void *
+ccm_pages(const size_t size)
+{
+    return allocateZonePages(MemZone::CCM, size);
+}
+
+static Skiplist &
+list_for(const enum MemZone zone)
+{
+    return (zone == MemZone::CCM) ? ccm_list : sram_list;
+}
+
+/* CCM first for MEM_FAST, unless it has to be reachable by DMA */
+RAMFUNC
+static void *
+zone_malloc(const size_t size, const uint32_t flags)
+{
+    if ((flags & MEM_FAST) && !(flags & MEM_DMA)) {
+        void *const p = ccm_list.malloc(size);
+        if (p != nullptr) {
+            return p;
+        }
+    }
+    return sram_list.malloc(size);
+}
+
+#if ALLOC_RECORDING
+AllocRecording alloc_recording;
+static volatile bool recording;
+
+void
+alloc_record_start(void)
+{
+    const uint32_t primask = irq_save();
+    alloc_recording.magic = ALLOC_RECORD_MAGIC;
+    alloc_recording.version = ALLOC_RECORD_VERSION;
+    alloc_recording.record_size = sizeof(AllocRecord);
+    alloc_recording.capacity = ALLOC_RECORDS;
+    alloc_recording.count = 0;
+    alloc_recording.dropped = 0;
+    recording = true;
+    irq_restore(primask);
+}
+
+void
+alloc_record_stop(void)
+{
+    recording = false;
+}
+
+static void
+fill_record(AllocRecord &record, const enum alloc_op op, const uint32_t start, const uint32_t end,
+        const void *const caller, const void *const addr, const size_t size)
+{
+    record.cycles = start;
+    record.duration = end - start;
+    record.caller = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(caller));
+    record.addr = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(addr));
+    record.size_op = (static_cast<uint32_t>(op) << 24) | (size & 0xffffff);
+}
+
+/* Takes count records at once, so a realloc's pair stays together */
+static AllocRecord *
+claim_records(const uint32_t count)
+{
+    if (!recording) {
+        return nullptr;
+    }
+    if ((alloc_recording.count + count) > ALLOC_RECORDS) {
+        alloc_recording.dropped++;
+        return nullptr;
+    }
+    AllocRecord *const records = &alloc_recording.records[alloc_recording.count];
+    alloc_recording.count += count;
+    return records;
+}
+
+static void
+record_call(const enum alloc_op op, const uint32_t start, const void *const caller, const void *const addr,
+        const size_t size)
+{
+    const uint32_t end = DWT->get_cycle_count();
+    const uint32_t primask = irq_save();
+    AllocRecord *const record = claim_records(1);
+    if (record != nullptr) {
+        fill_record(*record, op, start, end, caller, addr, size);
+    }
+    irq_restore(primask);
+}
+
+static void
+record_realloc(const enum alloc_op op, const uint32_t start, const void *const caller,
+        const void *const old_addr, const size_t old_size, const void *const addr, const size_t size)
+{
+    const uint32_t end = DWT->get_cycle_count();
+    const uint32_t primask = irq_save();
+    AllocRecord *const records = claim_records(2);
+    if (records != nullptr) {
+        fill_record(records[0], ALLOC_OP_REALLOC_FROM, start, start, caller, old_addr, old_size);
+        fill_record(records[1], op, start, end, caller, addr, size);
+    }
+    irq_restore(primask);
+}
+
+/* Sends the buffer as it sits in memory, the same as a debugger dump */
+void
+alloc_record_dump(usart_t usart)
+{
+    alloc_record_stop();
+
+    const char *const data = reinterpret_cast<const char *>(&alloc_recording);
+    const uint32_t size = offsetof(AllocRecording, records) + (alloc_recording.count * sizeof(AllocRecord));
+    (void)usart_send_blocking(usart, data, size, USART_SEND_TIMEOUT_TICKS);
+}
+
+/* Macros so __builtin_return_address is the recorded function's caller */
+#define RECORD_START() const uint32_t record_start = DWT->get_cycle_count()
+#define RECORD(_op, _addr, _size) \
+    record_call(ALLOC_OP_##_op, record_start, __builtin_return_address(0), (_addr), (_size))
+#define RECORD_REALLOC(_op, _old_addr, _old_size, _addr, _size) \
+    record_realloc(ALLOC_OP_##_op, record_start, __builtin_return_address(0), (_old_addr), (_old_size), \
+            (_addr), (_size))
+#else
+#define RECORD_START() do { } while (0)
+#define RECORD(_op, _addr, _size) do { } while (0)
+#define RECORD_REALLOC(_op, _old_addr, _old_size, _addr, _size) do { } while (0)
+#endif
 
 /* Initializes structures required for allocator to work */
 //TODO: skiplist needs an allocation function from mem_mgr to get blocks of mem
 void
 alloc_init(void) {
-    free_list_start = Skiplist(allocatePages);
+    sram_list = Skiplist(sram_pages);
+    ccm_list = Skiplist(ccm_pages);
+#if ALLOC_RECORDING
+    alloc_record_start();
+#endif
 }
 
 /* The _ker_* functions assume the caller enforces the restrictions
  * e.g. aligned sizes, aligned pointers
  */
+RAMFUNC
 void *
-_ker_malloc(const size_t req_size)
+_ker_malloc(const size_t req_size, const uint32_t flags)
 {
-    return free_list_start.malloc(req_size);
+    RECORD_START();
+    void *const p = zone_malloc(req_size, flags);
+    TRACE(MALLOC, 0, p, req_size);
+    RECORD(KER_MALLOC, p, req_size);
+    return p;
 }
 
 void *
-_ker_calloc(const size_t req_size)
+_ker_calloc(const size_t req_size, const uint32_t flags)
 {
-    size_t *p = static_cast<size_t *>(free_list_start.malloc(req_size));
+    RECORD_START();
+    size_t *p = static_cast<size_t *>(zone_malloc(req_size, flags));
     if (p == nullptr) {
+        RECORD(KER_CALLOC, nullptr, req_size);
         return nullptr;
     }
+    TRACE(MALLOC, 0, p, req_size);
 
     /* p is assumed to be a multiple of size_t bytes */
     const size_t count = req_size / sizeof(size_t);
-    for (unsigned i = 0; i < count; i++) {
-        size_t *c = p;
-        c[i] = 0;
-    }
+    dma_memset(p, 0, count * sizeof(size_t));
+    RECORD(KER_CALLOC, p, req_size);
     return p;
 }
 
+RAMFUNC
 void
 _ker_free(const size_t req_size, void *const p)
 {
-    free_list_start.free(req_size, p);
+    RECORD_START();
+    TRACE(FREE, 0, p, req_size);
+    list_for(memZoneOf(p)).free(req_size, p);
+    RECORD(KER_FREE, p, req_size);
 }
 
 void *
 _ker_realloc(const size_t old_size, const size_t new_size, void *const p)
 {
-    size_t *ret = static_cast<size_t *>(free_list_start.resize(old_size, new_size, static_cast<void *>(p)));
+    RECORD_START();
+    const enum MemZone zone = memZoneOf(p);
+    size_t *ret = static_cast<size_t *>(list_for(zone).resize(old_size, new_size, static_cast<void *>(p)));
     if (ret == nullptr) {
-        /* Need to allocate new block */
-        ret = static_cast<size_t *>(free_list_start.malloc(new_size));
+        /* Need to allocate new block, in the same zone if there's room */
+        const uint32_t flags = (zone == MemZone::CCM) ? MEM_FAST : 0;
+        ret = static_cast<size_t *>(zone_malloc(new_size, flags));
         if (ret == nullptr) {
             /* Couldn't allocate more mem */
+            RECORD_REALLOC(KER_REALLOC, p, old_size, nullptr, new_size);
             return nullptr;
         }
 
@@ -672,34 +867,41 @@ _ker_realloc(const size_t old_size, const size_t new_size, void *const p)
             copy_size = old_size;
         }
 
-        size_t count = copy_size / sizeof(size_t);
+        const size_t count = copy_size / sizeof(size_t);
         size_t *const r = static_cast<size_t *>(ret);
-        size_t *const c = static_cast<size_t *>(p);
-        for (size_t i = 0; i < count; i++) {
-            r[i] = c[i];
-        }
+        dma_memcpy(r, p, count * sizeof(size_t));
 
         /* Free old mem */
-        free_list_start.free(old_size, static_cast<void *>(p));
+        list_for(zone).free(old_size, static_cast<void *>(p));
 
+        TRACE(FREE, 0, p, old_size);
+        TRACE(MALLOC, 0, r, new_size);
+        RECORD_REALLOC(KER_REALLOC, p, old_size, r, new_size);
         return static_cast<void *>(r);
     }
 
+    TRACE(FREE, 0, p, old_size);
+    TRACE(MALLOC, 0, ret, new_size);
+    RECORD_REALLOC(KER_REALLOC, p, old_size, ret, new_size);
     return ret;
 }
 
+RAMFUNC
 void *
 _malloc(const size_t req_size) {
     if (req_size == 0) {
         return NULL;
     }
+    RECORD_START();
 
     const size_t size = round_up_to_mult(req_size, ALIGNMENT) + MALLOC_HEADER_SIZE;
 
     size_t *p = static_cast<size_t *>(_ker_malloc(size));
     p[0] = size;
     const uintptr_t p_int = reinterpret_cast<uintptr_t>(p);
-    return reinterpret_cast<void *>(p_int + MALLOC_HEADER_SIZE);
+    void *const ret = reinterpret_cast<void *>(p_int + MALLOC_HEADER_SIZE);
+    RECORD(MALLOC, ret, req_size);
+    return ret;
 }
 
 void *
@@ -707,15 +909,19 @@ _calloc(const size_t req_size) {
     if (req_size == 0) {
         return NULL;
     }
+    RECORD_START();
 
     const size_t size = round_up_to_mult(req_size, ALIGNMENT) + MALLOC_HEADER_SIZE;
 
     size_t *p = static_cast<size_t *>(_ker_calloc(size));
     p[0] = size;
     const uintptr_t p_int = reinterpret_cast<uintptr_t>(p);
-    return reinterpret_cast<void *>(p_int + MALLOC_HEADER_SIZE);
+    void *const ret = reinterpret_cast<void *>(p_int + MALLOC_HEADER_SIZE);
+    RECORD(CALLOC, ret, req_size);
+    return ret;
 }
 
+RAMFUNC
 void
 _free(void *const p) {
     if (UNALIGNED(p) || (p == nullptr)) {
@@ -726,7 +932,9 @@ _free(void *const p) {
     size_t *const q = reinterpret_cast<size_t *>(p_int - MALLOC_HEADER_SIZE);
     const size_t size = q[0];
 
+    RECORD_START();
     _ker_free(size, static_cast<void *>(q));
+    RECORD(FREE, p, size - MALLOC_HEADER_SIZE);
 }
 
 void *
@@ -752,8 +960,10 @@ _realloc(const size_t req_size, void *const p) {
         return p;
     }
     /* Actual realloc */
+    RECORD_START();
     size_t *ret = static_cast<size_t *>(_ker_realloc(old_size, new_size, static_cast<void *>(q)));
     if (ret == nullptr) {
+        RECORD_REALLOC(REALLOC, p, old_size - MALLOC_HEADER_SIZE, nullptr, req_size);
         return nullptr;
     }
 
@@ -761,7 +971,9 @@ _realloc(const size_t req_size, void *const p) {
     ret[0] = new_size;
 
     const uintptr_t ret_int = reinterpret_cast<uintptr_t>(ret);
-    return reinterpret_cast<void *>(ret_int + MALLOC_HEADER_SIZE);
+    void *const user_ret = reinterpret_cast<void *>(ret_int + MALLOC_HEADER_SIZE);
+    RECORD_REALLOC(REALLOC, p, old_size - MALLOC_HEADER_SIZE, user_ret, req_size);
+    return user_ret;
 }
 
 void *operator new(size_t size)
@@ -1,10 +1,87 @@
 #ifndef ALLOC_H
 #define ALLOC_H
 
+#include <cstdint>
 #include <cstdio>
 
-void *_ker_malloc(const size_t req_size);
-void *_ker_calloc(const size_t req_size);
+#include "mem_mgr.h"
+
+/*
+ * Allocation recorder. Every _ker_* and user level call is logged with its
+ * size, address, caller and timing into a RAM buffer, from alloc_init on. The
+ * dump is replayed on the host by tools/alloc_replay to compare allocators
+ * on what the device actually asked for. Build with ALLOC_RECORDING=1 to
+ * turn it on.
+ */
+#ifndef ALLOC_RECORDING
+#define ALLOC_RECORDING 0
+#endif
+
+#if ALLOC_RECORDING
+#include "stm32_usart.h"
+
+#ifndef ALLOC_RECORDS
+#define ALLOC_RECORDS 512u
+#endif
+
+#define ALLOC_RECORD_MAGIC 0x43524c41u      // "ALRC"
+#define ALLOC_RECORD_VERSION 1u
+
+enum alloc_op : uint8_t {
+    ALLOC_OP_KER_MALLOC = 1,
+    ALLOC_OP_KER_CALLOC,
+    ALLOC_OP_KER_FREE,
+    ALLOC_OP_KER_REALLOC,
+    ALLOC_OP_MALLOC,
+    ALLOC_OP_CALLOC,
+    ALLOC_OP_FREE,
+    ALLOC_OP_REALLOC,
+    /* Comes just before a realloc, with the block it was given */
+    ALLOC_OP_REALLOC_FROM,
+};
+
+struct AllocRecord {
+    uint32_t cycles;        // DWT cycle count when the call was made
+    uint32_t duration;      // Cycles the call took
+    uint32_t caller;        // Return address
+    uint32_t addr;          // Block returned (0 if it failed), or the block freed
+    uint32_t size_op;       // op << 24 | size
+};
+
+static_assert(sizeof(AllocRecord) == 20, "AllocRecord layout is shared with the host tool");
+
+/* Laid out for the host tool, all little endian */
+struct AllocRecording {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    volatile uint32_t count;
+    volatile uint32_t dropped;
+    AllocRecord records[ALLOC_RECORDS];
+};
+
+extern AllocRecording alloc_recording;
+
+/*
+ * Recording stops when the buffer is full, rather than wrapping, so a replay
+ * always starts from a known heap. Restarting clears the buffer.
+ */
+void alloc_record_start(void);
+void alloc_record_stop(void);
+/*
+ * Stops recording and sends the buffer out of the USART. Blocks until it's
+ * queued, or gives up if the USART stops taking it.
+ */
+void alloc_record_dump(usart_t usart);
+#endif
+
+/*
+ * flags are mem_mgr's MEM_FAST and MEM_DMA, picking the zone a block comes
+ * from. Frees and reallocs go by the zone the block is already in.
+ */
+void *_ker_malloc(const size_t req_size, const uint32_t flags = 0);
+void *_ker_calloc(const size_t req_size, const uint32_t flags = 0);
 void _ker_free(const size_t req_size, void *const p);
 void *_ker_realloc(const size_t old_size, const size_t new_size, void *const p);
 
@@ -18,26 +18,75 @@
  *     bit-band region (1 MB) followed by 31 MB of normal SRAM followed by 32 MB of
  *     the bit-band's alias section. Don't write into this alias section to avoid
  *     clobbering the data in the bit-band region
+ *
+ * Each zone (see mem_mgr.h) has its own PageList. Frees and allocations at a
+ * fixed address go to whichever zone the address is in.
  */
 
 /* Variables defined in the linker script */
 extern unsigned int _ALLOCABLE_MEM;
 extern unsigned int _DATA_RAM_START;
+#ifdef __STM32F4xx__
+extern unsigned int _CCM_RAM_END;
+#endif
 
 static void *const ALLOCABLE_MEM_START = &_ALLOCABLE_MEM;
 static size_t NUM_ALLOCABLE_PAGES;
 static size_t ALLOCABLE_MEM_SIZE;
 static void *ALLOCATION_START;
 
-static PageList pageList;
+static PageList zonePages[NUM_MEM_ZONES];
 
-void *allocatePages(const size_t size) {
+static size_t sizeToPages(const size_t size) {
     const size_t roundedDown = (size - 1) & ~(PAGE_SIZE - 1);
     const size_t roundedUp = roundedDown + PAGE_SIZE;
-    const size_t numPages = roundedUp / PAGE_SIZE;
-    return pageList.allocatePages(numPages);
+    return roundedUp / PAGE_SIZE;
 }
 
+static PageList &pagesFor(const enum MemZone zone) {
+    return zonePages[static_cast<uint32_t>(zone)];
+}
+
+static uintptr_t roundUpToPage(const uintptr_t addr) {
+    return ((addr - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
+}
+
+void *allocatePages(const size_t size, const uint32_t flags) {
+    if ((flags & MEM_FAST) && !(flags & MEM_DMA)) {
+        void *const pages = allocateZonePages(MemZone::CCM, size);
+        if (pages != nullptr) {
+            return pages;
+        }
+    }
+    return allocateZonePages(MemZone::SRAM, size);
+}
+
+void *allocateZonePages(const enum MemZone zone, const size_t size) {
+    return pagesFor(zone).allocatePages(sizeToPages(size));
+}
+
+void *allocatePagesAt(const size_t size, void *const startAddr) {
+    return pagesFor(memZoneOf(startAddr)).allocatePagesAt(sizeToPages(size), startAddr);
+}
+
+void freePages(const size_t size, void *const startAddr) {
+    pagesFor(memZoneOf(startAddr)).freePages(sizeToPages(size), startAddr);
+}
+
+#ifdef __STM32F4xx__
+/* Whatever .ccmram leaves of the CCM RAM, in whole pages */
+static void
+ccmZoneInit()
+{
+    const uintptr_t start = roundUpToPage(reinterpret_cast<uintptr_t>(&_CCM_RAM_END));
+    const uintptr_t end = CCMRAM_BASE + CCMRAM_SIZE;
+    if (start >= end) {
+        return;
+    }
+    pagesFor(MemZone::CCM).initialize((end - start) / PAGE_SIZE, reinterpret_cast<void *>(start));
+}
+#endif
+
 void
 mem_mgr_init()
 {
@@ -49,9 +98,11 @@ mem_mgr_init()
     NUM_ALLOCABLE_PAGES = (allocableMemSize / PAGE_SIZE) - 1;
     ALLOCABLE_MEM_SIZE = NUM_ALLOCABLE_PAGES * PAGE_SIZE;
     // Allocation needs to start at an aligned address - round up to nearest page boundary
-    const uintptr_t alignedAllocationStart = ((allocableMem - 1) & ~(PAGE_SIZE - 1)) + PAGE_SIZE;
-    ALLOCATION_START = reinterpret_cast<void *>(alignedAllocationStart);
-    pageList.initialize(NUM_ALLOCABLE_PAGES, ALLOCATION_START);
+    ALLOCATION_START = reinterpret_cast<void *>(roundUpToPage(allocableMem));
+    pagesFor(MemZone::SRAM).initialize(NUM_ALLOCABLE_PAGES, ALLOCATION_START);
+#ifdef __STM32F4xx__
+    ccmZoneInit();
+#endif
 
     MPU->init();
 }
@@ -3,15 +3,58 @@
 
 #include <cstdio>
 
+#include "chip_common.h"
+
 #define PAGE_SIZE (2 * 1024)
 
+/*
+ * Pages come from one of two zones:
+ *   SRAM: the main SRAM, which the DMA can reach
+ *   CCM:  the F4's core coupled RAM. No wait states and never contended by
+ *         the DMA, but the DMA can't reach it either. Empty on the F2.
+ */
+enum class MemZone : uint8_t {
+    SRAM,
+    CCM,
+    NUM_ZONES,
+};
+
+#define NUM_MEM_ZONES static_cast<uint32_t>(MemZone::NUM_ZONES)
+
+/*
+ * Allocation flags. With neither, memory comes from SRAM as it always has.
+ *   MEM_FAST: CCM if there's room, SRAM otherwise. For memory only the CPU
+ *             touches, e.g. thread stacks and kernel control blocks.
+ *   MEM_DMA:  has to be reachable by the DMA, so SRAM only whatever else is
+ *             asked for.
+ */
+#define MEM_FAST    (1u << 0)
+#define MEM_DMA     (1u << 1)
+
 class MemMgr {
     public:
         MemMgr();
 };
 
-void *allocatePages(const size_t size);
+/* The zone memory at p belongs to, going by address alone */
+static inline enum MemZone
+memZoneOf(const void *const p)
+{
+#ifdef __STM32F4xx__
+    const uintptr_t addr = reinterpret_cast<uintptr_t>(p);
+    if ((addr >= CCMRAM_BASE) && (addr < (CCMRAM_BASE + CCMRAM_SIZE))) {
+        return MemZone::CCM;
+    }
+#else
+    (void)p;
+#endif
+    return MemZone::SRAM;
+}
+
+void *allocatePages(const size_t size, const uint32_t flags = 0);
+void *allocateZonePages(const enum MemZone zone, const size_t size);
+void *allocatePagesAt(const size_t size, void *const startAddr);
+void freePages(const size_t size, void *const startAddr);
 void mem_mgr_init();
 
 #endif /* MEM_MGR_H */
-
@@ -98,7 +98,7 @@ PageList::allocatePages(const size_t numPages)
         // Need to put the extra pages back in the list
         const uintptr_t iterator_int = reinterpret_cast<uintptr_t>(iterator);
         const size_t leftoverPages = iterator->numPages - numPages;
-        const uintptr_t reinsertSequenceAddr = iterator_int + (leftoverPages * PAGE_SIZE);
+        const uintptr_t reinsertSequenceAddr = iterator_int + (numPages * PAGE_SIZE);
 
         PageSequence *const pagesToReinsert = reinterpret_cast<PageSequence *>(reinsertSequenceAddr);
         pagesToReinsert->numPages = leftoverPages;
@@ -108,6 +108,57 @@ PageList::allocatePages(const size_t numPages)
     return static_cast<void *>(iterator);
 }
 
+/*
+ * Allocates the given pages at exactly startAddr. Used when memory has to come
+ * back at the address it was given up from e.g. swapping a process back in.
+ * Fails if any of the pages are already in use.
+ */
+void *
+PageList::allocatePagesAt(const size_t numPages, void *const startAddr)
+{
+    const uintptr_t start = reinterpret_cast<uintptr_t>(startAddr);
+    const uintptr_t end = start + (numPages * PAGE_SIZE);
+
+    // Find the free sequence that fully contains the requested pages
+    PageSequence *iterator = sentinel.next;
+    while (iterator != &sentinel) {
+        const uintptr_t sequenceStart = reinterpret_cast<uintptr_t>(iterator);
+        const uintptr_t sequenceEnd = sequenceStart + (iterator->numPages * PAGE_SIZE);
+        if ((sequenceStart <= start) && (end <= sequenceEnd)) {
+            break;
+        }
+        iterator = iterator->next;
+    }
+
+    if (iterator == &sentinel) {
+        // At least one of the pages is allocated
+        return nullptr;
+    }
+
+    const uintptr_t sequenceStart = reinterpret_cast<uintptr_t>(iterator);
+    const uintptr_t sequenceEnd = sequenceStart + (iterator->numPages * PAGE_SIZE);
+    const size_t leadingPages = (start - sequenceStart) / PAGE_SIZE;
+    const size_t trailingPages = (sequenceEnd - end) / PAGE_SIZE;
+
+    PageSequence *insertPoint = iterator->prev;
+    iterator->remove();
+
+    if (leadingPages > 0) {
+        // Pages before the requested ones stay where they were
+        iterator->numPages = leadingPages;
+        insertPoint->insertAfter(*iterator);
+        insertPoint = iterator;
+    }
+
+    if (trailingPages > 0) {
+        PageSequence *const trailingSequence = reinterpret_cast<PageSequence *>(end);
+        trailingSequence->numPages = trailingPages;
+        insertPoint->insertAfter(*trailingSequence);
+    }
+
+    return startAddr;
+}
+
 void
 PageList::freePages(const size_t numPages, void *startAddr)
 {
@@ -24,6 +24,7 @@ class PageList {
         ~PageList();
         void initialize(const size_t numPages, void *const startAddr);
         void *allocatePages(const size_t numPages);
+        void *allocatePagesAt(const size_t numPages, void *const startAddr);
         void freePages(const size_t numPages, void *startAddr);
 };
 
@@ -0,0 +1,182 @@
+#include "alloc.h"
+#include "dwt.h"
+#include "lz_codec.h"
+#include "mem_mgr.h"
+#include "swap.h"
+
+#define SWAP_ALIGNMENT 8u
+
+/*
+ * One swapped out page, or the whole of a region smaller than a page. The
+ * (possibly compressed) data follows directly after this header in the same
+ * allocation.
+ */
+struct SwapEntry {
+    SwapEntry *next;
+    void *pageAddr;
+    uint16_t pageSize;  // Bytes of the region this entry restores
+    uint16_t storedSize;
+    bool compressed;    // False if the page didn't compress, data is a raw copy
+
+    uint8_t *data() { return reinterpret_cast<uint8_t *>(this + 1); };
+};
+
+static SwapStats stats;
+
+/* Compression output lands here first so we know how much pool memory to allocate */
+static uint8_t scratch[LZ_BOUND(PAGE_SIZE)];
+
+static size_t
+entryAllocSize(const size_t storedSize)
+{
+    const size_t size = sizeof(SwapEntry) + storedSize;
+    return (size + SWAP_ALIGNMENT - 1) & ~(SWAP_ALIGNMENT - 1);
+}
+
+static void
+freeEntry(SwapEntry *const entry)
+{
+    const size_t allocSize = entryAllocSize(entry->storedSize);
+    stats.poolBytes -= allocSize;
+    stats.pagesOut--;
+    _ker_free(allocSize, entry);
+}
+
+int
+swapOutRegion(void *const addr, const size_t size, SwapEntry **const list)
+{
+    const uintptr_t regionStart = reinterpret_cast<uintptr_t>(addr);
+
+    for (size_t offset = 0; offset < size; offset += PAGE_SIZE) {
+        const uint8_t *const page = reinterpret_cast<const uint8_t *>(regionStart + offset);
+        /* MPU regions can be as small as 32 bytes */
+        const size_t pageSize = ((size - offset) < PAGE_SIZE) ? (size - offset) : PAGE_SIZE;
+
+        /* Anything that doesn't shrink gets stored raw */
+        size_t storedSize = lz_compress(page, pageSize, scratch, pageSize - 1);
+        const bool compressed = storedSize != 0;
+        if (!compressed) {
+            storedSize = pageSize;
+        }
+
+        const size_t allocSize = entryAllocSize(storedSize);
+        SwapEntry *const entry = static_cast<SwapEntry *>(_ker_malloc(allocSize));
+        if (entry == nullptr) {
+            /* Pool is full, pages that were already compressed stay on the list for the caller to discard */
+            return -1;
+        }
+
+        entry->pageAddr = const_cast<uint8_t *>(page);
+        entry->pageSize = static_cast<uint16_t>(pageSize);
+        entry->storedSize = static_cast<uint16_t>(storedSize);
+        entry->compressed = compressed;
+
+        const uint8_t *const source = compressed ? scratch : page;
+        uint8_t *const dest = entry->data();
+        for (size_t i = 0; i < storedSize; i++) {
+            dest[i] = source[i];
+        }
+
+        entry->next = *list;
+        *list = entry;
+
+        stats.pagesOut++;
+        stats.poolBytes += allocSize;
+        stats.uncompressedBytes += pageSize;
+        stats.compressedBytes += storedSize;
+    }
+
+    return 0;
+}
+
+int
+swapInRegion(void *const addr, const size_t size, SwapEntry **const list)
+{
+    const uintptr_t regionStart = reinterpret_cast<uintptr_t>(addr);
+    const uintptr_t regionEnd = regionStart + size;
+
+    /* Check there's something to do before claiming the pages */
+    bool found = false;
+    for (SwapEntry *entry = *list; entry != nullptr; entry = entry->next) {
+        const uintptr_t pageAddr = reinterpret_cast<uintptr_t>(entry->pageAddr);
+        if ((pageAddr >= regionStart) && (pageAddr < regionEnd)) {
+            found = true;
+            break;
+        }
+    }
+    if (!found) {
+        return 0;
+    }
+
+    const uint32_t startCycles = DWT->get_cycle_count();
+
+    if (allocatePagesAt(size, addr) == nullptr) {
+        /* Someone else is using part of the region */
+        return -1;
+    }
+
+    SwapEntry **link = list;
+    while (*link != nullptr) {
+        SwapEntry *const entry = *link;
+        const uintptr_t pageAddr = reinterpret_cast<uintptr_t>(entry->pageAddr);
+        if ((pageAddr < regionStart) || (pageAddr >= regionEnd)) {
+            link = &entry->next;
+            continue;
+        }
+
+        uint8_t *const page = static_cast<uint8_t *>(entry->pageAddr);
+        if (entry->compressed) {
+            /* Can't fail unless the pool has been corrupted */
+            (void)lz_decompress(entry->data(), entry->storedSize, page, entry->pageSize);
+        } else {
+            const uint8_t *const source = entry->data();
+            for (size_t i = 0; i < entry->pageSize; i++) {
+                page[i] = source[i];
+            }
+        }
+
+        *link = entry->next;
+        freeEntry(entry);
+    }
+
+    const uint32_t elapsed = DWT->get_cycle_count() - startCycles;
+    stats.swapIns++;
+    stats.lastSwapInCycles = elapsed;
+    stats.totalSwapInCycles += elapsed;
+    if (elapsed > stats.maxSwapInCycles) {
+        stats.maxSwapInCycles = elapsed;
+    }
+
+    return 0;
+}
+
+void
+swapDiscard(SwapEntry **const list)
+{
+    while (*list != nullptr) {
+        SwapEntry *const entry = *list;
+        *list = entry->next;
+        freeEntry(entry);
+    }
+}
+
+const SwapStats &
+swapGetStats()
+{
+    return stats;
+}
+
+uint32_t
+swapCompressionRatio()
+{
+    if (stats.uncompressedBytes == 0) {
+        return 100;
+    }
+    /*
+     * Scale down first, multiplying by 100 overflows after ~40 MB otherwise.
+     * Regions are at least 32 bytes so this can't round to zero.
+     */
+    const uint32_t uncompressed = stats.uncompressedBytes / 16;
+    const uint32_t compressed = stats.compressedBytes / 16;
+    return (compressed * 100) / uncompressed;
+}
@@ -0,0 +1,48 @@
+#ifndef _SWAP_H
+#define _SWAP_H
+
+#include <cstdio>
+
+/*
+ * Compressed in-RAM swap.
+ *
+ * Pages of a suspended process are compressed one at a time into the kernel
+ * heap, which acts as the compressed pool, after which the pages themselves
+ * can be handed back to the page list. Swapping in decompresses each page
+ * back to the address it came from.
+ *
+ * There is no MMU, so a process must get its memory back at exactly the same
+ * addresses. If another allocation has taken one of those pages in the
+ * meantime, swapping in fails and the process has to wait until it is freed.
+ */
+struct SwapEntry;
+
+struct SwapStats {
+    uint32_t pagesOut;          // Pages currently held in the compressed pool
+    uint32_t poolBytes;         // Bytes of the kernel heap used by the pool right now
+    uint32_t uncompressedBytes; // Total bytes ever swapped out
+    uint32_t compressedBytes;   // What those bytes compressed down to
+    uint32_t swapIns;           // Number of regions swapped back in
+    uint32_t lastSwapInCycles;
+    uint32_t maxSwapInCycles;
+    uint32_t totalSwapInCycles;
+};
+
+/*
+ * Compresses the pages in [addr, addr + size) onto list. The pages are left
+ * allocated, the caller frees them once everything it needs is compressed.
+ */
+int swapOutRegion(void *const addr, const size_t size, SwapEntry **const list);
+/*
+ * Reclaims the pages in [addr, addr + size) and decompresses the entries
+ * on list that belong to them. Regions with nothing on the list are skipped.
+ */
+int swapInRegion(void *const addr, const size_t size, SwapEntry **const list);
+/* Throws away everything on list without restoring it */
+void swapDiscard(SwapEntry **const list);
+
+const SwapStats &swapGetStats();
+/* Size of the compressed data as a percentage of the original */
+uint32_t swapCompressionRatio();
+
+#endif /* _SWAP_H */
@@ -12,10 +12,6 @@
  *     - When a blocked process is next ran, it uses that amount as its next slice
  *     - Once slice runs out for blocked process, put it in regular queue
  *     - Queue for blocked processes has higher prio than regular queue
- *   - Some kind of processor affinity?
- *   - More queues when more than 1 core?
- *   - Queues for each core?
- *   - Knowing when to wake up threads/processes from sleep?
  *   - I/O operations?
  *
  *   - Create CPU class to represent hardware (place in cpu folder)
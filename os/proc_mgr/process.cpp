@@ -1,3 +1,5 @@
+#include "alloc.h"
+#include "mem_mgr.h"
 #include "process.h"
 
 #define ROOT_PROCESS_ID 1
@@ -15,14 +17,131 @@ Process::Process()
     _processId = getNextProcessId();
     _state = ProcessState::Created;
     _swapped = false;
+    _swapList = nullptr;
     _returnCode = 0;
     _threadList.pushFront(new Thread(*this));
 }
 
+void *
+Process::operator new(const size_t size)
+{
+    return _ker_malloc(size, MEM_FAST);
+}
+
+void
+Process::operator delete(void *const p, const size_t size)
+{
+    _ker_free(size, p);
+}
+
 Process::~Process()
 {
     while (!_threadList.empty()) {
         Thread *thread = _threadList.popFront();
         delete thread;
     }
+    swapDiscard(&_swapList);
+}
+
+static void *
+regionAddr(const mpu_region &region)
+{
+    return reinterpret_cast<void *>(region.get_addr());
+}
+
+static size_t
+regionSize(const mpu_region &region)
+{
+    /* Region size in bytes = 2^(SIZE + 1) */
+    return 1u << (region.get_size() + 1);
+}
+
+/*
+ * Compresses all of the process' memory into the swap pool
+ * and gives the pages back. Process must not be running.
+ */
+int
+Process::swapOut()
+{
+    if (_swapped || (_state == ProcessState::Running)) {
+        return -1;
+    }
+
+    const size_t numRegions = _memRegionList.size();
+
+    DoublyLinkedList<mpu_region *>::Iterator iter = _memRegionList.getIter();
+    for (size_t i = 0; i < numRegions; i++) {
+        iter.moveNext();
+        const mpu_region &region = *iter.currentItem();
+        if (swapOutRegion(regionAddr(region), regionSize(region), &_swapList) < 0) {
+            /* Out of pool memory, nothing has been freed yet so just drop what we have */
+            swapDiscard(&_swapList);
+            return -1;
+        }
+    }
+
+    /* Only free pages once everything is compressed so the pool can't land in them */
+    iter = _memRegionList.getIter();
+    for (size_t i = 0; i < numRegions; i++) {
+        iter.moveNext();
+        const mpu_region &region = *iter.currentItem();
+        freePages(regionSize(region), regionAddr(region));
+    }
+
+    _swapped = true;
+    return 0;
+}
+
+/*
+ * Restores the process' memory from the swap pool. If a region's pages have
+ * been taken in the meantime this fails, and can be retried later - regions
+ * that were already restored are skipped.
+ */
+int
+Process::swapIn()
+{
+    if (!_swapped) {
+        return 0;
+    }
+
+    const size_t numRegions = _memRegionList.size();
+
+    DoublyLinkedList<mpu_region *>::Iterator iter = _memRegionList.getIter();
+    for (size_t i = 0; i < numRegions; i++) {
+        iter.moveNext();
+        const mpu_region &region = *iter.currentItem();
+        if (swapInRegion(regionAddr(region), regionSize(region), &_swapList) < 0) {
+            return -1;
+        }
+    }
+
+    _swapped = false;
+    return 0;
+}
+
+int
+Process::dispatch()
+{
+    /* Swapped out processes are brought back in the first time they're needed */
+    if (_swapped && (swapIn() < 0)) {
+        return -1;
+    }
+    _state = ProcessState::Running;
+    return 0;
+}
+
+void
+Process::suspend()
+{
+    _state = ProcessState::Blocked;
+    /* Best effort, a process that can't be swapped out just keeps its pages */
+    (void)swapOut();
+}
+
+Thread *
+Process::createThread()
+{
+    Thread *const thread = new Thread(*this);
+    _threadList.pushBack(thread);
+    return thread;
 }
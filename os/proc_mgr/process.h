@@ -5,6 +5,7 @@
 
 #include "doubly_linked_list.h"
 #include "mpu.h"
+#include "swap.h"
 #include "thread.h"
 
 #define MAX_MPU_REGIONS 8
@@ -23,13 +24,18 @@ class Process {
         Process();
         ~Process();
 
+        // Control blocks go in CCM (MEM_FAST) when there's room
+        static void *operator new(const size_t size);
+        static void operator delete(void *const p, const size_t size);
+
         void readyForExec();
         void finishExec();
 
-        void swapOut();
-        void swapIn();
+        int swapOut();
+        int swapIn();
 
-        void dispatch();
+        // -1 if the process couldn't be swapped back in, it stays suspended and can be retried
+        int dispatch();
         void suspend();
 
         void sleep();
@@ -43,6 +49,7 @@ class Process {
         uint32_t _processId;
         ProcessState _state;
         bool _swapped;
+        SwapEntry *_swapList;
         uint32_t _returnCode;
 
         DoublyLinkedList<mpu_region *> _memRegionList;
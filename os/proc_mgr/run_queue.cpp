@@ -0,0 +1,152 @@
+#include "run_queue.h"
+
+/* Tick counts wrap, so compare them by difference */
+static inline bool
+tickReached(const uint32_t now, const uint32_t tick)
+{
+    return static_cast<int32_t>(now - tick) >= 0;
+}
+
+RunQueue::RunQueue()
+{
+    for (uint32_t i = 0; i < NUM_THREAD_PRIORITIES; i++) {
+        _heads[i] = nullptr;
+    }
+    _readyMask = 0;
+    _numThreads = 0;
+}
+
+void
+RunQueue::push(Thread &thread)
+{
+    const uint8_t priority = thread._priority;
+    Thread *const head = _heads[priority];
+
+    if (head == nullptr) {
+        thread._next = &thread;
+        thread._prev = &thread;
+        _heads[priority] = &thread;
+        _readyMask |= (1u << priority);
+    } else {
+        // Insert at the back, which is just before the head
+        thread._next = head;
+        thread._prev = head->_prev;
+        head->_prev->_next = &thread;
+        head->_prev = &thread;
+    }
+    _numThreads++;
+}
+
+void
+RunQueue::remove(Thread &thread)
+{
+    const uint8_t priority = thread._priority;
+
+    if (thread._next == &thread) {
+        _heads[priority] = nullptr;
+        _readyMask &= ~(1u << priority);
+    } else {
+        if (_heads[priority] == &thread) {
+            _heads[priority] = thread._next;
+        }
+        thread._next->_prev = thread._prev;
+        thread._prev->_next = thread._next;
+    }
+    thread._next = &thread;
+    thread._prev = &thread;
+    _numThreads--;
+}
+
+uint8_t
+RunQueue::topPriority() const
+{
+    if (_readyMask == 0) {
+        return NUM_THREAD_PRIORITIES;
+    }
+    return static_cast<uint8_t>(__builtin_ctz(_readyMask));
+}
+
+Thread *
+RunQueue::pop()
+{
+    const uint8_t priority = topPriority();
+    if (priority >= NUM_THREAD_PRIORITIES) {
+        return nullptr;
+    }
+
+    Thread *const thread = _heads[priority];
+    remove(*thread);
+    return thread;
+}
+
+Thread *
+RunQueue::popAllowed(const uint32_t cpuMask)
+{
+    uint32_t mask = _readyMask;
+    while (mask != 0) {
+        const uint8_t priority = static_cast<uint8_t>(__builtin_ctz(mask));
+        mask &= ~(1u << priority);
+
+        // Take from the back, the thread that would have waited longest here anyway
+        Thread *const head = _heads[priority];
+        Thread *thread = head->_prev;
+        do {
+            // A thread still on its old CPU can't be taken until that CPU has saved it
+            if ((thread->_affinity & cpuMask) && !thread->_onCpu) {
+                remove(*thread);
+                return thread;
+            }
+            thread = thread->_prev;
+        } while (thread != head->_prev);
+    }
+    return nullptr;
+}
+
+void
+SleepQueue::insert(Thread &thread, const uint32_t wakeTick)
+{
+    thread._wakeTick = wakeTick;
+    thread._timedOut = false;
+
+    Thread **link = &_head;
+    while ((*link != nullptr) && tickReached(wakeTick, (*link)->_wakeTick)) {
+        link = &(*link)->_sleepNext;
+    }
+    thread._sleepNext = *link;
+    *link = &thread;
+}
+
+void
+SleepQueue::remove(Thread &thread)
+{
+    for (Thread **link = &_head; *link != nullptr; link = &(*link)->_sleepNext) {
+        if (*link == &thread) {
+            *link = thread._sleepNext;
+            thread._sleepNext = nullptr;
+            return;
+        }
+    }
+}
+
+bool
+SleepQueue::nextWakeTick(uint32_t &wakeTick) const
+{
+    if (_head == nullptr) {
+        return false;
+    }
+    wakeTick = _head->_wakeTick;
+    return true;
+}
+
+Thread *
+SleepQueue::popExpired(const uint32_t now)
+{
+    Thread *const thread = _head;
+    if ((thread == nullptr) || !tickReached(now, thread->_wakeTick)) {
+        return nullptr;
+    }
+    _head = thread->_sleepNext;
+    thread->_sleepNext = nullptr;
+    thread->_timedOut = true;
+    return thread;
+}
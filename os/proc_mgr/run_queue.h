@@ -0,0 +1,58 @@
+#ifndef _RUN_QUEUE_H
+#define _RUN_QUEUE_H
+
+#include <cstdint>
+
+#include "spinlock.h"
+#include "thread.h"
+
+/*
+ * Ready threads, one FIFO per priority. Threads are linked through their own
+ * _prev/_next pointers so queueing never allocates, which means a thread can
+ * only be on one run queue at a time.
+ */
+class RunQueue {
+    public:
+        RunQueue();
+
+        void push(Thread &thread);
+        Thread *pop();
+        /* Pops the best thread allowed to run on the CPUs in cpuMask, for stealing */
+        Thread *popAllowed(const uint32_t cpuMask);
+        void remove(Thread &thread);
+
+        bool empty()        const { return _numThreads == 0; };
+        uint32_t size()     const { return _numThreads; };
+        /* Priority of the best thread queued, or NUM_THREAD_PRIORITIES if empty */
+        uint8_t topPriority() const;
+
+        uint32_t lock()                         { return _lock.lock(); };
+        void unlock(const uint32_t primask)     { _lock.unlock(primask); };
+
+    private:
+        SpinLock _lock;
+        Thread *_heads[NUM_THREAD_PRIORITIES];
+        /* Bit n is set when priority n has queued threads */
+        uint32_t _readyMask;
+        uint32_t _numThreads;
+};
+
+/*
+ * Blocked threads waiting on a timeout, sorted by wake tick.
+ */
+class SleepQueue {
+    public:
+        SleepQueue() : _head(nullptr) {};
+
+        void insert(Thread &thread, const uint32_t wakeTick);
+        void remove(Thread &thread);
+        /* Pops the first thread whose wake tick is at or before now */
+        Thread *popExpired(const uint32_t now);
+        /* Wake tick of the first thread due, false if nothing is sleeping */
+        bool nextWakeTick(uint32_t &wakeTick) const;
+
+    private:
+        Thread *_head;
+};
+
+#endif /* _RUN_QUEUE_H */
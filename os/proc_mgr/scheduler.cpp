@@ -0,0 +1,388 @@
+#include "cpu.h"
+#include "irq.h"
+#include "process.h"
+#include "run_queue.h"
+#include "scheduler.h"
+#include "spinlock.h"
+#include "wait_set.h"
+
+/*
+ * Priority round robin scheduler with a run queue per CPU.
+ *
+ * Ready threads are queued on the least loaded CPU their affinity allows,
+ * preferring the one they last ran on. A CPU with nothing to run steals the
+ * best thread it is allowed to run from another CPU's queue. Only one run
+ * queue lock is ever held at a time, so there is no lock ordering to get
+ * wrong as cores are added.
+ *
+ * The system timer tick drives timeouts and time slicing, and every actual
+ * switch happens in the context switch handler (PendSV) so it only runs once
+ * all other interrupt handlers are finished. The idle thread tells the CPU
+ * how long it has until anything is due, so it can sleep more deeply when
+ * there's time.
+ */
+
+static SleepQueue sleepQueue;
+static SpinLock sleepLock;
+
+static Process *kernelProcess;
+
+static volatile uint32_t ticks;
+static bool started;
+
+/* Ticks until a sleeping thread or timer source is due */
+static uint32_t
+ticksUntilDue(void)
+{
+    uint32_t ticksLeft = CPU_NO_DEADLINE;
+    const uint32_t now = ticks;
+
+    uint32_t wakeTick;
+    const uint32_t primask = sleepLock.lock();
+    if (sleepQueue.nextWakeTick(wakeTick)) {
+        const int32_t left = static_cast<int32_t>(wakeTick - now);
+        ticksLeft = (left > 0) ? left : 0;
+    }
+    sleepLock.unlock(primask);
+
+    uint32_t timerLeft;
+    if (wait_set_next_tick(now, timerLeft) && (timerLeft < ticksLeft)) {
+        ticksLeft = timerLeft;
+    }
+    return ticksLeft;
+}
+
+static void
+idleLoop(void *)
+{
+    for ( ;; ) {
+        // Masked so nothing can become due between working out how long there is and going to sleep
+        const uint32_t primask = irq_save();
+        cpu_idle(ticksUntilDue());
+        irq_restore(primask);
+    }
+}
+
+static inline void
+requestSwitch(const uint32_t cpuId)
+{
+    if (started) {
+        cpu_request_switch(cpuId);
+    }
+}
+
+static uint32_t
+cpuBit(const uint32_t cpuId)
+{
+    return 1u << cpuId;
+}
+
+/* Least loaded CPU the thread can run on, staying where it last ran on a tie */
+static uint32_t
+pickCpu(const Thread &thread)
+{
+    // Woken before its CPU switched away from it, so it has to stay there until then
+    if (thread.isOnCpu()) {
+        return thread.getCpu();
+    }
+
+    const uint32_t allowed = thread.getAffinity() & ALL_CPUS_MASK;
+    uint32_t best = thread.getCpu();
+    if ((allowed & cpuBit(best)) == 0) {
+        best = __builtin_ctz(allowed);
+    }
+
+    for (uint32_t i = 0; i < NUM_CPUS; i++) {
+        if ((allowed & cpuBit(i)) && (hw_cpus[i].getLoad() < hw_cpus[best].getLoad())) {
+            best = i;
+        }
+    }
+    return best;
+}
+
+static void
+makeReady(Thread &thread)
+{
+    Cpu &cpu = hw_cpus[pickCpu(thread)];
+    RunQueue &runQueue = cpu.getRunQueue();
+
+    const uint32_t primask = runQueue.lock();
+    thread.setState(Thread::ThreadState::Ready);
+    thread.setCpu(static_cast<uint8_t>(cpu.getId()));
+    runQueue.push(thread);
+    runQueue.unlock(primask);
+
+    const Thread *const running = cpu.getCurrentThread();
+    if ((running == nullptr) || cpu.isIdle() || (thread.getPriority() < running->getPriority())) {
+        if (started && cpu.isIdle()) {
+            cpu_idle_wake(cpu.getId());
+        }
+        requestSwitch(cpu.getId());
+    }
+}
+
+/* Takes a thread from the busiest other CPU that has one allowed to run here */
+static Thread *
+steal(Cpu &thief)
+{
+    const uint32_t thiefBit = cpuBit(thief.getId());
+
+    for (uint32_t n = 1; n < NUM_CPUS; n++) {
+        Cpu &victim = hw_cpus[(thief.getId() + n) % NUM_CPUS];
+        RunQueue &runQueue = victim.getRunQueue();
+        if (runQueue.empty()) {
+            continue;
+        }
+
+        const uint32_t primask = runQueue.lock();
+        Thread *const thread = runQueue.popAllowed(thiefBit);
+        runQueue.unlock(primask);
+
+        if (thread != nullptr) {
+            thief.getStats().steals++;
+            return thread;
+        }
+    }
+    return nullptr;
+}
+
+void
+scheduler_init(void)
+{
+    kernelProcess = new Process();
+
+    for (uint32_t i = 0; i < NUM_CPUS; i++) {
+        Thread *const idleThread = kernelProcess->createThread();
+        idleThread->setPriority(NUM_THREAD_PRIORITIES - 1);
+        idleThread->setAffinity(cpuBit(i));
+        idleThread->setCpu(static_cast<uint8_t>(i));
+        idleThread->initContext(idleLoop, nullptr);
+
+        hw_cpus[i].setIdleThread(idleThread);
+        hw_cpus[i].setCurrentThread(nullptr);
+        hw_cpus[i].resetSlice(SCHEDULER_TIME_SLICE_TICKS);
+    }
+
+    ticks = 0;
+    started = false;
+}
+
+void
+scheduler_start(void)
+{
+    started = true;
+    cpu_start_threads();
+}
+
+Thread *
+scheduler_create_kernel_thread(ThreadEntry entry, void *arg, const uint8_t priority)
+{
+    Thread *const thread = kernelProcess->createThread();
+    thread->setPriority(priority);
+    thread->initContext(entry, arg);
+    scheduler_add(*thread);
+    return thread;
+}
+
+int
+scheduler_set_affinity(Thread &thread, const uint32_t cpuMask)
+{
+    if ((cpuMask & ALL_CPUS_MASK) == 0) {
+        return -1;
+    }
+
+    thread.setAffinity(cpuMask);
+
+    // A running thread moves at its next switch, a queued one next time it's picked or stolen
+    if ((thread.getState() == Thread::ThreadState::Executing) && ((cpuMask & cpuBit(thread.getCpu())) == 0)) {
+        requestSwitch(thread.getCpu());
+    }
+    return 0;
+}
+
+Thread *
+scheduler_current(void)
+{
+    return hw_cpus[cpu_current_id()].getCurrentThread();
+}
+
+uint32_t
+scheduler_ticks(void)
+{
+    return ticks;
+}
+
+void
+scheduler_add(Thread &thread)
+{
+    makeReady(thread);
+}
+
+void
+scheduler_wake(Thread &thread)
+{
+    const uint32_t primask = sleepLock.lock();
+    const bool wasBlocked = (thread.getState() == Thread::ThreadState::Blocked);
+    if (wasBlocked) {
+        sleepQueue.remove(thread);
+        thread.setState(Thread::ThreadState::Ready);
+    }
+    sleepLock.unlock(primask);
+
+    if (wasBlocked) {
+        makeReady(thread);
+    }
+}
+
+void
+scheduler_mark_blocked(Thread &thread, const uint32_t timeoutTicks)
+{
+    const uint32_t primask = sleepLock.lock();
+    thread.setState(Thread::ThreadState::Blocked);
+    if (timeoutTicks != WAIT_FOREVER) {
+        sleepQueue.insert(thread, ticks + timeoutTicks);
+    }
+    sleepLock.unlock(primask);
+
+    requestSwitch(thread.getCpu());
+}
+
+bool
+scheduler_block(const uint32_t timeoutTicks)
+{
+    Thread *const thread = scheduler_current();
+    scheduler_mark_blocked(*thread, timeoutTicks);
+
+    // The switch is taken as soon as interrupts are unmasked, and this thread carries on from here once woken
+    irq_enable();
+    irq_disable();
+
+    return (timeoutTicks == WAIT_FOREVER) || !thread->timedOut();
+}
+
+void
+scheduler_sleep(const uint32_t sleepTicks)
+{
+    const uint32_t primask = irq_save();
+    (void)scheduler_block((sleepTicks == 0) ? 1 : sleepTicks);
+    irq_restore(primask);
+}
+
+void
+scheduler_yield(void)
+{
+    requestSwitch(cpu_current_id());
+}
+
+void
+scheduler_exit(void)
+{
+    (void)irq_save();
+    scheduler_current()->setState(Thread::ThreadState::Zombie);
+    requestSwitch(cpu_current_id());
+    irq_enable();
+
+    // Never scheduled again
+    for ( ;; ) {}
+}
+
+void
+scheduler_tick(void)
+{
+    if (!started) {
+        return;
+    }
+
+    Cpu &cpu = hw_cpus[cpu_current_id()];
+
+    // Every core ticks, but only the first one keeps time
+    if (cpu.getId() == 0) {
+        ticks++;
+
+        for ( ;; ) {
+            const uint32_t primask = sleepLock.lock();
+            Thread *const thread = sleepQueue.popExpired(ticks);
+            if (thread != nullptr) {
+                thread->setState(Thread::ThreadState::Ready);
+            }
+            sleepLock.unlock(primask);
+
+            if (thread == nullptr) {
+                break;
+            }
+            makeReady(*thread);
+        }
+
+        wait_set_tick(ticks);
+    }
+
+    if (cpu.isIdle()) {
+        cpu.getStats().idleTicks++;
+        // Idle time is when stealing happens, so look for work queued elsewhere
+        for (uint32_t i = 0; i < NUM_CPUS; i++) {
+            if (!hw_cpus[i].getRunQueue().empty()) {
+                requestSwitch(cpu.getId());
+                break;
+            }
+        }
+    } else if (cpu.tickSlice()) {
+        // Nothing switched in yet counts as below every priority
+        const Thread *const running = cpu.getCurrentThread();
+        const uint8_t lowest = (running == nullptr) ? NUM_THREAD_PRIORITIES - 1 : running->getPriority();
+        if (cpu.getRunQueue().topPriority() <= lowest) {
+            requestSwitch(cpu.getId());
+        }
+    }
+}
+
+CpuRegsOnStack *
+scheduler_switch(CpuRegsOnStack *const outgoingStack)
+{
+    Cpu &cpu = hw_cpus[cpu_current_id()];
+    RunQueue &runQueue = cpu.getRunQueue();
+
+    Thread *const outgoing = cpu.getCurrentThread();
+    if (outgoing != nullptr) {
+        outgoing->saveStackPointer(outgoingStack);
+
+        // Preempted rather than blocked, so it goes to the back of a queue
+        const bool preempted = (outgoing->getState() == Thread::ThreadState::Executing)
+                               && (outgoing != cpu.getIdleThread());
+        const bool staysHere = (outgoing->getAffinity() & cpuBit(cpu.getId())) != 0;
+
+        const uint32_t primask = runQueue.lock();
+        // Saved, so from here on another CPU may take it
+        outgoing->setOnCpu(false);
+        if (preempted && staysHere) {
+            outgoing->setState(Thread::ThreadState::Ready);
+            runQueue.push(*outgoing);
+        }
+        runQueue.unlock(primask);
+
+        if (preempted && !staysHere) {
+            makeReady(*outgoing);
+        }
+    }
+
+    const uint32_t primask = runQueue.lock();
+    Thread *incoming = runQueue.pop();
+    runQueue.unlock(primask);
+
+    if (incoming == nullptr) {
+        incoming = steal(cpu);
+    }
+    if (incoming == nullptr) {
+        incoming = cpu.getIdleThread();
+    }
+
+    if (incoming != outgoing) {
+        cpu.getStats().switches++;
+    }
+    incoming->setState(Thread::ThreadState::Executing);
+    incoming->setOnCpu(true);
+    incoming->setCpu(static_cast<uint8_t>(cpu.getId()));
+    cpu.setCurrentThread(incoming);
+    cpu.resetSlice(SCHEDULER_TIME_SLICE_TICKS);
+
+    return incoming->getStackPointer();
+}
@@ -0,0 +1,53 @@
+#ifndef _SCHEDULER_H
+#define _SCHEDULER_H
+
+#include <cstdint>
+
+#include "cpuRegsOnStack.h"
+#include "thread.h"
+
+/* Ticks a thread may run before being rotated behind threads of the same priority */
+#ifndef SCHEDULER_TIME_SLICE_TICKS
+#define SCHEDULER_TIME_SLICE_TICKS 4u
+#endif
+
+/* Pass as a timeout to block until woken */
+#define WAIT_FOREVER 0u
+
+void scheduler_init(void);
+__attribute__((noreturn)) void scheduler_start(void);
+
+/* Creates a thread in the kernel process and makes it ready to run */
+Thread *scheduler_create_kernel_thread(ThreadEntry entry, void *arg, const uint8_t priority);
+
+/* Restricts a thread to the CPUs in cpuMask. Returns -1 if none of them exist. */
+int scheduler_set_affinity(Thread &thread, const uint32_t cpuMask);
+
+Thread *scheduler_current(void);
+uint32_t scheduler_ticks(void);
+
+/* Makes a thread runnable. Safe to call from interrupt handlers. */
+void scheduler_add(Thread &thread);
+void scheduler_wake(Thread &thread);
+
+/*
+ * Blocks the current thread until scheduler_wake is called on it, or the
+ * timeout (in ticks) expires. Must be called with interrupts masked by
+ * irq_save, so the caller can check its wake condition without racing the
+ * interrupt that sets it. Interrupts are unmasked while switched out.
+ * Returns false if the timeout expired.
+ */
+bool scheduler_block(const uint32_t timeoutTicks);
+/* The bookkeeping half of scheduler_block, without waiting for the switch */
+void scheduler_mark_blocked(Thread &thread, const uint32_t timeoutTicks);
+
+void scheduler_sleep(const uint32_t ticks);
+void scheduler_yield(void);
+__attribute__((noreturn)) void scheduler_exit(void);
+
+/* Called from the system timer interrupt */
+void scheduler_tick(void);
+/* Called from PendSV only */
+CpuRegsOnStack *scheduler_switch(CpuRegsOnStack *const outgoingStack);
+
+#endif /* _SCHEDULER_H */
@@ -1,8 +1,12 @@
 #include "alloc.h"
+#include "scheduler.h"
 #include "thread.h"
 
 #define STACK_SIZE (2 * 1024)
 
+/* Thumb state bit in the xPSR - must always be set */
+#define PSR_THUMB (1u << 24)
+
 static uint32_t threadCounter = 0;
 static uint32_t getNextThreadId()
 {
@@ -10,6 +14,13 @@ static uint32_t getNextThreadId()
     return threadCounter;
 }
 
+/* Threads that return from their entry point end up here */
+static void
+threadExit(void)
+{
+    scheduler_exit();
+}
+
 Thread::Thread(Process &parentProcess)
 {
     _threadId = getNextThreadId();
@@ -19,7 +30,15 @@ Thread::Thread(Process &parentProcess)
     _prev = this;
     _privileged = false;
     _useMainStack = true;
-    _stack = static_cast<CpuRegsOnStack *>(_ker_malloc(STACK_SIZE));
+    _priority = THREAD_PRIORITY_DEFAULT;
+    _affinity = 0xffffffff;
+    _cpu = 0;
+    _onCpu = false;
+    _stackBase = _ker_malloc(STACK_SIZE, MEM_FAST);
+    _stack = nullptr;
+    _sleepNext = nullptr;
+    _wakeTick = 0;
+    _timedOut = false;
 }
 
 Thread::~Thread()
@@ -28,5 +47,46 @@ Thread::~Thread()
     _next->_prev = _prev;
     _prev->_next = _next;
     // Thread should always have a stack
-    _ker_free(STACK_SIZE, _stack);
+    _ker_free(STACK_SIZE, _stackBase);
+}
+
+void *
+Thread::operator new(const size_t size)
+{
+    return _ker_malloc(size, MEM_FAST);
+}
+
+void
+Thread::operator delete(void *const p, const size_t size)
+{
+    _ker_free(size, p);
+}
+
+void
+Thread::setPriority(const uint8_t priority)
+{
+    _priority = (priority < NUM_THREAD_PRIORITIES) ? priority : (NUM_THREAD_PRIORITIES - 1);
+}
+
+/*
+ * Builds the initial exception frame at the top of the stack so the
+ * first context switch "returns" into entry(arg).
+ */
+void
+Thread::initContext(ThreadEntry entry, void *arg)
+{
+    const uintptr_t stackTop = reinterpret_cast<uintptr_t>(_stackBase) + STACK_SIZE;
+    // Exception frames have to be 8 byte aligned
+    const uintptr_t frameAddr = (stackTop - sizeof(CpuRegsOnStack)) & ~static_cast<uintptr_t>(0x7);
+
+    CpuRegsOnStack *const regs = reinterpret_cast<CpuRegsOnStack *>(frameAddr);
+    *regs = CpuRegsOnStack();
+    regs->R0 = reinterpret_cast<uintptr_t>(arg);
+    regs->LR = reinterpret_cast<uintptr_t>(threadExit);
+    regs->PC = reinterpret_cast<uintptr_t>(entry) & ~static_cast<uintptr_t>(0x1);
+    regs->PSR = PSR_THUMB;
+
+    _stack = regs;
+    _useMainStack = false;
+    _state = ThreadState::Created;
 }
@@ -1,13 +1,22 @@
 #ifndef _THREAD_H
 #define _THREAD_H
 
+#include <cstddef>
 #include <cstdint>
-#include "cpu.h"
+#include "cpuRegsOnStack.h"
+
+/* 0 is the highest priority */
+#define NUM_THREAD_PRIORITIES 4u
+#define THREAD_PRIORITY_DEFAULT 2u
 
 class Process;
 
+typedef void (*ThreadEntry)(void *arg);
+
 class Thread {
     friend class Process;
+    friend class RunQueue;
+    friend class SleepQueue;
 
     public:
         enum class ThreadState {
@@ -22,6 +31,10 @@ class Thread {
         Thread(Process &parentProcess);
         ~Thread();
 
+        // Only the CPU touches these, so they go in CCM (MEM_FAST) along with the stacks
+        static void *operator new(const size_t size);
+        static void operator delete(void *const p, const size_t size);
+
         uint32_t getId()        const { return _threadId; };
         Process *getProcess()   const { return _parentProcess; };
         ThreadState getState()  const { return _state; };
@@ -30,6 +43,20 @@ class Thread {
         bool isPrivileged()     const { return _privileged; };
         bool isUsingMainStack() const { return _useMainStack; };
         CpuRegsOnStack *getStackPointer() const { return _stack; };
+        uint8_t getPriority()   const { return _priority; };
+        uint32_t getAffinity()  const { return _affinity; };
+        uint8_t getCpu()        const { return _cpu; };
+        bool timedOut()         const { return _timedOut; };
+        bool isOnCpu()          const { return _onCpu; };
+
+        void setState(const ThreadState state) { _state = state; };
+        void setPriority(const uint8_t priority);
+        void saveStackPointer(CpuRegsOnStack *const stack) { _stack = stack; };
+        void setAffinity(const uint32_t cpuMask) { _affinity = cpuMask; };
+        void setCpu(const uint8_t cpu) { _cpu = cpu; };
+        void setOnCpu(const bool onCpu) { _onCpu = onCpu; };
+
+        void initContext(ThreadEntry entry, void *arg);
 
     private:
         uint32_t _threadId;
@@ -42,7 +69,20 @@ class Thread {
 
         bool _privileged;
         bool _useMainStack;
+        uint8_t _priority;
+        /* Bit n set means the thread may run on CPU n */
+        uint32_t _affinity;
+        /* CPU the thread last ran or was queued on */
+        uint8_t _cpu;
+        /* Set from being switched in until its CPU has saved its context again */
+        bool _onCpu;
+        void *_stackBase;
         CpuRegsOnStack *_stack;
+
+        /* Only used while the thread is blocked with a timeout */
+        Thread *_sleepNext;
+        uint32_t _wakeTick;
+        bool _timedOut;
 };
 
 #endif
@@ -0,0 +1,347 @@
+#include "irq.h"
+#include "nvic.h"
+#include "scheduler.h"
+#include "stm32_dma.h"
+#include "stm32_exti.h"
+#include "stm32_usart.h"
+#include "trace.h"
+#include "wait_set.h"
+
+#define NUM_EXTI_LINES 23u
+#define NUM_USARTS 6u
+
+/* Strong versions of the weak handlers in startup.h */
+#define IRQ_HANDLER void __attribute__((interrupt("IRQ")))
+
+/* EXTI 16 and up share their interrupts with other peripherals, which are in charge of notifying */
+#define NUM_GPIO_EXTI_LINES 16u
+
+struct WaitBinding {
+    WaitSet *set;
+    uint32_t bit;
+};
+
+struct TimerBinding {
+    WaitSet *set;
+    uint32_t bit;
+    uint32_t period;
+    uint32_t nextTick;
+};
+
+static WaitBinding extiBindings[NUM_EXTI_LINES];
+static WaitBinding dma1Bindings[DMA_NUM_STREAMS];
+static WaitBinding dma2Bindings[DMA_NUM_STREAMS];
+static WaitBinding usartBindings[NUM_USARTS];
+static TimerBinding timerBindings[WAIT_SET_MAX_TIMERS];
+
+static usart_t usarts[NUM_USARTS] = { USART1, USART2, USART3, UART4, UART5, USART6 };
+
+static const Nvic::InterruptNumber usartIrqs[NUM_USARTS] = {
+    Nvic::InterruptNumber::USART1, Nvic::InterruptNumber::USART2,
+    Nvic::InterruptNumber::USART3, Nvic::InterruptNumber::UART4,
+    Nvic::InterruptNumber::UART5, Nvic::InterruptNumber::USART6,
+};
+
+static Nvic::InterruptNumber
+extiIrq(const uint8_t line)
+{
+    if (line <= 4) {
+        return static_cast<Nvic::InterruptNumber>(static_cast<uint8_t>(Nvic::InterruptNumber::EXTI0) + line);
+    } else if (line <= 9) {
+        return Nvic::InterruptNumber::EXTI9_5;
+    }
+    return Nvic::InterruptNumber::EXTI15_10;
+}
+
+static WaitBinding *
+findBinding(const WaitSource source, const uint8_t index)
+{
+    switch (source) {
+    case WaitSource::Exti:
+        return (index < NUM_EXTI_LINES) ? &extiBindings[index] : nullptr;
+    case WaitSource::Dma1:
+        return (index < DMA_NUM_STREAMS) ? &dma1Bindings[index] : nullptr;
+    case WaitSource::Dma2:
+        return (index < DMA_NUM_STREAMS) ? &dma2Bindings[index] : nullptr;
+    case WaitSource::UsartRx:
+        return (index < NUM_USARTS) ? &usartBindings[index] : nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+/* Turns on the source's interrupt once something is waiting on it */
+static void
+enableSource(const WaitSource source, const uint8_t index)
+{
+    switch (source) {
+    case WaitSource::Exti:
+        (void)EXTI->unmask_interrupt(index);
+        if (index < NUM_GPIO_EXTI_LINES) {
+            NVIC->enableInterrupt(extiIrq(index));
+        }
+        break;
+    case WaitSource::Dma1:
+    case WaitSource::Dma2:
+        // The DMA driver owns the stream interrupts and keeps them enabled
+        break;
+    case WaitSource::UsartRx:
+        // A port receiving by DMA notifies from the USART driver instead
+        if (!usarts[index]->dma_rx_enabled()) {
+            usarts[index]->enable_rx_interrupt();
+        }
+        NVIC->enableInterrupt(usartIrqs[index]);
+        break;
+    default:
+        break;
+    }
+}
+
+static void
+disableSource(const WaitSource source, const uint8_t index)
+{
+    switch (source) {
+    case WaitSource::Exti:
+        (void)EXTI->mask_interrupt(index);
+        break;
+    case WaitSource::UsartRx:
+        usarts[index]->disable_rx_interrupt();
+        break;
+    default:
+        // Shared or owned by whoever started the transfer, leave the NVIC alone
+        break;
+    }
+}
+
+WaitSet::WaitSet()
+{
+    _usedBits = 0;
+    _readyBits = 0;
+    _waiter = nullptr;
+}
+
+WaitSet::~WaitSet()
+{
+    for (uint8_t source = 0; source < static_cast<uint8_t>(WaitSource::NUM_SOURCES); source++) {
+        for (uint8_t index = 0; index < NUM_EXTI_LINES; index++) {
+            (void)remove(static_cast<WaitSource>(source), index);
+        }
+    }
+    for (uint32_t i = 0; i < WAIT_SET_MAX_TIMERS; i++) {
+        if (timerBindings[i].set == this) {
+            timerBindings[i].set = nullptr;
+        }
+    }
+}
+
+int
+WaitSet::allocateBit()
+{
+    if (_usedBits == 0xffffffff) {
+        return -1;
+    }
+    const int bit = __builtin_ctz(~_usedBits);
+    _usedBits |= (1u << bit);
+    return bit;
+}
+
+int
+WaitSet::add(const WaitSource source, const uint8_t index)
+{
+    WaitBinding *const binding = findBinding(source, index);
+    if ((binding == nullptr) || (binding->set != nullptr)) {
+        return -1;
+    }
+
+    const int bit = allocateBit();
+    if (bit < 0) {
+        return -1;
+    }
+
+    const uint32_t primask = irq_save();
+    binding->set = this;
+    binding->bit = 1u << bit;
+    irq_restore(primask);
+
+    enableSource(source, index);
+    return bit;
+}
+
+int
+WaitSet::addTimer(const uint32_t periodTicks)
+{
+    if (periodTicks == 0) {
+        return -1;
+    }
+
+    for (uint32_t i = 0; i < WAIT_SET_MAX_TIMERS; i++) {
+        TimerBinding &timer = timerBindings[i];
+        if (timer.set != nullptr) {
+            continue;
+        }
+
+        const int bit = allocateBit();
+        if (bit < 0) {
+            return -1;
+        }
+
+        const uint32_t primask = irq_save();
+        timer.bit = 1u << bit;
+        timer.period = periodTicks;
+        timer.nextTick = scheduler_ticks() + periodTicks;
+        timer.set = this;
+        irq_restore(primask);
+        return bit;
+    }
+    return -1;
+}
+
+/* For timers, index is the bit returned by addTimer */
+int
+WaitSet::remove(const WaitSource source, const uint8_t index)
+{
+    if (source == WaitSource::Timer) {
+        // Masked so wait_set_tick can't fire the timer while it's being unbound
+        const uint32_t primask = irq_save();
+        for (uint32_t i = 0; i < WAIT_SET_MAX_TIMERS; i++) {
+            TimerBinding &timer = timerBindings[i];
+            if ((timer.set == this) && (timer.bit == (1u << index))) {
+                timer.set = nullptr;
+                _usedBits &= ~timer.bit;
+                _readyBits &= ~timer.bit;
+                irq_restore(primask);
+                return 0;
+            }
+        }
+        irq_restore(primask);
+        return -1;
+    }
+
+    WaitBinding *const binding = findBinding(source, index);
+    if ((binding == nullptr) || (binding->set != this)) {
+        return -1;
+    }
+
+    disableSource(source, index);
+
+    const uint32_t primask = irq_save();
+    binding->set = nullptr;
+    _usedBits &= ~binding->bit;
+    _readyBits &= ~binding->bit;
+    irq_restore(primask);
+    return 0;
+}
+
+uint32_t
+WaitSet::poll()
+{
+    const uint32_t primask = irq_save();
+    const uint32_t ready = _readyBits;
+    _readyBits = 0;
+    irq_restore(primask);
+    return ready;
+}
+
+uint32_t
+WaitSet::wait(const uint32_t timeoutTicks)
+{
+    // USART RX interrupts are one-shot, so rearm the ones belonging to this set
+    for (uint8_t i = 0; i < NUM_USARTS; i++) {
+        if ((usartBindings[i].set == this) && !usarts[i]->dma_rx_enabled()) {
+            usarts[i]->enable_rx_interrupt();
+        }
+    }
+
+    const uint32_t primask = irq_save();
+    if (_readyBits == 0) {
+        _waiter = scheduler_current();
+        (void)scheduler_block(timeoutTicks);
+        _waiter = nullptr;
+    }
+    const uint32_t ready = _readyBits;
+    _readyBits = 0;
+    irq_restore(primask);
+
+    return ready;
+}
+
+void
+WaitSet::signal(const uint32_t readyMask)
+{
+    const uint32_t primask = irq_save();
+    _readyBits |= readyMask;
+    if (_waiter != nullptr) {
+        scheduler_wake(*_waiter);
+    }
+    irq_restore(primask);
+}
+
+void
+wait_set_notify(const WaitSource source, const uint8_t index)
+{
+    const WaitBinding *const binding = findBinding(source, index);
+    if ((binding != nullptr) && (binding->set != nullptr)) {
+        binding->set->signal(binding->bit);
+    }
+}
+
+void
+wait_set_tick(const uint32_t now)
+{
+    for (uint32_t i = 0; i < WAIT_SET_MAX_TIMERS; i++) {
+        TimerBinding &timer = timerBindings[i];
+        if ((timer.set != nullptr) && (static_cast<int32_t>(now - timer.nextTick) >= 0)) {
+            timer.nextTick += timer.period;
+            timer.set->signal(timer.bit);
+        }
+    }
+}
+
+bool
+wait_set_next_tick(const uint32_t now, uint32_t &ticksLeft)
+{
+    bool found = false;
+    int32_t soonest = 0;
+    for (uint32_t i = 0; i < WAIT_SET_MAX_TIMERS; i++) {
+        const TimerBinding &timer = timerBindings[i];
+        if (timer.set == nullptr) {
+            continue;
+        }
+        const int32_t left = static_cast<int32_t>(timer.nextTick - now);
+        if (!found || (left < soonest)) {
+            soonest = left;
+            found = true;
+        }
+    }
+
+    if (found) {
+        ticksLeft = (soonest > 0) ? soonest : 0;
+    }
+    return found;
+}
+
+/*
+ * Interrupt handlers for the sources above that don't have a driver handling
+ * their own interrupts yet. DMA streams and USARTs are notified by their
+ * drivers.
+ */
+static void
+handleExtiLines(const uint8_t first, const uint8_t last)
+{
+    TRACE_IRQ_ENTER();
+    for (uint8_t line = first; line <= last; line++) {
+        if (EXTI->get_pending(line)) {
+            (void)EXTI->clear_pending(line);
+            wait_set_notify(WaitSource::Exti, line);
+        }
+    }
+    TRACE_IRQ_EXIT();
+}
+
+IRQ_HANDLER EXTI0_IRQHandler(void)      { handleExtiLines(0, 0); }
+IRQ_HANDLER EXTI1_IRQHandler(void)      { handleExtiLines(1, 1); }
+IRQ_HANDLER EXTI2_IRQHandler(void)      { handleExtiLines(2, 2); }
+IRQ_HANDLER EXTI3_IRQHandler(void)      { handleExtiLines(3, 3); }
+IRQ_HANDLER EXTI4_IRQHandler(void)      { handleExtiLines(4, 4); }
+IRQ_HANDLER EXTI9_5_IRQHandler(void)    { handleExtiLines(5, 9); }
+IRQ_HANDLER EXTI15_10_IRQHandler(void)  { handleExtiLines(10, 15); }
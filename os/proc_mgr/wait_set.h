@@ -0,0 +1,61 @@
+#ifndef _WAIT_SET_H
+#define _WAIT_SET_H
+
+#include <cstdint>
+
+#include "thread.h"
+
+#define WAIT_SET_MAX_SOURCES 32u
+#define WAIT_SET_MAX_TIMERS 8u
+
+enum class WaitSource : uint8_t {
+    Exti,       // index is the EXTI line, 0-22
+    Dma1,       // index is the stream, 0-7
+    Dma2,
+    UsartRx,    // index is the USART number minus one, 0-5
+    Timer,      // periodic software timer driven by the system tick, use addTimer
+    NUM_SOURCES,
+};
+
+/*
+ * Lets one thread block on several interrupt sources at once, like poll().
+ * Each source added gets a bit, and wait() returns the mask of every source
+ * that fired since the last call. Events that fire while nobody is waiting
+ * are latched, but firing twice before being collected only shows up once.
+ *
+ * A source can only belong to one wait set at a time.
+ */
+class WaitSet {
+    public:
+        WaitSet();
+        ~WaitSet();
+
+        /* Returns the bit the source will show up as, or -1 */
+        int add(const WaitSource source, const uint8_t index);
+        int addTimer(const uint32_t periodTicks);
+        int remove(const WaitSource source, const uint8_t index);
+
+        /* Returns the ready mask, or 0 if the timeout (in ticks) expired */
+        uint32_t wait(const uint32_t timeoutTicks);
+        /* Same as wait, without blocking */
+        uint32_t poll();
+
+        /* Safe to call from interrupt handlers */
+        void signal(const uint32_t readyMask);
+
+    private:
+        int allocateBit();
+
+        uint32_t _usedBits;
+        volatile uint32_t _readyBits;
+        Thread *volatile _waiter;
+};
+
+/* Interrupt handlers call this to report an event */
+void wait_set_notify(const WaitSource source, const uint8_t index);
+/* Called from the scheduler tick to drive timer sources */
+void wait_set_tick(const uint32_t now);
+/* Ticks from now until the next timer source is due, false if there are none */
+bool wait_set_next_tick(const uint32_t now, uint32_t &ticksLeft);
+
+#endif /* _WAIT_SET_H */
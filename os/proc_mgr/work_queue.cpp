@@ -0,0 +1,186 @@
+#include "irq.h"
+#include "scheduler.h"
+#include "work_queue.h"
+
+#define NUM_WORK_PRIORITIES static_cast<uint32_t>(WorkPriority::NUM_PRIORITIES)
+
+struct WorkQueue {
+    WorkItem *head;
+    WorkItem *tail;
+    Thread *worker;
+    bool workerWaiting;
+    WorkQueueStats stats;
+};
+
+static WorkQueue queues[NUM_WORK_PRIORITIES];
+
+static WorkItem pool[WORK_POOL_SIZE];
+static WorkItem *poolFreeList;
+
+/* Worker threads run above normal threads so deferred interrupt work isn't starved */
+static const uint8_t workerPriorities[NUM_WORK_PRIORITIES] = { 0, 1, THREAD_PRIORITY_DEFAULT };
+
+WorkItem::WorkItem()
+    : fn(nullptr), arg(nullptr), priority(WorkPriority::Normal), pending(false), pooled(false), next(nullptr)
+{
+}
+
+WorkItem::WorkItem(WorkFn fn, void *arg, WorkPriority priority)
+    : fn(fn), arg(arg), priority(priority), pending(false), pooled(false), next(nullptr)
+{
+}
+
+/* Interrupts must be masked */
+static void
+enqueue(WorkQueue &queue, WorkItem &item)
+{
+    item.pending = true;
+    item.next = nullptr;
+    if (queue.tail == nullptr) {
+        queue.head = &item;
+    } else {
+        queue.tail->next = &item;
+    }
+    queue.tail = &item;
+
+    queue.stats.submitted++;
+    queue.stats.depth++;
+    if (queue.stats.depth > queue.stats.maxDepth) {
+        queue.stats.maxDepth = queue.stats.depth;
+    }
+
+    if (queue.workerWaiting) {
+        queue.workerWaiting = false;
+        scheduler_wake(*queue.worker);
+    }
+}
+
+/* Interrupts must be masked */
+static WorkItem *
+dequeue(WorkQueue &queue)
+{
+    WorkItem *const item = queue.head;
+    if (item != nullptr) {
+        queue.head = item->next;
+        if (queue.head == nullptr) {
+            queue.tail = nullptr;
+        }
+        item->next = nullptr;
+        queue.stats.depth--;
+    }
+    return item;
+}
+
+static void
+workerLoop(void *arg)
+{
+    WorkQueue &queue = *static_cast<WorkQueue *>(arg);
+
+    for ( ;; ) {
+        uint32_t primask = irq_save();
+        WorkItem *item = dequeue(queue);
+        while (item == nullptr) {
+            queue.workerWaiting = true;
+            (void)scheduler_block(WAIT_FOREVER);
+            item = dequeue(queue);
+        }
+
+        // Copy out and clear pending first so the item can be resubmitted while it runs
+        const WorkFn fn = item->fn;
+        void *const workArg = item->arg;
+        item->pending = false;
+        if (item->pooled) {
+            item->next = poolFreeList;
+            poolFreeList = item;
+        }
+        irq_restore(primask);
+
+        fn(workArg);
+
+        primask = irq_save();
+        queue.stats.executed++;
+        irq_restore(primask);
+    }
+}
+
+void
+work_queue_init(void)
+{
+    poolFreeList = nullptr;
+    for (uint32_t i = 0; i < WORK_POOL_SIZE; i++) {
+        pool[i].pooled = true;
+        pool[i].next = poolFreeList;
+        poolFreeList = &pool[i];
+    }
+
+    // Queues start out empty, and anything submitted before now (e.g. by binlog_init) stays queued for the workers
+    for (uint32_t i = 0; i < NUM_WORK_PRIORITIES; i++) {
+        WorkQueue &queue = queues[i];
+        queue.worker = scheduler_create_kernel_thread(workerLoop, &queue, workerPriorities[i]);
+    }
+}
+
+int
+work_submit(WorkItem &item)
+{
+    if ((item.fn == nullptr) || (item.priority >= WorkPriority::NUM_PRIORITIES)) {
+        return -1;
+    }
+
+    WorkQueue &queue = queues[static_cast<uint32_t>(item.priority)];
+    int ret = 0;
+
+    const uint32_t primask = irq_save();
+    if (item.pending) {
+        queue.stats.coalesced++;
+        ret = 1;
+    } else {
+        enqueue(queue, item);
+    }
+    irq_restore(primask);
+
+    return ret;
+}
+
+int
+work_submit_fn(const WorkPriority priority, WorkFn fn, void *arg, const uint32_t flags)
+{
+    if ((fn == nullptr) || (priority >= WorkPriority::NUM_PRIORITIES)) {
+        return -1;
+    }
+
+    WorkQueue &queue = queues[static_cast<uint32_t>(priority)];
+    int ret = 0;
+
+    const uint32_t primask = irq_save();
+    if (flags & WORK_COALESCE) {
+        for (WorkItem *pending = queue.head; pending != nullptr; pending = pending->next) {
+            if ((pending->fn == fn) && (pending->arg == arg)) {
+                queue.stats.coalesced++;
+                irq_restore(primask);
+                return 1;
+            }
+        }
+    }
+
+    WorkItem *const item = poolFreeList;
+    if (item == nullptr) {
+        queue.stats.dropped++;
+        ret = -1;
+    } else {
+        poolFreeList = item->next;
+        item->fn = fn;
+        item->arg = arg;
+        item->priority = priority;
+        enqueue(queue, *item);
+    }
+    irq_restore(primask);
+
+    return ret;
+}
+
+const WorkQueueStats &
+work_queue_stats(const WorkPriority priority)
+{
+    return queues[static_cast<uint32_t>(priority)].stats;
+}
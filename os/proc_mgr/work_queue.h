@@ -0,0 +1,67 @@
+#ifndef _WORK_QUEUE_H
+#define _WORK_QUEUE_H
+
+#include <cstdint>
+
+/*
+ * Deferred interrupt work ("bottom halves").
+ *
+ * Interrupt handlers should only do what can't wait, and submit the rest as a
+ * work item. Each work priority has its own kernel worker thread which runs
+ * the items in the order they were submitted, at thread level with
+ * interrupts enabled.
+ *
+ * Submitting never allocates, so it is safe from any interrupt handler:
+ * either the caller owns the WorkItem (usually a static in the driver), or
+ * work_submit_fn takes one from a small fixed pool.
+ */
+
+#define WORK_POOL_SIZE 16u
+
+/* Don't queue a work_submit_fn item if one with the same function and argument is already pending */
+#define WORK_COALESCE (1u << 0)
+
+enum class WorkPriority : uint8_t {
+    High = 0,
+    Normal,
+    Low,
+    NUM_PRIORITIES,
+};
+
+typedef void (*WorkFn)(void *arg);
+
+struct WorkItem {
+    WorkFn fn;
+    void *arg;
+    WorkPriority priority;
+    volatile bool pending;
+    bool pooled;
+    WorkItem *next;
+
+    WorkItem();
+    WorkItem(WorkFn fn, void *arg, WorkPriority priority);
+};
+
+struct WorkQueueStats {
+    uint32_t submitted;
+    uint32_t coalesced;     // Submissions dropped because the work was already pending
+    uint32_t dropped;       // work_submit_fn calls that found the pool empty
+    uint32_t executed;
+    uint32_t depth;
+    uint32_t maxDepth;
+};
+
+void work_queue_init(void);
+
+/*
+ * Queues an item the caller owns. Submitting an item that is still pending
+ * coalesces with it, so the work runs once. Returns 1 if coalesced, 0 if
+ * queued, -1 on error.
+ */
+int work_submit(WorkItem &item);
+/* Same as work_submit, with an item from the pool. flags is WORK_COALESCE or 0. */
+int work_submit_fn(const WorkPriority priority, WorkFn fn, void *arg, const uint32_t flags);
+
+const WorkQueueStats &work_queue_stats(const WorkPriority priority);
+
+#endif /* _WORK_QUEUE_H */
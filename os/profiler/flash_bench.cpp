@@ -0,0 +1,134 @@
+#include "flash_bench.h"
+
+#if FLASH_BENCHMARK
+
+#include "alloc.h"
+#include "chip_common.h"
+#include "clock_driver.h"
+#include "dwt.h"
+#include "flash_driver.h"
+#include "format.h"
+#include "irq.h"
+#include "ramfunc.h"
+#include "usart_driver.h"
+
+#define BENCH_LINE_SIZE 80u
+#define BENCH_RUNS 4u
+/* Enough to run well past the instruction cache's 64 lines of 128 bits */
+#define BENCH_ROUNDS 256u
+#define BENCH_ALLOCS 16u
+
+/*
+ * Branchy integer work with loads from a table. The table is in .rodata,
+ * so it's read from flash (through the data cache) whichever copy of the
+ * code runs: only the instruction fetches move to RAM in bench_in_ram. It's
+ * inlined into each of the wrappers below so they run the same code.
+ */
+static const uint32_t bench_table[16] = {
+    0x9e3779b9u, 0x7f4a7c15u, 0xf39cc060u, 0x5ced1fa3u,
+    0x12345678u, 0x0badf00du, 0xdeadbeefu, 0xcafef00du,
+    0x01234567u, 0x89abcdefu, 0xfedcba98u, 0x76543210u,
+    0x0f0f0f0fu, 0xf0f0f0f0u, 0x33333333u, 0xccccccccu,
+};
+
+static inline __attribute__((always_inline)) uint32_t
+bench_work(uint32_t x)
+{
+    for (uint32_t i = 0; i < BENCH_ROUNDS; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        if (x & 1u) {
+            x += bench_table[x & 0xf];
+        } else {
+            x -= bench_table[(x >> 4) & 0xf];
+        }
+    }
+    return x;
+}
+
+__attribute__((noinline))
+static uint32_t
+bench_in_flash(const uint32_t seed)
+{
+    return bench_work(seed);
+}
+
+RAMFUNC
+static uint32_t
+bench_in_ram(const uint32_t seed)
+{
+    return bench_work(seed);
+}
+
+static uint32_t
+bench_alloc(const uint32_t)
+{
+    void *blocks[BENCH_ALLOCS];
+    for (uint32_t i = 0; i < BENCH_ALLOCS; i++) {
+        blocks[i] = _malloc(16u + (i * 24u));
+    }
+    for (uint32_t i = BENCH_ALLOCS; i > 0; i--) {
+        _free(blocks[i - 1u]);
+    }
+    return 0;
+}
+
+/* Best of a few runs, the first of which warms the caches */
+static uint32_t
+bench_cycles(uint32_t (*const fn)(const uint32_t))
+{
+    uint32_t best = UINT32_MAX;
+    for (uint32_t run = 0; run < BENCH_RUNS; run++) {
+        const uint32_t primask = irq_save();
+        const uint32_t start = DWT->get_cycle_count();
+        (void)fn(run + 1u);
+        const uint32_t cycles = DWT->get_cycle_count() - start;
+        irq_restore(primask);
+
+        if (cycles < best) {
+            best = cycles;
+        }
+    }
+    return best;
+}
+
+static const char *
+where(uint32_t (*const fn)(const uint32_t))
+{
+    return (reinterpret_cast<uintptr_t>(fn) >= SRAM_BASE) ? "ram" : "flash";
+}
+
+static void
+bench_print(usart_t usart, const char *const name, uint32_t (*const fn)(const uint32_t), const bool accelerator)
+{
+    char line[BENCH_LINE_SIZE];
+
+    flash_accelerator_cmd(accelerator);
+    const uint32_t cycles = bench_cycles(fn);
+    const size_t len = FORMAT_BUF(line, sizeof(line), "flash_bench: %-10s %-5s accel %-3s %9u cycles\n",
+            name, where(fn), accelerator ? "on" : "off", cycles);
+    (void)usart_send_string(usart, line, len);
+}
+
+void
+flash_benchmark(usart_t usart)
+{
+    char line[BENCH_LINE_SIZE];
+    const bool was_enabled = flash_accelerator_enabled();
+
+    const size_t len = FORMAT_BUF(line, sizeof(line), "flash_bench: hclk %u MHz\n",
+            clock_rates().hclk_hz / 1000000u);
+    (void)usart_send_string(usart, line, len);
+
+    bench_print(usart, "work", bench_in_flash, false);
+    bench_print(usart, "work", bench_in_flash, true);
+    bench_print(usart, "work", bench_in_ram, false);
+    bench_print(usart, "work", bench_in_ram, true);
+    bench_print(usart, "malloc", bench_alloc, false);
+    bench_print(usart, "malloc", bench_alloc, true);
+
+    flash_accelerator_cmd(was_enabled);
+}
+
+#endif
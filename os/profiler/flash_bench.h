@@ -0,0 +1,24 @@
+#ifndef _FLASH_BENCH_H
+#define _FLASH_BENCH_H
+
+#include "stm32_usart.h"
+
+/*
+ * Times the same code with the flash accelerator off and on, and run from
+ * the flash and from RAM, then the allocator's malloc/free path both ways
+ * round the accelerator. Each case is the best of a few runs, in DWT
+ * cycles with interrupts masked. Build with RAMFUNC_IN_FLASH=1 as well to
+ * see what the allocator costs with nothing moved to RAM.
+ *
+ * Build with FLASH_BENCHMARK=1 to have ker_main run it once the allocator
+ * is up.
+ */
+#ifndef FLASH_BENCHMARK
+#define FLASH_BENCHMARK 0
+#endif
+
+#if FLASH_BENCHMARK
+void flash_benchmark(usart_t usart);
+#endif
+
+#endif /* _FLASH_BENCH_H */
@@ -0,0 +1,115 @@
+#include <cstddef>
+
+#include "cpuRegsOnStack.h"
+#include "irq.h"
+#include "profiler.h"
+#include "usart_driver.h"
+
+/* Defined in the linker script */
+extern unsigned int _TEXT_START;
+extern unsigned int _TEXT_END;
+extern unsigned int _RAMFUNC_START;
+extern unsigned int _RAMFUNC_END;
+
+#define PROF_BIN_MAX 0xffffu
+
+/* The hardware frame is the part of CpuRegsOnStack from R0 on */
+#define FRAME_PC_INDEX ((offsetof(CpuRegsOnStack, PC) - offsetof(CpuRegsOnStack, R0)) / sizeof(uint32_t))
+
+ProfBuffer prof_buffer;
+
+static volatile bool running;
+static uint32_t countdown;
+
+/* Narrowest bins that fit start..end into num_bins */
+static uint16_t
+bin_shift_for(const uint32_t start, const uint32_t end, const uint32_t num_bins)
+{
+    /* Thumb instructions are at least 2 bytes, so there's no point going finer */
+    uint16_t shift = 1;
+    while (((end - start) >> shift) >= num_bins) {
+        shift++;
+    }
+    return shift;
+}
+
+void
+prof_start(const uint32_t divisor)
+{
+    const uint32_t text_start = reinterpret_cast<uintptr_t>(&_TEXT_START);
+    const uint32_t text_end = reinterpret_cast<uintptr_t>(&_TEXT_END);
+    const uint32_t ram_start = reinterpret_cast<uintptr_t>(&_RAMFUNC_START);
+    const uint32_t ram_end = reinterpret_cast<uintptr_t>(&_RAMFUNC_END);
+    const uint16_t shift = bin_shift_for(text_start, text_end, PROF_BINS);
+
+    const uint32_t primask = irq_save();
+    prof_buffer.magic = PROF_MAGIC;
+    prof_buffer.version = PROF_VERSION;
+    prof_buffer.bin_shift = shift;
+    prof_buffer.text_start = text_start;
+    prof_buffer.text_end = text_end;
+    prof_buffer.num_bins = ((text_end - text_start) >> shift) + 1;
+    prof_buffer.divisor = (divisor == 0) ? 1 : divisor;
+    prof_buffer.samples = 0;
+    prof_buffer.outside = 0;
+    prof_buffer.saturated = 0;
+    prof_buffer.ram_bin_shift = bin_shift_for(ram_start, ram_end, PROF_RAM_BINS);
+    prof_buffer.num_ram_bins = PROF_RAM_BINS;
+    prof_buffer.ram_start = ram_start;
+    prof_buffer.ram_end = ram_end;
+    for (uint32_t i = 0; i < PROF_RAM_BINS; i++) {
+        prof_buffer.ram_bins[i] = 0;
+    }
+    for (uint32_t i = 0; i < PROF_BINS; i++) {
+        prof_buffer.bins[i] = 0;
+    }
+    countdown = prof_buffer.divisor;
+    running = true;
+    irq_restore(primask);
+}
+
+void
+prof_stop(void)
+{
+    running = false;
+}
+
+void
+prof_tick(const uint32_t *const frame)
+{
+    if (!running || (--countdown != 0)) {
+        return;
+    }
+    countdown = prof_buffer.divisor;
+
+    /* Bit 0 is clear in a stacked PC, but mask it anyway so a bad frame can't index past the bins */
+    const uint32_t pc = frame[FRAME_PC_INDEX] & ~1u;
+    prof_buffer.samples++;
+
+    uint16_t *bin;
+    if ((pc >= prof_buffer.text_start) && (pc < prof_buffer.text_end)) {
+        bin = &prof_buffer.bins[(pc - prof_buffer.text_start) >> prof_buffer.bin_shift];
+    } else if ((pc >= prof_buffer.ram_start) && (pc < prof_buffer.ram_end)) {
+        bin = &prof_buffer.ram_bins[(pc - prof_buffer.ram_start) >> prof_buffer.ram_bin_shift];
+    } else {
+        prof_buffer.outside++;
+        return;
+    }
+
+    if (*bin == PROF_BIN_MAX) {
+        prof_buffer.saturated++;
+    } else {
+        (*bin)++;
+    }
+}
+
+/* Sends the buffer as it sits in memory, the same as a debugger dump */
+void
+prof_dump(usart_t usart)
+{
+    prof_stop();
+
+    const char *const data = reinterpret_cast<const char *>(&prof_buffer);
+    const uint32_t size = offsetof(ProfBuffer, bins) + (prof_buffer.num_bins * sizeof(prof_buffer.bins[0]));
+    (void)usart_send_blocking(usart, data, size, USART_SEND_TIMEOUT_TICKS);
+}
@@ -0,0 +1,70 @@
+#ifndef _PROFILER_H
+#define _PROFILER_H
+
+#include <cstdint>
+
+#include "stm32_usart.h"
+
+/*
+ * Statistical profiler. Every divisor'th SysTick, the PC the tick
+ * interrupted is read out of its exception frame and counted in a histogram
+ * covering .text, so over time each bin's count is proportional to the CPU
+ * time spent in that part of the code. It needs nothing from a debugger:
+ * the histogram is sent out of a USART with prof_dump, and
+ * tools/profiler/prof_report.py turns it into a flat profile using the
+ * symbols in build/startup.elf.
+ *
+ * Samples are taken on the scheduler tick, so work that always runs in step
+ * with the tick (or in a handler that masks it) is under-represented.
+ *
+ * Bins are 2^bin_shift bytes wide, picked when profiling starts so that all
+ * of .text fits in PROF_BINS. Code running from RAM (RAMFUNC, see ramfunc.h)
+ * gets a second, smaller histogram of its own, sized the same way. A PC in
+ * neither is counted separately, as are samples dropped because their bin
+ * was full.
+ */
+#ifndef PROF_BINS
+#define PROF_BINS 1024u
+#endif
+
+#ifndef PROF_RAM_BINS
+#define PROF_RAM_BINS 64u
+#endif
+
+#define PROF_MAGIC 0x464f5250u      // "PROF"
+#define PROF_VERSION 2u
+
+/* Laid out for the host tool, all little endian */
+struct ProfBuffer {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t bin_shift;
+    uint32_t text_start;
+    uint32_t text_end;
+    uint32_t num_bins;
+    uint32_t divisor;
+    uint32_t samples;
+    uint32_t outside;
+    uint32_t saturated;
+    uint16_t ram_bin_shift;
+    uint16_t num_ram_bins;      // Always PROF_RAM_BINS, so the host knows where bins starts
+    uint32_t ram_start;
+    uint32_t ram_end;
+    uint16_t ram_bins[PROF_RAM_BINS];
+    uint16_t bins[PROF_BINS];
+};
+
+extern ProfBuffer prof_buffer;
+
+/* Clears the histogram and takes a sample every divisor ticks */
+void prof_start(const uint32_t divisor);
+void prof_stop(void);
+/* Called from SysTick with the interrupted context's exception frame */
+void prof_tick(const uint32_t *frame);
+/*
+ * Stops profiling and sends the histogram out of the USART. Blocks until it's
+ * queued, or gives up if the USART stops taking it.
+ */
+void prof_dump(usart_t usart);
+
+#endif /* _PROFILER_H */
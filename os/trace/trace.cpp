@@ -0,0 +1,104 @@
+#include "clock_driver.h"
+#include "cpu.h"
+#include "dwt.h"
+#include "irq.h"
+#include "trace.h"
+#include "usart_driver.h"
+
+#define TRACE_RECORDS_MASK (TRACE_RECORDS - 1u)
+
+static_assert((TRACE_RECORDS & TRACE_RECORDS_MASK) == 0, "TRACE_RECORDS must be a power of 2");
+
+TraceBuffer trace_buffer;
+
+/*
+ * The cycle counter runs at the core clock, so the host tool needs to know
+ * where that changed to turn cycles into time. core_hz is always the rate
+ * now, and each change is recorded with both rates so records from before
+ * it can still be placed once core_hz has moved on.
+ */
+static void
+trace_clock_changed(void *, const ClockEvent event, const ClockRates &old_rates, const ClockRates &new_rates)
+{
+    if (event != ClockEvent::POST_CHANGE) {
+        return;
+    }
+    trace_buffer.core_hz = new_rates.hclk_hz;
+    trace_record(TraceEvent::CLOCK_CHANGE, 0, old_rates.hclk_hz, new_rates.hclk_hz);
+}
+
+static ClockNotifier trace_notifier = { trace_clock_changed, nullptr, nullptr };
+
+void
+trace_init(void)
+{
+    trace_buffer.magic = TRACE_MAGIC;
+    trace_buffer.version = TRACE_VERSION;
+    trace_buffer.record_size = sizeof(TraceRecord);
+    trace_buffer.capacity = TRACE_RECORDS;
+    trace_buffer.core_hz = clock_rates().hclk_hz;
+    trace_buffer.head = 0;
+    clock_register_notifier(trace_notifier);
+    trace_start();
+}
+
+void
+trace_start(void)
+{
+    __atomic_store_n(&trace_buffer.enabled, 1, __ATOMIC_RELEASE);
+}
+
+void
+trace_stop(void)
+{
+    __atomic_store_n(&trace_buffer.enabled, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * The slot is taken with an atomic add, so an interrupt arriving half way
+ * through just records into the next one. The ring only wraps onto a record
+ * still being written after TRACE_RECORDS nested events, which doesn't happen.
+ */
+void
+trace_record(const TraceEvent event, const uint16_t id, const uint32_t a, const uint32_t b)
+{
+    if (__atomic_load_n(&trace_buffer.enabled, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+
+    const uint32_t slot = __atomic_fetch_add(&trace_buffer.head, 1, __ATOMIC_RELAXED) & TRACE_RECORDS_MASK;
+    TraceRecord &record = trace_buffer.records[slot];
+    record.cycles = DWT->get_cycle_count();
+    record.event = static_cast<uint8_t>(event);
+    record.cpu = static_cast<uint8_t>(cpu_current_id());
+    record.id = id;
+    record.a = a;
+    record.b = b;
+}
+
+void
+trace_irq_enter(void)
+{
+    trace_record(TraceEvent::IRQ_ENTER, static_cast<uint16_t>(irq_current_exception()), 0, 0);
+}
+
+void
+trace_irq_exit(void)
+{
+    trace_record(TraceEvent::IRQ_EXIT, static_cast<uint16_t>(irq_current_exception()), 0, 0);
+}
+
+/*
+ * Sends the buffer as it sits in memory, the same as a debugger dump, so
+ * the host tool only has one format to read. Recording stays stopped
+ * afterwards until trace_start.
+ */
+void
+trace_dump(usart_t usart)
+{
+    trace_stop();
+
+    const char *const data = reinterpret_cast<const char *>(&trace_buffer);
+    const uint32_t size = sizeof(trace_buffer);
+    (void)usart_send_blocking(usart, data, size, USART_SEND_TIMEOUT_TICKS);
+}
@@ -0,0 +1,98 @@
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <cstdint>
+
+#include "stm32_usart.h"
+
+/*
+ * Kernel event tracer. Each event is a fixed size record, stamped with the
+ * DWT cycle counter, in a RAM ring that always holds the most recent
+ * TRACE_RECORDS events. Recording takes a slot with one atomic add and never
+ * masks interrupts, so it can be used anywhere including PendSV.
+ *
+ * To look at a trace, either dump trace_buffer with a debugger:
+ *   dump binary memory trace.bin &trace_buffer ((char *)&trace_buffer + sizeof(trace_buffer))
+ * or send it over a USART with trace_dump. tools/trace/trace_to_json.py turns
+ * either into Chrome trace JSON for chrome://tracing or ui.perfetto.dev.
+ *
+ * Build with KERNEL_TRACE=0 to compile all the trace points out.
+ */
+#ifndef KERNEL_TRACE
+#define KERNEL_TRACE 1
+#endif
+
+/* Must be a power of 2 */
+#ifndef TRACE_RECORDS
+#define TRACE_RECORDS 256u
+#endif
+
+#define TRACE_MAGIC 0x45435254u     // "TRCE"
+#define TRACE_VERSION 2u
+
+enum class TraceEvent : uint8_t {
+    NONE = 0,           // Slot never written
+    CONTEXT_SWITCH,     // a = outgoing thread ID, b = incoming thread ID
+    IRQ_ENTER,          // id = exception number (16 + IRQ number for peripherals)
+    IRQ_EXIT,           // id = exception number
+    MALLOC,             // a = pointer, b = size
+    FREE,               // a = pointer, b = size
+    DMA_START,          // id = controller << 3 | stream, a = transfer, b = bytes
+    DMA_DONE,           // id = controller << 3 | stream, a = transfer, b = bytes moved
+    DMA_ERROR,          // id = controller << 3 | stream, a = transfer, b = interrupt flags
+    SYSCALL_ENTER,      // id = SVC number, a = first argument
+    SYSCALL_EXIT,       // id = SVC number, a = return value
+    CLOCK_CHANGE,       // a = old core clock in Hz, b = new core clock in Hz
+};
+
+struct TraceRecord {
+    uint32_t cycles;
+    uint8_t event;
+    uint8_t cpu;
+    uint16_t id;
+    uint32_t a;
+    uint32_t b;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord layout is shared with the host tool");
+
+/* Laid out for the host tool, all little endian */
+struct TraceBuffer {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t core_hz;           // Core clock now, records before a CLOCK_CHANGE ran at its old rate
+    volatile uint32_t head;     // Number of records ever written, the next one goes in head % capacity
+    volatile uint32_t enabled;
+    TraceRecord records[TRACE_RECORDS];
+};
+
+extern TraceBuffer trace_buffer;
+
+/* Sets up the buffer header and starts recording */
+void trace_init(void);
+void trace_start(void);
+void trace_stop(void);
+void trace_record(const TraceEvent event, const uint16_t id, const uint32_t a, const uint32_t b);
+/* Exception number comes from IPSR */
+void trace_irq_enter(void);
+void trace_irq_exit(void);
+/*
+ * Stops recording and sends the whole buffer out of the USART. Blocks until it's
+ * queued, or gives up if the USART stops taking it.
+ */
+void trace_dump(usart_t usart);
+
+#if KERNEL_TRACE
+#define TRACE(_event, _id, _a, _b) \
+    trace_record(TraceEvent::_event, (_id), (uint32_t)(uintptr_t)(_a), (uint32_t)(uintptr_t)(_b))
+#define TRACE_IRQ_ENTER() trace_irq_enter()
+#define TRACE_IRQ_EXIT() trace_irq_exit()
+#else
+#define TRACE(_event, _id, _a, _b) do { } while (0)
+#define TRACE_IRQ_ENTER() do { } while (0)
+#define TRACE_IRQ_EXIT() do { } while (0)
+#endif
+
+#endif /* _TRACE_H */
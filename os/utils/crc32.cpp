@@ -0,0 +1,23 @@
+#include "crc32.h"
+
+/* CRCs of each nibble value, for the reflected polynomial 0xedb88320 */
+static const uint32_t nibble_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+uint32_t
+crc32(const void *const data, const size_t len, const uint32_t crc)
+{
+    const uint8_t *const bytes = static_cast<const uint8_t *>(data);
+    uint32_t c = ~crc;
+
+    for (size_t i = 0; i < len; i++) {
+        c ^= bytes[i];
+        c = (c >> 4) ^ nibble_table[c & 0xf];
+        c = (c >> 4) ^ nibble_table[c & 0xf];
+    }
+    return ~c;
+}
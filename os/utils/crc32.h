@@ -0,0 +1,14 @@
+#ifndef _CRC32_H
+#define _CRC32_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Standard CRC-32 (the zlib/Ethernet one). Done in software a nibble at a
+ * time, the table is only 64 bytes. Pass the previous result as crc to
+ * carry on over more data, 0 to start.
+ */
+uint32_t crc32(const void *const data, const size_t len, const uint32_t crc = 0);
+
+#endif /* _CRC32_H */
@@ -63,7 +63,7 @@ class DoublyLinkedList {
 template <class T>
 DoublyLinkedList<T>::Iterator::Iterator(const list_item& start)
 {
-    current_item = &start;
+    current_item = const_cast<list_item *>(&start);
 }
 
 template <class T>
@@ -135,8 +135,12 @@ DoublyLinkedList<T>::list_item::~list_item()
  */
 template <class T>
 DoublyLinkedList<T>::DoublyLinkedList()
-    : sentinel()
-{ }
+    : num_items(0),
+      sentinel()
+{
+    sentinel.prev = &sentinel;
+    sentinel.next = &sentinel;
+}
 
 //DoublyLinkedList::DoublyLinkedList(const DoublyLinkedList& other) {}
 //DoublyLinkedList::DoublyLinkedList(DoublyLinkedList&& other) {}
@@ -189,6 +193,7 @@ void DoublyLinkedList<T>::clear()
     for (size_t i = 0; i < num_items; i++) {
         delete sentinel.next;
     }
+    num_items = 0;
 }
 
 template <class T>
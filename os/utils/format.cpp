@@ -0,0 +1,270 @@
+#include "format.h"
+
+/*
+ * Where the output goes. Without a sink, buf is the caller's buffer and
+ * anything past cap is dropped. With one, buf is a chunk on the stack that is
+ * handed to the sink each time it fills.
+ */
+struct FormatOut {
+    char *buf;
+    size_t cap;
+    size_t pos;
+    size_t total;
+    FormatSink sink;
+    void *ctx;
+};
+
+static void
+flush(FormatOut &out)
+{
+    if ((out.sink != nullptr) && (out.pos > 0)) {
+        out.sink(out.ctx, out.buf, out.pos);
+        out.pos = 0;
+    }
+}
+
+static void
+put(FormatOut &out, const char c)
+{
+    if (out.pos == out.cap) {
+        if (out.sink == nullptr) {
+            return;
+        }
+        flush(out);
+    }
+    out.buf[out.pos++] = c;
+    out.total++;
+}
+
+static void
+put_repeat(FormatOut &out, const char c, uint32_t count)
+{
+    while (count-- > 0) {
+        put(out, c);
+    }
+}
+
+static void
+put_str(FormatOut &out, const char *s, const uint32_t len)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        put(out, s[i]);
+    }
+}
+
+static uint32_t
+str_len(const char *const s, const int8_t max)
+{
+    uint32_t len = 0;
+    while ((s[len] != '\0') && ((max < 0) || (len < static_cast<uint32_t>(max)))) {
+        len++;
+    }
+    return len;
+}
+
+/*
+ * Writes a field: padding, then the prefix (sign or 0x), then zeros if the
+ * field is zero padded, then the body.
+ */
+static void
+put_field(FormatOut &out, const FormatSpec &spec, const char *const prefix, const uint32_t prefix_len,
+        const char *const body, const uint32_t body_len)
+{
+    const uint32_t len = prefix_len + body_len;
+    const uint32_t pad = (spec.width > len) ? spec.width - len : 0;
+
+    if (!spec.left && !spec.zero) {
+        put_repeat(out, ' ', pad);
+    }
+    put_str(out, prefix, prefix_len);
+    if (!spec.left && spec.zero) {
+        put_repeat(out, '0', pad);
+    }
+    put_str(out, body, body_len);
+    if (spec.left) {
+        put_repeat(out, ' ', pad);
+    }
+}
+
+/* Writes value's digits into the end of buf, returns where they start. Divisions are by constants. */
+static char *
+dec_digits(char *end, uint32_t value, uint32_t min_digits)
+{
+    do {
+        *--end = '0' + (value % 10);
+        value /= 10;
+        if (min_digits > 0) {
+            min_digits--;
+        }
+    } while ((value > 0) || (min_digits > 0));
+    return end;
+}
+
+static char *
+hex_digits(char *end, uint32_t value, uint32_t min_digits, const bool upper)
+{
+    const char *const hex = upper ? "0123456789ABCDEF" : "0123456789abcdef";
+    do {
+        *--end = hex[value & 0xf];
+        value >>= 4;
+        if (min_digits > 0) {
+            min_digits--;
+        }
+    } while ((value > 0) || (min_digits > 0));
+    return end;
+}
+
+static const uint32_t powers_of_ten[10] = {
+    1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000,
+};
+
+static void
+put_bad(FormatOut &out)
+{
+    put_str(out, "<?>", 3);
+}
+
+/* Splits a signed argument into a sign and magnitude */
+static char
+sign_of(const FormatArg &arg, const FormatSpec &spec, uint32_t &magnitude)
+{
+    if ((arg.kind == FormatArg::KIND_INT) && (arg.i < 0)) {
+        magnitude = 0u - arg.u;
+        return '-';
+    }
+    magnitude = arg.u;
+    return spec.plus ? '+' : '\0';
+}
+
+static void
+put_number(FormatOut &out, const FormatSpec &spec, const FormatArg &arg)
+{
+    /* Up to 10 integer digits, a point and 9 decimals */
+    char digits[24];
+    char *const end = digits + sizeof(digits);
+    char *start = end;
+    char prefix[2] = { '\0', '\0' };
+    uint32_t prefix_len = 0;
+    uint32_t magnitude = 0;
+
+    switch (spec.conv) {
+    case 'd':
+    case 'i':
+        prefix[0] = sign_of(arg, spec, magnitude);
+        start = dec_digits(end, magnitude, 0);
+        break;
+    case 'u':
+        start = dec_digits(end, arg.u, 0);
+        break;
+    case 'x':
+    case 'X':
+        start = hex_digits(end, arg.u, 0, spec.conv == 'X');
+        break;
+    case 'p':
+        prefix[0] = '0';
+        prefix[1] = 'x';
+        prefix_len = 2;
+        start = hex_digits(end, static_cast<uint32_t>(reinterpret_cast<uintptr_t>(arg.p)), 8, false);
+        break;
+    case 'k': {
+        const uint32_t decimals = (spec.precision < 0) ? 0 : spec.precision;
+        const uint32_t scale = powers_of_ten[decimals];
+        prefix[0] = sign_of(arg, spec, magnitude);
+        if (decimals > 0) {
+            start = dec_digits(end, magnitude % scale, decimals);
+            *--start = '.';
+        }
+        start = dec_digits(start, magnitude / scale, 0);
+        break;
+    }
+    case 'q': {
+        const uint32_t decimals = (spec.precision < 0) ? 4 : spec.precision;
+        const uint32_t scale = powers_of_ten[decimals];
+        prefix[0] = sign_of(arg, spec, magnitude);
+        uint32_t whole = magnitude >> 16;
+        /* At most 0xffff * 10^4, so this stays in 32 bits. Rounded to nearest. */
+        uint32_t frac = (((magnitude & 0xffff) * scale) + 0x8000) >> 16;
+        if (frac >= scale) {
+            whole++;
+            frac -= scale;
+        }
+        if (decimals > 0) {
+            start = dec_digits(end, frac, decimals);
+            *--start = '.';
+        }
+        start = dec_digits(start, whole, 0);
+        break;
+    }
+    default:
+        break;
+    }
+
+    if ((prefix_len == 0) && (prefix[0] != '\0')) {
+        prefix_len = 1;
+    }
+    put_field(out, spec, prefix, prefix_len, start, static_cast<uint32_t>(end - start));
+}
+
+static void
+run(FormatOut &out, const char *fmt, const FormatArg *const args, const size_t count)
+{
+    size_t used = 0;
+
+    while (*fmt != '\0') {
+        if (*fmt != '%') {
+            put(out, *fmt++);
+            continue;
+        }
+
+        FormatSpec spec {};
+        fmt = format_parse_spec(fmt + 1, spec);
+        if (spec.conv == '%') {
+            put(out, '%');
+            continue;
+        }
+        if ((spec.conv == '\0') || (used == count)) {
+            put_bad(out);
+            continue;
+        }
+        const FormatArg &arg = args[used++];
+        if (!format_arg_fits(spec.conv, arg.kind)) {
+            put_bad(out);
+            continue;
+        }
+
+        if (spec.conv == 's') {
+            const char *const s = (arg.s == nullptr) ? "(null)" : arg.s;
+            put_field(out, spec, nullptr, 0, s, str_len(s, spec.precision));
+        } else if (spec.conv == 'c') {
+            const char c = static_cast<char>(arg.u);
+            put_field(out, spec, nullptr, 0, &c, 1);
+        } else {
+            put_number(out, spec, arg);
+        }
+    }
+}
+
+size_t
+format_args_buf(char *const buf, const size_t size, const char *const fmt, const FormatArg *const args,
+        const size_t count)
+{
+    if (size == 0) {
+        return 0;
+    }
+
+    FormatOut out = { buf, size - 1, 0, 0, nullptr, nullptr };
+    run(out, fmt, args, count);
+    buf[out.pos] = '\0';
+    return out.pos;
+}
+
+size_t
+format_args_sink(FormatSink sink, void *const ctx, const char *const fmt, const FormatArg *const args,
+        const size_t count)
+{
+    char chunk[FORMAT_SINK_CHUNK];
+    FormatOut out = { chunk, sizeof(chunk), 0, 0, sink, ctx };
+    run(out, fmt, args, count);
+    flush(out);
+    return out.total;
+}
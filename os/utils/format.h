@@ -0,0 +1,248 @@
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <type_traits>
+
+/*
+ * printf style formatting that doesn't touch the heap or libc, and keeps no
+ * state between calls, so any thread (or handler) can use it.
+ *
+ * Conversions are %d %i %u %x %X %p %c %s %%, plus two for fixed point:
+ *   %.Nk  an integer holding value * 10^N, printed with N decimals (N <= 9),
+ *         e.g. ("%.3k V", 3300) prints "3.300 V"
+ *   %.Nq  a signed Q16.16 value, printed with N decimals (N <= 4, default 4)
+ * Flags are '-' (left justify), '0' (zero pad) and '+' (always show a sign),
+ * followed by a field width. A precision on %s limits how much of the string
+ * is printed. Width and precision can't come from arguments ('*'). The l, h
+ * and z length modifiers are accepted and ignored: everything is 32 bits.
+ * There is no 64 bit division without libgcc, so 64 bit values have to be
+ * split and printed as two %08x halves.
+ *
+ * Arguments carry their type with them. One that doesn't suit its conversion,
+ * a missing one, or a malformed conversion prints "<?>". When the format is a
+ * string literal, the FORMAT_BUF and FORMAT_SINK macros also parse it at
+ * compile time, so a mismatch is a build error instead.
+ */
+
+/* Receives the formatted text in pieces. The pieces aren't terminated. */
+typedef void (*FormatSink)(void *ctx, const char *data, size_t len);
+
+/* Number of bytes a sink's pieces are gathered into on the stack */
+#define FORMAT_SINK_CHUNK 32u
+
+struct FormatArg {
+    enum arg_kind : uint8_t { KIND_NONE = 0, KIND_INT, KIND_UINT, KIND_PTR, KIND_STR };
+
+    arg_kind kind;
+    union {
+        int32_t i;
+        uint32_t u;
+        const void *p;
+        const char *s;
+    };
+};
+
+/* One parsed conversion, the part of the format from '%' up to and including its letter */
+struct FormatSpec {
+    char conv;              // '\0' if the conversion is malformed
+    bool left;
+    bool zero;
+    bool plus;
+    uint8_t width;
+    int8_t precision;       // -1 if none was given
+};
+
+/* p points just past the '%'. Returns a pointer just past the conversion. */
+constexpr const char *
+format_parse_spec(const char *p, FormatSpec &spec)
+{
+    spec = FormatSpec { '\0', false, false, false, 0, -1 };
+
+    for (;; p++) {
+        if (*p == '-') {
+            spec.left = true;
+        } else if (*p == '0') {
+            spec.zero = true;
+        } else if (*p == '+') {
+            spec.plus = true;
+        } else {
+            break;
+        }
+    }
+    uint32_t width = 0;
+    while ((*p >= '0') && (*p <= '9')) {
+        width = (width * 10) + (*p++ - '0');
+    }
+    if (*p == '.') {
+        p++;
+        uint32_t precision = 0;
+        while ((*p >= '0') && (*p <= '9')) {
+            precision = (precision * 10) + (*p++ - '0');
+        }
+        if (precision > 127) {
+            return p;
+        }
+        spec.precision = static_cast<int8_t>(precision);
+    }
+    if (width > 255) {
+        return p;
+    }
+    spec.width = static_cast<uint8_t>(width);
+    while ((*p == 'l') || (*p == 'h') || (*p == 'z')) {
+        p++;
+    }
+
+    switch (*p) {
+    case 'k':
+        if (spec.precision > 9) {
+            return p + 1;
+        }
+        break;
+    case 'q':
+        if (spec.precision > 4) {
+            return p + 1;
+        }
+        break;
+    case 'd': case 'i': case 'u': case 'x': case 'X':
+    case 'p': case 'c': case 's': case '%':
+        break;
+    default:
+        return (*p == '\0') ? p : p + 1;
+    }
+    spec.conv = *p;
+    return p + 1;
+}
+
+constexpr bool
+format_arg_fits(const char conv, const FormatArg::arg_kind kind)
+{
+    switch (conv) {
+    case 's':
+        return kind == FormatArg::KIND_STR;
+    case 'p':
+        return (kind == FormatArg::KIND_PTR) || (kind == FormatArg::KIND_STR);
+    default:
+        return (kind == FormatArg::KIND_INT) || (kind == FormatArg::KIND_UINT);
+    }
+}
+
+/* Checks every conversion in fmt is well formed and has a suitable argument, with none left over */
+constexpr bool
+format_check(const char *fmt, const FormatArg::arg_kind *const kinds, const size_t count)
+{
+    size_t used = 0;
+    while (*fmt != '\0') {
+        if (*fmt++ != '%') {
+            continue;
+        }
+        FormatSpec spec {};
+        fmt = format_parse_spec(fmt, spec);
+        if (spec.conv == '%') {
+            continue;
+        }
+        if ((spec.conv == '\0') || (used == count) || !format_arg_fits(spec.conv, kinds[used])) {
+            return false;
+        }
+        used++;
+    }
+    return used == count;
+}
+
+template <typename T>
+constexpr FormatArg::arg_kind
+format_kind(void)
+{
+    if constexpr (std::is_enum<T>::value) {
+        return format_kind<std::underlying_type_t<T>>();
+    } else if constexpr (std::is_integral<T>::value) {
+        static_assert(sizeof(T) <= sizeof(uint32_t), "64 bit values have to be printed in two halves");
+        return std::is_signed<T>::value ? FormatArg::KIND_INT : FormatArg::KIND_UINT;
+    } else if constexpr (std::is_same<T, char *>::value || std::is_same<T, const char *>::value) {
+        return FormatArg::KIND_STR;
+    } else if constexpr (std::is_pointer<T>::value || std::is_null_pointer<T>::value) {
+        return FormatArg::KIND_PTR;
+    } else {
+        static_assert(sizeof(T) == 0, "type can't be formatted");
+        return FormatArg::KIND_NONE;
+    }
+}
+
+template <typename T>
+inline FormatArg
+format_arg(const T &value)
+{
+    typedef std::decay_t<T> arg_type;
+
+    FormatArg arg;
+    arg.kind = format_kind<arg_type>();
+    if constexpr (std::is_enum<arg_type>::value || std::is_integral<arg_type>::value) {
+        if (arg.kind == FormatArg::KIND_INT) {
+            arg.i = static_cast<int32_t>(value);
+        } else {
+            arg.u = static_cast<uint32_t>(value);
+        }
+    } else if constexpr (std::is_null_pointer<arg_type>::value) {
+        arg.p = nullptr;
+    } else if constexpr (std::is_same<arg_type, char *>::value || std::is_same<arg_type, const char *>::value) {
+        arg.s = value;
+    } else {
+        arg.p = (const void *)value;
+    }
+    return arg;
+}
+
+/*
+ * Formats into buf, which always ends up terminated (if size isn't 0).
+ * Returns the number of characters written, not counting the terminator.
+ * Anything that doesn't fit is dropped.
+ */
+size_t format_args_buf(char *buf, const size_t size, const char *fmt, const FormatArg *args, const size_t count);
+/* Formats into sink, returns the number of characters passed to it */
+size_t format_args_sink(FormatSink sink, void *ctx, const char *fmt, const FormatArg *args, const size_t count);
+
+template <typename... T>
+inline size_t
+format_buf(char *const buf, const size_t size, const char *const fmt, const T &... args)
+{
+    const FormatArg list[sizeof...(T) + 1] = { format_arg(args)..., FormatArg() };
+    return format_args_buf(buf, size, fmt, list, sizeof...(T));
+}
+
+template <typename... T>
+inline size_t
+format_sink(FormatSink sink, void *const ctx, const char *const fmt, const T &... args)
+{
+    const FormatArg list[sizeof...(T) + 1] = { format_arg(args)..., FormatArg() };
+    return format_args_sink(sink, ctx, fmt, list, sizeof...(T));
+}
+
+/* Compile time side of the FORMAT_ macros */
+template <typename... T>
+struct FormatKinds {
+    static constexpr size_t count = sizeof...(T);
+    static constexpr FormatArg::arg_kind kinds[sizeof...(T) + 1] = { format_kind<T>()..., FormatArg::KIND_NONE };
+};
+
+/* Only used in decltype, to get the types of the macro arguments */
+template <typename... T>
+FormatKinds<std::decay_t<T>...> format_kinds_of(const T &...);
+
+template <bool matches>
+struct FormatChecked {
+    static_assert(matches, "format string doesn't match its arguments");
+    static constexpr const char *pass(const char *fmt) { return fmt; }
+};
+
+#define FORMAT_CHECKED(fmt, ...)                                                        \
+    FormatChecked<format_check(fmt, decltype(format_kinds_of(__VA_ARGS__))::kinds,      \
+        decltype(format_kinds_of(__VA_ARGS__))::count)>::pass(fmt)
+
+/* fmt has to be a string literal */
+#define FORMAT_BUF(buf, size, fmt, ...) \
+    format_buf(buf, size, FORMAT_CHECKED(fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+#define FORMAT_SINK(sink, ctx, fmt, ...) \
+    format_sink(sink, ctx, FORMAT_CHECKED(fmt, ##__VA_ARGS__), ##__VA_ARGS__)
+
+#endif /* _FORMAT_H */
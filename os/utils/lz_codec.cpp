@@ -0,0 +1,217 @@
+#include "lz_codec.h"
+
+#define LZ_HASH_BITS 10u
+#define LZ_HASH_SIZE (1u << LZ_HASH_BITS)
+#define LZ_MAX_OFFSET 0xffffu
+#define LZ_NIBBLE_MAX 15u
+
+/*
+ * Holds (position + 1) of the last place each hashed 4 byte sequence was seen,
+ * 0 means the slot is empty. Kept static so it doesn't eat the kernel stack.
+ */
+static uint16_t hash_table[LZ_HASH_SIZE];
+
+static uint32_t
+read_u32(const uint8_t *const p)
+{
+    /* Byte reads, src isn't guaranteed to be aligned */
+    return static_cast<uint32_t>(p[0])
+        | (static_cast<uint32_t>(p[1]) << 8)
+        | (static_cast<uint32_t>(p[2]) << 16)
+        | (static_cast<uint32_t>(p[3]) << 24);
+}
+
+static unsigned
+lz_hash(const uint32_t sequence)
+{
+    /* Knuth's multiplicative hash, keep the top bits */
+    return (sequence * 2654435761u) >> (32u - LZ_HASH_BITS);
+}
+
+/* Writes the extra bytes of a length that didn't fit in its nibble */
+static bool
+write_length(uint8_t *const dest, size_t &op, const size_t dest_cap, size_t len)
+{
+    while (len >= 255) {
+        if (op >= dest_cap) {
+            return false;
+        }
+        dest[op++] = 255;
+        len -= 255;
+    }
+    if (op >= dest_cap) {
+        return false;
+    }
+    dest[op++] = static_cast<uint8_t>(len);
+    return true;
+}
+
+static bool
+emit_sequence(uint8_t *const dest, size_t &op, const size_t dest_cap,
+              const uint8_t *const literals, const size_t literal_len,
+              const size_t offset, const size_t match_len)
+{
+    if (op >= dest_cap) {
+        return false;
+    }
+
+    const size_t match_code = (match_len > 0) ? (match_len - LZ_MIN_MATCH) : 0;
+    const size_t token_index = op++;
+    uint8_t token = 0;
+
+    if (literal_len >= LZ_NIBBLE_MAX) {
+        token = LZ_NIBBLE_MAX << 4;
+        if (!write_length(dest, op, dest_cap, literal_len - LZ_NIBBLE_MAX)) {
+            return false;
+        }
+    } else {
+        token = static_cast<uint8_t>(literal_len << 4);
+    }
+
+    if ((op + literal_len) > dest_cap) {
+        return false;
+    }
+    for (size_t i = 0; i < literal_len; i++) {
+        dest[op++] = literals[i];
+    }
+
+    if (match_len > 0) {
+        if ((op + 2) > dest_cap) {
+            return false;
+        }
+        dest[op++] = static_cast<uint8_t>(offset & 0xff);
+        dest[op++] = static_cast<uint8_t>(offset >> 8);
+
+        if (match_code >= LZ_NIBBLE_MAX) {
+            token |= LZ_NIBBLE_MAX;
+            if (!write_length(dest, op, dest_cap, match_code - LZ_NIBBLE_MAX)) {
+                return false;
+            }
+        } else {
+            token |= static_cast<uint8_t>(match_code);
+        }
+    }
+
+    dest[token_index] = token;
+    return true;
+}
+
+size_t
+lz_compress(const uint8_t *const src, const size_t src_len, uint8_t *const dest, const size_t dest_cap)
+{
+    if (src_len > LZ_MAX_INPUT) {
+        return 0;
+    }
+
+    for (unsigned i = 0; i < LZ_HASH_SIZE; i++) {
+        hash_table[i] = 0;
+    }
+
+    size_t ip = 0;
+    size_t anchor = 0;
+    size_t op = 0;
+
+    while ((ip + LZ_MIN_MATCH) <= src_len) {
+        const uint32_t sequence = read_u32(&src[ip]);
+        const unsigned h = lz_hash(sequence);
+        const size_t candidate_slot = hash_table[h];
+        hash_table[h] = static_cast<uint16_t>(ip + 1);
+
+        if (candidate_slot == 0) {
+            ip++;
+            continue;
+        }
+
+        const size_t candidate = candidate_slot - 1;
+        if (((ip - candidate) > LZ_MAX_OFFSET) || (read_u32(&src[candidate]) != sequence)) {
+            ip++;
+            continue;
+        }
+
+        /* Found a match, see how far it goes */
+        size_t match_len = LZ_MIN_MATCH;
+        while (((ip + match_len) < src_len) && (src[candidate + match_len] == src[ip + match_len])) {
+            match_len++;
+        }
+
+        if (!emit_sequence(dest, op, dest_cap, &src[anchor], ip - anchor, ip - candidate, match_len)) {
+            return 0;
+        }
+
+        ip += match_len;
+        anchor = ip;
+    }
+
+    /* Whatever is left over goes out as literals */
+    if (!emit_sequence(dest, op, dest_cap, &src[anchor], src_len - anchor, 0, 0)) {
+        return 0;
+    }
+
+    return op;
+}
+
+/* Reads the extra bytes of a length whose nibble was maxed out */
+static bool
+read_length(const uint8_t *const src, size_t &ip, const size_t src_len, size_t &len)
+{
+    uint8_t byte;
+    do {
+        if (ip >= src_len) {
+            return false;
+        }
+        byte = src[ip++];
+        len += byte;
+    } while (byte == 255);
+    return true;
+}
+
+int
+lz_decompress(const uint8_t *const src, const size_t src_len, uint8_t *const dest, const size_t dest_len)
+{
+    size_t ip = 0;
+    size_t op = 0;
+
+    while (ip < src_len) {
+        const uint8_t token = src[ip++];
+
+        size_t literal_len = token >> 4;
+        if ((literal_len == LZ_NIBBLE_MAX) && !read_length(src, ip, src_len, literal_len)) {
+            return -1;
+        }
+        if (((ip + literal_len) > src_len) || ((op + literal_len) > dest_len)) {
+            return -1;
+        }
+        for (size_t i = 0; i < literal_len; i++) {
+            dest[op++] = src[ip++];
+        }
+
+        if (ip == src_len) {
+            /* Last sequence only has literals */
+            break;
+        }
+
+        if ((ip + 2) > src_len) {
+            return -1;
+        }
+        const size_t offset = static_cast<size_t>(src[ip]) | (static_cast<size_t>(src[ip + 1]) << 8);
+        ip += 2;
+
+        size_t match_len = token & LZ_NIBBLE_MAX;
+        if ((match_len == LZ_NIBBLE_MAX) && !read_length(src, ip, src_len, match_len)) {
+            return -1;
+        }
+        match_len += LZ_MIN_MATCH;
+
+        if ((offset == 0) || (offset > op) || ((op + match_len) > dest_len)) {
+            return -1;
+        }
+
+        /* Byte by byte since the match is allowed to overlap what it's writing */
+        const uint8_t *match = &dest[op - offset];
+        for (size_t i = 0; i < match_len; i++) {
+            dest[op++] = match[i];
+        }
+    }
+
+    return static_cast<int>(op);
+}
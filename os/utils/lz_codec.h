@@ -0,0 +1,37 @@
+#ifndef _LZ_CODEC_H
+#define _LZ_CODEC_H
+
+#include <cstdio>
+
+/*
+ * Small LZ77 codec in the style of LZ4, tuned for compressing pages of RAM.
+ *
+ * The compressed stream is a series of sequences:
+ *   token: high nibble = literal count, low nibble = match length - LZ_MIN_MATCH
+ *          (a nibble of 15 means more length bytes follow, each adding up to 255)
+ *   literals: copied as-is
+ *   offset: 2 bytes, little endian, distance back to the start of the match
+ *   match length extension bytes (if the low nibble was 15)
+ * The final sequence has no offset or match, only literals.
+ *
+ * Inputs are limited to LZ_MAX_INPUT bytes so offsets always fit in 16 bits.
+ * The compressor uses a static hash table, so it is not reentrant.
+ */
+#define LZ_MIN_MATCH 4u
+#define LZ_MAX_INPUT (64 * 1024 - 1)
+/* Worst case output size, when nothing in the input can be matched */
+#define LZ_BOUND(len) ((len) + ((len) / 255) + 16)
+
+/*
+ * Returns the number of bytes written to dest, or 0 if the
+ * compressed data would not fit in dest_cap bytes.
+ */
+size_t lz_compress(const uint8_t *const src, const size_t src_len, uint8_t *const dest, const size_t dest_cap);
+
+/*
+ * Returns the number of bytes written to dest, or -1 if the
+ * stream is malformed or would overflow dest_len bytes.
+ */
+int lz_decompress(const uint8_t *const src, const size_t src_len, uint8_t *const dest, const size_t dest_len);
+
+#endif /* _LZ_CODEC_H */
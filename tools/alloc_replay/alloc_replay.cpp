@@ -0,0 +1,623 @@
+/*
+ * Replays an allocation recording from the device (see ALLOC_RECORDING in
+ * os/mem_mgr/alloc.h) against the kernel's Skiplist allocator, built from
+ * os/mem_mgr/alloc.cpp as is, and against some alternatives. For each one it
+ * reports:
+ *   - latency on the host, per call (only comparable between allocators,
+ *     the device's own timings for the Skiplist are printed separately)
+ *   - peak footprint, the pages taken from the page allocator
+ *   - fragmentation, the share of the footprint that was never in use at
+ *     once: 1 - peak live bytes / peak footprint
+ *   - failed calls, and blocks that overlapped a live one (allocator bugs)
+ *
+ * Only the _ker_* calls are replayed, since the user level calls are made
+ * through them. The user level calls are summed up by caller instead.
+ *
+ * The host is 64 bit, so pointers in free blocks are twice the size they are
+ * on the device. Sizes are rounded up to a multiple of 8, and to at least
+ * 16, for every allocator alike.
+ *
+ * To add an allocator, implement ReplayAllocator and add it to main.
+ *
+ * Usage: alloc_replay [-a arena_kb] [-c core_mhz] <recording>
+ */
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "alloc.h"
+#include "host_stubs.h"
+#include "mem_mgr.h"
+
+#define RECORD_MAGIC 0x43524c41u
+#define RECORD_VERSION 1u
+#define RECORD_HEADER_SIZE 20u
+#define RECORD_SIZE 20u
+
+#define DEFAULT_ARENA_KB 128u
+#define DEFAULT_CORE_MHZ 64u
+#define TOP_CALLERS 10u
+
+/* Copies of the device side alloc_op values, which only exist in recording builds */
+enum RecordedOp : uint8_t {
+    OP_KER_MALLOC = 1,
+    OP_KER_CALLOC,
+    OP_KER_FREE,
+    OP_KER_REALLOC,
+    OP_MALLOC,
+    OP_CALLOC,
+    OP_FREE,
+    OP_REALLOC,
+    OP_REALLOC_FROM,
+    NUM_OPS,
+};
+
+static const char *const opNames[NUM_OPS] = {
+    "?", "_ker_malloc", "_ker_calloc", "_ker_free", "_ker_realloc",
+    "_malloc", "_calloc", "_free", "_realloc", "?",
+};
+
+struct RecordedCall {
+    uint32_t cycles;
+    uint32_t duration;
+    uint32_t caller;
+    uint32_t addr;
+    uint32_t size;
+    uint8_t op;
+};
+
+struct ReplayOp {
+    enum Kind { Malloc, Free, Realloc } kind;
+    uint32_t addr;
+    uint32_t oldAddr;
+    uint32_t size;
+};
+
+class ReplayAllocator {
+    public:
+        virtual ~ReplayAllocator() {}
+        virtual const char *name(void) const = 0;
+        /* Forgets everything, the page source has just been emptied */
+        virtual void reset(void) = 0;
+        virtual void *malloc(const size_t size) = 0;
+        virtual void free(const size_t size, void *const p) = 0;
+        virtual void *realloc(const size_t oldSize, const size_t newSize, void *const p) = 0;
+};
+
+/* The kernel's allocator, through the same entry points the kernel uses */
+class SkiplistAllocator : public ReplayAllocator {
+    public:
+        const char *name(void) const override { return "skiplist"; }
+        void reset(void) override { alloc_init(); }
+        void *malloc(const size_t size) override { return _ker_malloc(size); }
+        void free(const size_t size, void *const p) override { _ker_free(size, p); }
+        void *realloc(const size_t oldSize, const size_t newSize, void *const p) override
+        {
+            return _ker_realloc(oldSize, newSize, p);
+        }
+};
+
+/* Address ordered free list, first fit, coalescing on free */
+class FirstFitAllocator : public ReplayAllocator {
+    public:
+        const char *name(void) const override { return "first-fit"; }
+        void reset(void) override { _head = nullptr; }
+
+        void *
+        malloc(const size_t size) override
+        {
+            for (int attempt = 0; attempt < 2; attempt++) {
+                for (FreeBlock **link = &_head; *link != nullptr; link = &(*link)->next) {
+                    FreeBlock *const block = *link;
+                    if (block->size < size) {
+                        continue;
+                    }
+                    if ((block->size - size) >= sizeof(FreeBlock)) {
+                        FreeBlock *const rest = reinterpret_cast<FreeBlock *>(reinterpret_cast<uint8_t *>(block) + size);
+                        rest->size = block->size - size;
+                        rest->next = block->next;
+                        *link = rest;
+                    } else {
+                        /* Like the Skiplist, a leftover too small to track is lost */
+                        *link = block->next;
+                    }
+                    return block;
+                }
+
+                const size_t grow = ((size + PAGE_SIZE - 1) / PAGE_SIZE) * PAGE_SIZE;
+                void *const pages = host_pages->allocate(grow);
+                if (pages == nullptr) {
+                    return nullptr;
+                }
+                free(grow, pages);
+            }
+            return nullptr;
+        }
+
+        void
+        free(const size_t size, void *const p) override
+        {
+            FreeBlock *const block = static_cast<FreeBlock *>(p);
+            block->size = size;
+
+            FreeBlock *prev = nullptr;
+            FreeBlock *next = _head;
+            while ((next != nullptr) && (next < block)) {
+                prev = next;
+                next = next->next;
+            }
+
+            if ((next != nullptr) && (reinterpret_cast<uint8_t *>(block) + block->size == reinterpret_cast<uint8_t *>(next))) {
+                block->size += next->size;
+                next = next->next;
+            }
+            block->next = next;
+            if (prev == nullptr) {
+                _head = block;
+            } else if (reinterpret_cast<uint8_t *>(prev) + prev->size == reinterpret_cast<uint8_t *>(block)) {
+                prev->size += block->size;
+                prev->next = block->next;
+            } else {
+                prev->next = block;
+            }
+        }
+
+        void *
+        realloc(const size_t oldSize, const size_t newSize, void *const p) override
+        {
+            if (newSize <= oldSize) {
+                if ((oldSize - newSize) >= sizeof(FreeBlock)) {
+                    free(oldSize - newSize, static_cast<uint8_t *>(p) + newSize);
+                }
+                return p;
+            }
+            void *const q = malloc(newSize);
+            if (q != nullptr) {
+                memcpy(q, p, oldSize);
+                free(oldSize, p);
+            }
+            return q;
+        }
+
+    private:
+        struct FreeBlock {
+            size_t size;
+            FreeBlock *next;
+        };
+
+        FreeBlock *_head = nullptr;
+};
+
+/*
+ * Power of 2 size classes up to 1 KiB, each carved from whole pages and never
+ * merged. Anything bigger goes to a first fit list.
+ */
+class SegregatedAllocator : public ReplayAllocator {
+    public:
+        const char *name(void) const override { return "segregated"; }
+
+        void
+        reset(void) override
+        {
+            for (uint32_t i = 0; i < NUM_CLASSES; i++) {
+                _heads[i] = nullptr;
+            }
+            _large.reset();
+        }
+
+        void *
+        malloc(const size_t size) override
+        {
+            const int c = sizeClass(size);
+            if (c < 0) {
+                return _large.malloc(size);
+            }
+            if (_heads[c] == nullptr) {
+                uint8_t *const page = static_cast<uint8_t *>(host_pages->allocate(PAGE_SIZE));
+                if (page == nullptr) {
+                    return nullptr;
+                }
+                const size_t blockSize = classSize(c);
+                for (size_t offset = 0; offset + blockSize <= PAGE_SIZE; offset += blockSize) {
+                    push(c, page + offset);
+                }
+            }
+            Link *const block = _heads[c];
+            _heads[c] = block->next;
+            return block;
+        }
+
+        void
+        free(const size_t size, void *const p) override
+        {
+            const int c = sizeClass(size);
+            if (c < 0) {
+                _large.free(size, p);
+            } else {
+                push(c, p);
+            }
+        }
+
+        void *
+        realloc(const size_t oldSize, const size_t newSize, void *const p) override
+        {
+            const int oldClass = sizeClass(oldSize);
+            if ((oldClass >= 0) && (oldClass == sizeClass(newSize))) {
+                return p;
+            }
+            if ((oldClass < 0) && (sizeClass(newSize) < 0)) {
+                return _large.realloc(oldSize, newSize, p);
+            }
+            void *const q = malloc(newSize);
+            if (q != nullptr) {
+                memcpy(q, p, std::min(oldSize, newSize));
+                free(oldSize, p);
+            }
+            return q;
+        }
+
+    private:
+        static const uint32_t NUM_CLASSES = 7;  // 16 B to 1 KiB
+
+        struct Link {
+            Link *next;
+        };
+
+        static size_t classSize(const int c) { return 16u << c; }
+
+        static int
+        sizeClass(const size_t size)
+        {
+            for (uint32_t c = 0; c < NUM_CLASSES; c++) {
+                if (size <= classSize(c)) {
+                    return c;
+                }
+            }
+            return -1;
+        }
+
+        void
+        push(const int c, void *const p)
+        {
+            Link *const link = static_cast<Link *>(p);
+            link->next = _heads[c];
+            _heads[c] = link;
+        }
+
+        Link *_heads[NUM_CLASSES] = {};
+        FirstFitAllocator _large;
+};
+
+struct ReplayResult {
+    uint32_t calls = 0;
+    uint32_t failed = 0;
+    uint32_t unknown = 0;
+    uint32_t overlaps = 0;
+    std::vector<uint64_t> latencies;
+    size_t peakFootprint = 0;
+    size_t peakLive = 0;
+};
+
+static std::vector<RecordedCall>
+readRecording(const char *const path, uint32_t &dropped)
+{
+    FILE *const f = fopen(path, "rb");
+    if (f == nullptr) {
+        perror(path);
+        exit(1);
+    }
+    std::vector<uint8_t> data;
+    uint8_t chunk[4096];
+    size_t got;
+    while ((got = fread(chunk, 1, sizeof(chunk), f)) > 0) {
+        data.insert(data.end(), chunk, chunk + got);
+    }
+    fclose(f);
+
+    /* Skip anything that came out of the USART before the dump */
+    const uint8_t magic[4] = { 0x41, 0x4c, 0x52, 0x43 };
+    const auto start = std::search(data.begin(), data.end(), magic, magic + sizeof(magic));
+    if ((data.end() - start) < RECORD_HEADER_SIZE) {
+        fprintf(stderr, "%s: no allocation recording found\n", path);
+        exit(1);
+    }
+    const uint8_t *const header = &*start;
+
+    uint16_t version;
+    uint16_t recordSize;
+    uint32_t count;
+    memcpy(&version, header + 4, sizeof(version));
+    memcpy(&recordSize, header + 6, sizeof(recordSize));
+    memcpy(&count, header + 12, sizeof(count));
+    memcpy(&dropped, header + 16, sizeof(dropped));
+    if ((version != RECORD_VERSION) || (recordSize != RECORD_SIZE)) {
+        fprintf(stderr, "%s: version %u with %u byte records isn't supported\n", path, version, recordSize);
+        exit(1);
+    }
+    if (static_cast<size_t>(data.end() - start) < RECORD_HEADER_SIZE + (static_cast<size_t>(count) * RECORD_SIZE)) {
+        fprintf(stderr, "%s: recording is truncated\n", path);
+        exit(1);
+    }
+
+    std::vector<RecordedCall> calls(count);
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t words[5];
+        memcpy(words, header + RECORD_HEADER_SIZE + (i * RECORD_SIZE), sizeof(words));
+        calls[i] = RecordedCall { words[0], words[1], words[2], words[3], words[4] & 0xffffff,
+                static_cast<uint8_t>(words[4] >> 24) };
+    }
+    return calls;
+}
+
+static uint32_t
+hostSize(const uint32_t size)
+{
+    return std::max<uint32_t>(16u, (size + 7u) & ~7u);
+}
+
+static std::vector<ReplayOp>
+kernelOps(const std::vector<RecordedCall> &calls)
+{
+    std::vector<ReplayOp> ops;
+    for (size_t i = 0; i < calls.size(); i++) {
+        const RecordedCall &call = calls[i];
+        if (call.addr == 0) {
+            continue;
+        }
+        switch (call.op) {
+        case OP_KER_MALLOC:
+        case OP_KER_CALLOC:
+            ops.push_back(ReplayOp { ReplayOp::Malloc, call.addr, 0, hostSize(call.size) });
+            break;
+        case OP_KER_FREE:
+            ops.push_back(ReplayOp { ReplayOp::Free, call.addr, 0, hostSize(call.size) });
+            break;
+        case OP_KER_REALLOC:
+            if ((i > 0) && (calls[i - 1].op == OP_REALLOC_FROM)) {
+                ops.push_back(ReplayOp { ReplayOp::Realloc, call.addr, calls[i - 1].addr, hostSize(call.size) });
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    return ops;
+}
+
+struct LiveBlock {
+    void *p;
+    size_t size;
+};
+
+static bool
+overlapsLive(const std::map<uintptr_t, size_t> &extents, const void *const p, const size_t size)
+{
+    const uintptr_t start = reinterpret_cast<uintptr_t>(p);
+    auto next = extents.lower_bound(start);
+    if ((next != extents.end()) && (next->first < start + size)) {
+        return true;
+    }
+    if (next != extents.begin()) {
+        --next;
+        if (next->first + next->second > start) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static ReplayResult
+replay(ReplayAllocator &allocator, const std::vector<ReplayOp> &ops)
+{
+    ReplayResult result;
+    std::unordered_map<uint32_t, LiveBlock> live;    // By device address
+    std::map<uintptr_t, size_t> extents;            // By host address
+    size_t liveBytes = 0;
+
+    host_pages->reset();
+    allocator.reset();
+
+    auto track = [&](const uint32_t addr, void *const p, const size_t size) {
+        if (overlapsLive(extents, p, size)) {
+            result.overlaps++;
+        }
+        extents[reinterpret_cast<uintptr_t>(p)] = size;
+        live[addr] = LiveBlock { p, size };
+        liveBytes += size;
+    };
+    auto untrack = [&](const uint32_t addr) {
+        const LiveBlock block = live[addr];
+        extents.erase(reinterpret_cast<uintptr_t>(block.p));
+        live.erase(addr);
+        liveBytes -= block.size;
+    };
+
+    for (const ReplayOp &op : ops) {
+        const auto found = live.find((op.kind == ReplayOp::Realloc) ? op.oldAddr : op.addr);
+        const bool known = found != live.end();
+        const LiveBlock old = known ? found->second : LiveBlock { nullptr, 0 };
+
+        /* A block from before recording started can't be freed or resized here */
+        if ((op.kind == ReplayOp::Free) && !known) {
+            result.unknown++;
+            continue;
+        }
+
+        void *p = nullptr;
+        const auto start = std::chrono::steady_clock::now();
+        if (op.kind == ReplayOp::Free) {
+            allocator.free(old.size, old.p);
+        } else if ((op.kind == ReplayOp::Realloc) && known) {
+            p = allocator.realloc(old.size, op.size, old.p);
+        } else {
+            p = allocator.malloc(op.size);
+        }
+        const auto end = std::chrono::steady_clock::now();
+        result.latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+        result.calls++;
+
+        if (op.kind == ReplayOp::Free) {
+            untrack(op.addr);
+        } else if (p == nullptr) {
+            result.failed++;
+        } else {
+            if ((op.kind == ReplayOp::Realloc) && known) {
+                untrack(op.oldAddr);
+            } else if (op.kind == ReplayOp::Realloc) {
+                result.unknown++;
+            }
+            if (live.count(op.addr) != 0) {
+                untrack(op.addr);
+            }
+            track(op.addr, p, op.size);
+        }
+
+        result.peakFootprint = std::max(result.peakFootprint, host_pages->used());
+        result.peakLive = std::max(result.peakLive, liveBytes);
+    }
+    return result;
+}
+
+static void
+printDeviceTimings(const std::vector<RecordedCall> &calls, const double coreMhz)
+{
+    uint64_t count[NUM_OPS] = {};
+    uint64_t total[NUM_OPS] = {};
+    uint32_t worst[NUM_OPS] = {};
+    for (const RecordedCall &call : calls) {
+        if ((call.op == 0) || (call.op >= OP_REALLOC_FROM)) {
+            continue;
+        }
+        count[call.op]++;
+        total[call.op] += call.duration;
+        worst[call.op] = std::max(worst[call.op], call.duration);
+    }
+
+    printf("Recorded on the device (skiplist):\n");
+    printf("  %-13s %8s %12s %12s\n", "call", "count", "mean us", "max us");
+    for (uint32_t op = 1; op < OP_REALLOC_FROM; op++) {
+        if (count[op] == 0) {
+            continue;
+        }
+        printf("  %-13s %8" PRIu64 " %12.2f %12.2f\n", opNames[op], count[op],
+                (static_cast<double>(total[op]) / count[op]) / coreMhz, worst[op] / coreMhz);
+    }
+    printf("\n");
+}
+
+static void
+printCallers(const std::vector<RecordedCall> &calls)
+{
+    struct CallerStats {
+        uint32_t calls;
+        uint64_t bytes;
+    };
+    std::unordered_map<uint32_t, CallerStats> callers;
+    for (const RecordedCall &call : calls) {
+        if ((call.op == OP_MALLOC) || (call.op == OP_CALLOC) || (call.op == OP_REALLOC)) {
+            CallerStats &stats = callers[call.caller];
+            stats.calls++;
+            stats.bytes += call.size;
+        }
+    }
+    if (callers.empty()) {
+        return;
+    }
+
+    std::vector<std::pair<uint32_t, CallerStats>> ranked(callers.begin(), callers.end());
+    std::sort(ranked.begin(), ranked.end(), [](const auto &a, const auto &b) { return a.second.bytes > b.second.bytes; });
+
+    printf("Top user level callers (look them up with addr2line -e build/startup.elf):\n");
+    printf("  %-10s %8s %10s\n", "caller", "calls", "bytes");
+    for (size_t i = 0; (i < ranked.size()) && (i < TOP_CALLERS); i++) {
+        printf("  0x%08" PRIx32 " %8" PRIu32 " %10" PRIu64 "\n", ranked[i].first, ranked[i].second.calls,
+                ranked[i].second.bytes);
+    }
+    printf("\n");
+}
+
+static void
+printResult(const char *const name, ReplayResult &result)
+{
+    std::sort(result.latencies.begin(), result.latencies.end());
+    uint64_t total = 0;
+    for (const uint64_t ns : result.latencies) {
+        total += ns;
+    }
+    const size_t n = result.latencies.size();
+    const double mean = (n == 0) ? 0.0 : static_cast<double>(total) / n;
+    const uint64_t p99 = (n == 0) ? 0 : result.latencies[(n * 99) / 100];
+    const uint64_t worst = (n == 0) ? 0 : result.latencies.back();
+    const double fragmentation = (result.peakFootprint == 0) ? 0.0
+            : 1.0 - (static_cast<double>(result.peakLive) / result.peakFootprint);
+
+    printf("  %-11s %7" PRIu32 " %9.1f %9" PRIu64 " %9" PRIu64 " %10zu %10zu %7.1f%% %6" PRIu32 " %7" PRIu32
+            " %8" PRIu32 "\n",
+            name, result.calls, mean, p99, worst, result.peakFootprint, result.peakLive,
+            100.0 * fragmentation, result.failed, result.overlaps, result.unknown);
+}
+
+static void
+usage(void)
+{
+    fprintf(stderr, "Usage: alloc_replay [-a arena_kb] [-c core_mhz] <recording>\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t arenaKb = DEFAULT_ARENA_KB;
+    double coreMhz = DEFAULT_CORE_MHZ;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-a") == 0) && (i + 1 < argc)) {
+            arenaKb = strtoul(argv[++i], nullptr, 0);
+        } else if ((strcmp(argv[i], "-c") == 0) && (i + 1 < argc)) {
+            coreMhz = strtod(argv[++i], nullptr);
+        } else if ((argv[i][0] != '-') && (path == nullptr)) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if ((path == nullptr) || (arenaKb == 0) || (coreMhz <= 0)) {
+        usage();
+    }
+
+    uint32_t dropped = 0;
+    const std::vector<RecordedCall> calls = readRecording(path, dropped);
+    const std::vector<ReplayOp> ops = kernelOps(calls);
+    printf("%zu calls recorded, %zu replayed", calls.size(), ops.size());
+    if (dropped != 0) {
+        printf(", %" PRIu32 " dropped after the buffer filled", dropped);
+    }
+    printf("\n\n");
+
+    printDeviceTimings(calls, coreMhz);
+    printCallers(calls);
+
+    PageSource pages(arenaKb * 1024);
+    host_pages = &pages;
+
+    SkiplistAllocator skiplist;
+    FirstFitAllocator firstFit;
+    SegregatedAllocator segregated;
+    ReplayAllocator *const allocators[] = { &skiplist, &firstFit, &segregated };
+
+    printf("Replayed on the host (%zu KiB of pages):\n", arenaKb);
+    printf("  %-11s %7s %9s %9s %9s %10s %10s %8s %6s %7s %8s\n", "allocator", "calls", "mean ns", "p99 ns",
+            "max ns", "footprint", "peak live", "frag", "failed", "overlap", "unknown");
+    for (ReplayAllocator *const allocator : allocators) {
+        ReplayResult result = replay(*allocator, ops);
+        printResult(allocator->name(), result);
+    }
+    return 0;
+}
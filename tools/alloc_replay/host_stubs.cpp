@@ -0,0 +1,59 @@
+/*
+ * Stand-ins for the parts of the kernel alloc.cpp calls into. DMA copies
+ * become plain ones, and pages come from a host arena.
+ */
+#include <cstdlib>
+#include <cstring>
+
+#include "dma_driver.h"
+#include "host_stubs.h"
+#include "mem_mgr.h"
+
+PageSource *host_pages;
+
+PageSource::PageSource(const size_t arenaSize)
+    : _arena(static_cast<uint8_t *>(aligned_alloc(PAGE_SIZE, arenaSize))),
+      _size(arenaSize),
+      _used(0) { }
+
+PageSource::~PageSource()
+{
+    ::free(_arena);
+}
+
+void
+PageSource::reset(void)
+{
+    _used = 0;
+}
+
+void *
+PageSource::allocate(const size_t size)
+{
+    const size_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if ((_used + (pages * PAGE_SIZE)) > _size) {
+        return nullptr;
+    }
+    void *const p = _arena + _used;
+    _used += pages * PAGE_SIZE;
+    return p;
+}
+
+/* Recordings don't say which zone a block came from, so everything is SRAM */
+void *
+allocateZonePages(const enum MemZone zone, const size_t size)
+{
+    return (zone == MemZone::SRAM) ? host_pages->allocate(size) : nullptr;
+}
+
+void
+dma_memcpy(void *const dest, const void *const src, const size_t len)
+{
+    memcpy(dest, src, len);
+}
+
+void
+dma_memset(void *const dest, const uint8_t value, const size_t len)
+{
+    memset(dest, value, len);
+}
@@ -0,0 +1,32 @@
+#ifndef _HOST_STUBS_H
+#define _HOST_STUBS_H
+
+#include <cstddef>
+#include <cstdint>
+
+/*
+ * Stands in for mem_mgr's page allocator. Pages come out of one arena in
+ * address order and are never given back (the Skiplist never returns them
+ * either), so the high water mark is an allocator's footprint.
+ */
+class PageSource {
+    public:
+        PageSource(const size_t arenaSize);
+        ~PageSource();
+
+        void reset(void);
+        void *allocate(const size_t size);
+
+        size_t used(void) const { return _used; };
+        size_t size(void) const { return _size; };
+
+    private:
+        uint8_t *_arena;
+        size_t _size;
+        size_t _used;
+};
+
+/* Where allocateZonePages gets its pages from */
+extern PageSource *host_pages;
+
+#endif /* _HOST_STUBS_H */
@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+"""
+Decodes the binary log written by os/log/binlog.cpp.
+
+    binlog_decode.py build/startup.elf capture.bin
+    binlog_decode.py build/startup.elf - < /dev/ttyUSB0
+
+The capture is the raw USART output. Anything between records (plain text
+from usart_send_string) is passed through as it is. Format strings come from
+the ELF's .log_strings section, and %s arguments are looked up in the ELF's
+loaded sections, so they only work for strings in flash.
+
+Cycle counts turn into seconds using the core clock records the firmware
+writes when logging starts and whenever the clock changes. Until the first
+one turns up (e.g. a capture started mid-run), raw cycle counts are shown.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+BINLOG_MAGIC = 0xB1
+BINLOG_HEADER_WORDS = 3
+BINLOG_MAX_ARGS = 6
+BINLOG_CLOCK_ID = 0xFFFFFFFF
+
+SHT_NOBITS = 8
+SHF_ALLOC = 0x2
+
+FORMAT_SPEC = re.compile(r"%([-+ #0]*)(\d*)(?:\.(\d+))?(l{0,2}|h{0,2}|z)([diuxXpcs%])")
+
+
+class Elf:
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1 or self.data[5] != 1:
+            raise ValueError("%s is not a little endian 32 bit ELF" % path)
+
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data, 0x2E)
+
+        headers = []
+        for i in range(shnum):
+            (name, stype, flags, addr, offset, size) = struct.unpack_from(
+                "<IIIIII", self.data, shoff + i * shentsize)
+            headers.append((name, stype, flags, addr, offset, size))
+
+        names_offset = headers[shstrndx][4]
+        self.sections = {}
+        self.loaded = []
+        for (name, stype, flags, addr, offset, size) in headers:
+            end = self.data.index(b"\0", names_offset + name)
+            section_name = self.data[names_offset + name:end].decode()
+            self.sections[section_name] = (addr, offset, size)
+            if (flags & SHF_ALLOC) and stype != SHT_NOBITS:
+                self.loaded.append((addr, offset, size))
+
+    def log_string(self, fmt_id):
+        if ".log_strings" not in self.sections:
+            return None
+        addr, offset, size = self.sections[".log_strings"]
+        if not addr <= fmt_id < addr + size:
+            return None
+        return self._c_string(offset + fmt_id - addr, offset + size)
+
+    def target_string(self, address):
+        for (addr, offset, size) in self.loaded:
+            if addr <= address < addr + size:
+                return self._c_string(offset + address - addr, offset + size)
+        return None
+
+    def _c_string(self, start, limit):
+        end = self.data.find(b"\0", start, limit)
+        if end < 0:
+            end = limit
+        return self.data[start:end].decode(errors="replace")
+
+
+def render(elf, fmt, args):
+    args = list(args)
+
+    def convert(match):
+        flags, width, precision, _length, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if not args:
+            return "<missing>"
+        value = args.pop(0)
+        if conv in "di":
+            value = struct.unpack("<i", struct.pack("<I", value))[0]
+        elif conv == "p":
+            return "0x%08x" % value
+        elif conv == "c":
+            value = chr(value & 0xFF)
+        elif conv == "s":
+            string = elf.target_string(value)
+            value = string if string is not None else "<0x%08x>" % value
+        spec = "%" + flags + width + ("." + precision if precision else "") + (conv if conv not in "iu" else "d")
+        return spec % value
+
+    return FORMAT_SPEC.sub(convert, fmt)
+
+
+def decode(elf, data, clock_hz, out, fixed_clock=False):
+    text = bytearray()
+    last_seq = None
+    pos = 0
+    # The cycle counter wraps, and its rate changes with the clock, so time
+    # is built up from the cycles between records at the rate they ran at
+    seconds = None
+    last_cycles = None
+
+    def flush_text():
+        if text:
+            out.write(text.decode(errors="replace"))
+            text.clear()
+
+    while pos < len(data):
+        if pos + BINLOG_HEADER_WORDS * 4 <= len(data):
+            header, fmt_id, cycles = struct.unpack_from("<III", data, pos)
+            nargs = (header >> 16) & 0xFF
+            end = pos + (BINLOG_HEADER_WORDS + nargs) * 4
+            is_record = (header >> 24) == BINLOG_MAGIC
+            is_clock = is_record and fmt_id == BINLOG_CLOCK_ID and nargs == 1
+            fmt = elf.log_string(fmt_id) if is_record and not is_clock else None
+            if (fmt is not None or is_clock) and nargs <= BINLOG_MAX_ARGS and end <= len(data):
+                flush_text()
+                args = struct.unpack_from("<%dI" % nargs, data, pos + BINLOG_HEADER_WORDS * 4)
+                seq = header & 0xFFFF
+                if last_seq is not None and seq != ((last_seq + 1) & 0xFFFF):
+                    out.write("-- %d record(s) missing --\n" % ((seq - last_seq - 1) & 0xFFFF))
+                last_seq = seq
+
+                if clock_hz:
+                    if seconds is None:
+                        seconds = cycles / clock_hz
+                    else:
+                        seconds += ((cycles - last_cycles) & 0xFFFFFFFF) / clock_hz
+                last_cycles = cycles
+                if seconds is not None:
+                    stamp = "%12.6f" % seconds
+                else:
+                    stamp = "%10u" % cycles
+
+                if is_clock:
+                    if not fixed_clock:
+                        clock_hz = args[0]
+                    out.write("[%s] -- core clock %u Hz --\n" % (stamp, args[0]))
+                    pos = end
+                    continue
+
+                line = render(elf, fmt, args)
+                out.write("[%s] %s%s" % (stamp, line, "" if line.endswith("\n") else "\n"))
+                pos = end
+                continue
+
+        text.append(data[pos])
+        pos += 1
+
+    flush_text()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF the log was written by")
+    parser.add_argument("capture", help="raw USART capture, or - for stdin")
+    parser.add_argument("--clock", type=float, default=0,
+                        help="core clock in Hz for the whole capture, instead of the clock records in it")
+    options = parser.parse_args()
+
+    elf = Elf(options.elf)
+    if options.capture == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(options.capture, "rb") as f:
+            data = f.read()
+
+    decode(elf, data, options.clock, sys.stdout, fixed_clock=options.clock != 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,432 @@
+/*
+ * Host harness for the flash filesystem (os/flash_mgr/logFs).
+ *
+ * Runs the real filesystem code on a RAM backed flash that enforces NOR
+ * rules (erase to 0xff, programming only clears bits, word aligned) and
+ * charges each operation the time the STM32F2 internal flash typically
+ * takes, so the numbers are what the device would see rather than what the
+ * host does.
+ *
+ * Two tests:
+ *  - workload: random writes, reads and removes over a set of files with a
+ *    hot/cold skew, checked against a reference copy. Reports store
+ *    throughput, write amplification, wear spread and the time to mount the
+ *    result.
+ *  - power cuts: the flash dies part way through a random operation (even
+ *    mid-word or mid-erase), then the filesystem is remounted and every file
+ *    must hold either its old or its new contents.
+ *
+ * Usage: fs_sim [-s seed] [-n ops] [-c cuts] [-k sectors] [-z sector_kb] [-g gc_steps] [-v]
+ */
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "logFs.h"
+
+/* x32 parallelism, 2.7 V to 3.6 V, from the STM32F205 datasheet (typical) */
+#define PROGRAM_WORD_NS 16000u
+#define ERASE_128K_NS 1000000000ull
+/* Reading through the ART at 120 MHz, a word every few cycles */
+#define READ_WORD_NS 40u
+
+#define NUM_FILES 48u
+#define HOT_FILES 8u
+
+struct RamFlash {
+    std::vector<uint8_t> mem;
+    std::vector<uint32_t> erases;
+    FlashDevice dev;
+    uint64_t ns;
+
+    /* Words left before the power goes, 0 to never fail */
+    uint64_t wordsUntilCut;
+    bool dead;
+    std::mt19937 rng;
+};
+
+static int
+flashRead(void *ctx, const uint32_t addr, void *buf, const uint32_t len)
+{
+    RamFlash &flash = *static_cast<RamFlash *>(ctx);
+    if (flash.dead || (addr + len > flash.mem.size())) {
+        return -1;
+    }
+    memcpy(buf, &flash.mem[addr], len);
+    flash.ns += ((len + 3u) / 4u) * READ_WORD_NS;
+    return 0;
+}
+
+/* True if the power goes now */
+static bool
+cutNow(RamFlash &flash)
+{
+    if (flash.wordsUntilCut == 0) {
+        return false;
+    }
+    if (--flash.wordsUntilCut == 0) {
+        flash.dead = true;
+        return true;
+    }
+    return false;
+}
+
+static int
+flashProgram(void *ctx, const uint32_t addr, const void *buf, const uint32_t len)
+{
+    RamFlash &flash = *static_cast<RamFlash *>(ctx);
+    if (flash.dead || ((addr & 3u) != 0) || ((len & 3u) != 0) || (addr + len > flash.mem.size())) {
+        return -1;
+    }
+
+    const uint8_t *const src = static_cast<const uint8_t *>(buf);
+    for (uint32_t i = 0; i < len; i += 4) {
+        uint32_t want, have;
+        memcpy(&want, src + i, 4);
+        memcpy(&have, &flash.mem[addr + i], 4);
+        if (cutNow(flash)) {
+            // Some of the bits being cleared made it
+            const uint32_t partial = have & (want | flash.rng());
+            memcpy(&flash.mem[addr + i], &partial, 4);
+            return -1;
+        }
+        if ((want & ~have) != 0) {
+            fprintf(stderr, "program would set bits at 0x%" PRIx32 ": %08" PRIx32 " over %08" PRIx32 "\n",
+                    addr + i, want, have);
+            abort();
+        }
+        memcpy(&flash.mem[addr + i], &want, 4);
+        flash.ns += PROGRAM_WORD_NS;
+    }
+    return 0;
+}
+
+static int
+flashErase(void *ctx, const uint32_t sector)
+{
+    RamFlash &flash = *static_cast<RamFlash *>(ctx);
+    if (flash.dead || (sector >= flash.dev.numSectors)) {
+        return -1;
+    }
+
+    uint8_t *const start = &flash.mem[sector * flash.dev.sectorSize];
+    if (cutNow(flash)) {
+        // Whatever state the cells were left in
+        for (uint32_t i = 0; i < flash.dev.sectorSize; i++) {
+            start[i] = static_cast<uint8_t>(flash.rng());
+        }
+        return -1;
+    }
+    memset(start, 0xff, flash.dev.sectorSize);
+    flash.erases[sector]++;
+    flash.ns += (ERASE_128K_NS * flash.dev.sectorSize) / (128u * 1024u);
+    return 0;
+}
+
+static void
+flashInit(RamFlash &flash, const uint32_t numSectors, const uint32_t sectorSize, const uint32_t seed)
+{
+    flash.mem.assign(static_cast<size_t>(numSectors) * sectorSize, 0xff);
+    flash.erases.assign(numSectors, 0);
+    flash.dev = { sectorSize, numSectors, flashRead, flashProgram, flashErase, &flash };
+    flash.ns = 0;
+    flash.wordsUntilCut = 0;
+    flash.dead = false;
+    flash.rng.seed(seed);
+}
+
+typedef std::map<std::string, std::vector<uint8_t>> Model;
+
+/*
+ * Biggest cold file, so that on average the live data fills about half of
+ * what's left once the head and the sector kept back for collection are
+ * taken out, and no file is more than a quarter of a sector.
+ */
+static uint32_t
+maxFileSize(const uint32_t numSectors, const uint32_t sectorSize)
+{
+    const uint32_t usable = (numSectors - 2u) * sectorSize;
+    const uint32_t size = usable / (NUM_FILES - HOT_FILES);
+    return (size < (sectorSize / 4u)) ? size : (sectorSize / 4u);
+}
+
+struct Workload {
+    std::mt19937 rng;
+    uint32_t maxSize;
+
+    std::string pickName()
+    {
+        // Most of the traffic goes to a few hot files
+        const uint32_t i = ((rng() % 100) < 80) ? (rng() % HOT_FILES) : (rng() % NUM_FILES);
+        return "file" + std::to_string(i);
+    }
+
+    std::vector<uint8_t> pickData(const std::string &name)
+    {
+        // Hot files are small settings-like blobs, cold ones anything up to maxSize
+        const uint32_t i = std::stoul(name.substr(4));
+        const uint32_t limit = (i < HOT_FILES) ? 256u : maxSize;
+        std::vector<uint8_t> data(rng() % (limit + 1));
+        for (uint8_t &b : data) {
+            b = static_cast<uint8_t>(rng());
+        }
+        return data;
+    }
+};
+
+static bool
+checkFile(LogFs &fs, const std::string &name, const std::vector<uint8_t> *const want)
+{
+    const int size = fs.size(name.c_str());
+    if (want == nullptr) {
+        return size < 0;
+    }
+    if (size != static_cast<int>(want->size())) {
+        return false;
+    }
+
+    std::vector<uint8_t> got(want->size() + 1);
+    const int n = fs.read(name.c_str(), got.data(), got.size());
+    got.resize(want->size());
+    return (n == size) && (got == *want);
+}
+
+static bool
+checkAll(LogFs &fs, const Model &model, const char *const when)
+{
+    bool ok = true;
+    for (uint32_t i = 0; i < NUM_FILES; i++) {
+        const std::string name = "file" + std::to_string(i);
+        const auto it = model.find(name);
+        if (!checkFile(fs, name, (it != model.end()) ? &it->second : nullptr)) {
+            fprintf(stderr, "%s: %s doesn't match\n", when, name.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+/* One random operation on both the filesystem and the model. Returns false if the filesystem failed it */
+static bool
+step(LogFs &fs, Model &model, Workload &work, const uint32_t gcSteps)
+{
+    const std::string name = work.pickName();
+    const uint32_t r = work.rng() % 100;
+
+    if (r < 5) {
+        const bool exists = model.erase(name) != 0;
+        return (fs.remove(name.c_str()) == 0) == exists;
+    } else if (r < 25) {
+        const auto it = model.find(name);
+        return checkFile(fs, name, (it != model.end()) ? &it->second : nullptr);
+    }
+
+    const std::vector<uint8_t> data = work.pickData(name);
+    if (fs.write(name.c_str(), data.data(), data.size()) < 0) {
+        return false;
+    }
+    model[name] = data;
+
+    // Whatever the background worker would get through before the next write
+    for (uint32_t i = 0; (i < gcSteps) && fs.gcWanted(); i++) {
+        if (fs.gcStep() < 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void
+eraseSpread(const RamFlash &flash, uint32_t &minErase, uint32_t &maxErase)
+{
+    minErase = UINT32_MAX;
+    maxErase = 0;
+    for (const uint32_t e : flash.erases) {
+        minErase = (e < minErase) ? e : minErase;
+        maxErase = (e > maxErase) ? e : maxErase;
+    }
+}
+
+static void
+printStats(LogFs &fs, const RamFlash &flash)
+{
+    const LogFsStats &stats = fs.getStats();
+    uint32_t minErase, maxErase;
+    eraseSpread(flash, minErase, maxErase);
+
+    printf("  files               %" PRIu32 ", %" PRIu32 " sectors free\n", stats.files, stats.freeSectors);
+    printf("  payload             %" PRIu32 " bytes\n", stats.payloadBytes);
+    printf("  programmed          %" PRIu32 " bytes (%" PRIu32 " copied by gc)\n",
+           stats.programmedBytes, stats.gcCopiedBytes);
+    printf("  write amplification %.2f\n",
+           stats.payloadBytes ? static_cast<double>(stats.programmedBytes) / stats.payloadBytes : 0.0);
+    printf("  erases              %" PRIu32 ", per sector min %" PRIu32 " max %" PRIu32 "\n",
+           stats.erases, minErase, maxErase);
+}
+
+static int
+runWorkload(const uint32_t seed, const uint32_t ops, const uint32_t numSectors, const uint32_t sectorSize,
+            const uint32_t gcSteps, const bool verbose)
+{
+    static RamFlash flash;
+    static LogFs fs;
+    flashInit(flash, numSectors, sectorSize, seed);
+    if (fs.mount(flash.dev) < 0) {
+        fprintf(stderr, "mount of a blank flash failed\n");
+        return 1;
+    }
+
+    Model model;
+    Workload work = { std::mt19937(seed), maxFileSize(numSectors, sectorSize) };
+    flash.ns = 0;
+    for (uint32_t i = 0; i < ops; i++) {
+        if (!step(fs, model, work, gcSteps)) {
+            fprintf(stderr, "op %" PRIu32 " failed\n", i);
+            printStats(fs, flash);
+            return 1;
+        }
+        if (verbose && ((i % 1000) == 0)) {
+            printf("  op %" PRIu32 ": %" PRIu32 " free, erases %" PRIu32 "\n",
+                   i, fs.getStats().freeSectors, fs.getStats().erases);
+        }
+    }
+    const uint64_t busyNs = flash.ns;
+
+    printf("workload: %" PRIu32 " ops, %" PRIu32 " x %" PRIu32 " KB sectors, %" PRIu32 " gc steps per write\n",
+           ops, numSectors, sectorSize / 1024u, gcSteps);
+    printStats(fs, flash);
+    const double seconds = busyNs / 1e9;
+    printf("  flash busy          %.2f s, store throughput %.1f KB/s\n",
+           seconds, (fs.getStats().payloadBytes / 1024.0) / seconds);
+
+    if (!checkAll(fs, model, "after workload")) {
+        return 1;
+    }
+
+    static LogFs remounted;
+    flash.ns = 0;
+    if (remounted.mount(flash.dev) < 0) {
+        fprintf(stderr, "remount failed\n");
+        return 1;
+    }
+    const LogFsStats &stats = remounted.getStats();
+    printf("  mount               %" PRIu32 " records, %" PRIu32 " bytes read, %.1f us\n",
+           stats.mountRecords, stats.mountBytesRead, flash.ns / 1e3);
+    return checkAll(remounted, model, "after remount") ? 0 : 1;
+}
+
+static int
+runPowerCuts(const uint32_t seed, const uint32_t cuts, const uint32_t numSectors, const uint32_t sectorSize,
+             const uint32_t gcSteps)
+{
+    static RamFlash flash;
+    static LogFs fs;
+    flashInit(flash, numSectors, sectorSize, seed);
+    if (fs.mount(flash.dev) < 0) {
+        return 1;
+    }
+
+    Model model;
+    Workload work = { std::mt19937(seed + 1), maxFileSize(numSectors, sectorSize) };
+    std::mt19937 rng(seed + 2);
+    uint32_t recovered = 0, newer = 0;
+
+    for (uint32_t cut = 0; cut < cuts; cut++) {
+        // Get some garbage going between cuts so collection gets interrupted too
+        for (uint32_t i = rng() % 50; i > 0; i--) {
+            if (!step(fs, model, work, gcSteps)) {
+                fprintf(stderr, "cut %" PRIu32 ": op failed before the cut\n", cut);
+                return 1;
+            }
+        }
+
+        const std::string name = work.pickName();
+        const std::vector<uint8_t> data = work.pickData(name);
+        const bool remove = (rng() % 10) == 0;
+        const auto it = model.find(name);
+        const std::vector<uint8_t> old = (it != model.end()) ? it->second : std::vector<uint8_t>();
+        const bool existed = it != model.end();
+
+        flash.wordsUntilCut = 1u + (rng() % (data.size() / 4u + 16u));
+        if (remove) {
+            (void)fs.remove(name.c_str());
+        } else {
+            (void)fs.write(name.c_str(), data.data(), data.size());
+        }
+        // A cut that didn't land during the operation lands in background collection
+        while (!flash.dead && fs.gcWanted() && (fs.gcStep() > 0)) {}
+        flash.wordsUntilCut = 0;
+        flash.dead = false;
+
+        if (fs.mount(flash.dev) < 0) {
+            fprintf(stderr, "cut %" PRIu32 ": remount failed\n", cut);
+            return 1;
+        }
+
+        // The file being changed can be either way round, everything else has to be untouched
+        const std::vector<uint8_t> *const after = remove ? nullptr : &data;
+        const std::vector<uint8_t> *const before = existed ? &old : nullptr;
+        if (checkFile(fs, name, after)) {
+            newer++;
+            if (remove) {
+                model.erase(name);
+            } else {
+                model[name] = data;
+            }
+        } else if (!checkFile(fs, name, before)) {
+            fprintf(stderr, "cut %" PRIu32 ": %s is neither old nor new\n", cut, name.c_str());
+            return 1;
+        }
+        if (!checkAll(fs, model, "after cut")) {
+            fprintf(stderr, "cut %" PRIu32 " broke other files\n", cut);
+            return 1;
+        }
+        recovered++;
+    }
+
+    uint32_t minErase, maxErase;
+    eraseSpread(flash, minErase, maxErase);
+    printf("power cuts: %" PRIu32 " survived, %" PRIu32 " kept the new contents\n", recovered, newer);
+    printf("  erases per sector   min %" PRIu32 " max %" PRIu32 "\n", minErase, maxErase);
+    return 0;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t seed = 1, ops = 50000, cuts = 300, numSectors = 4, sectorKb = 128, gcSteps = 4;
+    bool verbose = false;
+
+    for (int i = 1; i < argc; i++) {
+        const bool hasArg = (i + 1) < argc;
+        if (!strcmp(argv[i], "-s") && hasArg) {
+            seed = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-n") && hasArg) {
+            ops = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-c") && hasArg) {
+            cuts = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-k") && hasArg) {
+            numSectors = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-z") && hasArg) {
+            sectorKb = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-g") && hasArg) {
+            gcSteps = strtoul(argv[++i], nullptr, 0);
+        } else if (!strcmp(argv[i], "-v")) {
+            verbose = true;
+        } else {
+            fprintf(stderr, "usage: %s [-s seed] [-n ops] [-c cuts] [-k sectors] [-z sector_kb] [-g gc_steps] [-v]\n",
+                    argv[0]);
+            return 2;
+        }
+    }
+
+    if (runWorkload(seed, ops, numSectors, sectorKb * 1024u, gcSteps, verbose) != 0) {
+        return 1;
+    }
+    return runPowerCuts(seed, cuts, numSectors, sectorKb * 1024u, gcSteps);
+}
@@ -0,0 +1,313 @@
+/*
+ * Host round trip test for the swap compressor (os/utils/lz_codec).
+ *
+ * Each case compresses an input, decompresses the result and checks it
+ * comes back unchanged, and that neither side writes past the buffer it was
+ * given. Covered:
+ *  - page-like data with runs and repeats, as swap sees it
+ *  - incompressible input, which must fit in LZ_BOUND
+ *  - a match reaching back nearly the whole of an LZ_MAX_INPUT input, and a
+ *    hand built stream using the largest offset the format has
+ *  - output buffers that are too small, for both directions
+ *  - malformed streams
+ *
+ * Usage: lz_test [-s seed]
+ * Exits non-zero if any check fails.
+ */
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "lz_codec.h"
+
+/* Bytes past the end of each output buffer that must be left alone */
+#define GUARD_SIZE 64u
+#define GUARD_BYTE 0xa5u
+
+#define PAGE_SIZE 4096u
+
+static unsigned failures;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            failures++; \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+        } \
+    } while (0)
+
+/* An output buffer of cap bytes followed by a guard */
+struct Output {
+    std::vector<uint8_t> buf;
+    size_t cap;
+
+    explicit Output(const size_t cap) : buf(cap + GUARD_SIZE, GUARD_BYTE), cap(cap) {}
+
+    bool guardIntact() const
+    {
+        for (size_t i = cap; i < buf.size(); i++) {
+            if (buf[i] != GUARD_BYTE) {
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+/* Compresses, decompresses and compares. Returns the compressed size, 0 on failure. */
+static size_t
+roundTrip(const char *const name, const std::vector<uint8_t> &input)
+{
+    Output packed(LZ_BOUND(input.size()));
+    const size_t packedLen = lz_compress(input.data(), input.size(), packed.buf.data(), packed.cap);
+    CHECK(packedLen != 0, "%s: didn't fit in LZ_BOUND(%zu)", name, input.size());
+    CHECK(packed.guardIntact(), "%s: compressor wrote past its buffer", name);
+    if (packedLen == 0) {
+        return 0;
+    }
+
+    Output unpacked(input.size());
+    const int unpackedLen = lz_decompress(packed.buf.data(), packedLen, unpacked.buf.data(), unpacked.cap);
+    CHECK(unpackedLen == static_cast<int>(input.size()), "%s: decompressed %d bytes, wanted %zu",
+          name, unpackedLen, input.size());
+    CHECK(unpacked.guardIntact(), "%s: decompressor wrote past its buffer", name);
+    if ((unpackedLen == static_cast<int>(input.size())) && !input.empty()) {
+        CHECK(memcmp(unpacked.buf.data(), input.data(), input.size()) == 0, "%s: contents differ", name);
+    }
+    return packedLen;
+}
+
+/* Largest match offset in a compressed stream, or -1 if it doesn't parse */
+static long
+largestOffset(const uint8_t *const src, const size_t len)
+{
+    long largest = 0;
+    size_t ip = 0;
+    while (ip < len) {
+        const uint8_t token = src[ip++];
+        size_t literals = token >> 4;
+        if (literals == 15) {
+            uint8_t byte;
+            do {
+                if (ip >= len) {
+                    return -1;
+                }
+                byte = src[ip++];
+                literals += byte;
+            } while (byte == 255);
+        }
+        ip += literals;
+        if (ip >= len) {
+            break;
+        }
+        const long offset = src[ip] | (src[ip + 1] << 8);
+        ip += 2;
+        if (offset > largest) {
+            largest = offset;
+        }
+        if ((token & 15) == 15) {
+            while ((ip < len) && (src[ip++] == 255)) {
+            }
+        }
+    }
+    return largest;
+}
+
+static std::vector<uint8_t>
+randomBytes(std::mt19937 &rng, const size_t len)
+{
+    std::vector<uint8_t> bytes(len);
+    for (uint8_t &b : bytes) {
+        b = static_cast<uint8_t>(rng());
+    }
+    return bytes;
+}
+
+/* Zeroed stretches, small counters and repeated structs, like a thread's stack and heap */
+static std::vector<uint8_t>
+pageLike(std::mt19937 &rng)
+{
+    std::vector<uint8_t> page(PAGE_SIZE, 0);
+    const std::vector<uint8_t> record = randomBytes(rng, 24);
+    for (size_t pos = 0; pos + record.size() <= PAGE_SIZE; pos += 64) {
+        switch (rng() % 4) {
+        case 0:
+            break;
+        case 1:
+            memcpy(&page[pos], record.data(), record.size());
+            break;
+        case 2:
+            for (size_t i = 0; i < 16; i += 4) {
+                page[pos + i] = static_cast<uint8_t>(rng() % 16);
+            }
+            break;
+        default:
+            for (size_t i = 0; i < 32; i++) {
+                page[pos + i] = static_cast<uint8_t>(rng());
+            }
+            break;
+        }
+    }
+    return page;
+}
+
+static void
+testPages(std::mt19937 &rng)
+{
+    size_t in = 0;
+    size_t out = 0;
+    for (unsigned i = 0; i < 200; i++) {
+        const std::vector<uint8_t> page = pageLike(rng);
+        in += page.size();
+        out += roundTrip("page", page);
+    }
+    printf("pages:          %zu -> %zu bytes\n", in, out);
+
+    /* Edge sizes, including ones too short to hold a match */
+    for (size_t len = 0; len <= 20; len++) {
+        roundTrip("short", std::vector<uint8_t>(len, 7));
+        roundTrip("short random", randomBytes(rng, len));
+    }
+    roundTrip("all zero max", std::vector<uint8_t>(LZ_MAX_INPUT, 0));
+}
+
+static void
+testIncompressible(std::mt19937 &rng)
+{
+    const size_t sizes[] = { 1, 255, 256, PAGE_SIZE, LZ_MAX_INPUT };
+    for (const size_t len : sizes) {
+        const std::vector<uint8_t> input = randomBytes(rng, len);
+        const size_t packed = roundTrip("incompressible", input);
+        CHECK(packed <= LZ_BOUND(len), "incompressible: %zu bytes beat LZ_BOUND(%zu)", packed, len);
+    }
+
+    const std::vector<uint8_t> tooBig(LZ_MAX_INPUT + 1, 0);
+    Output packed(LZ_BOUND(tooBig.size()));
+    CHECK(lz_compress(tooBig.data(), tooBig.size(), packed.buf.data(), packed.cap) == 0,
+          "input over LZ_MAX_INPUT was accepted");
+}
+
+static void
+testMaxOffset(std::mt19937 &rng)
+{
+    /*
+     * The same random block at both ends of a zero filled LZ_MAX_INPUT
+     * input. The zeros only hash a couple of slots, so the block's slot
+     * survives and the second copy matches the first from nearly 64 KB back.
+     */
+    const std::vector<uint8_t> block = randomBytes(rng, 16);
+    std::vector<uint8_t> input(LZ_MAX_INPUT, 0);
+    memcpy(&input[0], block.data(), block.size());
+    memcpy(&input[LZ_MAX_INPUT - block.size()], block.data(), block.size());
+
+    Output packed(LZ_BOUND(input.size()));
+    const size_t packedLen = lz_compress(input.data(), input.size(), packed.buf.data(), packed.cap);
+    roundTrip("far match", input);
+    const long offset = largestOffset(packed.buf.data(), packedLen);
+    CHECK(offset == static_cast<long>(LZ_MAX_INPUT - block.size()), "far match: largest offset %ld, wanted %zu",
+          offset, LZ_MAX_INPUT - block.size());
+
+    /* 0xffff, as far back as the format goes: 65535 literals then a 4 byte match of the first 4 */
+    std::vector<uint8_t> stream;
+    stream.push_back(0xf0);
+    size_t extra = 0xffff - 15;
+    while (extra >= 255) {
+        stream.push_back(255);
+        extra -= 255;
+    }
+    stream.push_back(static_cast<uint8_t>(extra));
+    const std::vector<uint8_t> literals = randomBytes(rng, 0xffff);
+    stream.insert(stream.end(), literals.begin(), literals.end());
+    stream.push_back(0xff);
+    stream.push_back(0xff);
+
+    Output unpacked(0xffff + LZ_MIN_MATCH);
+    const int len = lz_decompress(stream.data(), stream.size(), unpacked.buf.data(), unpacked.cap);
+    CHECK(len == static_cast<int>(unpacked.cap), "offset 0xffff: decompressed %d bytes", len);
+    CHECK(unpacked.guardIntact(), "offset 0xffff: decompressor wrote past its buffer");
+    if (len == static_cast<int>(unpacked.cap)) {
+        CHECK(memcmp(&unpacked.buf[0xffff], &literals[0], LZ_MIN_MATCH) == 0, "offset 0xffff: wrong match");
+    }
+}
+
+static void
+testSmallOutput(std::mt19937 &rng)
+{
+    const std::vector<uint8_t> inputs[] = { pageLike(rng), randomBytes(rng, 300) };
+    for (const std::vector<uint8_t> &input : inputs) {
+        Output full(LZ_BOUND(input.size()));
+        const size_t need = lz_compress(input.data(), input.size(), full.buf.data(), full.cap);
+        CHECK(need != 0, "small output: didn't compress");
+
+        /* Every capacity short of what's needed has to fail cleanly */
+        for (size_t cap = 0; cap < need; cap++) {
+            Output packed(cap);
+            CHECK(lz_compress(input.data(), input.size(), packed.buf.data(), cap) == 0,
+                  "compress into %zu of %zu bytes succeeded", cap, need);
+            CHECK(packed.guardIntact(), "compress into %zu bytes wrote past it", cap);
+        }
+        Output exact(need);
+        CHECK(lz_compress(input.data(), input.size(), exact.buf.data(), need) == need,
+              "compress into exactly %zu bytes failed", need);
+
+        for (size_t cap = 0; cap < input.size(); cap++) {
+            Output unpacked(cap);
+            CHECK(lz_decompress(full.buf.data(), need, unpacked.buf.data(), cap) == -1,
+                  "decompress into %zu of %zu bytes succeeded", cap, input.size());
+            CHECK(unpacked.guardIntact(), "decompress into %zu bytes wrote past it", cap);
+        }
+    }
+}
+
+static void
+testMalformed(void)
+{
+    uint8_t dest[64];
+    /* One literal, then a match with offset 0 */
+    const uint8_t zeroOffset[] = { 0x10, 'a', 0x00, 0x00 };
+    CHECK(lz_decompress(zeroOffset, sizeof(zeroOffset), dest, sizeof(dest)) == -1, "offset 0 accepted");
+    /* One literal, then a match reaching back 2 */
+    const uint8_t pastStart[] = { 0x10, 'a', 0x02, 0x00 };
+    CHECK(lz_decompress(pastStart, sizeof(pastStart), dest, sizeof(dest)) == -1, "offset before the start accepted");
+    /* Says 3 literals, has 1 */
+    const uint8_t shortLiterals[] = { 0x30, 'a' };
+    CHECK(lz_decompress(shortLiterals, sizeof(shortLiterals), dest, sizeof(dest)) == -1, "truncated literals accepted");
+    /* Offset cut off */
+    const uint8_t shortOffset[] = { 0x10, 'a', 0x01 };
+    CHECK(lz_decompress(shortOffset, sizeof(shortOffset), dest, sizeof(dest)) == -1, "truncated offset accepted");
+    /* Literal length extension never ends */
+    const uint8_t endlessLength[] = { 0xf0, 0xff, 0xff };
+    CHECK(lz_decompress(endlessLength, sizeof(endlessLength), dest, sizeof(dest)) == -1, "endless length accepted");
+}
+
+int
+main(int argc, char **argv)
+{
+    unsigned seed = 1;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-s") == 0) && ((i + 1) < argc)) {
+            seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 0));
+        } else {
+            fprintf(stderr, "usage: %s [-s seed]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    std::mt19937 rng(seed);
+    testPages(rng);
+    testIncompressible(rng);
+    testMaxOffset(rng);
+    testSmallOutput(rng);
+    testMalformed();
+
+    if (failures != 0) {
+        printf("%u check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all passed\n");
+    return 0;
+}
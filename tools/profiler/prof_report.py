@@ -0,0 +1,142 @@
+#!/usr/bin/env python3
+"""
+Turns a PC sample histogram (os/profiler/profiler.h) into a flat profile.
+
+    prof_report.py build/startup.elf prof.bin
+    prof_report.py build/startup.elf - < /dev/ttyUSB0
+
+The input is the output of prof_dump, or prof_buffer dumped with a debugger.
+Anything before the buffer's magic number (e.g. other USART output) is
+skipped. Each bin is put down to the function containing its first byte. A
+bin that straddles two functions is credited entirely to the first one, so
+small functions next to big ones can be under or over counted by up to a
+bin's width. Functions running from RAM (RAMFUNC) are looked up at their
+RAM addresses, which is where the ELF's symbols put them.
+"""
+
+import argparse
+import bisect
+import shutil
+import struct
+import subprocess
+import sys
+
+PROF_MAGIC = 0x464F5250
+PROF_VERSION = 2
+HEADER = struct.Struct("<IHHIIIIIIIHHII")
+
+SHT_SYMTAB = 2
+STT_FUNC = 2
+
+
+def read_functions(path):
+    """Returns sorted (start, end, name) for every function symbol in the ELF"""
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"\x7fELF" or data[4] != 1 or data[5] != 1:
+        raise ValueError("%s is not a little endian 32 bit ELF" % path)
+
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum = struct.unpack_from("<HH", data, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + i * shentsize) for i in range(shnum)]
+
+    functions = []
+    for (_, stype, _, _, offset, size, link, _, _, entsize) in headers:
+        if stype != SHT_SYMTAB:
+            continue
+        strings = headers[link][4]
+        for pos in range(offset, offset + size, entsize):
+            (name, value, sym_size, info, _, _) = struct.unpack_from("<IIIBBH", data, pos)
+            if (info & 0xF) != STT_FUNC or value == 0:
+                continue
+            end = data.index(b"\0", strings + name)
+            # Thumb function addresses have bit 0 set
+            start = value & ~1
+            functions.append((start, start + max(sym_size, 1), data[strings + name:end].decode()))
+    functions.sort()
+    return functions
+
+
+def read_histogram(data):
+    start = data.find(struct.pack("<I", PROF_MAGIC))
+    if start < 0:
+        raise ValueError("no profile found")
+
+    (_, version, bin_shift, text_start, text_end, num_bins, divisor, samples, outside,
+     saturated, ram_bin_shift, num_ram_bins, ram_start, _ram_end) = HEADER.unpack_from(data, start)
+    if version != PROF_VERSION:
+        raise ValueError("profile version %d isn't supported" % version)
+    body = start + HEADER.size
+    if len(data) < body + (num_ram_bins + num_bins) * 2:
+        raise ValueError("profile is truncated")
+
+    ram_bins = struct.unpack_from("<%dH" % num_ram_bins, data, body)
+    bins = struct.unpack_from("<%dH" % num_bins, data, body + num_ram_bins * 2)
+    return {
+        "divisor": divisor, "samples": samples, "outside": outside, "saturated": saturated,
+        # (first address, bin shift, bins) for .text, then for code running from RAM
+        "histograms": [(text_start, bin_shift, bins), (ram_start, ram_bin_shift, ram_bins)],
+    }
+
+
+def demangle(names):
+    """Uses c++filt if it's around, otherwise leaves the names alone"""
+    tool = shutil.which("arm-none-eabi-c++filt") or shutil.which("c++filt")
+    if tool is None:
+        return names
+    result = subprocess.run([tool], input="\n".join(names), capture_output=True, text=True)
+    if result.returncode != 0:
+        return names
+    return result.stdout.splitlines()
+
+
+def report(functions, profile, out):
+    starts = [f[0] for f in functions]
+    counts = {}
+    for (base, shift, bins) in profile["histograms"]:
+        for index, count in enumerate(bins):
+            if count == 0:
+                continue
+            addr = base + (index << shift)
+            i = bisect.bisect_right(starts, addr) - 1
+            if i >= 0 and addr < functions[i][1] + (1 << shift):
+                name = functions[i][2]
+            else:
+                name = "0x%08x" % addr
+            counts[name] = counts.get(name, 0) + count
+
+    samples = profile["samples"]
+    (_, text_shift, _), (_, ram_shift, _) = profile["histograms"]
+    out.write("%d samples, one every %d ticks, %d-byte bins (%d-byte for RAM code)\n"
+              % (samples, profile["divisor"], 1 << text_shift, 1 << ram_shift))
+    if profile["outside"]:
+        out.write("%d samples outside .text and RAM code\n" % profile["outside"])
+    if profile["saturated"]:
+        out.write("%d samples dropped from full bins\n" % profile["saturated"])
+    if samples == 0:
+        return
+
+    ranked = sorted(counts.items(), key=lambda item: -item[1])
+    names = demangle([name for (name, _) in ranked])
+    out.write("\n    %   samples  function\n")
+    for (name, count), pretty in zip(ranked, names):
+        out.write("%5.1f %9d  %s\n" % (100.0 * count / samples, count, pretty))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("elf", help="firmware ELF the profile was taken on")
+    parser.add_argument("dump", help="profile dump, or - for stdin")
+    options = parser.parse_args()
+
+    if options.dump == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(options.dump, "rb") as f:
+            data = f.read()
+
+    report(read_functions(options.elf), read_histogram(data), sys.stdout)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,62 @@
+/*
+ * Stand-ins for the hardware and the parts of the kernel the simulator
+ * doesn't build. The simulator plays the part of the CPUs: it picks which
+ * CPU is "current" and performs the context switches that were requested.
+ */
+#include <cstdlib>
+
+#include "cpu.h"
+#include "host_stubs.h"
+#include "mem_mgr.h"
+#include "swap.h"
+
+uint32_t sim_current_cpu;
+bool sim_switch_pending[NUM_CPUS];
+
+/* Only one host thread runs the kernel code, so there is nothing to mask */
+uint32_t irq_save(void) { return 0; }
+void irq_restore(const uint32_t) {}
+void irq_enable(void) {}
+void irq_disable(void) {}
+void wait_for_interrupt(void) {}
+bool irq_in_handler(void) { return false; }
+uint32_t irq_current_exception(void) { return 0; }
+
+uint32_t
+cpu_current_id(void)
+{
+    return sim_current_cpu;
+}
+
+void
+cpu_request_switch(const uint32_t cpuId)
+{
+    sim_switch_pending[cpuId] = true;
+}
+
+void
+cpu_idle(const uint32_t)
+{
+}
+
+void
+cpu_idle_wake(const uint32_t)
+{
+}
+
+void
+cpu_start_threads(void)
+{
+    sim_run();
+}
+
+void *_ker_malloc(const size_t req_size, const uint32_t) { return malloc(req_size); }
+void _ker_free(const size_t, void *const p) { free(p); }
+
+void freePages(const size_t, void *const) {}
+int swapOutRegion(void *const, const size_t, SwapEntry **const) { return -1; }
+int swapInRegion(void *const, const size_t, SwapEntry **const) { return -1; }
+void swapDiscard(SwapEntry **const) {}
+
+void wait_set_tick(const uint32_t) {}
+bool wait_set_next_tick(const uint32_t, uint32_t &) { return false; }
@@ -0,0 +1,16 @@
+#ifndef _HOST_STUBS_H
+#define _HOST_STUBS_H
+
+#include <cstdint>
+
+#include "cpu.h"
+
+/* CPU the kernel code thinks it is running on */
+extern uint32_t sim_current_cpu;
+/* Set by cpu_request_switch, cleared by the simulator once it switches */
+extern bool sim_switch_pending[NUM_CPUS];
+
+/* Runs the simulation, from the point the scheduler hands over to the CPUs */
+__attribute__((noreturn)) void sim_run(void);
+
+#endif /* _HOST_STUBS_H */
@@ -0,0 +1,421 @@
+/*
+ * Discrete-event simulator for the kernel scheduler.
+ *
+ * Runs the real scheduler code (os/proc_mgr) against a simulated clock,
+ * simulated SysTick and context switch handler, and a workload trace, then
+ * reports per-thread response time, wake latency and switch counts, plus
+ * throughput and fairness for the whole run. Build it with different CPUS
+ * and SLICE values (see the Makefile) to compare configurations on the same
+ * trace.
+ *
+ * Trace format, one thread per line, times in microseconds:
+ *
+ *   # comment
+ *   thread <name> <priority> <arrival> [affinity=<mask>] <burst> <burst> ...
+ *
+ * Bursts alternate however the trace says: c<us> needs a CPU for that long,
+ * i<us> blocks on I/O for that long. The first burst has to be a CPU burst.
+ *
+ *   thread ui     1 0     c1500 i30000 c1500 i30000 c1500
+ *   thread batch  2 0     c250000
+ *
+ * Usage: sched_sim [-t tick_us] [-l limit_us] [-v] <trace>
+ */
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cpu.h"
+#include "host_stubs.h"
+#include "scheduler.h"
+
+/* SysTick period on the real hardware is 64000 cycles at 8 MHz */
+#define DEFAULT_TICK_US 8000u
+#define DEFAULT_LIMIT_US (3600ull * 1000 * 1000)
+
+struct Burst {
+    bool io;
+    uint64_t length;
+};
+
+struct SimThread {
+    std::string name;
+    uint8_t priority;
+    uint64_t arrival;
+    uint32_t affinity;
+    std::vector<Burst> bursts;
+
+    Thread *thread;
+    size_t burst;
+    uint64_t remaining;
+    uint64_t ioDoneAt;
+    bool blocked;
+    bool finished;
+
+    uint64_t firstRun;
+    uint64_t finish;
+    uint64_t cpuTime;
+    uint64_t cpuDemand;
+    uint64_t ioTime;
+    uint64_t wokenAt;
+    bool waitingForCpu;
+    uint64_t wakeLatencyTotal;
+    uint64_t wakeLatencyMax;
+    uint32_t wakeups;
+    uint32_t switchesIn;
+};
+
+static std::vector<SimThread> simThreads;
+static std::unordered_map<const Thread *, SimThread *> byThread;
+
+static uint64_t tickUs = DEFAULT_TICK_US;
+static uint64_t limitUs = DEFAULT_LIMIT_US;
+static bool verbose;
+static uint64_t now;
+static uint64_t cpuBusy[NUM_CPUS];
+
+static void
+usage(void)
+{
+    fprintf(stderr, "usage: sched_sim [-t tick_us] [-l limit_us] [-v] <trace>\n");
+    exit(2);
+}
+
+static void
+threadEntry(void *)
+{
+    // Never runs - the simulator stands in for the code
+}
+
+static bool
+parseTrace(const char *const path)
+{
+    FILE *const file = fopen(path, "r");
+    if (file == nullptr) {
+        perror(path);
+        return false;
+    }
+
+    char line[4096];
+    unsigned lineNum = 0;
+    while (fgets(line, sizeof(line), file) != nullptr) {
+        lineNum++;
+        char *tok = strtok(line, " \t\r\n");
+        if ((tok == nullptr) || (tok[0] == '#')) {
+            continue;
+        }
+        if (strcmp(tok, "thread") != 0) {
+            fprintf(stderr, "%s:%u: expected 'thread'\n", path, lineNum);
+            fclose(file);
+            return false;
+        }
+
+        SimThread sim = SimThread();
+        const char *const name = strtok(nullptr, " \t\r\n");
+        const char *const prio = strtok(nullptr, " \t\r\n");
+        const char *const arrival = strtok(nullptr, " \t\r\n");
+        if ((name == nullptr) || (prio == nullptr) || (arrival == nullptr)) {
+            fprintf(stderr, "%s:%u: expected name, priority and arrival\n", path, lineNum);
+            fclose(file);
+            return false;
+        }
+        sim.name = name;
+        sim.priority = static_cast<uint8_t>(strtoul(prio, nullptr, 0));
+        sim.arrival = strtoull(arrival, nullptr, 0);
+        sim.affinity = 0xffffffff;
+
+        while ((tok = strtok(nullptr, " \t\r\n")) != nullptr) {
+            if (tok[0] == '#') {
+                break;
+            } else if (strncmp(tok, "affinity=", 9) == 0) {
+                sim.affinity = static_cast<uint32_t>(strtoul(tok + 9, nullptr, 0));
+            } else if (((tok[0] == 'c') || (tok[0] == 'i')) && (strtoull(tok + 1, nullptr, 0) > 0)) {
+                const Burst burst = { tok[0] == 'i', strtoull(tok + 1, nullptr, 0) };
+                sim.bursts.push_back(burst);
+                if (burst.io) {
+                    sim.ioTime += burst.length;
+                } else {
+                    sim.cpuDemand += burst.length;
+                }
+            } else {
+                fprintf(stderr, "%s:%u: bad burst '%s'\n", path, lineNum, tok);
+                fclose(file);
+                return false;
+            }
+        }
+
+        if (sim.bursts.empty() || sim.bursts[0].io) {
+            fprintf(stderr, "%s:%u: a thread has to start with a CPU burst\n", path, lineNum);
+            fclose(file);
+            return false;
+        }
+        if (sim.priority >= NUM_THREAD_PRIORITIES - 1) {
+            fprintf(stderr, "%s:%u: priority %u is reserved for the idle threads\n", path, lineNum, sim.priority);
+            fclose(file);
+            return false;
+        }
+        sim.remaining = sim.bursts[0].length;
+        simThreads.push_back(sim);
+    }
+
+    fclose(file);
+    return !simThreads.empty();
+}
+
+static SimThread *
+running(const uint32_t cpu)
+{
+    const Thread *const thread = hw_cpus[cpu].getCurrentThread();
+    const auto it = byThread.find(thread);
+    return (it == byThread.end()) ? nullptr : it->second;
+}
+
+/* Plays the part of PendSV on every CPU that asked for a switch */
+static void
+doSwitches(void)
+{
+    bool again = true;
+    while (again) {
+        again = false;
+        for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+            if (!sim_switch_pending[cpu]) {
+                continue;
+            }
+            sim_switch_pending[cpu] = false;
+            again = true;
+
+            const Thread *const before = hw_cpus[cpu].getCurrentThread();
+            sim_current_cpu = cpu;
+            (void)scheduler_switch(nullptr);
+
+            for (uint32_t other = 0; other < NUM_CPUS; other++) {
+                if ((other != cpu) && (hw_cpus[other].getCurrentThread() == hw_cpus[cpu].getCurrentThread())) {
+                    fprintf(stderr, "%" PRIu64 ": thread %u is running on cpu%u and cpu%u\n", now,
+                            hw_cpus[cpu].getCurrentThread()->getId(), other, cpu);
+                    exit(1);
+                }
+            }
+
+            SimThread *const sim = running(cpu);
+            if ((sim == nullptr) || (sim->thread == before)) {
+                continue;
+            }
+            sim->switchesIn++;
+            if (sim->switchesIn == 1) {
+                sim->firstRun = now;
+            }
+            if (sim->waitingForCpu) {
+                const uint64_t latency = now - sim->wokenAt;
+                sim->wakeLatencyTotal += latency;
+                if (latency > sim->wakeLatencyMax) {
+                    sim->wakeLatencyMax = latency;
+                }
+                sim->wakeups++;
+                sim->waitingForCpu = false;
+            }
+            if (verbose) {
+                printf("%10" PRIu64 " cpu%u -> %s\n", now, cpu, sim->name.c_str());
+            }
+        }
+    }
+}
+
+static void
+finishBurst(const uint32_t cpu, SimThread &sim)
+{
+    sim.burst++;
+    sim_current_cpu = cpu;
+
+    if (sim.burst == sim.bursts.size()) {
+        sim.finished = true;
+        sim.finish = now;
+        sim.thread->setState(Thread::ThreadState::Zombie);
+        cpu_request_switch(cpu);
+        if (verbose) {
+            printf("%10" PRIu64 " cpu%u    %s finished\n", now, cpu, sim.name.c_str());
+        }
+        return;
+    }
+
+    const Burst &next = sim.bursts[sim.burst];
+    if (next.io) {
+        sim.blocked = true;
+        sim.ioDoneAt = now + next.length;
+        scheduler_mark_blocked(*sim.thread, WAIT_FOREVER);
+    } else {
+        // Back to back CPU bursts just carry on
+        sim.remaining = next.length;
+    }
+}
+
+static void
+wakeFromIo(SimThread &sim)
+{
+    sim.blocked = false;
+    sim.burst++;
+    sim.remaining = sim.bursts[sim.burst].length;
+    sim.wokenAt = now;
+    sim.waitingForCpu = true;
+
+    // Completion interrupts are taken on the first CPU
+    sim_current_cpu = 0;
+    scheduler_wake(*sim.thread);
+}
+
+static void
+runSimulation(void)
+{
+    uint64_t nextTick = tickUs;
+    size_t numFinished = 0;
+
+    while ((numFinished < simThreads.size()) && (now < limitUs)) {
+        for (SimThread &sim : simThreads) {
+            if ((sim.thread == nullptr) && (sim.arrival <= now)) {
+                sim_current_cpu = 0;
+                sim.thread = scheduler_create_kernel_thread(threadEntry, nullptr, sim.priority);
+                byThread[sim.thread] = &sim;
+                (void)scheduler_set_affinity(*sim.thread, sim.affinity);
+            } else if (sim.blocked && (sim.ioDoneAt <= now)) {
+                wakeFromIo(sim);
+            }
+        }
+
+        if (nextTick <= now) {
+            for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+                sim_current_cpu = cpu;
+                scheduler_tick();
+            }
+            nextTick += tickUs;
+        }
+
+        doSwitches();
+
+        // Next thing to happen
+        uint64_t next = nextTick;
+        for (const SimThread &sim : simThreads) {
+            if ((sim.thread == nullptr) && (sim.arrival < next)) {
+                next = sim.arrival;
+            } else if (sim.blocked && (sim.ioDoneAt < next)) {
+                next = sim.ioDoneAt;
+            }
+        }
+        for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+            const SimThread *const sim = running(cpu);
+            if ((sim != nullptr) && ((now + sim->remaining) < next)) {
+                next = now + sim->remaining;
+            }
+        }
+
+        const uint64_t elapsed = next - now;
+        now = next;
+        for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+            SimThread *const sim = running(cpu);
+            if (sim == nullptr) {
+                continue;
+            }
+            sim->remaining -= elapsed;
+            sim->cpuTime += elapsed;
+            cpuBusy[cpu] += elapsed;
+            if (sim->remaining == 0) {
+                finishBurst(cpu, *sim);
+                if (sim->finished) {
+                    numFinished++;
+                }
+            }
+        }
+    }
+
+    if (numFinished < simThreads.size()) {
+        printf("stopped at the %" PRIu64 " us limit with %zu threads unfinished\n",
+               limitUs, simThreads.size() - numFinished);
+    }
+}
+
+static void
+report(void)
+{
+    printf("\n%-12s %4s %10s %10s %10s %10s %8s %10s %10s %8s\n",
+           "thread", "prio", "arrival", "response", "turnaround", "cpu", "wakeups",
+           "avg_wake", "max_wake", "switches");
+
+    double fairSum = 0;
+    double fairSumSq = 0;
+    uint32_t numFinished = 0;
+    for (const SimThread &sim : simThreads) {
+        const uint64_t avgWake = (sim.wakeups == 0) ? 0 : (sim.wakeLatencyTotal / sim.wakeups);
+        const uint64_t response = (sim.switchesIn == 0) ? 0 : (sim.firstRun - sim.arrival);
+        const uint64_t turnaround = sim.finished ? (sim.finish - sim.arrival) : 0;
+        printf("%-12s %4u %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %10" PRIu64 " %8u %10" PRIu64 " %10" PRIu64 " %8u\n",
+               sim.name.c_str(), sim.priority, sim.arrival, response, turnaround, sim.cpuTime,
+               sim.wakeups, avgWake, sim.wakeLatencyMax, sim.switchesIn);
+
+        if (sim.finished) {
+            // Share of the time it wasn't blocked on I/O that it actually got to run
+            const uint64_t runnable = turnaround - sim.ioTime;
+            const double share = (runnable == 0) ? 1.0 : (static_cast<double>(sim.cpuDemand) / runnable);
+            fairSum += share;
+            fairSumSq += share * share;
+            numFinished++;
+        }
+    }
+
+    uint32_t switches = 0;
+    uint32_t steals = 0;
+    printf("\n");
+    for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+        const CpuStats &stats = hw_cpus[cpu].getStats();
+        switches += stats.switches;
+        steals += stats.steals;
+        printf("cpu%u: %5.1f%% busy, %u switches, %u steals\n", cpu,
+               (now == 0) ? 0.0 : (100.0 * cpuBusy[cpu] / now), stats.switches, stats.steals);
+    }
+
+    printf("\nsimulated time  %" PRIu64 " us (tick %" PRIu64 " us, slice %u ticks, %u cpus)\n",
+           now, tickUs, SCHEDULER_TIME_SLICE_TICKS, NUM_CPUS);
+    printf("throughput      %.2f threads/s\n", (now == 0) ? 0.0 : (numFinished * 1e6 / now));
+    printf("switches        %u\n", switches);
+    printf("steals          %u\n", steals);
+    // Jain's index over each thread's share of its runnable time: 1 is perfectly fair, 1/n is as unfair as it gets
+    printf("fairness        %.3f\n", (fairSumSq == 0) ? 0.0 : ((fairSum * fairSum) / (numFinished * fairSumSq)));
+}
+
+/* The simulator is the hardware the scheduler starts running threads on */
+void
+sim_run(void)
+{
+    runSimulation();
+    report();
+    exit(0);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *path = nullptr;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "-t") == 0) && ((i + 1) < argc)) {
+            tickUs = strtoull(argv[++i], nullptr, 0);
+        } else if ((strcmp(argv[i], "-l") == 0) && ((i + 1) < argc)) {
+            limitUs = strtoull(argv[++i], nullptr, 0);
+        } else if (strcmp(argv[i], "-v") == 0) {
+            verbose = true;
+        } else if (argv[i][0] != '-') {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if ((path == nullptr) || (tickUs == 0) || !parseTrace(path)) {
+        usage();
+    }
+
+    for (uint32_t cpu = 0; cpu < NUM_CPUS; cpu++) {
+        hw_cpus[cpu].collectCpuInfo(cpu);
+    }
+    scheduler_init();
+    scheduler_start();
+}
@@ -0,0 +1,215 @@
+#!/usr/bin/env python3
+"""
+Converts a kernel trace buffer (os/trace/trace.h) into Chrome trace JSON.
+
+    trace_to_json.py trace.bin > trace.json
+    trace_to_json.py - < /dev/ttyUSB0 > trace.json
+
+The input is trace_buffer as it sits in memory, either dumped with a
+debugger or sent with trace_dump. Anything before the buffer's magic number
+(e.g. other USART output) is skipped. Open the result in chrome://tracing or
+ui.perfetto.dev.
+
+Each CPU is a process with these tracks:
+    threads     which thread was running, from the context switches
+    interrupts  exception handlers, nested as they preempted each other
+    syscalls    SVC calls
+    heap        _ker_malloc and _ker_free, plus a counter of bytes handed out
+                since the start of the trace (it can go negative when blocks
+                allocated before the trace started are freed)
+DMA transfers are async slices, one track per stream.
+
+The cycle counter runs at the core clock, which can change during a trace.
+Each change is recorded with the old and new rates, so time is worked out
+at whatever rate was in force for each stretch of the trace.
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x45435254
+# Version 1 buffers have no clock changes in them
+TRACE_VERSIONS = (1, 2)
+HEADER = struct.Struct("<IHHIIII")
+RECORD = struct.Struct("<IBBHII")
+
+(NONE, CONTEXT_SWITCH, IRQ_ENTER, IRQ_EXIT, MALLOC, FREE, DMA_START, DMA_DONE,
+ DMA_ERROR, SYSCALL_ENTER, SYSCALL_EXIT, CLOCK_CHANGE) = range(12)
+
+TID_THREADS = 0
+TID_INTERRUPTS = 1
+TID_SYSCALLS = 2
+TID_HEAP = 3
+TRACK_NAMES = {
+    TID_THREADS: "threads",
+    TID_INTERRUPTS: "interrupts",
+    TID_SYSCALLS: "syscalls",
+    TID_HEAP: "heap",
+}
+
+NO_THREAD = 0xFFFFFFFF
+
+CORE_EXCEPTIONS = {
+    2: "NMI", 3: "HardFault", 4: "MemManage", 5: "BusFault", 6: "UsageFault",
+    11: "SVCall", 12: "DebugMon", 14: "PendSV", 15: "SysTick",
+}
+
+# STM32F2 IRQ numbers, for the handlers the kernel has
+IRQ_NAMES = {
+    3: "RTC_WKUP", 6: "EXTI0", 7: "EXTI1", 8: "EXTI2", 9: "EXTI3", 10: "EXTI4",
+    11: "DMA1_Stream0", 12: "DMA1_Stream1", 13: "DMA1_Stream2", 14: "DMA1_Stream3",
+    15: "DMA1_Stream4", 16: "DMA1_Stream5", 17: "DMA1_Stream6", 23: "EXTI9_5",
+    37: "USART1", 38: "USART2", 39: "USART3", 40: "EXTI15_10", 47: "DMA1_Stream7",
+    52: "UART4", 53: "UART5", 56: "DMA2_Stream0", 57: "DMA2_Stream1",
+    58: "DMA2_Stream2", 59: "DMA2_Stream3", 60: "DMA2_Stream4", 68: "DMA2_Stream5",
+    69: "DMA2_Stream6", 70: "DMA2_Stream7", 71: "USART6",
+}
+
+
+def exception_name(number):
+    if number in CORE_EXCEPTIONS:
+        return CORE_EXCEPTIONS[number]
+    if number >= 16:
+        return IRQ_NAMES.get(number - 16, "IRQ %d" % (number - 16))
+    return "exception %d" % number
+
+
+def stream_name(stream_id):
+    return "DMA%d S%d" % ((stream_id >> 3) + 1, stream_id & 0x7)
+
+
+def read_buffer(data):
+    """Returns (core_hz, records in the order they were written)"""
+    start = data.find(struct.pack("<I", TRACE_MAGIC))
+    if start < 0:
+        raise ValueError("no trace buffer found")
+
+    (_, version, record_size, capacity, core_hz, head, _) = HEADER.unpack_from(data, start)
+    if version not in TRACE_VERSIONS or record_size != RECORD.size:
+        raise ValueError("trace buffer version %d with %d byte records isn't supported"
+                         % (version, record_size))
+    body = start + HEADER.size
+    if len(data) < body + capacity * record_size:
+        raise ValueError("trace buffer is truncated")
+
+    records = [RECORD.unpack_from(data, body + i * record_size) for i in range(capacity)]
+    if head > capacity:
+        oldest = head % capacity
+        records = records[oldest:] + records[:oldest]
+    else:
+        records = records[:head]
+    return core_hz, [r for r in records if r[1] != NONE]
+
+
+def starting_clock(core_hz, records):
+    """The clock the oldest record ran at: core_hz is the rate at the end"""
+    for (_, event, _, _, a, _) in records:
+        if event == CLOCK_CHANGE:
+            return a
+    return core_hz
+
+
+def convert(core_hz, records, fixed_clock=False):
+    events = []
+    cpus = set()
+    running = {}        # cpu -> thread ID
+    irq_stack = {}      # cpu -> exception numbers
+    syscall_stack = {}  # cpu -> SVC numbers
+    heap_bytes = {}     # cpu -> bytes
+
+    # The cycle counter wraps every 2^32 cycles, and an interrupt between
+    # taking a slot and reading the counter can put records slightly out of
+    # order, so each step is taken as a signed 32 bit difference.
+    hz = core_hz if fixed_clock else starting_clock(core_hz, records)
+    ts = 0.0
+    previous = None
+    for (stamp, event, cpu, ident, a, b) in records:
+        if previous is not None:
+            delta = (stamp - previous) & 0xFFFFFFFF
+            if delta >= 0x80000000:
+                delta -= 0x100000000
+            ts += delta * 1e6 / hz
+        previous = stamp
+        if event == CLOCK_CHANGE and not fixed_clock:
+            hz = b
+
+        def emit(**fields):
+            fields.setdefault("pid", cpu)
+            fields["ts"] = ts
+            events.append(fields)
+
+        cpus.add(cpu)
+        if event == CONTEXT_SWITCH:
+            if running.get(cpu, NO_THREAD) != NO_THREAD:
+                emit(ph="E", tid=TID_THREADS)
+            if b != NO_THREAD:
+                emit(ph="B", tid=TID_THREADS, name="thread %d" % b, args={"from": a})
+            running[cpu] = b
+        elif event == IRQ_ENTER:
+            irq_stack.setdefault(cpu, []).append(ident)
+            emit(ph="B", tid=TID_INTERRUPTS, name=exception_name(ident))
+        elif event == IRQ_EXIT:
+            # The trace can start half way through a handler
+            stack = irq_stack.get(cpu, [])
+            if ident in stack:
+                while stack.pop() != ident:
+                    emit(ph="E", tid=TID_INTERRUPTS)
+                emit(ph="E", tid=TID_INTERRUPTS)
+        elif event == SYSCALL_ENTER:
+            syscall_stack.setdefault(cpu, []).append(ident)
+            emit(ph="B", tid=TID_SYSCALLS, name="svc %d" % ident, args={"arg": a})
+        elif event == SYSCALL_EXIT:
+            stack = syscall_stack.get(cpu, [])
+            if stack:
+                stack.pop()
+                emit(ph="E", tid=TID_SYSCALLS, args={"ret": a})
+        elif event in (MALLOC, FREE):
+            size = b if event == MALLOC else -b
+            heap_bytes[cpu] = heap_bytes.get(cpu, 0) + size
+            emit(ph="i", s="t", tid=TID_HEAP, name="malloc" if event == MALLOC else "free",
+                 args={"ptr": "0x%08x" % a, "size": b})
+            emit(ph="C", name="heap bytes", args={"bytes": heap_bytes[cpu]})
+        elif event == DMA_START:
+            emit(ph="b", cat="dma", id="0x%08x" % a, name=stream_name(ident),
+                 args={"bytes": b})
+        elif event == DMA_DONE:
+            emit(ph="e", cat="dma", id="0x%08x" % a, name=stream_name(ident),
+                 args={"bytes": b})
+        elif event == DMA_ERROR:
+            emit(ph="e", cat="dma", id="0x%08x" % a, name=stream_name(ident),
+                 args={"error_flags": "0x%x" % b})
+        elif event == CLOCK_CHANGE:
+            emit(ph="i", s="g", name="clock %g MHz" % (b / 1e6), args={"from_hz": a, "to_hz": b})
+
+    for cpu in sorted(cpus):
+        events.append({"ph": "M", "pid": cpu, "name": "process_name", "args": {"name": "CPU %d" % cpu}})
+        for tid, name in TRACK_NAMES.items():
+            events.append({"ph": "M", "pid": cpu, "tid": tid, "name": "thread_name",
+                           "args": {"name": name}})
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument("dump", help="trace buffer dump, or - for stdin")
+    parser.add_argument("--clock", type=float, default=0,
+                        help="core clock in Hz for the whole trace, ignoring the rates in the buffer")
+    options = parser.parse_args()
+
+    if options.dump == "-":
+        data = sys.stdin.buffer.read()
+    else:
+        with open(options.dump, "rb") as f:
+            data = f.read()
+
+    core_hz, records = read_buffer(data)
+    if options.clock:
+        core_hz = options.clock
+    json.dump(convert(core_hz, records, fixed_clock=bool(options.clock)), sys.stdout)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()